@@ -9,88 +9,65 @@
 */
 #include "ui.h"
 #include "views.h"
+#include "utf8.h"
 #include <utils/helpers.h>
 
-#define FIELD_CAP	(128)
-typedef struct {
-	bool		numeric;
-	char		txt[FIELD_CAP];
-	int		cap;
-	int		len;
-	int 		cur;
-} ui_field_t;
-
+#define MAX_SUGGESTIONS	(4)
 
-static void
-ui_field_draw(const char *label, const ui_field_t *field, bool highlight, int label_w, int max_w) {
-	int label_size = MIN(label_w, max_w);
-	ui_text(label_size, "%-*.*s", label_size, label_size, label);
+typedef struct {
+	db_t		*db;
+	veh_t		*veh;
+	ui_field_t	fields[3];
+	int		sel;
 	
-	int size = MIN(field->cap, (max_w - label_w));
-	if(highlight)
-		term_reverse(stdout);
-	term_set_underline(stdout, true);
-	ui_text(size, "%-*.*s", size, size, field->txt);
-	term_style_reset(stdout);
-}
+	trie_match_t	suggest[MAX_SUGGESTIONS];
+	int		num_suggest;
+	
+	char		message[64];
+} addview_t;
 
-static inline bool char_match(bool numeric, int c) {
-	if(c >= '0' && c <= '9') return true;
-	if(numeric) return false;
-	return (c >= 'a' && c <= 'z')
-	    || (c >= 'A' && c <= 'Z')
-	    || c == ' ' || c == '/' || c == '-' || c == '(' || c == ')';
+static void
+update_suggestions(addview_t *view) {
+	view->num_suggest = (int)stock_db_complete_class(view->db, view->fields[0].txt,
+							 view->suggest, MAX_SUGGESTIONS);
 }
 
 static bool
-ui_field_input(ui_field_t *field, int c) {
-
-	switch(c) {
-	case KEY_BACKSPACE:
-		if(field->len && field->cur) {
-			memmove(field->txt + field->cur - 1,
-				field->txt + field->cur,
-				field->len - field->cur);
-			field->cur = MAX(0, field->cur - 1);
-			field->len = MAX(0, field->len - 1);
-			field->txt[field->len] = '\0';
-		}
-		return true;
-	case KEY_ARROW_LEFT:
-		field->cur = MAX(0, field->cur - 1);
-		return true;
-	case KEY_ARROW_RIGHT:
-		field->cur = MIN(field->len, field->cur + 1);
-		return true;
-		
-	}
-	
-	if(!char_match(field->numeric, c))
+accept_suggestion(addview_t *view) {
+	ui_field_t *f = &view->fields[0];
+	if(view->sel != 0 || f->cur != f->len || !view->num_suggest)
+		return false;
+	if(!strcmp(f->txt, view->suggest[0].str))
 		return false;
 	
-	if(field->len + 1 > field->cap || field->len + 2 > FIELD_CAP)
-		return true;
-	
-	memmove(field->txt + field->cur + 1,
-		field->txt + field->cur,
-		field->len - field->cur);
-	field->txt[field->cur] = (char)c;
-	field->cur++;
-	field->len++;
-	field->txt[field->len] = '\0';
-	
+	size_t len = utf8_clip(view->suggest[0].str, f->cap);
+	memcpy(f->txt, view->suggest[0].str, len);
+	f->txt[len] = '\0';
+	f->len = f->cur = (int)len;
+	update_suggestions(view);
 	return true;
 }
 
-
-typedef struct {
-	db_t		*db;
-	veh_t		*veh;
-	ui_field_t	fields[3];
-	int		sel;
+static void
+addview_draw_suggestions(const addview_t *view, int x, int y, int w) {
+	if(view->sel != 0 || !view->num_suggest)
+		return;
 	
-	char		message[64];
-} addview_t;
+	hexes_cursor_go(x, y);
+	term_set_bold(stdout, true);
+	ui_text(w - x, "Suggestions [->]:");
+	term_style_reset(stdout);
+	
+	for(int i = 0; i < view->num_suggest; ++i) {
+		hexes_cursor_go(x, y + 1 + i);
+		if(i == 0)
+			term_reverse(stdout);
+		char class[UI_CELL_CAP];
+		ui_text(w - x, " %s %6u", ui_cell(class, view->suggest[i].str, -1, 15),
+			view->suggest[i].count);
+		term_style_reset(stdout);
+	}
+}
 
 
 static void
@@ -120,7 +97,7 @@ addview_draw(addview_t *view) {
 	for(int i = 0; i < 3; ++i) {
 		const ui_field_t *f = &view->fields[i];
 		if(i == view->sel) {
-			cur_x = MIN(x + max_label_size + MIN(f->cur, f->cap-1), w);
+			cur_x = MIN(x + max_label_size + MIN(ui_field_cursor_x(f), f->cap-1), w);
 			cur_y = y + i;
 		}
 		hexes_cursor_go(x, y + i);
@@ -130,12 +107,16 @@ addview_draw(addview_t *view) {
 	// Draw the OK prompt
 	if(view->sel == -1)
 		term_reverse(stdout);
+	int form_x = x;
 	x = MAX(0, (w/2) - 8);
 	hexes_cursor_go(x, y + 4);
 	ui_text(MIN(16, w), "[      OK      ]");
+	term_style_reset(stdout);
 	
+	addview_draw_suggestions(view, form_x, y + 6, w);
 	
-	ui_prompt(" [tab]: next field    [q]: cancel");
+	
+	ui_prompt(" [tab]: next field    [+]: next free number    [q]: cancel");
 	
 	if(!view->message[0]) {
 		hexes_show_cursor(view->sel != -1);
@@ -153,7 +134,7 @@ addview_draw(addview_t *view) {
 }
 
 static bool
-check_edit_conflict(db_t *db, veh_t *veh, int num) {
+check_edit_conflict(db_t *db, veh_t *veh, veh_num_t num) {
 	veh_t *existing = stock_db_get(db, num);
 	return existing == NULL || existing == veh;
 }
@@ -167,38 +148,67 @@ validate_veh(addview_t *view) {
 	}
 	
 	
-	int num = atoi(view->fields[1].txt);
+	veh_num_t num = strtoll(view->fields[1].txt, NULL, 10);
 	if(!check_edit_conflict(view->db, view->veh, num)) {
 		snprintf(view->message, sizeof(view->message),
-			"running number %d already in use", num);
+			"running number %" VEH_NUM_FMT " already in use", num);
 		return false;
 	}
 	
-	veh_t *veh = view->veh ?
-		view->veh :
-		safe_calloc(1, sizeof(*veh));
-
-	veh->num = num;
-	strncpy(veh->class, view->fields[0].txt, sizeof(veh->class));
-	strncpy(veh->desc, view->fields[2].txt, sizeof(veh->desc));
-	
+	veh_t data = {.num = num, .class = view->fields[0].txt, .desc = view->fields[2].txt};
 	if(view->veh)
-		stock_db_update(view->db, veh);
+		stock_db_update(view->db, view->veh, &data);
 	else
-		stock_db_add(view->db, veh);
+		stock_db_add(view->db, &data);
 	return true;
 }
 
+static void
+lift_field(ui_field_t *f, const char *src) {
+	strncpy(f->txt, src, f->cap-1);
+	f->txt[f->cap-1] = '\0';
+	f->len = f->cur = strlen(f->txt);
+}
+
+static void
+lift_field_num(ui_field_t *f, veh_num_t num) {
+	f->len = snprintf(f->txt, sizeof(f->txt), "%" VEH_NUM_FMT, num);
+	f->cur = f->len;
+}
+
+// Fills the running number field with the first free number at or after the one typed, within its
+// block of a hundred (so "800" finds the next free 8xx number).
+static void
+fill_free_num(addview_t *view) {
+	ui_field_t *f = &view->fields[1];
+	veh_num_t lo = f->len ? strtoll(f->txt, NULL, 10) : 1;
+	veh_num_t hi = f->len ? stock_block_end(lo) : VEH_NUM_MAX;
+	
+	veh_num_t num;
+	if(!stock_db_next_free(view->db, lo, hi, &num)) {
+		snprintf(view->message, sizeof(view->message),
+			"no free running number in %" VEH_NUM_FMT "-%" VEH_NUM_FMT, lo - (lo % 100), hi);
+		return;
+	}
+	lift_field_num(f, num);
+}
+
 static bool
 addview_update(addview_t *view) {
 	UNUSED(view);
 	
 	int c = hexes_get_key();
 	
+	if(c == KEY_ARROW_RIGHT && accept_suggestion(view))
+		return true;
+	
 	if(view->sel >= 0 && view->sel < 3) {
 		ui_field_t *f = &view->fields[view->sel];
-		if(ui_field_input(f, c))
+		if(ui_field_input(f, c)) {
+			if(view->sel == 0)
+				update_suggestions(view);
 			return true;
+		}
 	}
 	
 	switch(c) {
@@ -208,6 +218,10 @@ addview_update(addview_t *view) {
 	case KEY_ESC:
 	case 'q':
 		return false;
+	case '+':
+		if(view->sel == 1)
+			fill_free_num(view);
+		break;
 	case '\t':
 		view->sel = (view->sel + 1);
 		if(view->sel == 3)
@@ -237,19 +251,6 @@ addview_update(addview_t *view) {
 	return true;
 }
 
-static void
-lift_field(ui_field_t *f, const char *src) {
-	strncpy(f->txt, src, f->cap-1);
-	f->txt[f->cap-1] = '\0';
-	f->len = f->cur = strlen(f->txt);
-}
-
-static void
-lift_field_num(ui_field_t *f, int num) {
-	f->len = snprintf(f->txt, sizeof(f->txt), "%d", num);
-	f->cur = f->len;
-}
-
 void
 show_addview(db_t *db, veh_t *veh) {
 	addview_t view = {
@@ -258,15 +259,15 @@ show_addview(db_t *db, veh_t *veh) {
 	};
 	
 	view.fields[0] = (ui_field_t){
-		.numeric = false,
+		.kind = UI_FIELD_TEXT,
 		.cap = 15,
 	};
 	view.fields[1] = (ui_field_t){
-		.numeric = true,
+		.kind = UI_FIELD_NUMERIC,
 		.cap = 15,
 	};
 	view.fields[2] = (ui_field_t){
-		.numeric = false,
+		.kind = UI_FIELD_TEXT,
 		.cap = 30,
 	};
 	
@@ -275,6 +276,7 @@ show_addview(db_t *db, veh_t *veh) {
 		lift_field(&view.fields[2], veh->desc);
 		lift_field_num(&view.fields[1], veh->num);
 	}
+	update_suggestions(&view);
 	
 	do {
 		addview_draw(&view);
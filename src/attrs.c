@@ -0,0 +1,241 @@
+/*===--------------------------------------------------------------------------------------------===
+ * attrs.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "attrs.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct attr_entry_s {
+	struct attr_entry_s	*next;	// the next class with the same hash
+	char			class[MAX_CLASS_LEN];
+	class_attrs_t		attrs;
+} attr_entry_t;
+
+// Classes are cut to the length the DB keeps, so that a long name still finds its vehicles.
+static int64_t
+class_hash(const char *class) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < MAX_CLASS_LEN - 1 && class[i]; ++i)
+		h = (h ^ (uint8_t)class[i]) * 0x100000001b3ull;
+	return (int64_t)h;
+}
+
+static attr_entry_t *
+find_entry(const attr_table_t *table, const char *class, int64_t hash) {
+	for(attr_entry_t *entry = hash_get(&table->by_class, hash); entry; entry = entry->next) {
+		if(!strncmp(entry->class, class, MAX_CLASS_LEN - 1))
+			return entry;
+	}
+	return NULL;
+}
+
+void
+attrs_init(attr_table_t *table) {
+	ASSERT(table != NULL);
+	hash_init(&table->by_class);
+	table->count = 0;
+}
+
+void
+attrs_fini(attr_table_t *table) {
+	ASSERT(table != NULL);
+	size_t iter = 0;
+	const hash_entry_t *it;
+	while((it = hash_next(&table->by_class, &iter)) != NULL) {
+		attr_entry_t *entry = it->value;
+		while(entry) {
+			attr_entry_t *next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+	hash_fini(&table->by_class);
+	table->count = 0;
+}
+
+void
+attrs_set(attr_table_t *table, const char *class, const class_attrs_t *attrs) {
+	ASSERT(table != NULL);
+	ASSERT(class != NULL);
+	ASSERT(attrs != NULL);
+
+	int64_t hash = class_hash(class);
+	attr_entry_t *entry = find_entry(table, class, hash);
+	if(!entry) {
+		entry = safe_calloc(1, sizeof(*entry));
+		strncpy(entry->class, class, sizeof(entry->class) - 1);
+		entry->next = hash_get(&table->by_class, hash);
+		hash_put(&table->by_class, hash, entry);
+		table->count += 1;
+	}
+	entry->attrs = *attrs;
+}
+
+const class_attrs_t *
+attrs_get(const attr_table_t *table, const char *class) {
+	ASSERT(table != NULL);
+	ASSERT(class != NULL);
+	attr_entry_t *entry = find_entry(table, class, class_hash(class));
+	return entry ? &entry->attrs : NULL;
+}
+
+bool
+attrs_load_from_path(attr_table_t *table, const char *path) {
+	ASSERT(table != NULL);
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+
+	char *line = NULL;
+	size_t cap = 0;
+	while(getline(&line, &cap, f) > 0) {
+		str_trim_space(line);
+		if(line[0] == '#')
+			continue;
+		char *comps[8];
+		if(str_split_inplace(line, ',', comps, 8) != 7)
+			continue;
+		str_trim_space(comps[0]);
+		if(!comps[0][0])
+			continue;
+
+		class_attrs_t attrs = {
+			.length = strtof(comps[1], NULL),
+			.mass = strtof(comps[2], NULL),
+			.seats = {strtof(comps[3], NULL), strtof(comps[4], NULL)},
+			.vmax = strtof(comps[5], NULL),
+			.brake = strtof(comps[6], NULL),
+		};
+		if(attrs.vmax <= 0.f)
+			attrs.vmax = ATTR_NO_VMAX;
+		attrs_set(table, comps[0], &attrs);
+	}
+	free(line);
+	fclose(f);
+	return true;
+}
+
+void
+consist_metrics(const attr_table_t *table, const veh_t *const *veh, size_t count,
+		consist_metrics_t *metrics) {
+	ASSERT(table != NULL);
+	ASSERT(metrics != NULL);
+
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->vmax = ATTR_NO_VMAX;
+	metrics->count = count;
+	for(size_t i = 0; i < count; ++i) {
+		const class_attrs_t *attrs = attrs_get(table, veh[i]->class);
+		if(!attrs)
+			continue;
+		metrics->length += attrs->length;
+		metrics->mass += attrs->mass;
+		metrics->brake += attrs->brake;
+		metrics->seats[0] += attrs->seats[0];
+		metrics->seats[1] += attrs->seats[1];
+		metrics->vmax = MIN(metrics->vmax, attrs->vmax);
+		metrics->known += 1;
+	}
+}
+
+// MARK: - Columns
+
+void
+attr_cols_init(attr_cols_t *cols, size_t count) {
+	ASSERT(cols != NULL);
+	size_t n = MAX(count, 1);
+	cols->count = count;
+	cols->length = safe_calloc(n, sizeof(float));
+	cols->mass = safe_calloc(n, sizeof(float));
+	cols->brake = safe_calloc(n, sizeof(float));
+	cols->seats[0] = safe_calloc(n, sizeof(float));
+	cols->seats[1] = safe_calloc(n, sizeof(float));
+	cols->vmax = safe_calloc(n, sizeof(float));
+	cols->known = safe_calloc(n, sizeof(float));
+}
+
+void
+attr_cols_fini(attr_cols_t *cols) {
+	ASSERT(cols != NULL);
+	free(cols->length);
+	free(cols->mass);
+	free(cols->brake);
+	free(cols->seats[0]);
+	free(cols->seats[1]);
+	free(cols->vmax);
+	free(cols->known);
+	memset(cols, 0, sizeof(*cols));
+}
+
+void
+attr_cols_gather(attr_cols_t *cols, const attr_table_t *table, const veh_t *const *veh) {
+	ASSERT(cols != NULL);
+	ASSERT(table != NULL);
+
+	static const class_attrs_t none = {.vmax = ATTR_NO_VMAX};
+	for(size_t i = 0; i < cols->count; ++i) {
+		const class_attrs_t *attrs = attrs_get(table, veh[i]->class);
+		if(!attrs)
+			attrs = &none;
+		cols->length[i] = attrs->length;
+		cols->mass[i] = attrs->mass;
+		cols->brake[i] = attrs->brake;
+		cols->seats[0][i] = attrs->seats[0];
+		cols->seats[1][i] = attrs->seats[1];
+		cols->vmax[i] = attrs->vmax;
+		cols->known[i] = attrs != &none;
+	}
+}
+
+// Each column is its own loop over every train, so the compiler can turn it into vector gathers
+// and adds without any of the other columns in the way.
+static void
+sum_col(float *restrict out, const float *restrict in, const uint32_t *restrict idx, size_t len,
+	size_t count) {
+	memset(out, 0, count * sizeof(*out));
+	for(size_t p = 0; p < len; ++p) {
+		const uint32_t *row = idx + p * count;
+		for(size_t t = 0; t < count; ++t)
+			out[t] += in[row[t]];
+	}
+}
+
+static void
+min_col(float *restrict out, const float *restrict in, const uint32_t *restrict idx, size_t len,
+	size_t count) {
+	for(size_t t = 0; t < count; ++t)
+		out[t] = ATTR_NO_VMAX;
+	for(size_t p = 0; p < len; ++p) {
+		const uint32_t *row = idx + p * count;
+		for(size_t t = 0; t < count; ++t) {
+			float v = in[row[t]];
+			out[t] = v < out[t] ? v : out[t];
+		}
+	}
+}
+
+void
+attr_cols_sum(const attr_cols_t *pool, const uint32_t *idx, size_t len, attr_cols_t *trains) {
+	ASSERT(pool != NULL);
+	ASSERT(idx != NULL);
+	ASSERT(trains != NULL);
+
+	size_t count = trains->count;
+	sum_col(trains->length, pool->length, idx, len, count);
+	sum_col(trains->mass, pool->mass, idx, len, count);
+	sum_col(trains->brake, pool->brake, idx, len, count);
+	sum_col(trains->seats[0], pool->seats[0], idx, len, count);
+	sum_col(trains->seats[1], pool->seats[1], idx, len, count);
+	sum_col(trains->known, pool->known, idx, len, count);
+	min_col(trains->vmax, pool->vmax, idx, len, count);
+}
@@ -0,0 +1,98 @@
+/*===--------------------------------------------------------------------------------------------===
+ * attrs.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _ATTRS_H_
+#define _ATTRS_H_
+
+#include "stock.h"
+
+// Speed used for vehicles that don't limit the train, so that taking the minimum ignores them.
+#define ATTR_NO_VMAX	(1000.f)
+
+// The technical data of one class of vehicle.
+typedef struct {
+	float		length;		// over buffers, in m
+	float		mass;		// tare, in t
+	float		brake;		// brake weight, in t
+	float		seats[2];	// 1st and 2nd class
+	float		vmax;		// in km/h
+} class_attrs_t;
+
+// Technical data by class designation, kept next to a DB as <db>.attrs.
+typedef struct {
+	hash_map_t	by_class;	// class hash -> first entry with that hash
+	size_t		count;
+} attr_table_t;
+
+void
+attrs_init(attr_table_t *table);
+
+void
+attrs_fini(attr_table_t *table);
+
+void
+attrs_set(attr_table_t *table, const char *class, const class_attrs_t *attrs);
+
+// Returns the data for a class, or NULL if there is none.
+const class_attrs_t *
+attrs_get(const attr_table_t *table, const char *class);
+
+// One class per line, as "<class>, <length>, <tare>, <1st seats>, <2nd seats>, <vmax>, <brake>".
+bool
+attrs_load_from_path(attr_table_t *table, const char *path);
+
+// The totals of a train. Vehicles without data count towards `count` only.
+typedef struct {
+	float		length;
+	float		mass;
+	float		brake;
+	float		seats[2];
+	float		vmax;		// the lowest maximum speed in the train, or ATTR_NO_VMAX
+	size_t		known;		// vehicles with data
+	size_t		count;
+} consist_metrics_t;
+
+void
+consist_metrics(const attr_table_t *table, const veh_t *const *veh, size_t count,
+		consist_metrics_t *metrics);
+
+// Brake weight as a percentage of the train's mass.
+static inline float
+consist_brake_pct(float brake, float mass) {
+	return mass > 0.f ? 100.f * brake / mass : 0.f;
+}
+
+// The same data as columns, one row per vehicle of a pool, or one row per train made from it.
+// Working on whole columns lets thousands of candidate trains be totalled in a few vector loops.
+typedef struct {
+	size_t		count;
+	float		*length;
+	float		*mass;
+	float		*brake;
+	float		*seats[2];
+	float		*vmax;
+	float		*known;		// 1 for vehicles with data, and the number of them for trains
+} attr_cols_t;
+
+void
+attr_cols_init(attr_cols_t *cols, size_t count);
+
+void
+attr_cols_fini(attr_cols_t *cols);
+
+// Fills one row per vehicle. Vehicles without data get zeroes and ATTR_NO_VMAX.
+void
+attr_cols_gather(attr_cols_t *cols, const attr_table_t *table, const veh_t *const *veh);
+
+// Totals `trains->count` trains of `len` vehicles each, drawn from the rows of `pool`. The p-th
+// vehicle of train t is idx[p * trains->count + t], so that each step goes across every train.
+void
+attr_cols_sum(const attr_cols_t *pool, const uint32_t *idx, size_t len, attr_cols_t *trains);
+
+#endif /* ifndef _ATTRS_H_ */
@@ -0,0 +1,975 @@
+/*===--------------------------------------------------------------------------------------------===
+ * batch.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "batch.h"
+#include "query.h"
+#include "fuzzy.h"
+#include "diff.h"
+#include "history.h"
+#include "mem.h"
+#include "ndjson.h"
+#include "sim.h"
+#include "uic.h"
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const char	*name;
+	const char	*args;
+	int		(*run)(const batch_env_t *env, int argc, const char **argv);
+} batch_cmd_t;
+
+static void
+print_stats_row(const char *label, const size_t count[2]) {
+	printf("  %-24s %10zu %10zu %10zu\n", label, count[0] + count[1], count[1], count[0]);
+}
+
+static int
+cmd_stats(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	UNUSED(argc);
+	UNUSED(argv);
+	const stock_stats_t *stats = stock_db_stats(db);
+	
+	printf("  %-24s %10s %10s %10s\n", "", "total", "in use", "spare");
+	print_stats_row("all vehicles", stats->total);
+	
+	printf("by type\n");
+	for(int i = 0; i < VEH_TYPE_COUNT; ++i)
+		print_stats_row(stock_type_name(i), stats->by_type[i]);
+	
+	printf("by traction\n");
+	for(int i = TRACTION_NONE + 1; i < TRACTION_COUNT; ++i)
+		print_stats_row(stock_traction_name(i), stats->by_traction[i]);
+	
+	printf("by capability\n");
+	for(int i = 0; i < VEH_CAP_COUNT; ++i)
+		print_stats_row(stock_cap_name(i), stats->by_cap[i]);
+	return 0;
+}
+
+static void
+print_mem_row(const char *label, size_t bytes) {
+	char size[32];
+	mem_format_size(bytes, size, sizeof(size));
+	printf("  %-24s %12zu %12s\n", label, bytes, size);
+}
+
+// Byte counts are exact so that runs can be compared, allocations included.
+static int
+cmd_mem(const batch_env_t *env, int argc, const char **argv) {
+	UNUSED(argc);
+	UNUSED(argv);
+	stock_memstats_t mem;
+	stock_db_memstats(env->db, &mem);
+	
+	printf("memory in use\n");
+	print_mem_row("records", mem.records);
+	print_mem_row("strings", mem.strings);
+	print_mem_row("index", mem.index);
+	print_mem_row("slack", mem.slack);
+	print_mem_row("total", stock_memstats_total(&mem));
+	
+	mem_count_t counts[MEM_OP_COUNT];
+	mem_counts(counts);
+	printf("allocations since start\n");
+	printf("  %-24s %12s %12s\n", "", "count", "bytes");
+	for(int i = 0; i < MEM_OP_COUNT; ++i)
+		printf("  %-24s %12zu %12zu\n", mem_op_name(i), counts[i].allocs, counts[i].bytes);
+	return 0;
+}
+
+static int
+cmd_rules(const batch_env_t *env, int argc, const char **argv) {
+	UNUSED(env);
+	UNUSED(argc);
+	UNUSED(argv);
+	fputs(uic_rules_source(uic_rules_active()), stdout);
+	return 0;
+}
+
+static int
+cmd_classify(const batch_env_t *env, int argc, const char **argv) {
+	UNUSED(env);
+	if(argc < 2)
+		return -1;
+	for(int i = 1; i < argc; ++i) {
+		veh_type_t type;
+		uint32_t caps;
+		uic_classify(argv[i], &type, &caps);
+		printf("%s: %s", argv[i], stock_type_name(type));
+		for(int bit = 0; bit < VEH_CAP_COUNT; ++bit) {
+			if(caps & (1u << bit))
+				printf(" %s", stock_cap_name(bit));
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+static int
+cmd_import(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	bool renumber = argc > 2 && !strcmp(argv[2], "--renumber");
+	
+	stock_import_t res;
+	if(!stock_import_from_path(argv[1], db, renumber, &res)) {
+		fprintf(stderr, "cannot read %s\n", argv[1]);
+		return 1;
+	}
+	printf("%zu added, %zu renumbered, %zu skipped\n", res.added, res.renumbered, res.skipped);
+	return 0;
+}
+
+static int
+cmd_import_json(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	bool renumber = argc > 2 && !strcmp(argv[2], "--renumber");
+	
+	ndjson_import_t res;
+	bool ok = !strcmp(argv[1], "-")
+		? ndjson_import_from_file(stdin, db, renumber, &res)
+		: ndjson_import_from_path(argv[1], db, renumber, &res);
+	if(!ok) {
+		fprintf(stderr, "cannot read %s\n", argv[1]);
+		return 1;
+	}
+	printf("%zu added, %zu renumbered, %zu skipped, %zu invalid\n",
+	       res.stock.added, res.stock.renumbered, res.stock.skipped, res.invalid);
+	if(res.invalid)
+		fprintf(stderr, "line %zu: %s\n", res.error_line, res.error);
+	return res.invalid ? 1 : 0;
+}
+
+static int
+cmd_export_json(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2 || !strcmp(argv[1], "-"))
+		return ndjson_write_to_file(stdout, db) ? 0 : 1;
+	
+	FILE *f = fopen(argv[1], "wb");
+	if(!f) {
+		fprintf(stderr, "cannot write %s\n", argv[1]);
+		return 1;
+	}
+	bool ok = ndjson_write_to_file(f, db);
+	ok = (fclose(f) == 0) && ok;
+	if(!ok)
+		fprintf(stderr, "cannot write %s\n", argv[1]);
+	return ok ? 0 : 1;
+}
+
+static int
+cmd_next_free(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	veh_num_t lo = strtoll(argv[1], NULL, 10);
+	veh_num_t hi = argc > 2 ? strtoll(argv[2], NULL, 10) : VEH_NUM_MAX;
+	
+	veh_num_t num;
+	if(!stock_db_next_free(db, lo, hi, &num)) {
+		fprintf(stderr, "no free running number in %" VEH_NUM_FMT "-%" VEH_NUM_FMT "\n", lo, hi);
+		return 1;
+	}
+	printf("%" VEH_NUM_FMT "\n", num);
+	return 0;
+}
+
+// Prints the matching vehicles in the DB file's own format, so the output can be loaded back.
+static void
+print_row(const veh_t *veh) {
+	printf("%c,%" VEH_NUM_FMT ", %s, %s\n",
+		veh->in_use ? 'x' : '-',
+		veh->num,
+		veh->class,
+		veh->desc);
+}
+
+// Let the shell split the expression, so it doesn't have to be quoted as a whole
+static query_t *
+compile_args(int argc, const char **argv) {
+	char src[1024] = "";
+	for(int i = 1; i < argc; ++i) {
+		if(i > 1)
+			strncat(src, " ", sizeof(src) - strlen(src) - 1);
+		strncat(src, argv[i], sizeof(src) - strlen(src) - 1);
+	}
+	
+	char err[128];
+	query_t *query = query_compile(src, err, sizeof(err));
+	if(!query)
+		fprintf(stderr, "invalid query: %s\n", err);
+	return query;
+}
+
+static int
+cmd_query(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	query_t *query = compile_args(argc, argv);
+	if(!query)
+		return 1;
+	
+	veh_t **list;
+	size_t count = query_select(query, db, &list);
+	for(size_t i = 0; i < count; ++i)
+		print_row(list[i]);
+	free(list);
+	query_free(query);
+	return 0;
+}
+
+static int
+cmd_search(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	int max_dist = argc > 2 ? atoi(argv[2]) : fuzzy_default_dist(argv[1]);
+	
+	fuzzy_hit_t *hits;
+	size_t count = fuzzy_search(db, argv[1], max_dist, &hits);
+	for(size_t i = 0; i < count; ++i) {
+		const veh_t *veh = hits[i].veh;
+		printf("%d %" VEH_NUM_FMT ", %s, %s\n", hits[i].dist, veh->num, veh->class, veh->desc);
+	}
+	free(hits);
+	return 0;
+}
+
+// Prints the patch that turns this DB into the other one.
+static int
+cmd_diff(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	
+	db_t other;
+	stock_db_init(&other);
+	if(stock_load_from_path(argv[1], &other) < 0) {
+		fprintf(stderr, "cannot read %s\n", argv[1]);
+		stock_db_fini(&other);
+		return 1;
+	}
+	
+	patch_t patch;
+	patch_init(&patch);
+	stock_diff(db, &other, &patch);
+	patch_write_to_file(stdout, &patch);
+	patch_fini(&patch);
+	stock_db_fini(&other);
+	return 0;
+}
+
+static int
+cmd_patch(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	
+	FILE *f = !strcmp(argv[1], "-") ? stdin : fopen(argv[1], "rb");
+	if(!f) {
+		fprintf(stderr, "cannot read %s\n", argv[1]);
+		return 1;
+	}
+	patch_t patch;
+	patch_init(&patch);
+	bool ok = patch_read_from_file(f, &patch);
+	if(f != stdin)
+		fclose(f);
+	if(!ok) {
+		fprintf(stderr, "%s is not a valid patch\n", argv[1]);
+		patch_fini(&patch);
+		return 1;
+	}
+	
+	size_t applied = stock_patch_apply(db, &patch);
+	printf("%zu applied, %zu skipped\n", applied, patch.count - applied);
+	patch_fini(&patch);
+	return 0;
+}
+
+static int
+apply_batch(db_t *db, stock_batch_t *batch, const char *done) {
+	veh_num_t conflict;
+	bool ok = stock_db_apply(db, batch, &conflict);
+	if(ok)
+		printf("%zu %s\n", batch->count, done);
+	else
+		fprintf(stderr, "running number %" VEH_NUM_FMT " is taken, nothing changed\n", conflict);
+	stock_batch_fini(batch);
+	return ok ? 0 : 1;
+}
+
+// Moves every vehicle numbered in [from, to] along so that `from` becomes `new from`.
+static int
+cmd_renumber(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 4)
+		return -1;
+	veh_num_t lo = strtoll(argv[1], NULL, 10);
+	veh_num_t hi = strtoll(argv[2], NULL, 10);
+	veh_num_t to = strtoll(argv[3], NULL, 10);
+	if(hi < lo || to < 0 || to > VEH_NUM_MAX - (hi - lo)) {
+		fprintf(stderr, "invalid range\n");
+		return 1;
+	}
+	
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	stock_batch_renumber_range(&batch, env->db, lo, hi, to);
+	return apply_batch(env->db, &batch, "renumbered");
+}
+
+static int
+cmd_set_in_use(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 3)
+		return -1;
+	bool in_use;
+	if(!strcmp(argv[1], "yes"))
+		in_use = true;
+	else if(!strcmp(argv[1], "no"))
+		in_use = false;
+	else
+		return -1;
+	query_t *query = compile_args(argc - 1, argv + 1);
+	if(!query)
+		return 1;
+	
+	veh_t **list;
+	size_t count = query_select(query, db, &list);
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	for(size_t i = 0; i < count; ++i)
+		stock_batch_set_in_use(&batch, list[i], in_use);
+	free(list);
+	query_free(query);
+	return apply_batch(db, &batch, "updated");
+}
+
+static int
+cmd_delete_where(const batch_env_t *env, int argc, const char **argv) {
+	db_t *db = env->db;
+	if(argc < 2)
+		return -1;
+	query_t *query = compile_args(argc, argv);
+	if(!query)
+		return 1;
+	
+	veh_t **list;
+	size_t count = query_select(query, db, &list);
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	for(size_t i = 0; i < count; ++i)
+		stock_batch_delete(&batch, list[i]);
+	free(list);
+	query_free(query);
+	return apply_batch(db, &batch, "deleted");
+}
+
+static void
+print_consist(const consist_t *consist) {
+	printf("%s:", consist->name);
+	for(const consist_member_t *m = consist->head; m; m = m->next)
+		printf(" %" VEH_NUM_FMT, m->num);
+	printf("\n");
+}
+
+static int
+cmd_consists(const batch_env_t *env, int argc, const char **argv) {
+	UNUSED(argc);
+	UNUSED(argv);
+	const avl_tree_t *tree = &env->consists->by_name;
+	for(const consist_t *consist = avl_first(tree); consist; consist = AVL_NEXT(tree, consist))
+		print_consist(consist);
+	return 0;
+}
+
+// Prints a consist, or with running numbers after the name, replaces its vehicles.
+static int
+cmd_consist(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	
+	consist_t *consist = consists_get(env->consists, argv[1]);
+	if(argc == 2) {
+		if(!consist) {
+			fprintf(stderr, "no consist named %s\n", argv[1]);
+			return 1;
+		}
+		print_consist(consist);
+		return 0;
+	}
+	
+	veh_num_t *nums = safe_calloc(argc - 2, sizeof(veh_num_t));
+	for(int i = 2; i < argc; ++i)
+		nums[i-2] = strtoll(argv[i], NULL, 10);
+	consist = consists_set(env->consists, argv[1], nums, argc - 2);
+	free(nums);
+	print_consist(consist);
+	return 0;
+}
+
+static int
+cmd_consist_of(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	const consist_t *consist = consists_find_veh(env->consists, strtoll(argv[1], NULL, 10));
+	if(!consist) {
+		fprintf(stderr, "%s is not in a consist\n", argv[1]);
+		return 1;
+	}
+	printf("%s\n", consist->name);
+	return 0;
+}
+
+// Totals a named consist, or the vehicles listed by number, from the class data in <db>.attrs.
+static int
+cmd_metrics(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	
+	const veh_t **list = safe_calloc(MAX(argc, 32), sizeof(*list));
+	size_t count = 0, cap = MAX(argc, 32);
+	const consist_t *consist = consists_get(env->consists, argv[1]);
+	if(consist) {
+		for(const consist_member_t *m = consist->head; m; m = m->next) {
+			if(count == cap) {
+				cap *= 2;
+				list = safe_realloc(list, cap * sizeof(*list));
+			}
+			list[count++] = stock_db_get(env->db, m->num);
+		}
+	} else {
+		for(int i = 1; i < argc; ++i) {
+			const veh_t *veh = stock_db_get(env->db, strtoll(argv[i], NULL, 10));
+			if(!veh) {
+				fprintf(stderr, "no vehicle numbered %s\n", argv[i]);
+				free(list);
+				return 1;
+			}
+			list[count++] = veh;
+		}
+	}
+	
+	consist_metrics_t m;
+	consist_metrics(env->attrs, list, count, &m);
+	free(list);
+	printf("length      %.1f m\n", m.length);
+	printf("mass        %.1f t\n", m.mass);
+	printf("seats       %.0f 1st, %.0f 2nd\n", m.seats[0], m.seats[1]);
+	if(m.vmax < ATTR_NO_VMAX)
+		printf("max speed   %.0f km/h\n", m.vmax);
+	else
+		printf("max speed   -\n");
+	printf("braked      %.0f%%\n", consist_brake_pct(m.brake, m.mass));
+	if(m.known < m.count)
+		printf("no data for %zu of %zu vehicles\n", m.count - m.known, m.count);
+	return 0;
+}
+
+// Runs the yard simulation over the in-use stock. Parameters are given as <name>=<value>, and
+// --trace prints the events of the first run.
+static int
+cmd_simulate(const batch_env_t *env, int argc, const char **argv) {
+	sim_params_t params;
+	sim_params_default(&params);
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--trace")) {
+			params.trace = stdout;
+			continue;
+		}
+		const char *value = strchr(argv[i], '=');
+		if(!value)
+			return -1;
+		size_t len = value++ - argv[i];
+		const char *name = argv[i];
+		if(!strncmp(name, "runs", len) && len == 4)
+			params.runs = atoi(value);
+		else if(!strncmp(name, "seed", len) && len == 4)
+			params.seed = strtoull(value, NULL, 10);
+		else if(!strncmp(name, "threads", len) && len == 7)
+			params.threads = atoi(value);
+		else if(!strncmp(name, "hours", len) && len == 5)
+			params.hours = strtod(value, NULL);
+		else if(!strncmp(name, "rate", len) && len == 4)
+			params.arrivals_per_hour = strtod(value, NULL);
+		else if(!strncmp(name, "tracks", len) && len == 6)
+			params.tracks = atoi(value);
+		else if(!strncmp(name, "shunters", len) && len == 8)
+			params.shunters = atoi(value);
+		else if(!strncmp(name, "cars", len) && len == 4) {
+			char *end;
+			params.min_cars = params.max_cars = (int)strtol(value, &end, 10);
+			if(*end == '-')
+				params.max_cars = (int)strtol(end + 1, NULL, 10);
+		} else {
+			fprintf(stderr, "unknown parameter %.*s\n", (int)len, name);
+			return 1;
+		}
+	}
+	if(params.runs < 1 || params.hours <= 0 || params.arrivals_per_hour <= 0 || params.tracks < 1
+	   || params.shunters < 1 || params.min_cars < 0 || params.max_cars < params.min_cars) {
+		fprintf(stderr, "invalid simulation parameters\n");
+		return 1;
+	}
+	
+	sim_report_t report;
+	if(!sim_run(env->db, &params, &report)) {
+		fprintf(stderr, "no locomotive in use\n");
+		return 1;
+	}
+	if(params.trace)
+		printf("\n");
+	sim_report_print(stdout, &params, &report);
+	return 0;
+}
+
+static void
+print_booking(const roster_booking_t *booking) {
+	char start[ROSTER_TIME_LEN], end[ROSTER_TIME_LEN];
+	roster_format_time(booking->start, start, sizeof(start));
+	roster_format_time(booking->end, end, sizeof(end));
+	printf("%s, %s, %s, %" VEH_NUM_FMT "\n", start, end, booking->service, booking->veh->num);
+}
+
+static bool
+parse_interval(const char *start_str, const char *end_str, roster_time_t *start, roster_time_t *end) {
+	if(!roster_parse_time(start_str, start) || !roster_parse_time(end_str, end) || *start >= *end) {
+		fprintf(stderr, "invalid interval %s-%s\n", start_str, end_str);
+		return false;
+	}
+	return true;
+}
+
+static int
+cmd_book(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 5)
+		return -1;
+	roster_time_t start, end;
+	if(!parse_interval(argv[2], argv[3], &start, &end))
+		return 1;
+	
+	const roster_booking_t *clash = NULL;
+	bool ok;
+	char *num_end;
+	veh_num_t num = strtoll(argv[1], &num_end, 10);
+	if(num_end != argv[1] && *num_end == '\0') {
+		ok = roster_book(env->roster, num, start, end, argv[4], &clash);
+	} else {
+		const consist_t *consist = consists_get(env->consists, argv[1]);
+		if(!consist) {
+			fprintf(stderr, "no consist named %s\n", argv[1]);
+			return 1;
+		}
+		ok = roster_book_consist(env->roster, consist, start, end, argv[4], &clash);
+	}
+	
+	if(clash) {
+		fprintf(stderr, "clashes with ");
+		print_booking(clash);
+	} else if(!ok) {
+		fprintf(stderr, "cannot book %s\n", argv[1]);
+	}
+	return ok ? 0 : 1;
+}
+
+// Prints the whole roster in time order, or every booking of one vehicle.
+static int
+cmd_roster(const batch_env_t *env, int argc, const char **argv) {
+	const roster_t *roster = env->roster;
+	if(argc > 1) {
+		const roster_veh_t *rv = hash_get(&roster->by_veh, strtoll(argv[1], NULL, 10));
+		if(!rv)
+			return 0;
+		const avl_tree_t *tree = &rv->bookings;
+		for(const roster_booking_t *b = avl_first(tree); b; b = AVL_NEXT(tree, b))
+			print_booking(b);
+		return 0;
+	}
+	
+	const roster_booking_t **list = safe_calloc(MAX(roster->count, 1), sizeof(*list));
+	size_t count = roster_busy(roster, INT64_MIN, INT64_MAX, list, roster->count);
+	for(size_t i = 0; i < count; ++i)
+		print_booking(list[i]);
+	free(list);
+	return 0;
+}
+
+static int
+cmd_busy(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 3)
+		return -1;
+	roster_time_t start, end;
+	if(!parse_interval(argv[1], argv[2], &start, &end))
+		return 1;
+	
+	size_t count = roster_busy(env->roster, start, end, NULL, 0);
+	const roster_booking_t **list = safe_calloc(MAX(count, 1), sizeof(*list));
+	roster_busy(env->roster, start, end, list, count);
+	for(size_t i = 0; i < count; ++i)
+		print_booking(list[i]);
+	free(list);
+	return 0;
+}
+
+static int
+cmd_free(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 3)
+		return -1;
+	roster_time_t start, end;
+	if(!parse_interval(argv[1], argv[2], &start, &end))
+		return 1;
+	
+	size_t count = roster_free(env->roster, start, end, NULL, 0);
+	const veh_t **list = safe_calloc(MAX(count, 1), sizeof(*list));
+	roster_free(env->roster, start, end, list, count);
+	char label[MAX_DESC_LEN];
+	for(size_t i = 0; i < count; ++i) {
+		veh_combo_desc(list[i], label, sizeof(label));
+		printf("%" VEH_NUM_FMT " %s\n", list[i]->num, label);
+	}
+	free(list);
+	return 0;
+}
+
+// Books a day's diagram and prints what could not be booked.
+static int
+cmd_diagram(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	
+	FILE *f = !strcmp(argv[1], "-") ? stdin : fopen(argv[1], "rb");
+	if(!f) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return 1;
+	}
+	roster_report_t report;
+	roster_import_from_file(env->roster, env->consists, f, &report);
+	if(f != stdin)
+		fclose(f);
+	
+	roster_report_write(stdout, &report);
+	int res = report.num_conflicts ? 1 : 0;
+	roster_report_fini(&report);
+	return res;
+}
+
+// The history store is only opened by the commands that need it, so it never slows down loading.
+static history_t *
+open_history(const batch_env_t *env) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.history", env->db_path);
+	history_t *history = history_open(path);
+	if(!history)
+		fprintf(stderr, "cannot open %s\n", path);
+	return history;
+}
+
+// Reads one "<number>, <YYYY-MM-DD>, <km>[, <kind>]" event. Kinds default to an odometer reading.
+static bool
+parse_event(char *line, veh_num_t *num, hist_event_t *event) {
+	char *comps[4];
+	unsigned n = str_split_inplace(line, ',', comps, 4);
+	if(n < 3)
+		return false;
+	for(unsigned i = 0; i < n; ++i)
+		str_trim_space(comps[i]);
+
+	char *end;
+	*num = strtoll(comps[0], &end, 10);
+	if(end == comps[0] || *end)
+		return false;
+	event->km = strtoll(comps[2], &end, 10);
+	if(end == comps[2] || *end)
+		return false;
+	event->kind = HIST_ODOMETER;
+	if(n > 3 && !history_parse_kind(comps[3], &event->kind))
+		return false;
+	return history_parse_day(comps[1], &event->day);
+}
+
+static int
+cmd_log(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	FILE *f = !strcmp(argv[1], "-") ? stdin : fopen(argv[1], "rb");
+	if(!f) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return 1;
+	}
+	history_t *history = open_history(env);
+	if(!history) {
+		if(f != stdin)
+			fclose(f);
+		return 1;
+	}
+	
+	size_t logged = 0, rejected = 0, line_num = 0;
+	char *line = NULL;
+	size_t cap = 0;
+	while(getline(&line, &cap, f) > 0) {
+		line_num += 1;
+		str_trim_space(line);
+		if(!line[0] || line[0] == '#')
+			continue;
+		
+		veh_num_t num;
+		hist_event_t event;
+		if(parse_event(line, &num, &event) && history_append(history, num, &event)) {
+			logged += 1;
+		} else {
+			fprintf(stderr, "line %zu: invalid or out of order\n", line_num);
+			rejected += 1;
+		}
+	}
+	free(line);
+	if(f != stdin)
+		fclose(f);
+	
+	bool ok = history_close(history);
+	printf("%zu logged, %zu rejected\n", logged, rejected);
+	return ok && !rejected ? 0 : 1;
+}
+
+static bool
+parse_day_arg(const char *str, hist_day_t *day) {
+	if(history_parse_day(str, day))
+		return true;
+	fprintf(stderr, "invalid date %s, expected YYYY-MM-DD\n", str);
+	return false;
+}
+
+// Lists a vehicle's events over a period, followed by what they add up to.
+static int
+cmd_history(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	veh_num_t num = strtoll(argv[1], NULL, 10);
+	hist_day_t from = INT64_MIN, to = INT64_MAX;
+	if(argc > 2 && !parse_day_arg(argv[2], &from))
+		return 1;
+	if(argc > 3 && !parse_day_arg(argv[3], &to))
+		return 1;
+	
+	history_t *history = open_history(env);
+	if(!history)
+		return 1;
+	
+	hist_event_t *events;
+	size_t count = history_events(history, num, from, to, &events);
+	char day[HIST_DAY_LEN];
+	for(size_t i = 0; i < count; ++i) {
+		history_format_day(events[i].day, day, sizeof(day));
+		printf("%s %10" PRId64 " km  %s\n", day, events[i].km, history_kind_name(events[i].kind));
+	}
+	free(events);
+	
+	hist_summary_t summary;
+	if(history_summarise(history, num, from, to, &summary)) {
+		printf("%zu events, %" PRId64 " km", count, summary.last.km - summary.first.km);
+		for(int k = HIST_ODOMETER + 1; k < HIST_KIND_COUNT; ++k)
+			printf(", %zu %s", summary.count[k], history_kind_name(k));
+		printf("\n");
+	}
+	history_close(history);
+	return 0;
+}
+
+static int
+cmd_km_since(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	hist_kind_t kind;
+	if(!history_parse_kind(argv[1], &kind)) {
+		fprintf(stderr, "unknown event kind %s\n", argv[1]);
+		return 1;
+	}
+	history_t *history = open_history(env);
+	if(!history)
+		return 1;
+	
+	size_t count = argc - 2;
+	veh_num_t *nums;
+	if(count) {
+		nums = safe_calloc(count, sizeof(*nums));
+		for(size_t i = 0; i < count; ++i)
+			nums[i] = strtoll(argv[i+2], NULL, 10);
+	} else {
+		count = history_vehicles(history, NULL, 0);
+		nums = safe_calloc(MAX(count, 1), sizeof(*nums));
+		history_vehicles(history, nums, count);
+	}
+	
+	for(size_t i = 0; i < count; ++i) {
+		int64_t km;
+		if(history_km_since(history, nums[i], kind, &km))
+			printf("%" VEH_NUM_FMT " %" PRId64 "\n", nums[i], km);
+		else
+			printf("%" VEH_NUM_FMT " -\n", nums[i]);
+	}
+	free(nums);
+	history_close(history);
+	return 0;
+}
+
+static const batch_cmd_t commands[] = {
+	{"stats", "", cmd_stats},
+	{"mem", "", cmd_mem},
+	{"rules", "", cmd_rules},
+	{"classify", "<class>...", cmd_classify},
+	{"import", "<path> [--renumber]", cmd_import},
+	{"import-json", "<path | -> [--renumber]", cmd_import_json},
+	{"export-json", "[<path> | -]", cmd_export_json},
+	{"next-free", "<from> [<to>]", cmd_next_free},
+	{"query", "<expression>", cmd_query},
+	{"search", "<text> [<max distance>]", cmd_search},
+	{"diff", "<other db path>", cmd_diff},
+	{"patch", "<patch path | ->", cmd_patch},
+	{"renumber", "<from> <to> <new from>", cmd_renumber},
+	{"set-in-use", "<yes | no> <expression>", cmd_set_in_use},
+	{"delete-where", "<expression>", cmd_delete_where},
+	{"consists", "", cmd_consists},
+	{"consist", "<name> [<number>...]", cmd_consist},
+	{"consist-of", "<number>", cmd_consist_of},
+	{"metrics", "<consist | number...>", cmd_metrics},
+	{"simulate", "[runs|seed|threads|hours|rate|tracks|shunters|cars=<value>...] [--trace]",
+	 cmd_simulate},
+	{"book", "<number | consist> <start> <end> <service>", cmd_book},
+	{"roster", "[<number>]", cmd_roster},
+	{"busy", "<start> <end>", cmd_busy},
+	{"free", "<start> <end>", cmd_free},
+	{"diagram", "<diagram path | ->", cmd_diagram},
+	{"log", "<events path | ->", cmd_log},
+	{"history", "<number> [<from> [<to>]]", cmd_history},
+	{"km-since", "<event kind> [<number>...]", cmd_km_since},
+};
+
+#define NUM_COMMANDS	(sizeof(commands) / sizeof(commands[0]))
+
+typedef struct {
+	const char	*name;
+	const char	*args;
+	int		(*run)(depot_set_t *set, int argc, const char **argv);
+} depot_cmd_t;
+
+static int
+cmd_depots(depot_set_t *set, int argc, const char **argv) {
+	UNUSED(argc);
+	UNUSED(argv);
+	for(size_t i = 0; i < set->count; ++i) {
+		if(!set->depots[i].loaded) continue;
+		const stock_stats_t *stats = stock_db_stats(&set->depots[i].db);
+		printf("%-*s %10zu %10zu\n", DEPOT_NAME_LEN / 2, set->depots[i].name,
+		       stats->total[0] + stats->total[1], stats->total[1]);
+	}
+	return 0;
+}
+
+static int
+cmd_where(depot_set_t *set, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	int res = 0;
+	for(int i = 1; i < argc; ++i) {
+		veh_num_t num = strtoll(argv[i], NULL, 10);
+		bool found = false;
+		for(size_t j = 0; j < set->count; ++j) {
+			if(!set->depots[j].loaded || !stock_db_get(&set->depots[j].db, num)) continue;
+			printf("%" VEH_NUM_FMT " %s\n", num, set->depots[j].name);
+			found = true;
+		}
+		if(!found) {
+			fprintf(stderr, "no vehicle %s\n", argv[i]);
+			res = 1;
+		}
+	}
+	return res;
+}
+
+// Runs the query on every depot, and merges the per-depot results in running-number order.
+static int
+cmd_depot_query(depot_set_t *set, int argc, const char **argv) {
+	if(argc < 2)
+		return -1;
+	query_t *query = compile_args(argc, argv);
+	if(!query)
+		return 1;
+	
+	veh_t ***lists = safe_calloc(MAX(set->count, 1), sizeof(*lists));
+	depot_iter_t iter;
+	depot_iter_init(&iter, VEH_SORT_NUM, set->count);
+	for(size_t i = 0; i < set->count; ++i) {
+		if(!set->depots[i].loaded) continue;
+		size_t count = query_select(query, &set->depots[i].db, &lists[i]);
+		depot_iter_add(&iter, &set->depots[i], lists[i], count);
+	}
+	
+	depot_row_t row;
+	while(depot_iter_next(&iter, &row)) {
+		printf("%s: ", row.depot->name);
+		print_row(row.veh);
+	}
+	depot_iter_fini(&iter);
+	for(size_t i = 0; i < set->count; ++i)
+		free(lists[i]);
+	free(lists);
+	query_free(query);
+	return 0;
+}
+
+static const depot_cmd_t depot_commands[] = {
+	{"depots", "", cmd_depots},
+	{"where", "<number>...", cmd_where},
+	{"query", "<expression>", cmd_depot_query},
+};
+
+#define NUM_DEPOT_COMMANDS	(sizeof(depot_commands) / sizeof(depot_commands[0]))
+
+void
+batch_usage(FILE *out, const char *name) {
+	for(size_t i = 0; i < NUM_COMMANDS; ++i) {
+		fprintf(out, "       %s <db path> %s %s\n", name, commands[i].name, commands[i].args);
+	}
+	for(size_t i = 0; i < NUM_DEPOT_COMMANDS; ++i) {
+		fprintf(out, "       %s <depot dir> %s %s\n",
+			name, depot_commands[i].name, depot_commands[i].args);
+	}
+	fprintf(out, "       %s <depot dir> @<depot> [<command>]\n", name);
+}
+
+int
+batch_run(const batch_env_t *env, int argc, const char **argv) {
+	if(argc < 1)
+		return -1;
+	
+	for(size_t i = 0; i < NUM_COMMANDS; ++i) {
+		if(strcmp(argv[0], commands[i].name)) continue;
+		return commands[i].run(env, argc, argv);
+	}
+	return -1;
+}
+
+int
+batch_run_depots(depot_set_t *set, int argc, const char **argv) {
+	if(argc < 1)
+		return -1;
+	
+	for(size_t i = 0; i < NUM_DEPOT_COMMANDS; ++i) {
+		if(strcmp(argv[0], depot_commands[i].name)) continue;
+		return depot_commands[i].run(set, argc, argv);
+	}
+	return -1;
+}
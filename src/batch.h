@@ -0,0 +1,39 @@
+/*===--------------------------------------------------------------------------------------------===
+ * batch.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "stock.h"
+#include "consist.h"
+#include "roster.h"
+#include "depot.h"
+#include "attrs.h"
+
+// Everything a headless command may work on.
+typedef struct {
+	const char	*db_path;
+	db_t		*db;
+	consists_t	*consists;
+	roster_t	*roster;
+	const attr_table_t *attrs;
+} batch_env_t;
+
+// Runs a headless command. Returns the process exit status, or -1 if the command is not known.
+int
+batch_run(const batch_env_t *env, int argc, const char **argv);
+
+// Runs a command across every loaded depot of a set.
+int
+batch_run_depots(depot_set_t *set, int argc, const char **argv);
+
+void
+batch_usage(FILE *out, const char *name);
+
+#endif /* ifndef _BATCH_H_ */
@@ -0,0 +1,181 @@
+/*===--------------------------------------------------------------------------------------------===
+ * client.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "net.h"
+#include "watch.h"
+#include "ui.h"
+#include <utils/helpers.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define READ_CHUNK	(16384)
+
+struct client_s {
+	int		fd;
+	db_t		*db;
+	buf_t		in;
+	buf_t		out;
+	bool		applying;
+	
+	char		path[1024];
+	db_watch_t	*watch;		// the file, once the daemon is gone
+};
+
+// Once the daemon is gone, our copy is the only one with what it hadn't written back yet, and
+// with the edits it never got. The session carries on as if the file had been opened without a
+// daemon: changes to the file are merged in, and the copy is written back when the client closes.
+static void
+client_lost(client_t *client) {
+	if(client->fd < 0)
+		return;
+	close(client->fd);
+	client->fd = -1;
+	client->out.len = 0;
+	
+	client->watch = watch_open(client->path, client->db);
+	watch_mark_dirty(client->watch);
+	int fd = watch_fd(client->watch);
+	ui_set_pump(fd, fd >= 0 ? client_pump : NULL, client);
+	ui_status("daemon gone, changes are kept here");
+}
+
+static bool
+client_send(client_t *client) {
+	while(client->out.len) {
+		ssize_t n = write(client->fd, client->out.data, client->out.len);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			client_lost(client);
+			return false;
+		}
+		buf_consume(&client->out, n);
+	}
+	return true;
+}
+
+// Local edits go straight to the daemon. Changes the daemon pushes to us are applied through the
+// same stock_db_* calls, so they must not be echoed back. Once the daemon is gone, the watch
+// picks up local edits from the DB's generation instead.
+static void
+on_change(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	client_t *client = ctx;
+	if(client->applying || client->watch)
+		return;
+	msg_put_event(&client->out, client->db, ev, veh, old_num);
+	client_send(client);
+}
+
+// Reads whatever the daemon has sent and applies it. Returns false once the daemon is gone, or
+// when `until_sync` is set and the connection closes before the end of the snapshot.
+static bool
+client_read(client_t *client, bool until_sync) {
+	bool synced = false;
+	do {
+		buf_reserve(&client->in, READ_CHUNK);
+		ssize_t n = read(client->fd, client->in.data + client->in.len,
+				 client->in.cap - client->in.len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		client->in.len += n;
+
+		// A change that clashes with one of ours is skipped: the daemon refuses ours in turn,
+		// and its REJECT brings us back in line.
+		msg_t msg;
+		int res;
+		client->applying = true;
+		client->db->merging = true;
+		while((res = msg_next(&client->in, &msg)) > 0) {
+			veh_num_t conflict;
+			if(msg.op == MSG_SYNC)
+				synced = true;
+			else if(msg_apply(client->db, &msg, &conflict) && msg.op == MSG_REJECT)
+				ui_status("%" VEH_NUM_FMT " was changed by someone else too, theirs is kept", msg.veh.num);
+			msg_fini(&msg);
+		}
+		client->applying = false;
+		client->db->merging = false;
+		if(res < 0)
+			return false;
+	} while(until_sync && !synced);
+	return true;
+}
+
+client_t *
+client_connect(const char *db_path, db_t *db, bool *served) {
+	*served = false;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(!net_socket_path(db_path, addr.sun_path, sizeof(addr.sun_path)))
+		return NULL;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+		return NULL;
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return NULL;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	*served = true;
+
+	client_t *client = safe_calloc(1, sizeof(*client));
+	client->fd = fd;
+	client->db = db;
+	snprintf(client->path, sizeof(client->path), "%s", db_path);
+
+	if(!client_read(client, true)) {
+		client_close(client);
+		stock_db_fini(db);
+		stock_db_init(db);
+		return NULL;
+	}
+	stock_db_observe(db, on_change, client);
+	return client;
+}
+
+int
+client_fd(const client_t *client) {
+	return client->watch ? watch_fd(client->watch) : client->fd;
+}
+
+bool
+client_pump(void *ctx) {
+	client_t *client = ctx;
+	if(client->watch)
+		return watch_pump(client->watch);
+	if(client_read(client, false))
+		return true;
+	client_lost(client);
+	return watch_fd(client->watch) >= 0;
+}
+
+bool
+client_close(client_t *client) {
+	if(!client)
+		return true;
+	bool ok = true;
+	stock_db_unobserve(client->db, on_change, client);
+	if(client->watch) {
+		watch_sync(client->watch, false);
+		ok = watch_write(client->watch);
+		watch_close(client->watch);
+	} else {
+		close(client->fd);
+	}
+	buf_fini(&client->in);
+	buf_fini(&client->out);
+	free(client);
+	return ok;
+}
@@ -0,0 +1,363 @@
+/*===--------------------------------------------------------------------------------------------===
+ * consist.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "consist.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int
+consist_cmp(const void *a, const void *b) {
+	int res = strcmp(((const consist_t *)a)->name, ((const consist_t *)b)->name);
+	return res < 0 ? -1 : (res > 0 ? 1 : 0);
+}
+
+static void
+member_unlink(consists_t *set, consist_member_t *member) {
+	consist_t *consist = member->consist;
+	if(member->prev)
+		member->prev->next = member->next;
+	else
+		consist->head = member->next;
+	if(member->next)
+		member->next->prev = member->prev;
+	else
+		consist->tail = member->prev;
+	consist->count -= 1;
+	hash_remove(&set->by_veh, member->num);
+	free(member);
+}
+
+static void
+member_append(consists_t *set, consist_t *consist, veh_num_t num) {
+	consist_member_t *old = hash_get(&set->by_veh, num);
+	if(old) {
+		old->consist->changed = true;
+		member_unlink(set, old);
+	}
+
+	consist_member_t *member = safe_calloc(1, sizeof(*member));
+	member->num = num;
+	member->consist = consist;
+	member->prev = consist->tail;
+	if(consist->tail)
+		consist->tail->next = member;
+	else
+		consist->head = member;
+	consist->tail = member;
+	consist->count += 1;
+	hash_put(&set->by_veh, num, member);
+}
+
+static void
+mark_changed(consists_t *set, consist_t *consist) {
+	if(stock_db_merging(set->db))
+		return;
+	consist->changed = true;
+	set->dirty = true;
+}
+
+static void
+consist_clear(consists_t *set, consist_t *consist) {
+	while(consist->head)
+		member_unlink(set, consist->head);
+}
+
+// Vehicles in a batch can trade numbers, so every member leaves the index before any is put back
+// under its new number.
+static void
+renumber_members(consists_t *set) {
+	size_t count;
+	const stock_move_t *moves = stock_db_moves(set->db, &count);
+	consist_member_t **members = safe_calloc(MAX(count, 1), sizeof(*members));
+	for(size_t i = 0; i < count; ++i) {
+		members[i] = hash_get(&set->by_veh, moves[i].old_num);
+		if(members[i])
+			hash_remove(&set->by_veh, moves[i].old_num);
+	}
+	for(size_t i = 0; i < count; ++i) {
+		if(!members[i]) continue;
+		members[i]->num = moves[i].veh->num;
+		hash_put(&set->by_veh, members[i]->num, members[i]);
+		mark_changed(set, members[i]->consist);
+	}
+	free(members);
+}
+
+static void
+on_change(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	consists_t *set = ctx;
+	if(ev == DB_EV_RENUMBER) {
+		renumber_members(set);
+		return;
+	}
+	consist_member_t *member = hash_get(&set->by_veh, old_num);
+	if(!member)
+		return;
+
+	switch(ev) {
+	case DB_EV_DELETE:
+		mark_changed(set, member->consist);
+		member_unlink(set, member);
+		break;
+	case DB_EV_UPDATE:
+		if(veh->num == old_num)
+			break;
+		hash_remove(&set->by_veh, old_num);
+		member->num = veh->num;
+		hash_put(&set->by_veh, veh->num, member);
+		mark_changed(set, member->consist);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+consists_init(consists_t *set, db_t *db) {
+	ASSERT(set != NULL);
+	ASSERT(db != NULL);
+
+	set->db = db;
+	avl_create(&set->by_name, consist_cmp, sizeof(consist_t), offsetof(consist_t, node));
+	hash_init(&set->by_veh);
+	set->deleted = NULL;
+	set->num_deleted = 0;
+	set->dirty = false;
+	stock_db_observe(db, on_change, set);
+}
+
+void
+consists_fini(consists_t *set) {
+	ASSERT(set != NULL);
+
+	stock_db_unobserve(set->db, on_change, set);
+	consist_t *consist;
+	void *cookie = NULL;
+	while((consist = avl_destroy_nodes(&set->by_name, &cookie)) != NULL) {
+		consist_clear(set, consist);
+		free(consist);
+	}
+	avl_destroy(&set->by_name);
+	hash_fini(&set->by_veh);
+	free(set->deleted);
+}
+
+consist_t *
+consists_get(const consists_t *set, const char *name) {
+	ASSERT(set != NULL);
+	ASSERT(name != NULL);
+
+	consist_t search;
+	strncpy(search.name, name, CONSIST_NAME_LEN - 1);
+	search.name[CONSIST_NAME_LEN - 1] = '\0';
+	return avl_find(&set->by_name, &search, NULL);
+}
+
+consist_t *
+consists_set(consists_t *set, const char *name, const veh_num_t *nums, size_t count) {
+	ASSERT(set != NULL);
+	ASSERT(name != NULL);
+
+	consist_t *consist = consists_get(set, name);
+	if(consist) {
+		consist_clear(set, consist);
+	} else {
+		consist = safe_calloc(1, sizeof(*consist));
+		strncpy(consist->name, name, CONSIST_NAME_LEN - 1);
+		avl_add(&set->by_name, consist);
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		if(stock_db_get(set->db, nums[i]))
+			member_append(set, consist, nums[i]);
+	}
+	consist->changed = true;
+	set->dirty = true;
+	return consist;
+}
+
+void
+consists_delete(consists_t *set, consist_t *consist) {
+	ASSERT(set != NULL);
+	ASSERT(consist != NULL);
+
+	set->deleted = safe_realloc(set->deleted, (set->num_deleted + 1) * sizeof(*set->deleted));
+	memcpy(set->deleted[set->num_deleted++], consist->name, CONSIST_NAME_LEN);
+	consist_clear(set, consist);
+	avl_remove(&set->by_name, consist);
+	free(consist);
+	set->dirty = true;
+}
+
+consist_t *
+consists_find_veh(const consists_t *set, veh_num_t num) {
+	ASSERT(set != NULL);
+	consist_member_t *member = hash_get(&set->by_veh, num);
+	return member ? member->consist : NULL;
+}
+
+static void
+mark_written(consists_t *set) {
+	const avl_tree_t *tree = &set->by_name;
+	for(consist_t *consist = avl_first(tree); consist; consist = AVL_NEXT(tree, consist))
+		consist->changed = false;
+	set->num_deleted = 0;
+	set->dirty = false;
+}
+
+// Whether the file's line for `name` gives way to ours.
+static bool
+replaced_here(const consists_t *set, const char *name) {
+	const consist_t *consist = consists_get(set, name);
+	if(consist)
+		return consist->changed;
+	for(size_t i = 0; i < set->num_deleted; ++i) {
+		if(!strncmp(set->deleted[i], name, CONSIST_NAME_LEN - 1))
+			return true;
+	}
+	return false;
+}
+
+// Copies the lines of the file that stay as they are, noting the vehicles they hold in `kept`.
+static void
+copy_kept_lines(const consists_t *set, FILE *in, FILE *out, hash_map_t *kept) {
+	char *line = NULL, *name = NULL;
+	size_t cap = 0, name_cap = 0;
+	ssize_t len;
+	while((len = getline(&line, &cap, in)) > 0) {
+		if(name_cap < cap) {
+			name_cap = cap;
+			name = safe_realloc(name, name_cap);
+		}
+		memcpy(name, line, len + 1);
+		char *sep = strchr(name, ':');
+		if(sep) {
+			*sep = '\0';
+			str_trim_space(name);
+		}
+		if(sep && name[0] != '#' && replaced_here(set, name))
+			continue;
+		if(sep && name[0] != '#') {
+			char *end;
+			for(char *c = sep + 1;; c = end) {
+				veh_num_t num = strtoll(c, &end, 10);
+				if(end == c)
+					break;
+				hash_put(kept, num, kept);
+			}
+		}
+		fputs(line, out);
+		if(line[len - 1] != '\n')
+			fputc('\n', out);
+	}
+	free(name);
+	free(line);
+}
+
+bool
+consists_load_from_path(consists_t *set, const char *path) {
+	ASSERT(set != NULL);
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+
+	char *line = NULL;
+	size_t cap = 0;
+	veh_num_t *nums = NULL;
+	size_t nums_cap = 0;
+
+	while(getline(&line, &cap, f) > 0) {
+		str_trim_space(line);
+		if(line[0] == '#')
+			continue;
+		char *sep = strchr(line, ':');
+		if(!sep)
+			continue;
+		*sep = '\0';
+		str_trim_space(line);
+		if(!line[0])
+			continue;
+
+		size_t count = 0;
+		char *end;
+		for(char *c = sep + 1;; c = end) {
+			veh_num_t num = strtoll(c, &end, 10);
+			if(end == c)
+				break;
+			if(count == nums_cap) {
+				nums_cap = nums_cap ? nums_cap * 2 : 32;
+				nums = safe_realloc(nums, nums_cap * sizeof(*nums));
+			}
+			nums[count++] = num;
+		}
+		consists_set(set, line, nums, count);
+	}
+	free(nums);
+	free(line);
+	fclose(f);
+	mark_written(set);
+	return true;
+}
+
+bool
+consists_write_to_path(consists_t *set, const char *path) {
+	ASSERT(set != NULL);
+	ASSERT(path != NULL);
+
+	// The file itself is replaced, so writers hold a lock on one next to it that stays put
+	char lock_path[1024], tmp_path[1024];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	int lock = open(lock_path, O_RDWR | O_CREAT, 0666);
+	if(lock < 0)
+		return false;
+	if(flock(lock, LOCK_EX) < 0) {
+		close(lock);
+		return false;
+	}
+
+	// A vehicle another process put in one of the consists kept stays there: ours can only still
+	// hold it because that change never reached us.
+	bool ok = false;
+	hash_map_t kept;
+	hash_init(&kept);
+	FILE *f = fopen(tmp_path, "wb");
+	if(f) {
+		FILE *old = fopen(path, "rb");
+		if(old) {
+			copy_kept_lines(set, old, f, &kept);
+			fclose(old);
+		}
+		const avl_tree_t *tree = &set->by_name;
+		for(const consist_t *consist = avl_first(tree); consist; consist = AVL_NEXT(tree, consist)) {
+			if(!consist->changed) continue;
+			fprintf(f, "%s:", consist->name);
+			for(const consist_member_t *m = consist->head; m; m = m->next) {
+				if(!hash_get(&kept, m->num))
+					fprintf(f, " %" VEH_NUM_FMT, m->num);
+			}
+			fprintf(f, "\n");
+		}
+		ok = fclose(f) == 0 && rename(tmp_path, path) == 0;
+		if(!ok)
+			unlink(tmp_path);
+	}
+	hash_fini(&kept);
+	close(lock);
+	if(ok)
+		mark_written(set);
+	return ok;
+}
@@ -0,0 +1,82 @@
+/*===--------------------------------------------------------------------------------------------===
+ * consist.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _CONSIST_H_
+#define _CONSIST_H_
+
+#include "stock.h"
+
+#define CONSIST_NAME_LEN	(32)
+
+typedef struct consist_s consist_t;
+typedef struct consist_member_s consist_member_t;
+
+struct consist_member_s {
+	veh_num_t		num;
+	consist_t		*consist;
+	consist_member_t	*prev;
+	consist_member_t	*next;
+};
+
+// A named train: an ordered list of vehicles, from the front.
+struct consist_s {
+	char			name[CONSIST_NAME_LEN];
+	consist_member_t	*head;
+	consist_member_t	*tail;
+	size_t			count;
+	bool			changed;	// here, since the file was read or written
+	avl_node_t		node;
+};
+
+// The consists built on one stock DB. A vehicle is in at most one consist, and a reverse index
+// from running number to list entry makes finding its train, and following it through deletes and
+// renumbering, constant-time. The set observes the DB to do that, so it must be finalised before
+// the DB is. Changes the DB merges in from elsewhere are followed, but left to the side that made
+// them to write back.
+typedef struct {
+	db_t			*db;
+	avl_tree_t		by_name;
+	hash_map_t		by_veh;
+	char			(*deleted)[CONSIST_NAME_LEN];
+	size_t			num_deleted;
+	bool			dirty;
+} consists_t;
+
+void
+consists_init(consists_t *set, db_t *db);
+
+void
+consists_fini(consists_t *set);
+
+consist_t *
+consists_get(const consists_t *set, const char *name);
+
+// Creates the consist, or replaces the vehicles of an existing one. Vehicles that are not in the DB
+// are left out, and vehicles that were in another consist are moved out of it.
+consist_t *
+consists_set(consists_t *set, const char *name, const veh_num_t *nums, size_t count);
+
+void
+consists_delete(consists_t *set, consist_t *consist);
+
+// Returns the consist the vehicle is in, or NULL.
+consist_t *
+consists_find_veh(const consists_t *set, veh_num_t num);
+
+// Consists are stored one per line, as "<name>: <num> <num> ...".
+bool
+consists_load_from_path(consists_t *set, const char *path);
+
+// Writes back the consists changed here, keeping the file's version of every other one. Other
+// processes may be writing the same file: the read, merge and write happen under a lock, and the
+// file is replaced whole.
+bool
+consists_write_to_path(consists_t *set, const char *path);
+
+#endif /* ifndef _CONSIST_H_ */
@@ -9,37 +9,286 @@
 */
 #include "ui.h"
 #include "views.h"
+#include "query.h"
+#include "fuzzy.h"
+#include "mem.h"
+#include "hash.h"
+#include <utils/assert.h>
 #include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef struct {
-	int	id;
-	veh_t	*veh;
+	veh_num_t	id;
+	veh_t		*veh;
 } rec_t;
 
+#define PATCH_LIMIT	(64)
+
 typedef struct {
-	db_t	*db;
-	int	offset;
-	int	sel;
+	db_t		*db;
+	consists_t	*consists;
+	const attr_table_t *attrs;
+	int		offset;
+	int		sel;
+	veh_sort_t	sort;
+	
+	rec_t		*veh;
+	int		num_veh;
+	size_t		veh_cap;
+	uint64_t	gen;
+	bool		stale;		// the rows must be rebuilt before they are drawn
+	veh_t		*pending[PATCH_LIMIT];	// changed records waiting for their row
+	int		num_pending;
+	
+	query_t		*filter;
+	char		filter_src[FIELD_CAP];
+	uint8_t		*match;
+	size_t		match_cap;
 	
-	rec_t	*veh;
-	int	num_veh;
+	char		search_src[FIELD_CAP];
+	fuzzy_hit_t	*hits;
+	size_t		num_hits;
+	
+	hash_map_t	marked;		// running numbers picked for a bulk edit
+	char		status[64];	// shown on the prompt line until the next key
 } dbview_t;
 
+static void
+push_row(dbview_t *view, veh_t *veh) {
+	if(view->filter && !view->match[veh->slot])
+		return;
+	view->veh[view->num_veh].id = veh->num;
+	view->veh[view->num_veh].veh = veh;
+	view->num_veh += 1;
+}
+
+// Buffers only grow, so refreshing the rows after an edit doesn't go back to the allocator.
 static void
 update_veh(dbview_t *view) {
+	mem_op_t op = mem_op_begin(MEM_OP_VIEW);
 	size_t num_veh = stock_db_get_count(view->db);
 	
-	view->veh = safe_realloc(view->veh, num_veh * sizeof(rec_t));
-	view->num_veh = (int)num_veh;
+	if(num_veh > view->veh_cap || !view->veh) {
+		view->veh_cap = MAX(num_veh, view->veh_cap * 3 / 2);
+		view->veh_cap = MAX(view->veh_cap, 1);
+		view->veh = mem_realloc(view->veh, view->veh_cap * sizeof(rec_t));
+	}
+	view->num_veh = 0;
+	view->gen = stock_db_gen(view->db);
+	view->stale = false;
+	view->num_pending = 0;
+	
+	// The filter marks matching slots, and rows that aren't marked are skipped
+	if(view->filter) {
+		if(num_veh > view->match_cap || !view->match) {
+			view->match_cap = MAX(num_veh, view->match_cap * 3 / 2);
+			view->match_cap = MAX(view->match_cap, 1);
+			view->match = mem_realloc(view->match, view->match_cap);
+		}
+		query_mark(view->filter, view->db, view->match);
+	}
+	
+	// A fuzzy search ranks rows by distance, which takes over from the sort key
+	if(view->search_src[0]) {
+		free(view->hits);
+		const char *pattern = view->search_src;
+		view->num_hits = fuzzy_search(view->db, pattern, fuzzy_default_dist(pattern), &view->hits);
+		for(size_t i = 0; i < view->num_hits; ++i)
+			push_row(view, view->hits[i].veh);
+		mem_op_end(op);
+		return;
+	}
+	
+	veh_t *const *sorted = stock_db_sorted(view->db, view->sort);
+	for(size_t i = 0; i < num_veh; ++i)
+		push_row(view, sorted[i]);
+	mem_op_end(op);
+}
+
+// Rows are in the view's sort order, which is total, so a record's row can be found by binary
+// search as long as the fields it is sorted on haven't changed since the row was placed.
+static int
+row_lower_bound(const dbview_t *view, const veh_t *veh) {
+	int lo = 0, hi = view->num_veh;
+	while(lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if(stock_sort_cmp(view->sort, view->veh[mid].veh, veh) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// The selection follows its vehicle when rows come and go above it.
+static void
+row_remove(dbview_t *view, int i) {
+	view->num_veh -= 1;
+	memmove(&view->veh[i], &view->veh[i+1], (view->num_veh - i) * sizeof(rec_t));
+	if(i < view->sel)
+		view->sel -= 1;
+	view->sel = MAX(0, MIN(view->sel, view->num_veh - 1));
+}
+
+static void
+row_insert(dbview_t *view, veh_t *veh) {
+	if(view->filter && !query_match(view->filter, view->db, veh))
+		return;
+	if((size_t)view->num_veh == view->veh_cap) {
+		mem_op_t op = mem_op_begin(MEM_OP_VIEW);
+		view->veh_cap = MAX(view->veh_cap * 3 / 2, view->veh_cap + 1);
+		view->veh = mem_realloc(view->veh, view->veh_cap * sizeof(rec_t));
+		mem_op_end(op);
+	}
+	int i = row_lower_bound(view, veh);
+	memmove(&view->veh[i+1], &view->veh[i], (view->num_veh - i) * sizeof(rec_t));
+	view->veh[i].id = veh->num;
+	view->veh[i].veh = veh;
+	view->num_veh += 1;
+	if(i <= view->sel && view->num_veh > 1)
+		view->sel += 1;
+}
+
+// Takes the row of a record that changed out of the list, and holds the record until the rows
+// are patched. A batch changes all of its records before telling observers about any, so the
+// records can only be put back once the rows left are all in order again.
+static void
+row_take(dbview_t *view, veh_t *veh, bool is_new) {
+	for(int i = 0; i < view->num_veh && !is_new; ++i) {
+		if(view->veh[i].veh != veh) continue;
+		row_remove(view, i);
+		break;
+	}
+	for(int i = 0; i < view->num_pending; ++i) {
+		if(view->pending[i] == veh)
+			return;
+	}
+	view->pending[view->num_pending++] = veh;
+}
+
+// Sent before the record goes, so it still sorts where its row is, if it has one.
+static void
+row_drop(dbview_t *view, const veh_t *veh) {
+	for(int i = 0; i < view->num_pending; ++i) {
+		if(view->pending[i] != veh) continue;
+		view->pending[i] = view->pending[--view->num_pending];
+		return;
+	}
+	int i = row_lower_bound(view, veh);
+	if(i < view->num_veh && view->veh[i].veh == veh)
+		row_remove(view, i);
+}
+
+static void
+patch_rows(dbview_t *view) {
+	for(int i = 0; i < view->num_pending; ++i)
+		row_insert(view, view->pending[i]);
+	view->num_pending = 0;
+}
+
+// Changes to the DB, ours or merged from elsewhere, are patched into the rows a record at a time
+// rather than filtering and sorting the whole fleet again. The rows are rebuilt instead when a
+// fuzzy search ranks them, past PATCH_LIMIT changes between two patches, or when the DB changed
+// without telling observers since the rows were last in sync.
+static void
+on_change(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	UNUSED(old_num);
+	dbview_t *view = ctx;
+	uint64_t gen = stock_db_gen(view->db);
+	size_t num_moves = 0;
+	const stock_move_t *moves = stock_db_moves(view->db, &num_moves);
+	size_t count = ev == DB_EV_RENUMBER ? num_moves : 1;
 	
-	int *veh_ids = safe_calloc(view->num_veh, sizeof(int));
-	stock_db_get_list(view->db, veh_ids, num_veh);
+	if(view->stale)
+		return;
+	if(view->search_src[0] || count > (size_t)(PATCH_LIMIT - view->num_pending)
+	   || (view->gen != gen && view->gen + 1 != gen)) {
+		view->stale = true;
+		return;
+	}
 	
+	switch(ev) {
+	case DB_EV_ADD:
+	case DB_EV_UPDATE:
+	case DB_EV_IN_USE:
+		row_take(view, stock_db_get(view->db, veh->num), ev == DB_EV_ADD);
+		break;
+	case DB_EV_DELETE:
+		row_drop(view, veh);
+		break;
+	case DB_EV_RENUMBER:
+		for(size_t i = 0; i < num_moves; ++i)
+			row_take(view, moves[i].veh, false);
+		break;
+	default:
+		view->stale = true;
+		return;
+	}
+	view->gen = gen;
+}
+
+static size_t
+dbview_mem(const dbview_t *view) {
+	return view->veh_cap * sizeof(*view->veh) + view->match_cap
+		+ (view->hits ? MAX(view->num_hits, 1) * sizeof(*view->hits) : 0)
+		+ view->marked.cap * (sizeof(hash_entry_t) + 1);
+}
+
+static bool
+is_marked(const dbview_t *view, veh_num_t num) {
+	return hash_get(&view->marked, num) != NULL;
+}
+
+static void
+toggle_mark(dbview_t *view, veh_num_t num) {
+	if(!hash_remove(&view->marked, num))
+		hash_put(&view->marked, num, view);
+}
+
+// Marks every row shown, or clears them all if they already are.
+static void
+toggle_mark_all(dbview_t *view) {
+	bool all = true;
+	for(int i = 0; i < view->num_veh && all; ++i)
+		all = is_marked(view, view->veh[i].id);
+	for(int i = 0; i < view->num_veh; ++i) {
+		if(all)
+			hash_remove(&view->marked, view->veh[i].id);
+		else
+			hash_put(&view->marked, view->veh[i].id, view);
+	}
+}
+
+static void
+clear_marks(dbview_t *view) {
+	hash_fini(&view->marked);
+	hash_init(&view->marked);
+}
+
+// Returns the marked vehicles that are still in the DB, in running-number order.
+static veh_t **
+marked_veh(dbview_t *view, size_t *count) {
+	veh_t **list = safe_calloc(MAX(view->marked.count, 1), sizeof(*list));
+	size_t total = stock_db_get_count(view->db);
+	veh_t *const *sorted = stock_db_sorted(view->db, VEH_SORT_NUM);
+	*count = 0;
+	for(size_t i = 0; i < total && *count < view->marked.count; ++i) {
+		if(is_marked(view, sorted[i]->num))
+			list[(*count)++] = sorted[i];
+	}
+	return list;
+}
+
+static void
+select_veh(dbview_t *view, veh_num_t num) {
+	patch_rows(view);
+	view->sel = 0;
 	for(int i = 0; i < view->num_veh; ++i) {
-		view->veh[i].id = veh_ids[i];
-		view->veh[i].veh = stock_db_get(view->db, veh_ids[i]);
+		if(view->veh[i].id != num) continue;
+		view->sel = i;
+		break;
 	}
-	free(veh_ids);
 }
 
 static const char *type_name[] = {
@@ -55,7 +304,7 @@ static const char *type_name[] = {
 static void
 dbview_draw_list(dbview_t *view) {
 	
-#define ID_WIDTH	(6)
+#define ID_WIDTH	(12)
 #define CLASS_WIDTH	(12)
 #define TYPE_WIDTH	(12)
 #define SELECT_WIDTH	(2)
@@ -64,13 +313,20 @@ dbview_draw_list(dbview_t *view) {
 	hexes_get_size(&w, &h);
 	int desc_width = w - (13 + ID_WIDTH + CLASS_WIDTH + TYPE_WIDTH + SELECT_WIDTH);
 	
+	int rows = MAX(1, h-2);
+	if(view->sel < view->offset)
+		view->offset = view->sel;
+	if(view->sel >= view->offset + rows)
+		view->offset = view->sel - rows + 1;
+	view->offset = MAX(0, view->offset);
+	
 	for(int i = 0; i < h-2; ++i) {
 		hexes_cursor_go(0, i+1);
-		if(i == view->sel)
+		int idx = i + view->offset;
+		if(idx == view->sel)
 			term_reverse(stdout);
 		
-		int idx = i + view->offset;
-		if(i < 0 || i >= view->num_veh) {
+		if(idx < 0 || idx >= view->num_veh) {
 			ui_line("| %c%-*s | %-*s | %-*s | %-*s%c |",
 				' ',
 				CLASS_WIDTH, "",
@@ -82,13 +338,14 @@ dbview_draw_list(dbview_t *view) {
 			rec_t *rec = &view->veh[idx];
 			veh_t *veh = rec->veh;
 			if(!veh) continue;
-			ui_line("|%c %-*.*s | %*d | %-*s | %-*.*s %c|",
+			char class[UI_CELL_CAP], desc[UI_CELL_CAP];
+			ui_line("|%c %s | %*" VEH_NUM_FMT " | %-*s | %s %c|",
 				veh->in_use ? '*' : ' ',
-				CLASS_WIDTH, CLASS_WIDTH, veh->class,
+				ui_cell(class, veh->class, dict_width(veh->class), CLASS_WIDTH),
 				ID_WIDTH, veh->num,
 				TYPE_WIDTH, type_name[veh->type],
-				desc_width, desc_width, veh->desc,
-				veh->in_use ? '*' : ' ');
+				ui_cell(desc, veh->desc, dict_width(veh->desc), desc_width),
+				is_marked(view, veh->num) ? '+' : ' ');
 		}
 		term_style_reset(stdout);
 	}
@@ -97,39 +354,197 @@ dbview_draw_list(dbview_t *view) {
 static void
 dbview_draw(dbview_t *view) {
 	hexes_clear_screen();
-	ui_title(" Rolling Stock Database - Vehicles");
+	
+	char by[FIELD_CAP + 16];
+	if(view->search_src[0])
+		snprintf(by, sizeof(by), "closest to \"%s\"", view->search_src);
+	else
+		snprintf(by, sizeof(by), "by %s", stock_sort_name(view->sort));
+	
+	// Say which train the selected vehicle is part of, if any
+	char in_consist[CONSIST_NAME_LEN + 8] = "";
+	if(view->sel >= 0 && view->sel < view->num_veh) {
+		const consist_t *consist = consists_find_veh(view->consists, view->veh[view->sel].id);
+		if(consist)
+			snprintf(in_consist, sizeof(in_consist), " - in %s", consist->name);
+	}
+	
+	char marked[32] = "";
+	if(view->marked.count)
+		snprintf(marked, sizeof(marked), " - %zu marked", view->marked.count);
+	
+	if(view->filter)
+		ui_title(" Rolling Stock Database - Vehicles (%s) - %d matching %s%s%s",
+			 by, view->num_veh, view->filter_src, marked, in_consist);
+	else
+		ui_title(" Rolling Stock Database - Vehicles (%s)%s%s", by, marked, in_consist);
 	dbview_draw_list(view);
-	ui_prompt(" [Q]uit    [A]dd    [E]dit    [D]elete    [S]elect for s[H]unting");
+	if(view->status[0])
+		ui_prompt(" %s", view->status);
+	else if(view->marked.count)
+		ui_prompt(" [Q]uit    [Space] mark    [M]ark all    [D]elete    [S]elect    [R]enumber"
+			  "    [Esc] clear marks");
+	else
+		ui_prompt(" [Q]uit    [A]dd    [E]dit    [D]elete    [S]elect for s[H]unting    s[O]rt"
+			  "    s[T]ats    [/] filter    [F]ind    [Space] mark");
 }
 
+static bool
+apply_filter(dbview_t *view, const char *src, char *err, size_t err_cap) {
+	query_t *filter = NULL;
+	if(src[0]) {
+		filter = query_compile(src, err, err_cap);
+		if(!filter)
+			return false;
+	}
+	query_free(view->filter);
+	view->filter = filter;
+	strncpy(view->filter_src, src, FIELD_CAP);
+	return true;
+}
+
+static bool
+apply_search(dbview_t *view, const char *src, char *err, size_t err_cap) {
+	UNUSED(err);
+	UNUSED(err_cap);
+	strncpy(view->search_src, src, FIELD_CAP);
+	return true;
+}
+
+// The marked vehicles take consecutive numbers from the one given, in the order they had.
+static bool
+apply_renumber(dbview_t *view, const char *src, char *err, size_t err_cap) {
+	veh_num_t to = strtoll(src, NULL, 10);
+	size_t count;
+	veh_t **list = marked_veh(view, &count);
+	if(!src[0] || to < 0 || (veh_num_t)count > VEH_NUM_MAX - to) {
+		snprintf(err, err_cap, "invalid number");
+		free(list);
+		return false;
+	}
+	
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	for(size_t i = 0; i < count; ++i)
+		stock_batch_renumber(&batch, list[i], to + (veh_num_t)i);
+	free(list);
+	
+	veh_num_t conflict;
+	bool ok = stock_db_apply(view->db, &batch, &conflict);
+	stock_batch_fini(&batch);
+	if(!ok) {
+		snprintf(err, err_cap, "%" VEH_NUM_FMT " is taken", conflict);
+		return false;
+	}
+	clear_marks(view);
+	return true;
+}
+
+// Edits a line of text on the prompt line, starting from `src`, and hands it to `apply` on Enter.
+// When `apply` rejects it, the prompt stays open with the error next to it.
 static void
-shunting_puzzle(dbview_t *view) {
-	int num_veh = 0;
-	for(int i = 0; i < view->num_veh; ++i) {
-		if(view->veh[i].veh->in_use)
-			num_veh += 1;
+edit_prompt(dbview_t *view, const char *name, const char *src, ui_field_kind_t kind,
+	    bool (*apply)(dbview_t *, const char *, char *, size_t)) {
+	ui_field_t field = {.kind = kind, .cap = FIELD_CAP - 1};
+	strncpy(field.txt, src, FIELD_CAP - 1);
+	field.len = field.cur = (int)strlen(field.txt);
+	char err[64] = "";
+	
+	for(;;) {
+		dbview_draw(view);
+		
+		char label[96];
+		if(err[0])
+			snprintf(label, sizeof(label), " %s (%s): ", name, err);
+		else
+			snprintf(label, sizeof(label), " %s: ", name);
+		ui_prompt_field(label, &field);
+		
+		int c = hexes_get_key();
+		if(ui_field_input(&field, c))
+			continue;
+		
+		switch(c) {
+		case KEY_CTRL_C:
+		case KEY_ESC:
+			hexes_show_cursor(false);
+			return;
+		case KEY_RETURN:
+			break;
+		default:
+			continue;
+		}
+		
+		if(!apply(view, field.txt, err, sizeof(err)))
+			continue;
+		hexes_show_cursor(false);
+		
+		veh_num_t num = view->sel < view->num_veh ? view->veh[view->sel].id : 0;
+		update_veh(view);
+		select_veh(view, num);
+		return;
 	}
+}
+
+static void
+shunting_puzzle(dbview_t *view) {
+	veh_filter_t filter = {.types = 0, .in_use = 1};
+	int num_veh = (int)stock_db_count(view->db, &filter);
 	
 	if(!num_veh)
 		return;
 	
 	const veh_t **stock = safe_calloc(num_veh, sizeof(veh_t *));
+	num_veh = (int)stock_db_select(view->db, &filter, stock, num_veh);
 	
-	for(int i = 0, j = 0; i < view->num_veh; ++i) {
-		if(view->veh[i].veh->in_use)
-			stock[j++] = view->veh[i].veh;
-	}
-	
-	show_shuntview(view->db, stock, num_veh);
+	show_shuntview(view->db, view->consists, view->attrs, stock, num_veh);
 	free(stock);
 }
 
 
+// Deletes the marked vehicles, or puts them all in or out of use, as one change to the DB.
+static void
+edit_marked(dbview_t *view, bool delete) {
+	size_t count;
+	veh_t **list = marked_veh(view, &count);
+	
+	// If any of them is out of use, they all go in use
+	bool in_use = false;
+	for(size_t i = 0; i < count && !in_use; ++i)
+		in_use = !list[i]->in_use;
+	
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	for(size_t i = 0; i < count; ++i) {
+		if(delete)
+			stock_batch_delete(&batch, list[i]);
+		else
+			stock_batch_set_in_use(&batch, list[i], in_use);
+	}
+	free(list);
+	
+	veh_num_t conflict;
+	bool ok = stock_db_apply(view->db, &batch, &conflict);
+	stock_batch_fini(&batch);
+	if(!ok) {
+		snprintf(view->status, sizeof(view->status), "%" VEH_NUM_FMT " cannot be changed, nothing was",
+			 conflict);
+		return;
+	}
+	
+	veh_num_t num = view->sel < view->num_veh ? view->veh[view->sel].id : 0;
+	if(delete)
+		clear_marks(view);
+	select_veh(view, num);
+}
+
 static bool
 dbview_update(dbview_t *view) {
 	UNUSED(view);
 	
-	int c = hexes_get_key_raw();
+	int c = ui_get_key();
+	if(c != UI_KEY_REFRESH)
+		view->status[0] = '\0';
 	
 	veh_t *veh = NULL;
 	rec_t *rec = NULL;
@@ -156,7 +571,9 @@ dbview_update(dbview_t *view) {
 	case 'd':
 	case 'D':
 	case KEY_BACKSPACE:
-		if(veh) {
+		if(view->marked.count) {
+			edit_marked(view, true);
+		} else if(veh) {
 			stock_db_delete(view->db, veh);
 			update_veh(view);
 			view->sel = 0;
@@ -170,16 +587,60 @@ dbview_update(dbview_t *view) {
 		break;
 	case 's':
 	case 'S':
-		if(veh) {
-			veh->in_use = !veh->in_use;
+		if(view->marked.count) {
+			edit_marked(view, false);
+		} else if(veh) {
+			stock_db_set_in_use(view->db, veh, !veh->in_use);
+			if(view->sort == VEH_SORT_IN_USE)
+				select_veh(view, veh->num);
 		}
 		break;
+	case 'o':
+	case 'O':
+		view->sort = (view->sort + 1) % VEH_SORT_COUNT;
+		update_veh(view);
+		if(veh)
+			select_veh(view, veh->num);
+		break;
 		
 		case 'h':
 		case 'H':
 		shunting_puzzle(view);
 		break;
 		
+	case 't':
+	case 'T':
+		show_statsview(view->db, dbview_mem(view));
+		break;
+	case '/':
+		edit_prompt(view, "filter", view->filter_src, UI_FIELD_EXPR, apply_filter);
+		break;
+	case 'f':
+	case 'F':
+		edit_prompt(view, "find", view->search_src, UI_FIELD_EXPR, apply_search);
+		if(view->search_src[0])
+			view->sel = 0;
+		break;
+		
+	case ' ':
+		if(veh) {
+			toggle_mark(view, veh->num);
+			view->sel = MIN(view->num_veh-1, view->sel+1);
+		}
+		break;
+	case 'm':
+	case 'M':
+		toggle_mark_all(view);
+		break;
+	case 'r':
+	case 'R':
+		if(view->marked.count)
+			edit_prompt(view, "renumber marked from", "", UI_FIELD_NUMERIC, apply_renumber);
+		break;
+	case KEY_ESC:
+		clear_marks(view);
+		break;
+		
 	case KEY_ARROW_DOWN:
 		view->sel = MIN(view->num_veh-1, view->sel+1);
 		break;
@@ -192,16 +653,33 @@ dbview_update(dbview_t *view) {
 	return true;
 }
 
-void show_dbview(db_t *db) {
+void show_dbview(db_t *db, consists_t *consists, const attr_table_t *attrs) {
 	dbview_t view = {
 		.db = db,
+		.consists = consists,
+		.attrs = attrs,
 		.offset = 0,
+		.sort = VEH_SORT_NUM,
 	};
+	hash_init(&view.marked);
 	update_veh(&view);
+	stock_db_observe(db, on_change, &view);
 	do {
+		// The observer keeps the rows in sync, unless it gave up or wasn't told
+		if(view.stale || view.gen != stock_db_gen(db)) {
+			veh_num_t num = view.sel < view.num_veh ? view.veh[view.sel].id : 0;
+			update_veh(&view);
+			select_veh(&view, num);
+		}
+		patch_rows(&view);
 		dbview_draw(&view);
 	} while(dbview_update(&view));
+	stock_db_unobserve(db, on_change, &view);
 	if(view.veh)
 		free(view.veh);
+	free(view.match);
+	free(view.hits);
+	hash_fini(&view.marked);
+	query_free(view.filter);
 }
 
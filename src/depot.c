@@ -0,0 +1,298 @@
+/*===--------------------------------------------------------------------------------------------===
+ * depot.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "depot.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_THREADS	(16)
+
+// Files that live next to a DB without being one
+static const char *sidecars[] = {".idx", ".tmp", ".lock", ".consists", ".roster", ".rules", ".attrs"};
+
+static bool
+is_sidecar(const char *name) {
+	size_t len = strlen(name);
+	for(size_t i = 0; i < sizeof(sidecars) / sizeof(sidecars[0]); ++i) {
+		size_t ext = strlen(sidecars[i]);
+		if(len >= ext && !strcmp(name + len - ext, sidecars[i]))
+			return true;
+	}
+	return false;
+}
+
+static int
+depot_cmp(const void *a, const void *b) {
+	return strcmp(((const depot_t *)a)->name, ((const depot_t *)b)->name);
+}
+
+bool
+depots_open(depot_set_t *set, const char *dir) {
+	ASSERT(set != NULL);
+	ASSERT(dir != NULL);
+
+	memset(set, 0, sizeof(*set));
+	DIR *d = opendir(dir);
+	if(!d)
+		return false;
+	snprintf(set->dir, sizeof(set->dir), "%s", dir);
+
+	size_t cap = 0;
+	struct dirent *ent;
+	while((ent = readdir(d)) != NULL) {
+		if(ent->d_name[0] == '.' || is_sidecar(ent->d_name) || strlen(ent->d_name) >= DEPOT_NAME_LEN)
+			continue;
+
+		char path[DEPOT_PATH_LEN];
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		struct stat st;
+		if(stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		if(set->count == cap) {
+			cap = cap ? cap * 2 : 16;
+			set->depots = safe_realloc(set->depots, cap * sizeof(*set->depots));
+		}
+		depot_t *depot = &set->depots[set->count++];
+		memset(depot, 0, sizeof(*depot));
+		strcpy(depot->name, ent->d_name);
+		strcpy(depot->path, path);
+	}
+	closedir(d);
+
+	if(set->count)
+		qsort(set->depots, set->count, sizeof(*set->depots), depot_cmp);
+	return true;
+}
+
+void
+depots_close(depot_set_t *set) {
+	ASSERT(set != NULL);
+	for(size_t i = 0; i < set->count; ++i) {
+		if(set->depots[i].loaded)
+			stock_db_fini(&set->depots[i].db);
+	}
+	free(set->depots);
+	memset(set, 0, sizeof(*set));
+}
+
+depot_t *
+depots_get(const depot_set_t *set, const char *name) {
+	ASSERT(set != NULL);
+	ASSERT(name != NULL);
+
+	depot_t search;
+	strncpy(search.name, name, DEPOT_NAME_LEN - 1);
+	search.name[DEPOT_NAME_LEN - 1] = '\0';
+	return bsearch(&search, set->depots, set->count, sizeof(*set->depots), depot_cmp);
+}
+
+// MARK: - Loading
+
+typedef struct {
+	depot_t		**list;
+	size_t		count;
+	size_t		first;
+	size_t		stride;
+	bool		ok;
+} load_job_t;
+
+// Each depot has its own DB, so workers never share anything they write to.
+static void *
+run_load(void *data) {
+	load_job_t *job = data;
+	job->ok = true;
+	for(size_t i = job->first; i < job->count; i += job->stride) {
+		// A depot that can't be read stays unloaded rather than empty, so that writing back
+		// never replaces its file with whatever was added to it in the meantime
+		depot_t *depot = job->list[i];
+		stock_db_init(&depot->db);
+		if(stock_load_from_path(depot->path, &depot->db) < 0) {
+			stock_db_fini(&depot->db);
+			job->ok = false;
+			continue;
+		}
+		depot->saved_gen = stock_db_gen(&depot->db);
+		depot->loaded = true;
+	}
+	return NULL;
+}
+
+bool
+depots_load(depot_set_t *set, depot_t **list, size_t count) {
+	ASSERT(set != NULL);
+
+	if(!list)
+		count = set->count;
+	depot_t **pending = safe_calloc(MAX(count, 1), sizeof(*pending));
+	size_t num_pending = 0;
+	for(size_t i = 0; i < count; ++i) {
+		depot_t *depot = list ? list[i] : &set->depots[i];
+		if(!depot->loaded)
+			pending[num_pending++] = depot;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t workers = MIN((size_t)MAX(cpus, 1), MIN(num_pending, MAX_THREADS));
+	load_job_t jobs[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	for(size_t i = 0; i < workers; ++i)
+		jobs[i] = (load_job_t){.list = pending, .count = num_pending, .first = i, .stride = workers};
+
+	size_t started = 1;
+	for(; started < workers; ++started) {
+		if(pthread_create(&threads[started], NULL, run_load, &jobs[started]))
+			break;
+	}
+	if(workers)
+		run_load(&jobs[0]);
+	for(size_t i = 1; i < started; ++i)
+		pthread_join(threads[i], NULL);
+	for(size_t i = started; i < workers; ++i)
+		run_load(&jobs[i]);
+
+	bool ok = true;
+	for(size_t i = 0; i < workers; ++i)
+		ok = ok && jobs[i].ok;
+	free(pending);
+	return ok;
+}
+
+size_t
+depots_vehicle_count(const depot_set_t *set) {
+	ASSERT(set != NULL);
+	size_t count = 0;
+	for(size_t i = 0; i < set->count; ++i) {
+		if(set->depots[i].loaded)
+			count += stock_db_get_count(&set->depots[i].db);
+	}
+	return count;
+}
+
+ssize_t
+depots_write_changed(depot_set_t *set) {
+	ASSERT(set != NULL);
+
+	ssize_t written = 0;
+	for(size_t i = 0; i < set->count; ++i) {
+		depot_t *depot = &set->depots[i];
+		if(!depot->loaded || stock_db_gen(&depot->db) == depot->saved_gen)
+			continue;
+		if(!stock_write_to_path(depot->path, &depot->db))
+			return -1;
+		depot->saved_gen = stock_db_gen(&depot->db);
+		written += 1;
+	}
+	return written;
+}
+
+// MARK: - Merging
+
+static bool
+cursor_before(const depot_iter_t *iter, size_t a, size_t b) {
+	const depot_cursor_t *lhs = &iter->cursors[a];
+	const depot_cursor_t *rhs = &iter->cursors[b];
+	int res = stock_sort_cmp(iter->key, lhs->list[lhs->pos], rhs->list[rhs->pos]);
+	return res ? res < 0 : a < b;
+}
+
+static void
+heap_up(depot_iter_t *iter, size_t i) {
+	while(i > 0) {
+		size_t parent = (i - 1) / 2;
+		if(!cursor_before(iter, iter->heap[i], iter->heap[parent]))
+			break;
+		size_t tmp = iter->heap[i];
+		iter->heap[i] = iter->heap[parent];
+		iter->heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void
+heap_down(depot_iter_t *iter, size_t i) {
+	for(;;) {
+		size_t min = i;
+		size_t left = 2 * i + 1, right = 2 * i + 2;
+		if(left < iter->heap_len && cursor_before(iter, iter->heap[left], iter->heap[min]))
+			min = left;
+		if(right < iter->heap_len && cursor_before(iter, iter->heap[right], iter->heap[min]))
+			min = right;
+		if(min == i)
+			return;
+		size_t tmp = iter->heap[i];
+		iter->heap[i] = iter->heap[min];
+		iter->heap[min] = tmp;
+		i = min;
+	}
+}
+
+void
+depot_iter_init(depot_iter_t *iter, veh_sort_t key, size_t cap) {
+	ASSERT(iter != NULL);
+	ASSERT(key < VEH_SORT_COUNT);
+	iter->key = key;
+	iter->cursors = safe_calloc(MAX(cap, 1), sizeof(*iter->cursors));
+	iter->heap = safe_calloc(MAX(cap, 1), sizeof(*iter->heap));
+	iter->num_cursors = 0;
+	iter->heap_len = 0;
+}
+
+void
+depot_iter_add(depot_iter_t *iter, depot_t *depot, veh_t *const *list, size_t count) {
+	ASSERT(iter != NULL);
+	if(!count)
+		return;
+	size_t i = iter->num_cursors++;
+	iter->cursors[i] = (depot_cursor_t){.list = list, .count = count, .depot = depot};
+	iter->heap[iter->heap_len++] = i;
+	heap_up(iter, iter->heap_len - 1);
+}
+
+void
+depot_iter_sorted(depot_iter_t *iter, depot_set_t *set, veh_sort_t key) {
+	ASSERT(set != NULL);
+	depot_iter_init(iter, key, set->count);
+	for(size_t i = 0; i < set->count; ++i) {
+		depot_t *depot = &set->depots[i];
+		if(!depot->loaded) continue;
+		depot_iter_add(iter, depot, stock_db_sorted(&depot->db, key), stock_db_get_count(&depot->db));
+	}
+}
+
+bool
+depot_iter_next(depot_iter_t *iter, depot_row_t *row) {
+	ASSERT(iter != NULL);
+	ASSERT(row != NULL);
+	if(!iter->heap_len)
+		return false;
+
+	depot_cursor_t *cursor = &iter->cursors[iter->heap[0]];
+	row->veh = cursor->list[cursor->pos++];
+	row->depot = cursor->depot;
+
+	if(cursor->pos == cursor->count)
+		iter->heap[0] = iter->heap[--iter->heap_len];
+	heap_down(iter, 0);
+	return true;
+}
+
+void
+depot_iter_fini(depot_iter_t *iter) {
+	ASSERT(iter != NULL);
+	free(iter->cursors);
+	free(iter->heap);
+	memset(iter, 0, sizeof(*iter));
+}
@@ -0,0 +1,99 @@
+/*===--------------------------------------------------------------------------------------------===
+ * depot.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _DEPOT_H_
+#define _DEPOT_H_
+
+#include "stock.h"
+
+#define DEPOT_NAME_LEN	(64)
+#define DEPOT_PATH_LEN	(1024)
+
+// One depot's DB file, loaded into its own DB the first time it is needed.
+typedef struct {
+	char			name[DEPOT_NAME_LEN];
+	char			path[DEPOT_PATH_LEN];
+	db_t			db;
+	bool			loaded;
+	// The DB generation last read from or written to the file
+	uint64_t		saved_gen;
+} depot_t;
+
+// A directory of depot files, used as shards of one fleet. Every regular file in it is a depot,
+// apart from hidden files and the sidecars other parts of the program keep next to a DB. Opening
+// the set only lists the files: depots are loaded on demand, several at a time in parallel.
+typedef struct {
+	char			dir[DEPOT_PATH_LEN];
+	depot_t			*depots;
+	size_t			count;
+} depot_set_t;
+
+bool
+depots_open(depot_set_t *set, const char *dir);
+
+void
+depots_close(depot_set_t *set);
+
+depot_t *
+depots_get(const depot_set_t *set, const char *name);
+
+// Loads the depots in the list that aren't loaded yet, one thread per depot up to the number of
+// CPUs. With a NULL list, loads all of them. Returns false if a file could not be read: that depot
+// is left unloaded, so it is skipped by views and by write-back, and tried again by the next load.
+bool
+depots_load(depot_set_t *set, depot_t **list, size_t count);
+
+size_t
+depots_vehicle_count(const depot_set_t *set);
+
+// Writes back the depots that changed since they were loaded, and only those. Returns how many
+// were written, or -1 if one of them could not be.
+ssize_t
+depots_write_changed(depot_set_t *set);
+
+typedef struct {
+	veh_t			*veh;
+	depot_t			*depot;
+} depot_row_t;
+
+typedef struct {
+	veh_t *const		*list;
+	size_t			pos;
+	size_t			count;
+	depot_t			*depot;
+} depot_cursor_t;
+
+// A k-way merge of per-depot lists that are each sorted on the same key. Rows with equal keys come
+// out in depot order.
+typedef struct {
+	veh_sort_t		key;
+	depot_cursor_t		*cursors;
+	size_t			num_cursors;
+	size_t			*heap;
+	size_t			heap_len;
+} depot_iter_t;
+
+void
+depot_iter_init(depot_iter_t *iter, veh_sort_t key, size_t cap);
+
+// Adds a depot's list to the merge. Lists must be added in depot order, before iterating.
+void
+depot_iter_add(depot_iter_t *iter, depot_t *depot, veh_t *const *list, size_t count);
+
+// Sets up the iterator to merge the sorted order of every loaded depot.
+void
+depot_iter_sorted(depot_iter_t *iter, depot_set_t *set, veh_sort_t key);
+
+bool
+depot_iter_next(depot_iter_t *iter, depot_row_t *row);
+
+void
+depot_iter_fini(depot_iter_t *iter);
+
+#endif /* ifndef _DEPOT_H_ */
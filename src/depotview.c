@@ -0,0 +1,262 @@
+/*===--------------------------------------------------------------------------------------------===
+ * depotview.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "ui.h"
+#include "views.h"
+#include "query.h"
+#include "mem.h"
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEPOT_WIDTH	(12)
+#define ID_WIDTH	(12)
+#define CLASS_WIDTH	(12)
+#define TYPE_WIDTH	(12)
+
+typedef struct {
+	depot_set_t	*set;
+	int		offset;
+	int		sel;
+	veh_sort_t	sort;
+
+	depot_row_t	*rows;
+	int		num_rows;
+
+	query_t		*filter;
+	char		filter_src[FIELD_CAP];
+	uint8_t		**match;
+} depotview_t;
+
+// Rows come out of a k-way merge of each depot's own sorted order, so changing the sort key or
+// editing one depot never re-sorts the whole fleet.
+static void
+update_rows(depotview_t *view) {
+	mem_op_t op = mem_op_begin(MEM_OP_VIEW);
+	depot_set_t *set = view->set;
+	size_t total = depots_vehicle_count(set);
+	view->rows = mem_realloc(view->rows, MAX(total, 1) * sizeof(*view->rows));
+	view->num_rows = 0;
+
+	if(view->filter) {
+		for(size_t i = 0; i < set->count; ++i) {
+			if(!set->depots[i].loaded) continue;
+			db_t *db = &set->depots[i].db;
+			view->match[i] = mem_realloc(view->match[i], MAX(stock_db_get_count(db), 1));
+			query_mark(view->filter, db, view->match[i]);
+		}
+	}
+
+	depot_iter_t iter;
+	depot_row_t row;
+	depot_iter_sorted(&iter, set, view->sort);
+	while(depot_iter_next(&iter, &row)) {
+		if(view->filter && !view->match[row.depot - set->depots][row.veh->slot]) continue;
+		view->rows[view->num_rows++] = row;
+	}
+	depot_iter_fini(&iter);
+	mem_op_end(op);
+}
+
+static void
+select_row(depotview_t *view, const depot_t *depot, veh_num_t num) {
+	view->sel = 0;
+	for(int i = 0; i < view->num_rows; ++i) {
+		if(view->rows[i].depot != depot || view->rows[i].veh->num != num) continue;
+		view->sel = i;
+		break;
+	}
+}
+
+static void
+depotview_draw(depotview_t *view) {
+	int w, h;
+	hexes_get_size(&w, &h);
+	int desc_width = w - (14 + DEPOT_WIDTH + ID_WIDTH + CLASS_WIDTH + TYPE_WIDTH);
+
+	int rows = MAX(1, h-2);
+	if(view->sel < view->offset)
+		view->offset = view->sel;
+	if(view->sel >= view->offset + rows)
+		view->offset = view->sel - rows + 1;
+	view->offset = MAX(0, view->offset);
+
+	hexes_clear_screen();
+	if(view->filter)
+		ui_title(" Rolling Stock Database - %zu depots (by %s) - %d matching %s",
+			 view->set->count, stock_sort_name(view->sort), view->num_rows, view->filter_src);
+	else
+		ui_title(" Rolling Stock Database - %zu depots (by %s) - %d vehicles",
+			 view->set->count, stock_sort_name(view->sort), view->num_rows);
+
+	for(int i = 0; i < h-2; ++i) {
+		hexes_cursor_go(0, i+1);
+		int idx = i + view->offset;
+		if(idx == view->sel)
+			term_reverse(stdout);
+
+		if(idx < view->num_rows) {
+			const depot_row_t *row = &view->rows[idx];
+			const veh_t *veh = row->veh;
+			char depot[UI_CELL_CAP], class[UI_CELL_CAP], desc[UI_CELL_CAP];
+			ui_line("| %s |%c %s | %*" VEH_NUM_FMT " | %-*s | %s |",
+				ui_cell(depot, row->depot->name, -1, DEPOT_WIDTH),
+				veh->in_use ? '*' : ' ',
+				ui_cell(class, veh->class, dict_width(veh->class), CLASS_WIDTH),
+				ID_WIDTH, veh->num,
+				TYPE_WIDTH, stock_type_name(veh->type),
+				ui_cell(desc, veh->desc, dict_width(veh->desc), desc_width));
+		} else {
+			ui_line("| %-*s |  %-*s | %-*s | %-*s | %-*s |",
+				DEPOT_WIDTH, "",
+				CLASS_WIDTH, "",
+				ID_WIDTH, "",
+				TYPE_WIDTH, "",
+				desc_width, "");
+		}
+		term_style_reset(stdout);
+	}
+	ui_prompt(" [Q]uit    [Return] open depot    s[O]rt    [/] filter    [Left/Right] page");
+}
+
+static void
+edit_filter(depotview_t *view) {
+	ui_field_t field = {.kind = UI_FIELD_EXPR, .cap = FIELD_CAP - 1};
+	strncpy(field.txt, view->filter_src, FIELD_CAP - 1);
+	field.len = field.cur = (int)strlen(field.txt);
+	char err[64] = "";
+
+	for(;;) {
+		depotview_draw(view);
+		char label[96];
+		if(err[0])
+			snprintf(label, sizeof(label), " filter (%s): ", err);
+		else
+			snprintf(label, sizeof(label), " filter: ");
+		ui_prompt_field(label, &field);
+
+		int c = hexes_get_key();
+		if(ui_field_input(&field, c))
+			continue;
+		if(c == KEY_ESC || c == KEY_CTRL_C)
+			break;
+		if(c != KEY_RETURN)
+			continue;
+
+		query_t *filter = NULL;
+		if(field.txt[0] && !(filter = query_compile(field.txt, err, sizeof(err))))
+			continue;
+		query_free(view->filter);
+		view->filter = filter;
+		strncpy(view->filter_src, field.txt, FIELD_CAP);
+		update_rows(view);
+		view->sel = 0;
+		break;
+	}
+	hexes_show_cursor(false);
+}
+
+// Edits go through the full single-DB view, on the depot the selected vehicle lives in.
+static void
+open_depot(depotview_t *view, depot_t *depot) {
+	char consists_path[DEPOT_PATH_LEN + 16];
+	snprintf(consists_path, sizeof(consists_path), "%s.consists", depot->path);
+	consists_t consists;
+	consists_init(&consists, &depot->db);
+	consists_load_from_path(&consists, consists_path);
+
+	char attrs_path[DEPOT_PATH_LEN + 16];
+	snprintf(attrs_path, sizeof(attrs_path), "%s.attrs", depot->path);
+	attr_table_t attrs;
+	attrs_init(&attrs);
+	attrs_load_from_path(&attrs, attrs_path);
+
+	show_dbview(&depot->db, &consists, &attrs);
+
+	if(consists.dirty)
+		consists_write_to_path(&consists, consists_path);
+	consists_fini(&consists);
+	attrs_fini(&attrs);
+	update_rows(view);
+}
+
+static bool
+depotview_update(depotview_t *view) {
+	int w, h;
+	hexes_get_size(&w, &h);
+	int page = MAX(1, h-2);
+
+	depot_row_t *row = view->sel < view->num_rows ? &view->rows[view->sel] : NULL;
+	switch(ui_get_key()) {
+	case KEY_CTRL_C:
+	case KEY_CTRL_D:
+	case KEY_CTRL_Q:
+	case 'q':
+	case 'Q':
+		return false;
+	case KEY_RETURN:
+		if(row) {
+			depot_t *depot = row->depot;
+			veh_num_t num = row->veh->num;
+			open_depot(view, depot);
+			select_row(view, depot, num);
+		}
+		break;
+	case 'o':
+	case 'O':
+		view->sort = (view->sort + 1) % VEH_SORT_COUNT;
+		if(row) {
+			depot_t *depot = row->depot;
+			veh_num_t num = row->veh->num;
+			update_rows(view);
+			select_row(view, depot, num);
+		} else {
+			update_rows(view);
+		}
+		break;
+	case '/':
+		edit_filter(view);
+		break;
+	case KEY_ARROW_DOWN:
+		view->sel = MIN(view->num_rows-1, view->sel+1);
+		break;
+	case KEY_ARROW_UP:
+		view->sel = MAX(0, view->sel-1);
+		break;
+	case KEY_ARROW_RIGHT:
+		view->sel = MIN(view->num_rows-1, view->sel+page);
+		break;
+	case KEY_ARROW_LEFT:
+		view->sel = MAX(0, view->sel-page);
+		break;
+	default:
+		break;
+	}
+	view->sel = MAX(0, view->sel);
+	return true;
+}
+
+void
+show_depotview(depot_set_t *set) {
+	depotview_t view = {
+		.set = set,
+		.sort = VEH_SORT_NUM,
+		.match = safe_calloc(MAX(set->count, 1), sizeof(uint8_t *)),
+	};
+	update_rows(&view);
+	do {
+		depotview_draw(&view);
+	} while(depotview_update(&view));
+
+	for(size_t i = 0; i < set->count; ++i)
+		free(view.match[i]);
+	free(view.match);
+	free(view.rows);
+	query_free(view.filter);
+}
@@ -0,0 +1,140 @@
+/*===--------------------------------------------------------------------------------------------===
+ * dict.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "dict.h"
+#include "mem.h"
+#include "utf8.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int64_t
+str_hash(const char *str, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < len; ++i)
+		h = (h ^ (uint8_t)str[i]) * 0x100000001b3ull;
+	return (int64_t)h;
+}
+
+static dict_str_t *
+entry_of(const char *str) {
+	return (dict_str_t *)(str - offsetof(dict_str_t, text));
+}
+
+void
+dict_init(dict_t *dict) {
+	ASSERT(dict != NULL);
+	hash_init(&dict->map);
+	dict->count = 0;
+	dict->bytes = 0;
+}
+
+void
+dict_fini(dict_t *dict) {
+	ASSERT(dict != NULL);
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&dict->map, &iter)) != NULL) {
+		dict_str_t *str = entry->value;
+		while(str) {
+			dict_str_t *next = str->next;
+			free(str);
+			str = next;
+		}
+	}
+	hash_fini(&dict->map);
+	dict->count = 0;
+	dict->bytes = 0;
+}
+
+const char *
+dict_intern(dict_t *dict, const char *str, size_t max_len) {
+	ASSERT(dict != NULL);
+	ASSERT(str != NULL);
+	
+	size_t len = utf8_clip(str, MIN(max_len, UINT16_MAX));
+	int64_t hash = str_hash(str, len);
+	dict_str_t *head = hash_get(&dict->map, hash);
+	for(dict_str_t *it = head; it; it = it->next) {
+		if(it->len == len && !memcmp(it->text, str, len)) {
+			it->refs += 1;
+			return it->text;
+		}
+	}
+	
+	size_t size = sizeof(dict_str_t) + len + 1;
+	dict_str_t *it = mem_calloc(1, size);
+	dict_str_init(it, str, len);
+	it->refs = 1;
+	it->next = head;
+	hash_put(&dict->map, hash, it);
+	dict->count += 1;
+	dict->bytes += size;
+	return it->text;
+}
+
+size_t
+dict_slack(const dict_t *dict) {
+	ASSERT(dict != NULL);
+	size_t slack = 0;
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&dict->map, &iter)) != NULL) {
+		for(const dict_str_t *str = entry->value; str; str = str->next) {
+			size_t size = sizeof(dict_str_t) + str->len + 1;
+			slack += mem_block_size(str, size) - size;
+		}
+	}
+	return slack;
+}
+
+const char *
+dict_str_init(void *mem, const char *str, size_t len) {
+	ASSERT(mem != NULL);
+	ASSERT(str != NULL);
+	ASSERT(len <= UINT16_MAX);
+	
+	dict_str_t *it = mem;
+	it->next = NULL;
+	it->refs = 0;
+	it->len = (uint16_t)len;
+	it->width = (uint16_t)utf8_width(str, len);
+	memcpy(it->text, str, len);
+	it->text[len] = '\0';
+	return it->text;
+}
+
+void
+dict_release(dict_t *dict, const char *str) {
+	ASSERT(dict != NULL);
+	ASSERT(str != NULL);
+	
+	dict_str_t *it = entry_of(str);
+	ASSERT(it->refs > 0);
+	if(--it->refs)
+		return;
+	
+	int64_t hash = str_hash(it->text, it->len);
+	dict_str_t *head = hash_get(&dict->map, hash);
+	if(head == it) {
+		if(it->next)
+			hash_put(&dict->map, hash, it->next);
+		else
+			hash_remove(&dict->map, hash);
+	} else {
+		dict_str_t *prev = head;
+		while(prev->next != it)
+			prev = prev->next;
+		prev->next = it->next;
+	}
+	dict->count -= 1;
+	dict->bytes -= sizeof(dict_str_t) + it->len + 1;
+	free(it);
+}
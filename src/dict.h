@@ -0,0 +1,71 @@
+/*===--------------------------------------------------------------------------------------------===
+ * dict.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _DICT_H_
+#define _DICT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hash.h"
+
+// A reference-counted set of interned strings. Every distinct string is stored once, however many
+// records use it, and two interned strings are equal exactly when their pointers are.
+typedef struct dict_str_s {
+	struct dict_str_s	*next;	// the next string with the same hash
+	uint32_t		refs;
+	uint16_t		len;
+	uint16_t		width;	// in terminal columns, see utf8.h
+	char			text[];
+} dict_str_t;
+
+typedef struct {
+	hash_map_t	map;	// string hash -> first dict_str_t with that hash
+	size_t		count;
+	size_t		bytes;	// strings and their headers, as requested from the allocator
+} dict_t;
+
+void
+dict_init(dict_t *dict);
+
+void
+dict_fini(dict_t *dict);
+
+// Returns the dictionary's copy of the first `max_len` bytes of `str`, and takes a reference to it.
+// A sequence cut by `max_len` is dropped whole.
+const char *
+dict_intern(dict_t *dict, const char *str, size_t max_len);
+
+// Drops a reference taken by dict_intern(). The string is freed with its last reference.
+void
+dict_release(dict_t *dict, const char *str);
+
+// How much more than `bytes` the allocator handed out for the strings, by rounding up each block.
+size_t
+dict_slack(const dict_t *dict);
+
+// Lays out `len` bytes of `str` in `mem` the way the dictionary stores them, without adding them to
+// any dictionary, and returns the text. `mem` must hold dict_str_size(len) bytes.
+const char *
+dict_str_init(void *mem, const char *str, size_t len);
+
+static inline size_t
+dict_str_size(size_t len) {
+	size_t align = _Alignof(dict_str_t);
+	return (sizeof(dict_str_t) + len + 1 + align - 1) & ~(align - 1);
+}
+
+// The display width of text returned by dict_intern() or dict_str_init(), measured when it was
+// stored.
+static inline int
+dict_width(const char *str) {
+	return ((const dict_str_t *)(str - offsetof(dict_str_t, text)))->width;
+}
+
+#endif /* ifndef _DICT_H_ */
@@ -0,0 +1,236 @@
+/*===--------------------------------------------------------------------------------------------===
+ * diff.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "diff.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+patch_init(patch_t *patch) {
+	ASSERT(patch != NULL);
+	memset(patch, 0, sizeof(*patch));
+}
+
+void
+patch_fini(patch_t *patch) {
+	ASSERT(patch != NULL);
+	free(patch->entries);
+	memset(patch, 0, sizeof(*patch));
+}
+
+static void
+patch_push(patch_t *patch, patch_op_t op, const veh_t *veh) {
+	if(patch->count == patch->cap) {
+		patch->cap = patch->cap ? patch->cap * 2 : 64;
+		patch->entries = safe_realloc(patch->entries, patch->cap * sizeof(*patch->entries));
+	}
+	patch_entry_t *entry = &patch->entries[patch->count++];
+	memset(entry, 0, sizeof(*entry));
+	entry->op = op;
+	entry->num = veh->num;
+	if(op == PATCH_DELETE)
+		return;
+	entry->in_use = veh->in_use;
+	strncpy(entry->class, veh->class, sizeof(entry->class) - 1);
+	strncpy(entry->desc, veh->desc, sizeof(entry->desc) - 1);
+}
+
+static bool
+veh_same(const veh_t *a, const veh_t *b) {
+	return a->in_use == b->in_use && !strcmp(a->class, b->class) && !strcmp(a->desc, b->desc);
+}
+
+static veh_t *
+first_in_block(const db_t *db, int64_t block) {
+	veh_t search = {.num = block * ((int64_t)1 << STOCK_DIGEST_SHIFT)};
+	avl_index_t where;
+	veh_t *veh = avl_find(&db->tree, &search, &where);
+	return veh ? veh : avl_nearest(&db->tree, where, AVL_AFTER);
+}
+
+// Merges the two DBs' records in one block of running numbers.
+static void
+diff_block(const db_t *from, const db_t *to, int64_t block, patch_t *patch) {
+	const veh_t *a = first_in_block(from, block);
+	const veh_t *b = first_in_block(to, block);
+
+	for(;;) {
+		if(a && (a->num >> STOCK_DIGEST_SHIFT) != block)
+			a = NULL;
+		if(b && (b->num >> STOCK_DIGEST_SHIFT) != block)
+			b = NULL;
+		if(!a && !b)
+			break;
+
+		if(!b || (a && a->num < b->num)) {
+			patch_push(patch, PATCH_DELETE, a);
+			a = AVL_NEXT(&from->tree, a);
+		} else if(!a || b->num < a->num) {
+			patch_push(patch, PATCH_ADD, b);
+			b = AVL_NEXT(&to->tree, b);
+		} else {
+			if(!veh_same(a, b))
+				patch_push(patch, PATCH_UPDATE, b);
+			a = AVL_NEXT(&from->tree, a);
+			b = AVL_NEXT(&to->tree, b);
+		}
+	}
+}
+
+static bool
+digest_same(const stock_digest_t *a, const stock_digest_t *b) {
+	return a && b && a->hash == b->hash && a->count == b->count;
+}
+
+// Compares the children of a block that differs, and descends into the ones that differ too.
+static void
+diff_node(const db_t *from, const db_t *to, int level, int64_t block, patch_t *patch) {
+	if(level == 0) {
+		diff_block(from, to, block, patch);
+		return;
+	}
+
+	const int64_t fanout = (int64_t)1 << STOCK_DIGEST_SHIFT;
+	for(int64_t i = 0; i < fanout; ++i) {
+		int64_t child = block * fanout + i;
+		const stock_digest_t *a = hash_get(&from->digests[level-1], child);
+		const stock_digest_t *b = hash_get(&to->digests[level-1], child);
+		if((a || b) && !digest_same(a, b))
+			diff_node(from, to, level - 1, child, patch);
+	}
+}
+
+static int
+entry_cmp(const void *a, const void *b) {
+	veh_num_t lhs = ((const patch_entry_t *)a)->num;
+	veh_num_t rhs = ((const patch_entry_t *)b)->num;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+void
+stock_diff(const db_t *from, const db_t *to, patch_t *patch) {
+	ASSERT(from != NULL);
+	ASSERT(to != NULL);
+	ASSERT(patch != NULL);
+
+	const int top = STOCK_DIGEST_LEVELS - 1;
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&from->digests[top], &iter)) != NULL) {
+		if(!digest_same(entry->value, hash_get(&to->digests[top], entry->key)))
+			diff_node(from, to, top, entry->key, patch);
+	}
+
+	// Blocks that only exist on the other side are all additions
+	iter = 0;
+	while((entry = hash_next(&to->digests[top], &iter)) != NULL) {
+		if(!hash_get(&from->digests[top], entry->key))
+			diff_node(from, to, top, entry->key, patch);
+	}
+
+	// Blocks came out in hash order, but a running number is only ever in one of them
+	if(patch->count)
+		qsort(patch->entries, patch->count, sizeof(*patch->entries), entry_cmp);
+}
+
+size_t
+stock_patch_apply(db_t *db, const patch_t *patch) {
+	ASSERT(db != NULL);
+	ASSERT(patch != NULL);
+
+	size_t applied = 0;
+	for(size_t i = 0; i < patch->count; ++i) {
+		const patch_entry_t *entry = &patch->entries[i];
+		veh_t *veh = stock_db_get(db, entry->num);
+		veh_t data = {
+			.num = entry->num,
+			.in_use = entry->in_use,
+			.class = entry->class,
+			.desc = entry->desc,
+		};
+
+		switch(entry->op) {
+		case PATCH_ADD:
+			if(veh) continue;
+			stock_db_add(db, &data);
+			break;
+		case PATCH_UPDATE:
+			if(!veh) continue;
+			if(strcmp(veh->class, entry->class) || strcmp(veh->desc, entry->desc))
+				stock_db_update(db, veh, &data);
+			if(veh->in_use != entry->in_use)
+				stock_db_set_in_use(db, veh, entry->in_use);
+			break;
+		case PATCH_DELETE:
+			if(!veh) continue;
+			stock_db_delete(db, veh);
+			break;
+		}
+		applied += 1;
+	}
+	return applied;
+}
+
+bool
+patch_write_to_file(FILE *f, const patch_t *patch) {
+	ASSERT(f != NULL);
+	ASSERT(patch != NULL);
+
+	for(size_t i = 0; i < patch->count; ++i) {
+		const patch_entry_t *entry = &patch->entries[i];
+		if(entry->op == PATCH_DELETE) {
+			fprintf(f, "- %" VEH_NUM_FMT "\n", entry->num);
+			continue;
+		}
+		fprintf(f, "%c %c,%" VEH_NUM_FMT ", %s, %s\n",
+			entry->op == PATCH_ADD ? '+' : '~',
+			entry->in_use ? 'x' : '-',
+			entry->num,
+			entry->class,
+			entry->desc);
+	}
+	return !ferror(f);
+}
+
+bool
+patch_read_from_file(FILE *f, patch_t *patch) {
+	ASSERT(f != NULL);
+	ASSERT(patch != NULL);
+
+	char *line = NULL;
+	size_t cap = 0;
+	bool ok = true;
+	while(ok && getline(&line, &cap, f) > 0) {
+		str_trim_space(line);
+		if(!line[0] || line[0] == '#')
+			continue;
+
+		if(line[0] == '-' && line[1] == ' ') {
+			veh_t veh = {.num = strtoll(line + 2, NULL, 10)};
+			patch_push(patch, PATCH_DELETE, &veh);
+			continue;
+		}
+		if((line[0] != '+' && line[0] != '~') || line[1] != ' ') {
+			ok = false;
+			break;
+		}
+
+		veh_t *veh = stock_parse_line(line + 2);
+		if(!veh) {
+			ok = false;
+			break;
+		}
+		patch_push(patch, line[0] == '+' ? PATCH_ADD : PATCH_UPDATE, veh);
+		free(veh);
+	}
+	free(line);
+	return ok;
+}
@@ -0,0 +1,62 @@
+/*===--------------------------------------------------------------------------------------------===
+ * diff.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+#include "stock.h"
+
+typedef enum {
+	PATCH_ADD,
+	PATCH_UPDATE,
+	PATCH_DELETE,
+} patch_op_t;
+
+// For additions and updates, the entry holds the new num, in_use, class and desc. Deletions only
+// use the running number.
+typedef struct {
+	patch_op_t	op;
+	veh_num_t	num;
+	bool		in_use;
+	char		class[MAX_CLASS_LEN];
+	char		desc[MAX_DESC_LEN];
+} patch_entry_t;
+
+typedef struct {
+	patch_entry_t	*entries;
+	size_t		count;
+	size_t		cap;
+} patch_t;
+
+void
+patch_init(patch_t *patch);
+
+void
+patch_fini(patch_t *patch);
+
+// Fills `patch` with the changes that turn `from` into `to`, in running-number order. Blocks of
+// running numbers whose digests match in both DBs are skipped without looking at their records.
+void
+stock_diff(const db_t *from, const db_t *to, patch_t *patch);
+
+// Applies a patch through the usual stock_db_* calls, so observers see every change. Entries that
+// don't fit the DB (adding a number that is taken, updating or deleting one that isn't) are
+// skipped. Returns the number of entries applied.
+size_t
+stock_patch_apply(db_t *db, const patch_t *patch);
+
+// Patches are written one entry per line: "+ " or "~ " followed by a DB file row for additions and
+// updates, and "- <num>" for deletions.
+bool
+patch_write_to_file(FILE *f, const patch_t *patch);
+
+bool
+patch_read_from_file(FILE *f, patch_t *patch);
+
+#endif /* ifndef _DIFF_H_ */
@@ -0,0 +1,177 @@
+/*===--------------------------------------------------------------------------------------------===
+ * fuzzy.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "fuzzy.h"
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Below this many records, starting threads costs more than the search itself.
+#define PARALLEL_MIN	(4096)
+#define MAX_THREADS	(16)
+#define NO_MATCH	(UINT8_MAX)
+
+typedef struct {
+	uint64_t	peq[256];	// bit i is set when pattern[i] matches the character
+	int		len;
+	uint64_t	last;		// bit of the last pattern character
+} pattern_t;
+
+typedef struct {
+	const pattern_t	*pat;
+	const stock_cols_t *cols;
+	int		max_dist;
+	size_t		begin;
+	size_t		end;
+	uint8_t		*dist;
+} job_t;
+
+static void
+pattern_init(pattern_t *pat, const char *str) {
+	memset(pat, 0, sizeof(*pat));
+	pat->len = (int)MIN(strlen(str), FUZZY_MAX_LEN);
+	for(int i = 0; i < pat->len; ++i) {
+		unsigned char c = (unsigned char)str[i];
+		pat->peq[tolower(c)] |= 1ull << i;
+		pat->peq[toupper(c)] |= 1ull << i;
+	}
+	pat->last = pat->len ? 1ull << (pat->len - 1) : 0;
+}
+
+// Smallest edit distance between the pattern and any substring of `text`. The top row of the table
+// stays at zero, so a match may start anywhere in the text. Returns NO_MATCH when that is more than
+// `max_dist`.
+static int
+pattern_dist(const pattern_t *pat, const char *text, int max_dist) {
+	uint64_t pv = ~0ull;
+	uint64_t mv = 0;
+	int score = pat->len;
+	int best = score;
+
+	for(const unsigned char *c = (const unsigned char *)text; *c && best; ++c) {
+		uint64_t eq = pat->peq[*c];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+
+		if(ph & pat->last)
+			score += 1;
+		else if(mh & pat->last)
+			score -= 1;
+
+		ph <<= 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+		best = MIN(best, score);
+	}
+	return best <= max_dist ? best : NO_MATCH;
+}
+
+static void *
+run_job(void *ctx) {
+	job_t *job = ctx;
+	const stock_cols_t *cols = job->cols;
+
+	for(size_t i = job->begin; i < job->end; ++i) {
+		const veh_t *veh = cols->rec[i];
+		int dist = pattern_dist(job->pat, veh->class, job->max_dist);
+		if(dist)
+			dist = MIN(dist, pattern_dist(job->pat, veh->desc, job->max_dist));
+		job->dist[i] = (uint8_t)dist;
+	}
+	return NULL;
+}
+
+static int
+num_workers(size_t count) {
+	if(count < PARALLEL_MIN)
+		return 1;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = (int)MIN(MAX(cpus, 1), MAX_THREADS);
+	return (int)MIN((size_t)workers, count / (PARALLEL_MIN / 2));
+}
+
+static int
+hit_cmp(const void *a, const void *b) {
+	const fuzzy_hit_t *lhs = a;
+	const fuzzy_hit_t *rhs = b;
+	if(lhs->dist != rhs->dist)
+		return lhs->dist - rhs->dist;
+	return (lhs->veh->num > rhs->veh->num) - (lhs->veh->num < rhs->veh->num);
+}
+
+int
+fuzzy_default_dist(const char *pattern) {
+	ASSERT(pattern != NULL);
+	return (int)MIN(strlen(pattern), FUZZY_MAX_LEN) / 3;
+}
+
+size_t
+fuzzy_search(const db_t *db, const char *pattern, int max_dist, fuzzy_hit_t **hits) {
+	ASSERT(db != NULL);
+	ASSERT(pattern != NULL);
+	ASSERT(hits != NULL);
+
+	pattern_t pat;
+	pattern_init(&pat, pattern);
+	max_dist = MAX(0, MIN(max_dist, pat.len));
+
+	const stock_cols_t *cols = &db->cols;
+	uint8_t *dist = mem_calloc(MAX(cols->count, 1), 1);
+
+	// Each worker takes a contiguous run of slots and writes only its own part of `dist`
+	job_t jobs[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int workers = num_workers(cols->count);
+	size_t chunk = (cols->count + workers - 1) / workers;
+
+	for(int i = 0; i < workers; ++i) {
+		jobs[i] = (job_t){
+			.pat = &pat,
+			.cols = cols,
+			.max_dist = max_dist,
+			.begin = MIN(cols->count, i * chunk),
+			.end = MIN(cols->count, (i + 1) * chunk),
+			.dist = dist,
+		};
+	}
+	int started = 1;
+	for(; started < workers; ++started) {
+		if(pthread_create(&threads[started], NULL, run_job, &jobs[started]))
+			break;
+	}
+	run_job(&jobs[0]);
+	for(int i = 1; i < started; ++i)
+		pthread_join(threads[i], NULL);
+	// Anything a thread could not be started for is picked up here
+	for(int i = started; i < workers; ++i)
+		run_job(&jobs[i]);
+
+	size_t count = 0;
+	for(size_t i = 0; i < cols->count; ++i)
+		count += dist[i] != NO_MATCH;
+
+	*hits = mem_calloc(MAX(count, 1), sizeof(fuzzy_hit_t));
+	size_t j = 0;
+	for(size_t i = 0; i < cols->count; ++i) {
+		if(dist[i] == NO_MATCH) continue;
+		(*hits)[j++] = (fuzzy_hit_t){.veh = cols->rec[i], .dist = dist[i]};
+	}
+	free(dist);
+
+	qsort(*hits, count, sizeof(fuzzy_hit_t), hit_cmp);
+	return count;
+}
@@ -0,0 +1,36 @@
+/*===--------------------------------------------------------------------------------------------===
+ * fuzzy.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _FUZZY_H_
+#define _FUZZY_H_
+
+#include "stock.h"
+
+// Patterns longer than a machine word are cut down to this many characters.
+#define FUZZY_MAX_LEN	(64)
+
+// Approximate search over vehicle descriptions and classes. A vehicle matches when some part of
+// its desc or class is within `max_dist` edits (insertions, deletions, substitutions) of the
+// pattern, ignoring case. Matching uses the Myers/Hyyro bit-parallel algorithm, which advances a
+// whole column of the edit-distance table per text character.
+typedef struct {
+	veh_t		*veh;
+	int		dist;
+} fuzzy_hit_t;
+
+// The distance budget used when the caller doesn't pick one: about one typo per three characters.
+int
+fuzzy_default_dist(const char *pattern);
+
+// Returns a newly allocated list of hits, closest first and by running number within the same
+// distance. Large DBs are split across worker threads.
+size_t
+fuzzy_search(const db_t *db, const char *pattern, int max_dist, fuzzy_hit_t **hits);
+
+#endif /* ifndef _FUZZY_H_ */
@@ -0,0 +1,171 @@
+/*===--------------------------------------------------------------------------------------------===
+ * hash.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "hash.h"
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CAP		(64)
+#define MAX_DIST	(255)
+
+// Running numbers are dense and sequential, so they have to be mixed before masking
+static inline size_t
+hash_slot(const hash_map_t *map, int64_t key) {
+	uint64_t x = (uint64_t)key;
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return (size_t)x & (map->cap - 1);
+}
+
+void
+hash_init(hash_map_t *map) {
+	ASSERT(map != NULL);
+	memset(map, 0, sizeof(*map));
+}
+
+void
+hash_fini(hash_map_t *map) {
+	ASSERT(map != NULL);
+	free(map->entries);
+	free(map->dist);
+	memset(map, 0, sizeof(*map));
+}
+
+static void hash_resize(hash_map_t *map, size_t cap);
+
+static void
+hash_insert(hash_map_t *map, int64_t key, void *value) {
+	hash_entry_t entry = {key, value};
+	size_t mask = map->cap - 1;
+	size_t slot = hash_slot(map, key);
+	unsigned dist = 1;
+	
+	for(;;) {
+		if(!map->dist[slot]) {
+			map->entries[slot] = entry;
+			map->dist[slot] = dist;
+			map->count += 1;
+			return;
+		}
+		if(map->entries[slot].key == entry.key) {
+			map->entries[slot].value = entry.value;
+			return;
+		}
+		if(map->dist[slot] < dist) {
+			hash_entry_t tmp_entry = map->entries[slot];
+			unsigned tmp_dist = map->dist[slot];
+			map->entries[slot] = entry;
+			map->dist[slot] = dist;
+			entry = tmp_entry;
+			dist = tmp_dist;
+		}
+		slot = (slot + 1) & mask;
+		dist += 1;
+		
+		// Only reachable with a pathological key set: grow and start over with the evicted entry
+		if(dist >= MAX_DIST) {
+			hash_resize(map, map->cap * 2);
+			hash_insert(map, entry.key, entry.value);
+			return;
+		}
+	}
+}
+
+static void
+hash_resize(hash_map_t *map, size_t cap) {
+	hash_entry_t *old_entries = map->entries;
+	uint8_t *old_dist = map->dist;
+	size_t old_cap = map->cap;
+	
+	map->cap = cap;
+	map->count = 0;
+	map->entries = mem_calloc(cap, sizeof(*map->entries));
+	map->dist = mem_calloc(cap, sizeof(*map->dist));
+	
+	for(size_t i = 0; i < old_cap; ++i) {
+		if(old_dist[i])
+			hash_insert(map, old_entries[i].key, old_entries[i].value);
+	}
+	free(old_entries);
+	free(old_dist);
+}
+
+static size_t
+hash_find(const hash_map_t *map, int64_t key) {
+	if(!map->count)
+		return SIZE_MAX;
+	
+	size_t mask = map->cap - 1;
+	size_t slot = hash_slot(map, key);
+	
+	// An entry closer to home than we are means the key would have displaced it: it isn't here
+	for(unsigned dist = 1; map->dist[slot] >= dist; ++dist) {
+		if(map->entries[slot].key == key)
+			return slot;
+		slot = (slot + 1) & mask;
+	}
+	return SIZE_MAX;
+}
+
+void *
+hash_get(const hash_map_t *map, int64_t key) {
+	ASSERT(map != NULL);
+	size_t slot = hash_find(map, key);
+	return slot == SIZE_MAX ? NULL : map->entries[slot].value;
+}
+
+void
+hash_put(hash_map_t *map, int64_t key, void *value) {
+	ASSERT(map != NULL);
+	if((map->count + 1) * 8 > map->cap * 7)
+		hash_resize(map, MAX(MIN_CAP, map->cap * 2));
+	hash_insert(map, key, value);
+}
+
+void *
+hash_remove(hash_map_t *map, int64_t key) {
+	ASSERT(map != NULL);
+	size_t slot = hash_find(map, key);
+	if(slot == SIZE_MAX)
+		return NULL;
+	
+	void *value = map->entries[slot].value;
+	size_t mask = map->cap - 1;
+	size_t next = (slot + 1) & mask;
+	
+	// Backward-shift: pull every displaced entry that follows one step closer to home
+	while(map->dist[next] > 1) {
+		map->entries[slot] = map->entries[next];
+		map->dist[slot] = map->dist[next] - 1;
+		slot = next;
+		next = (next + 1) & mask;
+	}
+	map->dist[slot] = 0;
+	map->count -= 1;
+	return value;
+}
+
+const hash_entry_t *
+hash_next(const hash_map_t *map, size_t *iter) {
+	ASSERT(map != NULL);
+	ASSERT(iter != NULL);
+	
+	while(*iter < map->cap) {
+		size_t slot = (*iter)++;
+		if(map->dist[slot])
+			return &map->entries[slot];
+	}
+	return NULL;
+}
@@ -0,0 +1,54 @@
+/*===--------------------------------------------------------------------------------------------===
+ * hash.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Open-addressing hash map from 64-bit keys to pointers, using Robin Hood probing: on insert, an
+// entry that is further from its home slot takes the place of one that is closer. That keeps probe
+// sequences short and even at high load, and lets deletion shift entries back instead of leaving
+// tombstones behind.
+typedef struct {
+	int64_t		key;
+	void		*value;
+} hash_entry_t;
+
+typedef struct {
+	hash_entry_t	*entries;
+	uint8_t		*dist;		// probe distance + 1, 0 for an empty slot
+	size_t		cap;
+	size_t		count;
+} hash_map_t;
+
+void
+hash_init(hash_map_t *map);
+
+void
+hash_fini(hash_map_t *map);
+
+void *
+hash_get(const hash_map_t *map, int64_t key);
+
+// Inserts or replaces the value for `key`.
+void
+hash_put(hash_map_t *map, int64_t key, void *value);
+
+void *
+hash_remove(hash_map_t *map, int64_t key);
+
+// Walks the entries in no particular order. Start with *iter set to 0; returns NULL at the end. The
+// map must not be modified during the walk.
+const hash_entry_t *
+hash_next(const hash_map_t *map, size_t *iter);
+
+#endif /* ifndef _HASH_H_ */
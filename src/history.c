@@ -0,0 +1,739 @@
+/*===--------------------------------------------------------------------------------------------===
+ * history.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "history.h"
+#include "hash.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PART_MAGIC	(0x53484d54u)	// "TMHS"
+#define PART_VERSION	(1)
+#define BLOCK_MAGIC	(0x4b4c4248u)	// "HBLK"
+
+// A day delta, an odometer delta and a kind byte per event, at worst
+#define MAX_EVENT_SIZE	(10 + 10 + 1)
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	int64_t		year;
+} part_header_t;
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	count;
+	int64_t		num;
+	uint64_t	payload_size;
+	int64_t		first_day;
+	int64_t		last_day;
+	int64_t		first_km;
+	int64_t		last_km;
+	uint32_t	first_kind;
+	uint32_t	last_kind;
+	uint32_t	kind_count[HIST_KIND_COUNT];
+	int64_t		last_day_of[HIST_KIND_COUNT];
+	int64_t		last_km_of[HIST_KIND_COUNT];
+} block_header_t;
+
+typedef struct {
+	int64_t		year;
+	FILE		*file;
+} part_t;
+
+typedef struct {
+	part_t		*part;
+	uint64_t	offset;
+	block_header_t	hdr;
+} block_ref_t;
+
+typedef struct {
+	veh_num_t	num;
+	block_ref_t	*blocks;
+	size_t		count;
+	size_t		cap;
+
+	hist_event_t	*pending;
+	size_t		num_pending;
+	size_t		pending_cap;
+} hist_veh_t;
+
+struct history_s {
+	char		dir[1024];
+	hash_map_t	parts;
+	hash_map_t	by_veh;
+	size_t		num_pending;
+
+	uint8_t		*buf;
+	size_t		buf_cap;
+	hist_event_t	*decoded;
+};
+
+static const char *kind_names[HIST_KIND_COUNT] = {
+	[HIST_ODOMETER] = "odometer",
+	[HIST_INSPECTION] = "inspection",
+	[HIST_REPAIR] = "repair",
+	[HIST_OVERHAUL] = "overhaul",
+};
+
+const char *
+history_kind_name(hist_kind_t kind) {
+	ASSERT(kind < HIST_KIND_COUNT);
+	return kind_names[kind];
+}
+
+bool
+history_parse_kind(const char *str, hist_kind_t *kind) {
+	ASSERT(str != NULL);
+	ASSERT(kind != NULL);
+	for(int i = 0; i < HIST_KIND_COUNT; ++i) {
+		if(strcasecmp(str, kind_names[i])) continue;
+		*kind = i;
+		return true;
+	}
+	return false;
+}
+
+// MARK: - Days
+
+// Proleptic Gregorian calendar conversions, after Howard Hinnant's chrono algorithms.
+static hist_day_t
+days_from_civil(int64_t y, unsigned m, unsigned d) {
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void
+civil_from_days(hist_day_t z, int64_t *y, unsigned *m, unsigned *d) {
+	z += 719468;
+	int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static int64_t
+year_of(hist_day_t day) {
+	int64_t y;
+	unsigned m, d;
+	civil_from_days(day, &y, &m, &d);
+	return y;
+}
+
+bool
+history_parse_day(const char *str, hist_day_t *day) {
+	ASSERT(str != NULL);
+	ASSERT(day != NULL);
+
+	int y, m, d, len = 0;
+	if(sscanf(str, "%4d-%2d-%2d%n", &y, &m, &d, &len) != 3 || str[len] != '\0')
+		return false;
+	if(m < 1 || m > 12 || d < 1 || d > 31)
+		return false;
+
+	// Days past the end of the month roll over, so a round trip catches them
+	hist_day_t res = days_from_civil(y, m, d);
+	int64_t yy;
+	unsigned mm, dd;
+	civil_from_days(res, &yy, &mm, &dd);
+	if(yy != y || mm != (unsigned)m || dd != (unsigned)d)
+		return false;
+	*day = res;
+	return true;
+}
+
+void
+history_format_day(hist_day_t day, char *dest, size_t cap) {
+	ASSERT(dest != NULL);
+	int64_t y;
+	unsigned m, d;
+	civil_from_days(day, &y, &m, &d);
+	snprintf(dest, cap, "%04" PRId64 "-%02u-%02u", y, m, d);
+}
+
+// MARK: - Encoding
+
+static size_t
+put_varint(uint8_t *dest, uint64_t v) {
+	size_t n = 0;
+	while(v >= 0x80) {
+		dest[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	dest[n++] = (uint8_t)v;
+	return n;
+}
+
+static bool
+get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+	uint64_t res = 0;
+	for(int shift = 0; *p < end && shift < 64; shift += 7) {
+		uint8_t b = *(*p)++;
+		res |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)) {
+			*v = res;
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint64_t
+zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t
+unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void
+reserve_buf(history_t *history, size_t size) {
+	if(history->buf_cap >= size)
+		return;
+	history->buf_cap = MAX(size, history->buf_cap * 2);
+	history->buf = safe_realloc(history->buf, history->buf_cap);
+}
+
+// Encodes a run of events into the history's buffer, column by column, and fills in the header.
+static size_t
+encode_block(history_t *history, veh_num_t num, const hist_event_t *events, size_t count,
+	     block_header_t *hdr) {
+	ASSERT(count > 0 && count <= HIST_BLOCK_EVENTS);
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = BLOCK_MAGIC;
+	hdr->count = count;
+	hdr->num = num;
+	hdr->first_day = events[0].day;
+	hdr->first_km = events[0].km;
+	hdr->first_kind = events[0].kind;
+	hdr->last_day = events[count-1].day;
+	hdr->last_km = events[count-1].km;
+	hdr->last_kind = events[count-1].kind;
+	for(size_t i = 0; i < count; ++i) {
+		hist_kind_t kind = events[i].kind;
+		hdr->kind_count[kind] += 1;
+		hdr->last_day_of[kind] = events[i].day;
+		hdr->last_km_of[kind] = events[i].km;
+	}
+
+	reserve_buf(history, count * MAX_EVENT_SIZE);
+	uint8_t *p = history->buf;
+	for(size_t i = 1; i < count; ++i)
+		p += put_varint(p, (uint64_t)(events[i].day - events[i-1].day));
+	for(size_t i = 1; i < count; ++i)
+		p += put_varint(p, zigzag(events[i].km - events[i-1].km));
+	for(size_t i = 0; i < count; ++i)
+		*p++ = (uint8_t)events[i].kind;
+
+	hdr->payload_size = (uint64_t)(p - history->buf);
+	return hdr->payload_size;
+}
+
+// Reads and decodes one block into the history's scratch array.
+static bool
+decode_block(history_t *history, const block_ref_t *ref) {
+	const block_header_t *hdr = &ref->hdr;
+	reserve_buf(history, hdr->payload_size);
+	FILE *f = ref->part->file;
+	if(fseeko(f, (off_t)ref->offset, SEEK_SET) < 0
+	   || fread(history->buf, 1, hdr->payload_size, f) != hdr->payload_size)
+		return false;
+
+	hist_event_t *events = history->decoded;
+	const uint8_t *p = history->buf;
+	const uint8_t *end = p + hdr->payload_size;
+	uint64_t v;
+
+	events[0].day = hdr->first_day;
+	for(size_t i = 1; i < hdr->count; ++i) {
+		if(!get_varint(&p, end, &v))
+			return false;
+		events[i].day = events[i-1].day + (int64_t)v;
+	}
+	events[0].km = hdr->first_km;
+	for(size_t i = 1; i < hdr->count; ++i) {
+		if(!get_varint(&p, end, &v))
+			return false;
+		events[i].km = events[i-1].km + unzigzag(v);
+	}
+	if((size_t)(end - p) != hdr->count)
+		return false;
+	for(size_t i = 0; i < hdr->count; ++i) {
+		if(p[i] >= HIST_KIND_COUNT)
+			return false;
+		events[i].kind = p[i];
+	}
+	return true;
+}
+
+// MARK: - Partitions
+
+static void
+part_path(const history_t *history, int64_t year, char *dest, size_t cap) {
+	snprintf(dest, cap, "%s/%04" PRId64 ".hist", history->dir, year);
+}
+
+static hist_veh_t *
+get_veh(history_t *history, veh_num_t num) {
+	hist_veh_t *veh = hash_get(&history->by_veh, num);
+	if(!veh) {
+		veh = safe_calloc(1, sizeof(*veh));
+		veh->num = num;
+		hash_put(&history->by_veh, num, veh);
+	}
+	return veh;
+}
+
+static void
+push_block(hist_veh_t *veh, part_t *part, uint64_t offset, const block_header_t *hdr) {
+	if(veh->count == veh->cap) {
+		veh->cap = veh->cap ? veh->cap * 2 : 8;
+		veh->blocks = safe_realloc(veh->blocks, veh->cap * sizeof(*veh->blocks));
+	}
+	veh->blocks[veh->count++] = (block_ref_t){.part = part, .offset = offset, .hdr = *hdr};
+}
+
+static bool
+header_valid(const block_header_t *hdr) {
+	if(hdr->magic != BLOCK_MAGIC || hdr->count == 0 || hdr->count > HIST_BLOCK_EVENTS)
+		return false;
+	if(hdr->payload_size < hdr->count || hdr->payload_size > hdr->count * MAX_EVENT_SIZE)
+		return false;
+	if(hdr->first_kind >= HIST_KIND_COUNT || hdr->last_kind >= HIST_KIND_COUNT)
+		return false;
+	return hdr->first_day <= hdr->last_day;
+}
+
+// Indexes every block of a partition from its headers alone, and cuts off a torn last block.
+static bool
+scan_part(history_t *history, part_t *part) {
+	FILE *f = part->file;
+	struct stat st;
+	if(fstat(fileno(f), &st) < 0)
+		return false;
+
+	uint64_t size = (uint64_t)st.st_size;
+	uint64_t pos = sizeof(part_header_t);
+	block_header_t hdr;
+	while(pos < size) {
+		if(fseeko(f, (off_t)pos, SEEK_SET) < 0
+		   || fread(&hdr, sizeof(hdr), 1, f) != 1
+		   || !header_valid(&hdr)
+		   || pos + sizeof(hdr) + hdr.payload_size > size)
+			break;
+		push_block(get_veh(history, hdr.num), part, pos + sizeof(hdr), &hdr);
+		pos += sizeof(hdr) + hdr.payload_size;
+	}
+	if(pos < size && ftruncate(fileno(f), (off_t)pos) < 0)
+		return false;
+	return true;
+}
+
+// Opens, or with `create`, creates the file for a year.
+static part_t *
+open_part(history_t *history, int64_t year, bool create) {
+	char path[1100];
+	part_path(history, year, path, sizeof(path));
+	FILE *f = fopen(path, create ? "a+b" : "r+b");
+	if(!f)
+		return NULL;
+
+	part_header_t hdr;
+	rewind(f);
+	if(fread(&hdr, sizeof(hdr), 1, f) != 1) {
+		hdr = (part_header_t){.magic = PART_MAGIC, .version = PART_VERSION, .year = year};
+		if(!create || fseeko(f, 0, SEEK_END) < 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1
+		   || fflush(f) != 0) {
+			fclose(f);
+			return NULL;
+		}
+	}
+	if(hdr.magic != PART_MAGIC || hdr.version != PART_VERSION || hdr.year != year) {
+		fclose(f);
+		return NULL;
+	}
+
+	part_t *part = safe_calloc(1, sizeof(*part));
+	part->year = year;
+	part->file = f;
+	hash_put(&history->parts, year, part);
+	return part;
+}
+
+static int
+block_cmp(const void *a, const void *b) {
+	const block_ref_t *lhs = a;
+	const block_ref_t *rhs = b;
+	if(lhs->hdr.first_day != rhs->hdr.first_day)
+		return (lhs->hdr.first_day > rhs->hdr.first_day) - (lhs->hdr.first_day < rhs->hdr.first_day);
+	if(lhs->hdr.last_day != rhs->hdr.last_day)
+		return (lhs->hdr.last_day > rhs->hdr.last_day) - (lhs->hdr.last_day < rhs->hdr.last_day);
+	// Blocks on the same days are in the same file, in the order they were written
+	return (lhs->offset > rhs->offset) - (lhs->offset < rhs->offset);
+}
+
+// MARK: - Lifetime
+
+static void
+history_free(history_t *history) {
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&history->by_veh, &iter)) != NULL) {
+		hist_veh_t *veh = entry->value;
+		free(veh->blocks);
+		free(veh->pending);
+		free(veh);
+	}
+	iter = 0;
+	while((entry = hash_next(&history->parts, &iter)) != NULL) {
+		part_t *part = entry->value;
+		fclose(part->file);
+		free(part);
+	}
+	hash_fini(&history->by_veh);
+	hash_fini(&history->parts);
+	free(history->buf);
+	free(history->decoded);
+	free(history);
+}
+
+history_t *
+history_open(const char *dir) {
+	ASSERT(dir != NULL);
+
+	if(mkdir(dir, 0777) < 0 && errno != EEXIST)
+		return NULL;
+	DIR *d = opendir(dir);
+	if(!d)
+		return NULL;
+
+	history_t *history = safe_calloc(1, sizeof(*history));
+	snprintf(history->dir, sizeof(history->dir), "%s", dir);
+	hash_init(&history->parts);
+	hash_init(&history->by_veh);
+	history->decoded = safe_calloc(HIST_BLOCK_EVENTS, sizeof(*history->decoded));
+
+	bool ok = true;
+	struct dirent *ent;
+	while(ok && (ent = readdir(d)) != NULL) {
+		long long year;
+		int len = 0;
+		if(sscanf(ent->d_name, "%lld%n", &year, &len) != 1 || strcmp(ent->d_name + len, ".hist"))
+			continue;
+		part_t *part = open_part(history, year, false);
+		ok = part && scan_part(history, part);
+	}
+	closedir(d);
+	if(!ok) {
+		history_free(history);
+		return NULL;
+	}
+
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&history->by_veh, &iter)) != NULL) {
+		hist_veh_t *veh = entry->value;
+		qsort(veh->blocks, veh->count, sizeof(*veh->blocks), block_cmp);
+	}
+	return history;
+}
+
+bool
+history_close(history_t *history) {
+	if(!history)
+		return true;
+	bool ok = history_flush(history);
+	history_free(history);
+	return ok;
+}
+
+// MARK: - Writing
+
+static bool
+last_day(const hist_veh_t *veh, hist_day_t *day) {
+	if(veh->num_pending)
+		*day = veh->pending[veh->num_pending-1].day;
+	else if(veh->count)
+		*day = veh->blocks[veh->count-1].hdr.last_day;
+	else
+		return false;
+	return true;
+}
+
+bool
+history_append(history_t *history, veh_num_t num, const hist_event_t *event) {
+	ASSERT(history != NULL);
+	ASSERT(event != NULL);
+	ASSERT(event->kind < HIST_KIND_COUNT);
+
+	hist_veh_t *veh = get_veh(history, num);
+	hist_day_t day;
+	if(last_day(veh, &day) && event->day < day)
+		return false;
+
+	if(veh->num_pending == veh->pending_cap) {
+		veh->pending_cap = veh->pending_cap ? veh->pending_cap * 2 : 16;
+		veh->pending = safe_realloc(veh->pending, veh->pending_cap * sizeof(*veh->pending));
+	}
+	veh->pending[veh->num_pending++] = *event;
+	history->num_pending += 1;
+
+	// The event is recorded either way: if it can't be written yet, it stays buffered and the
+	// failure is up to history_flush() or history_close() to report
+	if(history->num_pending >= HIST_FLUSH_EVENTS)
+		history_flush(history);
+	return true;
+}
+
+static bool
+write_block(history_t *history, hist_veh_t *veh, const hist_event_t *events, size_t count) {
+	int64_t year = year_of(events[0].day);
+	part_t *part = hash_get(&history->parts, year);
+	if(!part)
+		part = open_part(history, year, true);
+	if(!part)
+		return false;
+
+	block_header_t hdr;
+	size_t size = encode_block(history, veh->num, events, count, &hdr);
+	FILE *f = part->file;
+	if(fseeko(f, 0, SEEK_END) < 0)
+		return false;
+	off_t pos = ftello(f);
+	if(pos < 0
+	   || fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	   || fwrite(history->buf, 1, size, f) != size
+	   || fflush(f) != 0)
+		return false;
+	push_block(veh, part, (uint64_t)pos + sizeof(hdr), &hdr);
+	return true;
+}
+
+// Writes a vehicle's buffered events, cut into blocks at year boundaries and at the block size.
+static bool
+flush_veh(history_t *history, hist_veh_t *veh) {
+	size_t i = 0;
+	while(i < veh->num_pending) {
+		int64_t year = year_of(veh->pending[i].day);
+		hist_day_t year_end = days_from_civil(year + 1, 1, 1);
+		size_t j = i + 1;
+		while(j < veh->num_pending && j - i < HIST_BLOCK_EVENTS && veh->pending[j].day < year_end)
+			j += 1;
+		if(!write_block(history, veh, veh->pending + i, j - i))
+			break;
+		i = j;
+	}
+
+	// Whatever didn't make it to disk stays buffered
+	memmove(veh->pending, veh->pending + i, (veh->num_pending - i) * sizeof(*veh->pending));
+	veh->num_pending -= i;
+	history->num_pending -= i;
+	return veh->num_pending == 0;
+}
+
+bool
+history_flush(history_t *history) {
+	ASSERT(history != NULL);
+
+	bool ok = true;
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while(history->num_pending && (entry = hash_next(&history->by_veh, &iter)) != NULL) {
+		hist_veh_t *veh = entry->value;
+		if(veh->num_pending && !flush_veh(history, veh))
+			ok = false;
+	}
+	return ok;
+}
+
+// MARK: - Queries
+
+static int
+num_cmp(const void *a, const void *b) {
+	veh_num_t lhs = *(const veh_num_t *)a;
+	veh_num_t rhs = *(const veh_num_t *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+size_t
+history_vehicles(const history_t *history, veh_num_t *list, size_t cap) {
+	ASSERT(history != NULL);
+
+	size_t count = 0;
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&history->by_veh, &iter)) != NULL) {
+		const hist_veh_t *veh = entry->value;
+		if(!veh->count && !veh->num_pending) continue;
+		if(count < cap)
+			list[count] = veh->num;
+		count += 1;
+	}
+	if(list && count)
+		qsort(list, MIN(count, cap), sizeof(*list), num_cmp);
+	return count;
+}
+
+bool
+history_last(const history_t *history, veh_num_t num, hist_kind_t kind, hist_event_t *event) {
+	ASSERT(history != NULL);
+	ASSERT(event != NULL);
+
+	const hist_veh_t *veh = hash_get(&history->by_veh, num);
+	if(!veh)
+		return false;
+
+	for(size_t i = veh->num_pending; i > 0; --i) {
+		if(kind != HIST_KIND_COUNT && veh->pending[i-1].kind != kind) continue;
+		*event = veh->pending[i-1];
+		return true;
+	}
+	for(size_t i = veh->count; i > 0; --i) {
+		const block_header_t *hdr = &veh->blocks[i-1].hdr;
+		if(kind == HIST_KIND_COUNT) {
+			*event = (hist_event_t){hdr->last_day, hdr->last_km, hdr->last_kind};
+			return true;
+		}
+		if(!hdr->kind_count[kind]) continue;
+		*event = (hist_event_t){hdr->last_day_of[kind], hdr->last_km_of[kind], kind};
+		return true;
+	}
+	return false;
+}
+
+bool
+history_km_since(const history_t *history, veh_num_t num, hist_kind_t kind, int64_t *km) {
+	ASSERT(km != NULL);
+	hist_event_t last, since;
+	if(!history_last(history, num, kind, &since) || !history_last(history, num, HIST_KIND_COUNT, &last))
+		return false;
+	*km = last.km - since.km;
+	return true;
+}
+
+// Index of the first block that ends on or after a day.
+static size_t
+first_block_from(const hist_veh_t *veh, hist_day_t from) {
+	size_t lo = 0, hi = veh->count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(veh->blocks[mid].hdr.last_day < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+summary_add(hist_summary_t *summary, bool *found, const hist_event_t *event) {
+	summary->count[event->kind] += 1;
+	if(!*found)
+		summary->first = *event;
+	summary->last = *event;
+	*found = true;
+}
+
+bool
+history_summarise(history_t *history, veh_num_t num, hist_day_t from, hist_day_t to,
+		  hist_summary_t *summary) {
+	ASSERT(history != NULL);
+	ASSERT(summary != NULL);
+
+	memset(summary, 0, sizeof(*summary));
+	const hist_veh_t *veh = hash_get(&history->by_veh, num);
+	if(!veh)
+		return false;
+
+	bool found = false;
+	for(size_t i = first_block_from(veh, from); i < veh->count; ++i) {
+		const block_ref_t *ref = &veh->blocks[i];
+		const block_header_t *hdr = &ref->hdr;
+		if(hdr->first_day >= to)
+			break;
+
+		// Blocks entirely inside the range are answered from their header
+		if(hdr->first_day >= from && hdr->last_day < to) {
+			for(int k = 0; k < HIST_KIND_COUNT; ++k)
+				summary->count[k] += hdr->kind_count[k];
+			if(!found)
+				summary->first = (hist_event_t){hdr->first_day, hdr->first_km, hdr->first_kind};
+			summary->last = (hist_event_t){hdr->last_day, hdr->last_km, hdr->last_kind};
+			found = true;
+			continue;
+		}
+
+		if(!decode_block(history, ref))
+			return false;
+		for(size_t j = 0; j < hdr->count; ++j) {
+			const hist_event_t *event = &history->decoded[j];
+			if(event->day >= from && event->day < to)
+				summary_add(summary, &found, event);
+		}
+	}
+
+	for(size_t i = 0; i < veh->num_pending; ++i) {
+		const hist_event_t *event = &veh->pending[i];
+		if(event->day >= from && event->day < to)
+			summary_add(summary, &found, event);
+	}
+	return found;
+}
+
+static void
+collect(const hist_event_t *src, size_t count, hist_day_t from, hist_day_t to,
+	hist_event_t **list, size_t *len, size_t *cap) {
+	for(size_t i = 0; i < count; ++i) {
+		if(src[i].day < from || src[i].day >= to) continue;
+		if(*len == *cap) {
+			*cap = *cap ? *cap * 2 : 64;
+			*list = safe_realloc(*list, *cap * sizeof(**list));
+		}
+		(*list)[(*len)++] = src[i];
+	}
+}
+
+size_t
+history_events(history_t *history, veh_num_t num, hist_day_t from, hist_day_t to,
+	       hist_event_t **list) {
+	ASSERT(history != NULL);
+	ASSERT(list != NULL);
+
+	*list = NULL;
+	const hist_veh_t *veh = hash_get(&history->by_veh, num);
+	if(!veh)
+		return 0;
+
+	size_t count = 0, cap = 0;
+	for(size_t i = first_block_from(veh, from); i < veh->count; ++i) {
+		const block_ref_t *ref = &veh->blocks[i];
+		if(ref->hdr.first_day >= to)
+			break;
+		if(decode_block(history, ref))
+			collect(history->decoded, ref->hdr.count, from, to, list, &count, &cap);
+	}
+	collect(veh->pending, veh->num_pending, from, to, list, &count, &cap);
+	return count;
+}
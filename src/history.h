@@ -0,0 +1,107 @@
+/*===--------------------------------------------------------------------------------------------===
+ * history.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include "stock.h"
+
+#define HIST_DAY_LEN		(16)
+#define HIST_BLOCK_EVENTS	(4096)
+#define HIST_FLUSH_EVENTS	(1 << 16)
+
+typedef enum {
+	HIST_ODOMETER,
+	HIST_INSPECTION,
+	HIST_REPAIR,
+	HIST_OVERHAUL,
+	HIST_KIND_COUNT,
+} hist_kind_t;
+
+// Days since 1970-01-01, written as YYYY-MM-DD.
+typedef int64_t hist_day_t;
+
+// Every event carries the odometer reading at the time it happened.
+typedef struct {
+	hist_day_t		day;
+	int64_t			km;
+	hist_kind_t		kind;
+} hist_event_t;
+
+typedef struct {
+	size_t			count[HIST_KIND_COUNT];
+	hist_event_t		first;
+	hist_event_t		last;
+} hist_summary_t;
+
+// Mileage and maintenance events, kept apart from the stock DB in a directory with one append-only
+// file per year. Events are written in blocks of one vehicle's consecutive events, stored column
+// by column: day and odometer deltas as varints, then kinds as bytes. Each block header carries
+// enough to answer most questions without decoding it: its time and mileage bounds, a count of
+// each kind of event, and the last event of each kind.
+//
+// Opening the store only reads the block headers, into a per-vehicle list of blocks in time order.
+// Events for one vehicle must be appended in time order, and are buffered until flushed.
+typedef struct history_s history_t;
+
+bool
+history_parse_day(const char *str, hist_day_t *day);
+
+void
+history_format_day(hist_day_t day, char *dest, size_t cap);
+
+const char *
+history_kind_name(hist_kind_t kind);
+
+bool
+history_parse_kind(const char *str, hist_kind_t *kind);
+
+// Opens the store in `dir`, creating the directory if needed. A block cut short by a crash at the
+// end of a file is dropped.
+history_t *
+history_open(const char *dir);
+
+// Flushes buffered events, then closes the store.
+bool
+history_close(history_t *history);
+
+// Buffers an event, and writes the buffered ones out once there are enough of them. Fails, and
+// records nothing, only if the event is older than the vehicle's latest one; write errors are
+// left to history_flush() and history_close(), which retry them.
+bool
+history_append(history_t *history, veh_num_t num, const hist_event_t *event);
+
+bool
+history_flush(history_t *history);
+
+// Lists the running numbers with a history, in order. Returns how many there are, which may be
+// more than `cap`.
+size_t
+history_vehicles(const history_t *history, veh_num_t *list, size_t cap);
+
+// The most recent event of a vehicle, of one kind or, with HIST_KIND_COUNT, of any kind.
+bool
+history_last(const history_t *history, veh_num_t num, hist_kind_t kind, hist_event_t *event);
+
+// Kilometres run since the last event of a kind, such as an overhaul. Fails if there is none.
+bool
+history_km_since(const history_t *history, veh_num_t num, hist_kind_t kind, int64_t *km);
+
+// Counts the events in [from, to), and finds the first and last ones: the vehicle ran
+// `last.km - first.km` over the period. Returns false if there are none.
+bool
+history_summarise(history_t *history, veh_num_t num, hist_day_t from, hist_day_t to,
+		  hist_summary_t *summary);
+
+// Lists the events in [from, to). The list is allocated, and must be freed by the caller.
+size_t
+history_events(history_t *history, veh_num_t num, hist_day_t from, hist_day_t to,
+	       hist_event_t **list);
+
+#endif /* ifndef _HISTORY_H_ */
@@ -0,0 +1,325 @@
+/*===--------------------------------------------------------------------------------------------===
+ * lazy.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "lazy.h"
+#include "hash.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC	(0x58494d54u)	// "TMIX"
+#define INDEX_VERSION	(2)
+#define SAMPLE_SIZE	(4096)
+#define NO_ENTRY	(SIZE_MAX)
+
+typedef struct {
+	int64_t		num;
+	uint64_t	offset;
+} index_entry_t;
+
+// The sidecar is tied to one exact version of the DB file through its size, its mtime to the
+// nanosecond and a checksum of its first and last few kilobytes. Where timestamps are coarse, the
+// checksum still catches most rewrites that keep the size within the same tick.
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	file_size;
+	int64_t		mtime;
+	int64_t		mtime_nsec;
+	uint64_t	sample;
+	uint64_t	count;
+} index_header_t;
+
+typedef struct {
+	veh_t		*veh;
+	size_t		prev;
+	size_t		next;
+} cache_entry_t;
+
+struct lazy_db_s {
+	FILE		*file;
+	index_entry_t	*index;
+	size_t		count;
+
+	// Cached rows, on a list from most to least recently used
+	cache_entry_t	*cache;
+	size_t		cache_cap;
+	size_t		cache_len;
+	size_t		head;
+	size_t		tail;
+	hash_map_t	by_num;
+
+	char		*line;
+	size_t		line_cap;
+};
+
+static int
+entry_cmp(const void *a, const void *b) {
+	const index_entry_t *lhs = a;
+	const index_entry_t *rhs = b;
+	if(lhs->num != rhs->num)
+		return (lhs->num > rhs->num) - (lhs->num < rhs->num);
+	return (lhs->offset > rhs->offset) - (lhs->offset < rhs->offset);
+}
+
+static void
+build_index(lazy_db_t *db) {
+	size_t cap = 0;
+	uint64_t offset = 0;
+	ssize_t len;
+
+	rewind(db->file);
+	// Rows are only parsed and classified once they are looked at, the index only needs numbers
+	while((len = getline(&db->line, &db->line_cap, db->file)) > 0) {
+		veh_num_t num;
+		if(stock_parse_num(db->line, &num)) {
+			if(db->count == cap) {
+				cap = cap ? cap * 2 : 1024;
+				db->index = safe_realloc(db->index, cap * sizeof(*db->index));
+			}
+			db->index[db->count++] = (index_entry_t){.num = num, .offset = offset};
+		}
+		offset += len;
+	}
+
+	// Keep the first row of every running number, like the eager loader does
+	qsort(db->index, db->count, sizeof(*db->index), entry_cmp);
+	size_t j = 0;
+	for(size_t i = 0; i < db->count; ++i) {
+		if(j && db->index[j-1].num == db->index[i].num) continue;
+		db->index[j++] = db->index[i];
+	}
+	db->count = j;
+}
+
+static uint64_t
+sample_hash(FILE *f, const struct stat *st) {
+	uint8_t buf[SAMPLE_SIZE];
+	uint64_t hash = 0xcbf29ce484222325ull;
+	off_t starts[2] = {0, MAX(st->st_size - SAMPLE_SIZE, 0)};
+	for(int i = 0; i < 2; ++i) {
+		if(fseeko(f, starts[i], SEEK_SET) < 0)
+			return 0;
+		size_t len = fread(buf, 1, sizeof(buf), f);
+		for(size_t j = 0; j < len; ++j) {
+			hash ^= buf[j];
+			hash *= 0x100000001b3ull;
+		}
+	}
+	return hash;
+}
+
+static void
+sidecar_path(const char *path, char *dest, size_t cap) {
+	snprintf(dest, cap, "%s.idx", path);
+}
+
+static bool
+read_sidecar(lazy_db_t *db, const char *path, const struct stat *st, uint64_t sample) {
+	char idx_path[1024];
+	sidecar_path(path, idx_path, sizeof(idx_path));
+	FILE *f = fopen(idx_path, "rb");
+	if(!f)
+		return false;
+
+	index_header_t hdr;
+	bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1
+		&& hdr.magic == INDEX_MAGIC
+		&& hdr.version == INDEX_VERSION
+		&& hdr.file_size == (uint64_t)st->st_size
+		&& hdr.mtime == (int64_t)st->st_mtim.tv_sec
+		&& hdr.mtime_nsec == (int64_t)st->st_mtim.tv_nsec
+		&& hdr.sample == sample
+		&& hdr.count <= (uint64_t)st->st_size;
+	if(ok) {
+		db->count = hdr.count;
+		db->index = safe_calloc(MAX(db->count, 1), sizeof(*db->index));
+		ok = fread(db->index, sizeof(*db->index), db->count, f) == db->count;
+	}
+	fclose(f);
+	if(!ok) {
+		free(db->index);
+		db->index = NULL;
+		db->count = 0;
+	}
+	return ok;
+}
+
+// The sidecar is only a cache: failing to write it costs a rescan next time, nothing more.
+static void
+write_sidecar(const lazy_db_t *db, const char *path, const struct stat *st, uint64_t sample) {
+	char idx_path[1024], tmp_path[1040];
+	sidecar_path(path, idx_path, sizeof(idx_path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", idx_path);
+
+	FILE *f = fopen(tmp_path, "wb");
+	if(!f)
+		return;
+	index_header_t hdr = {
+		.magic = INDEX_MAGIC,
+		.version = INDEX_VERSION,
+		.file_size = (uint64_t)st->st_size,
+		.mtime = (int64_t)st->st_mtim.tv_sec,
+		.mtime_nsec = (int64_t)st->st_mtim.tv_nsec,
+		.sample = sample,
+		.count = db->count,
+	};
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+		&& fwrite(db->index, sizeof(*db->index), db->count, f) == db->count;
+	if(fclose(f) == 0 && ok)
+		rename(tmp_path, idx_path);
+	else
+		remove(tmp_path);
+}
+
+lazy_db_t *
+lazy_open(const char *path, size_t cache_cap) {
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return NULL;
+	struct stat st;
+	if(fstat(fileno(f), &st) < 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	lazy_db_t *db = safe_calloc(1, sizeof(*db));
+	db->file = f;
+	db->cache_cap = MAX(cache_cap, 1);
+	db->cache = safe_calloc(db->cache_cap, sizeof(*db->cache));
+	db->head = db->tail = NO_ENTRY;
+	hash_init(&db->by_num);
+
+	uint64_t sample = sample_hash(f, &st);
+	if(!read_sidecar(db, path, &st, sample)) {
+		build_index(db);
+		write_sidecar(db, path, &st, sample);
+	}
+	return db;
+}
+
+void
+lazy_close(lazy_db_t *db) {
+	if(!db)
+		return;
+	fclose(db->file);
+	hash_fini(&db->by_num);
+	for(size_t i = 0; i < db->cache_len; ++i)
+		free(db->cache[i].veh);
+	free(db->cache);
+	free(db->index);
+	free(db->line);
+	free(db);
+}
+
+size_t
+lazy_count(const lazy_db_t *db) {
+	ASSERT(db != NULL);
+	return db->count;
+}
+
+static void
+lru_unlink(lazy_db_t *db, size_t i) {
+	cache_entry_t *e = &db->cache[i];
+	if(e->prev != NO_ENTRY)
+		db->cache[e->prev].next = e->next;
+	else
+		db->head = e->next;
+	if(e->next != NO_ENTRY)
+		db->cache[e->next].prev = e->prev;
+	else
+		db->tail = e->prev;
+}
+
+static void
+lru_push_front(lazy_db_t *db, size_t i) {
+	cache_entry_t *e = &db->cache[i];
+	e->prev = NO_ENTRY;
+	e->next = db->head;
+	if(db->head != NO_ENTRY)
+		db->cache[db->head].prev = i;
+	db->head = i;
+	if(db->tail == NO_ENTRY)
+		db->tail = i;
+}
+
+// Reads and parses the row an index entry points to, into a free or evicted cache slot.
+static const veh_t *
+load_entry(lazy_db_t *db, const index_entry_t *entry) {
+	if(fseeko(db->file, (off_t)entry->offset, SEEK_SET) < 0
+	   || getline(&db->line, &db->line_cap, db->file) <= 0)
+		return NULL;
+	// A row that isn't the one indexed means the index is out of date: it's not cached under a
+	// number it doesn't have
+	veh_t *veh = stock_parse_line(db->line);
+	if(!veh)
+		return NULL;
+	if(veh->num != entry->num) {
+		free(veh);
+		return NULL;
+	}
+
+	size_t i;
+	if(db->cache_len < db->cache_cap) {
+		i = db->cache_len++;
+	} else {
+		i = db->tail;
+		lru_unlink(db, i);
+		hash_remove(&db->by_num, db->cache[i].veh->num);
+		free(db->cache[i].veh);
+	}
+	db->cache[i].veh = veh;
+
+	lru_push_front(db, i);
+	hash_put(&db->by_num, entry->num, &db->cache[i]);
+	return veh;
+}
+
+static const veh_t *
+get_entry(lazy_db_t *db, const index_entry_t *entry) {
+	cache_entry_t *cached = hash_get(&db->by_num, entry->num);
+	if(!cached)
+		return load_entry(db, entry);
+
+	size_t i = (size_t)(cached - db->cache);
+	if(db->head != i) {
+		lru_unlink(db, i);
+		lru_push_front(db, i);
+	}
+	return cached->veh;
+}
+
+const veh_t *
+lazy_get(lazy_db_t *db, veh_num_t num) {
+	ASSERT(db != NULL);
+
+	size_t lo = 0, hi = db->count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(db->index[mid].num < num)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == db->count || db->index[lo].num != num)
+		return NULL;
+	return get_entry(db, &db->index[lo]);
+}
+
+const veh_t *
+lazy_at(lazy_db_t *db, size_t idx) {
+	ASSERT(db != NULL);
+	if(idx >= db->count)
+		return NULL;
+	return get_entry(db, &db->index[idx]);
+}
@@ -0,0 +1,43 @@
+/*===--------------------------------------------------------------------------------------------===
+ * lazy.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _LAZY_H_
+#define _LAZY_H_
+
+#include "stock.h"
+
+#define LAZY_CACHE_DEFAULT	(1024)
+
+// Read-only access to a DB file without loading it. Opening the file only builds an index from
+// running number to byte offset, or reads it from `<path>.idx` when that sidecar is still up to
+// date. Rows are parsed and classified when they are asked for, and the most recently used ones
+// are kept in a cache of bounded size.
+//
+// As with stock_load_from_path(), the first row wins when a running number appears twice.
+typedef struct lazy_db_s lazy_db_t;
+
+lazy_db_t *
+lazy_open(const char *path, size_t cache_cap);
+
+void
+lazy_close(lazy_db_t *db);
+
+size_t
+lazy_count(const lazy_db_t *db);
+
+// The returned vehicle belongs to the cache. It stays valid until `cache_cap` other rows have been
+// read after it.
+const veh_t *
+lazy_get(lazy_db_t *db, veh_num_t num);
+
+// Returns the `idx`-th vehicle in running-number order.
+const veh_t *
+lazy_at(lazy_db_t *db, size_t idx);
+
+#endif /* ifndef _LAZY_H_ */
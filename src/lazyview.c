@@ -0,0 +1,114 @@
+/*===--------------------------------------------------------------------------------------------===
+ * lazyview.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "ui.h"
+#include "views.h"
+#include <utils/helpers.h>
+#include <limits.h>
+
+#define ID_WIDTH	(12)
+#define CLASS_WIDTH	(12)
+#define TYPE_WIDTH	(12)
+
+typedef struct {
+	lazy_db_t	*db;
+	const char	*path;
+	int		offset;
+	int		sel;
+	int		count;
+} lazyview_t;
+
+// Only the rows in the window are read from the file, so the cost of a redraw doesn't depend on
+// the size of the fleet.
+static void
+lazyview_draw(lazyview_t *view) {
+	int w, h;
+	hexes_get_size(&w, &h);
+	int desc_width = w - (11 + ID_WIDTH + CLASS_WIDTH + TYPE_WIDTH);
+
+	int rows = MAX(1, h-2);
+	if(view->sel < view->offset)
+		view->offset = view->sel;
+	if(view->sel >= view->offset + rows)
+		view->offset = view->sel - rows + 1;
+	view->offset = MAX(0, view->offset);
+
+	hexes_clear_screen();
+	ui_title(" Rolling Stock Database - %s (read-only, %d vehicles)", view->path, view->count);
+
+	for(int i = 0; i < h-2; ++i) {
+		hexes_cursor_go(0, i+1);
+		int idx = i + view->offset;
+		if(idx == view->sel)
+			term_reverse(stdout);
+
+		const veh_t *veh = idx < view->count ? lazy_at(view->db, idx) : NULL;
+		if(veh) {
+			char class[UI_CELL_CAP], desc[UI_CELL_CAP];
+			ui_line("|%c %s | %*" VEH_NUM_FMT " | %-*s | %s |",
+				veh->in_use ? '*' : ' ',
+				ui_cell(class, veh->class, dict_width(veh->class), CLASS_WIDTH),
+				ID_WIDTH, veh->num,
+				TYPE_WIDTH, stock_type_name(veh->type),
+				ui_cell(desc, veh->desc, dict_width(veh->desc), desc_width));
+		} else {
+			ui_line("|  %-*s | %-*s | %-*s | %-*s |",
+				CLASS_WIDTH, "",
+				ID_WIDTH, "",
+				TYPE_WIDTH, "",
+				desc_width, "");
+		}
+		term_style_reset(stdout);
+	}
+	ui_prompt(" [Q]uit    [Up/Down] move    [Left/Right] page");
+}
+
+static bool
+lazyview_update(lazyview_t *view) {
+	int w, h;
+	hexes_get_size(&w, &h);
+	int page = MAX(1, h-2);
+
+	switch(ui_get_key()) {
+	case KEY_CTRL_C:
+	case KEY_CTRL_D:
+	case KEY_CTRL_Q:
+	case 'q':
+	case 'Q':
+		return false;
+	case KEY_ARROW_DOWN:
+		view->sel = MIN(view->count-1, view->sel+1);
+		break;
+	case KEY_ARROW_UP:
+		view->sel = MAX(0, view->sel-1);
+		break;
+	case KEY_ARROW_RIGHT:
+		view->sel = MIN(view->count-1, view->sel+page);
+		break;
+	case KEY_ARROW_LEFT:
+		view->sel = MAX(0, view->sel-page);
+		break;
+	default:
+		break;
+	}
+	view->sel = MAX(0, view->sel);
+	return true;
+}
+
+void
+show_lazyview(lazy_db_t *db, const char *path) {
+	lazyview_t view = {
+		.db = db,
+		.path = path,
+		.count = (int)MIN(lazy_count(db), (size_t)INT_MAX),
+	};
+	do {
+		lazyview_draw(&view);
+	} while(lazyview_update(&view));
+}
@@ -8,32 +8,250 @@
  *===--------------------------------------------------------------------------------------------===
 */
 #include "stock.h"
+#include "consist.h"
+#include "roster.h"
+#include "depot.h"
+#include "batch.h"
+#include "watch.h"
+#include "uic.h"
+#include "net.h"
 #include "ui.h"
 #include "views.h"
 #include <utils/helpers.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 
+static int
+usage(const char *name) {
+	fprintf(stderr, "usage: %s <db path>\n", name);
+	fprintf(stderr, "       %s <depot dir>\n", name);
+	fprintf(stderr, "       %s --serve <db path>\n", name);
+	fprintf(stderr, "       %s --lazy <db path> [<number>...]\n", name);
+	batch_usage(stderr, name);
+	return -1;
+}
+
+// Classification rules are kept next to the DB, as <db>.rules, or as .rules in a depot directory.
+// Without one, the built-in rules are used.
+static void
+load_rules(const char *path) {
+	struct stat st;
+	if(stat(path, &st) < 0)
+		return;
+	char err[128];
+	uic_rules_t *rules = uic_rules_load_from_path(path, err, sizeof(err));
+	if(!rules) {
+		fprintf(stderr, "%s: %s, using the built-in rules\n", path, err);
+		return;
+	}
+	uic_rules_use(rules);
+}
+
+// Browses or prints rows of a DB file that may not fit in memory. Nothing is written back.
+static int
+run_lazy(const char *db_path, int argc, const char **argv) {
+	lazy_db_t *db = lazy_open(db_path, LAZY_CACHE_DEFAULT);
+	if(!db) {
+		fprintf(stderr, "cannot read %s\n", db_path);
+		return 1;
+	}
+	
+	int res = 0;
+	if(argc) {
+		for(int i = 0; i < argc; ++i) {
+			const veh_t *veh = lazy_get(db, strtoll(argv[i], NULL, 10));
+			if(!veh) {
+				fprintf(stderr, "no vehicle %s\n", argv[i]);
+				res = 1;
+				continue;
+			}
+			printf("%c,%" VEH_NUM_FMT ", %s, %s\n",
+			       veh->in_use ? 'x' : '-', veh->num, veh->class, veh->desc);
+		}
+	} else {
+		ui_start();
+		show_lazyview(db, db_path);
+		ui_end();
+	}
+	lazy_close(db);
+	return res;
+}
+
+// Runs a command on a loaded DB, or the TUI without one. The consists and roster kept next to the
+// DB are always ours to write, the DB itself only with `write_back`.
+static int
+run_db(const char *name, const char *db_path, db_t *db, bool write_back, int argc, const char **argv) {
+	char consists_path[1024];
+	snprintf(consists_path, sizeof(consists_path), "%s.consists", db_path);
+	consists_t consists;
+	consists_init(&consists, db);
+	consists_load_from_path(&consists, consists_path);
+	
+	char roster_path[1024];
+	snprintf(roster_path, sizeof(roster_path), "%s.roster", db_path);
+	roster_t roster;
+	roster_init(&roster, db);
+	roster_load_from_path(&roster, roster_path);
+	
+	char attrs_path[1024];
+	snprintf(attrs_path, sizeof(attrs_path), "%s.attrs", db_path);
+	attr_table_t attrs;
+	attrs_init(&attrs);
+	attrs_load_from_path(&attrs, attrs_path);
+	
+	int res = 0;
+	if(argc) {
+		uint64_t gen = stock_db_gen(db);
+		batch_env_t env = {
+			.db_path = db_path,
+			.db = db,
+			.consists = &consists,
+			.roster = &roster,
+			.attrs = &attrs,
+		};
+		res = batch_run(&env, argc, argv);
+		if(res == -1)
+			usage(name);
+		else if(write_back && stock_db_gen(db) != gen)
+			stock_write_to_path(db_path, db);
+	} else {
+		// Another process may rewrite the file while it's open here: changes are merged in as
+		// they land, and the file is only written back if something was changed here too.
+		db_watch_t *watch = write_back ? watch_open(db_path, db) : NULL;
+		if(watch && watch_fd(watch) >= 0)
+			ui_set_pump(watch_fd(watch), watch_pump, watch);
+		
+		ui_start();
+		show_dbview(db, &consists, &attrs);
+		ui_end();
+		ui_set_pump(-1, NULL, NULL);
+		
+		if(watch) {
+			watch_sync(watch, false);
+			if(watch_db_dirty(watch))
+				watch_write(watch);
+			watch_close(watch);
+		}
+	}
+	
+	if(roster.dirty)
+		roster_write_to_path(&roster, roster_path);
+	if(consists.dirty)
+		consists_write_to_path(&consists, consists_path);
+	roster_fini(&roster);
+	consists_fini(&consists);
+	attrs_fini(&attrs);
+	return res;
+}
+
+// Opens a directory of depot files as one fleet. A command prefixed with @<depot> runs on that
+// depot alone, and only loads that one; anything else loads every depot.
+static int
+run_depots(const char *name, const char *dir, int argc, const char **argv) {
+	depot_set_t set;
+	if(!depots_open(&set, dir)) {
+		fprintf(stderr, "cannot read %s\n", dir);
+		return 1;
+	}
+	
+	int res = 0;
+	if(argc && argv[0][0] == '@') {
+		depot_t *depot = depots_get(&set, argv[0] + 1);
+		if(!depot) {
+			fprintf(stderr, "no depot named %s\n", argv[0] + 1);
+			depots_close(&set);
+			return 1;
+		}
+		if(!depots_load(&set, &depot, 1)) {
+			fprintf(stderr, "cannot read %s\n", depot->path);
+			depots_close(&set);
+			return 1;
+		}
+		res = run_db(name, depot->path, &depot->db, false, argc - 1, argv + 1);
+	} else {
+		if(!depots_load(&set, NULL, 0)) {
+			for(size_t i = 0; i < set.count; ++i) {
+				if(!set.depots[i].loaded)
+					fprintf(stderr, "cannot read %s, it is left out\n", set.depots[i].path);
+			}
+		}
+		if(argc) {
+			res = batch_run_depots(&set, argc, argv);
+			if(res == -1)
+				usage(name);
+		} else {
+			ui_start();
+			show_depotview(&set);
+			ui_end();
+		}
+	}
+	
+	if(depots_write_changed(&set) < 0) {
+		fprintf(stderr, "cannot write back every depot in %s\n", dir);
+		res = 1;
+	}
+	depots_close(&set);
+	return res;
+}
 
 int main(int argc, const char **argv) {
 	if(argc < 2)
-		return -1;
+		return usage(argv[0]);
+	
+	char rules_path[1024];
+	if(!strcmp(argv[1], "--serve")) {
+		if(argc < 3)
+			return usage(argv[0]);
+		snprintf(rules_path, sizeof(rules_path), "%s.rules", argv[2]);
+		load_rules(rules_path);
+		return server_run(argv[2]);
+	}
+	
+	if(!strcmp(argv[1], "--lazy")) {
+		if(argc < 3)
+			return usage(argv[0]);
+		snprintf(rules_path, sizeof(rules_path), "%s.rules", argv[2]);
+		load_rules(rules_path);
+		return run_lazy(argv[2], argc - 3, argv + 3);
+	}
 	
 	srand(time(0L));
 	
 	const char *db_path = argc >= 2 ? argv[1] : "";
+	struct stat st;
+	if(stat(db_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+		snprintf(rules_path, sizeof(rules_path), "%s/.rules", db_path);
+		load_rules(rules_path);
+		return run_depots(argv[0], db_path, argc - 2, argv + 2);
+	}
 	
-	avl_tree_t db;
-	stock_db_init(&db);
+	snprintf(rules_path, sizeof(rules_path), "%s.rules", db_path);
+	load_rules(rules_path);
 	
-	stock_load_from_path(db_path, &db);
+	db_t db;
+	stock_db_init(&db);
 	
-	ui_start();
-	show_dbview(&db);
-	ui_end();
+	// If a daemon is serving this DB, it owns the file: work on its copy and let it write back.
+	bool served;
+	client_t *client = client_connect(db_path, &db, &served);
+	if(!client && served) {
+		// Whatever the daemon holds that isn't in the file yet would be lost by writing it back.
+		fprintf(stderr, "the daemon serving %s hung up before sending the DB\n", db_path);
+		stock_db_fini(&db);
+		return 1;
+	}
+	if(client)
+		ui_set_pump(client_fd(client), client_pump, client);
+	else
+		stock_load_from_path(db_path, &db);
 	
-	stock_write_to_path(db_path, &db);
+	int res = run_db(argv[0], db_path, &db, !client, argc - 2, argv + 2);
+	if(!client_close(client)) {
+		fprintf(stderr, "the daemon went away, and %s cannot be written back\n", db_path);
+		res = 1;
+	}
 	stock_db_fini(&db);
+	return res;
 }
-
-
@@ -0,0 +1,110 @@
+/*===--------------------------------------------------------------------------------------------===
+ * mem.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdio.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Depots load on several threads at once, so the counters are shared but the operation isn't.
+static mem_count_t counts[MEM_OP_COUNT];
+static _Thread_local mem_op_t current = MEM_OP_OTHER;
+
+static const char *op_names[] = {
+	[MEM_OP_OTHER] = "other",
+	[MEM_OP_LOAD] = "load",
+	[MEM_OP_ADD] = "add",
+	[MEM_OP_UPDATE] = "update",
+	[MEM_OP_DELETE] = "delete",
+	[MEM_OP_VIEW] = "view refresh",
+};
+
+static void
+count(size_t bytes) {
+	__atomic_fetch_add(&counts[current].allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counts[current].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void *
+mem_calloc(size_t num, size_t size) {
+	count(num * size);
+	return safe_calloc(num, size);
+}
+
+void *
+mem_realloc(void *ptr, size_t size) {
+	count(size);
+	return safe_realloc(ptr, size);
+}
+
+mem_op_t
+mem_op_begin(mem_op_t op) {
+	ASSERT(op < MEM_OP_COUNT);
+	mem_op_t prev = current;
+	if(prev == MEM_OP_OTHER)
+		current = op;
+	return prev;
+}
+
+void
+mem_op_end(mem_op_t prev) {
+	current = prev;
+}
+
+const char *
+mem_op_name(mem_op_t op) {
+	ASSERT(op < MEM_OP_COUNT);
+	return op_names[op];
+}
+
+void
+mem_counts(mem_count_t out[MEM_OP_COUNT]) {
+	for(int i = 0; i < MEM_OP_COUNT; ++i) {
+		out[i].allocs = __atomic_load_n(&counts[i].allocs, __ATOMIC_RELAXED);
+		out[i].bytes = __atomic_load_n(&counts[i].bytes, __ATOMIC_RELAXED);
+	}
+}
+
+void
+mem_counts_reset(void) {
+	for(int i = 0; i < MEM_OP_COUNT; ++i) {
+		__atomic_store_n(&counts[i].allocs, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&counts[i].bytes, 0, __ATOMIC_RELAXED);
+	}
+}
+
+void
+mem_format_size(size_t bytes, char *buf, size_t cap) {
+	static const char *units[] = {"B", "KiB", "MiB", "GiB"};
+	double size = (double)bytes;
+	int unit = 0;
+	while(size >= 1024.0 && unit < 3) {
+		size /= 1024.0;
+		unit += 1;
+	}
+	if(unit)
+		snprintf(buf, cap, "%.1f %s", size, units[unit]);
+	else
+		snprintf(buf, cap, "%zu %s", bytes, units[unit]);
+}
+
+size_t
+mem_block_size(const void *ptr, size_t requested) {
+	if(!ptr)
+		return 0;
+#ifdef __GLIBC__
+	(void)requested;
+	return malloc_usable_size((void *)ptr);
+#else
+	return requested;
+#endif
+}
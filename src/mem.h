@@ -0,0 +1,64 @@
+/*===--------------------------------------------------------------------------------------------===
+ * mem.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+
+// Allocations made by the DB and the views are counted against the operation that made them, so
+// a change that makes loading or refreshing a view allocate more shows up in the numbers.
+typedef enum {
+	MEM_OP_OTHER,
+	MEM_OP_LOAD,
+	MEM_OP_ADD,
+	MEM_OP_UPDATE,
+	MEM_OP_DELETE,
+	MEM_OP_VIEW,
+	MEM_OP_COUNT,
+} mem_op_t;
+
+typedef struct {
+	size_t		allocs;
+	size_t		bytes;
+} mem_count_t;
+
+// Same as safe_calloc() and safe_realloc(), but counted.
+void *
+mem_calloc(size_t count, size_t size);
+
+void *
+mem_realloc(void *ptr, size_t size);
+
+// Counts this thread's allocations against `op` until mem_op_end(), unless an outer operation is
+// already running: the adds a load makes are part of the load. Returns what to pass to mem_op_end().
+mem_op_t
+mem_op_begin(mem_op_t op);
+
+void
+mem_op_end(mem_op_t prev);
+
+const char *
+mem_op_name(mem_op_t op);
+
+void
+mem_counts(mem_count_t counts[MEM_OP_COUNT]);
+
+void
+mem_counts_reset(void);
+
+// Writes a size as bytes, KiB, MiB or GiB, whichever reads best.
+void
+mem_format_size(size_t bytes, char *buf, size_t cap);
+
+// The size of a heap block as the allocator sees it, when the platform can tell, else `requested`.
+size_t
+mem_block_size(const void *ptr, size_t requested);
+
+#endif /* ifndef _MEM_H_ */
@@ -0,0 +1,645 @@
+/*===--------------------------------------------------------------------------------------------===
+ * ndjson.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "ndjson.h"
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define OUT_BUF_SIZE	(64 * 1024)
+#define IN_BUF_SIZE	(1024 * 1024)
+#define MAX_DEPTH	(64)
+
+// The most a record can take once written: any text byte may become a six-byte \u escape.
+#define MAX_RECORD	(128 + 6 * (MAX_CLASS_LEN + MAX_DESC_LEN + MAX_LONG_DESC_LEN + 16))
+
+// Returns the length of the valid UTF-8 sequence at `str`, or 0 if there isn't one. Overlong forms,
+// surrogates and code points past U+10FFFF are rejected.
+static size_t
+utf8_len(const uint8_t *str, size_t len) {
+	uint8_t c = str[0];
+	if(c < 0x80)
+		return 1;
+
+	size_t n;
+	uint32_t cp, min;
+	if((c & 0xe0) == 0xc0) {
+		n = 2; cp = c & 0x1f; min = 0x80;
+	} else if((c & 0xf0) == 0xe0) {
+		n = 3; cp = c & 0x0f; min = 0x800;
+	} else if((c & 0xf8) == 0xf0) {
+		n = 4; cp = c & 0x07; min = 0x10000;
+	} else {
+		return 0;
+	}
+	if(len < n)
+		return 0;
+	for(size_t i = 1; i < n; ++i) {
+		if((str[i] & 0xc0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (str[i] & 0x3f);
+	}
+	if(cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+		return 0;
+	return n;
+}
+
+static size_t
+utf8_encode(uint32_t cp, char *out) {
+	if(cp < 0x80) {
+		out[0] = (char)cp;
+		return 1;
+	}
+	if(cp < 0x800) {
+		out[0] = (char)(0xc0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if(cp < 0x10000) {
+		out[0] = (char)(0xe0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+// MARK: - Export
+
+typedef struct {
+	FILE		*f;
+	size_t		len;
+	bool		ok;
+	char		buf[OUT_BUF_SIZE];
+} writer_t;
+
+static void
+flush(writer_t *w) {
+	if(w->len && fwrite(w->buf, 1, w->len, w->f) != w->len)
+		w->ok = false;
+	w->len = 0;
+}
+
+static char *
+put_raw(char *out, const char *str) {
+	size_t len = strlen(str);
+	memcpy(out, str, len);
+	return out + len;
+}
+
+static char *
+put_num(char *out, int64_t num) {
+	char digits[24];
+	int n = 0;
+	uint64_t mag = num < 0 ? -(uint64_t)num : (uint64_t)num;
+	do {
+		digits[n++] = (char)('0' + mag % 10);
+		mag /= 10;
+	} while(mag);
+	if(num < 0)
+		*out++ = '-';
+	while(n)
+		*out++ = digits[--n];
+	return out;
+}
+
+// Text that isn't valid UTF-8 can't go into JSON as it is, so bad bytes come out as U+FFFD.
+static char *
+put_string(char *out, const char *str, size_t cap) {
+	static const char hex[] = "0123456789abcdef";
+	size_t len = strnlen(str, cap);
+
+	*out++ = '"';
+	for(size_t i = 0; i < len;) {
+		uint8_t c = (uint8_t)str[i];
+		if(c == '"' || c == '\\') {
+			*out++ = '\\';
+			*out++ = (char)c;
+		} else if(c < 0x20) {
+			out = put_raw(out, "\\u00");
+			*out++ = hex[c >> 4];
+			*out++ = hex[c & 0xf];
+		} else if(c >= 0x80) {
+			size_t n = utf8_len((const uint8_t *)str + i, len - i);
+			if(!n) {
+				out = put_raw(out, "\\ufffd");
+				i += 1;
+				continue;
+			}
+			memcpy(out, str + i, n);
+			out += n;
+			i += n;
+			continue;
+		} else {
+			*out++ = (char)c;
+		}
+		i += 1;
+	}
+	*out++ = '"';
+	return out;
+}
+
+bool
+ndjson_write_to_file(FILE *f, const db_t *db) {
+	ASSERT(f != NULL);
+	ASSERT(db != NULL);
+
+	writer_t *w = safe_calloc(1, sizeof(*w));
+	w->f = f;
+	w->ok = true;
+	char class_desc[MAX_LONG_DESC_LEN];
+	for(const veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh)) {
+		if(w->len + MAX_RECORD > OUT_BUF_SIZE)
+			flush(w);
+		char *out = w->buf + w->len;
+		out = put_raw(out, "{\"num\":");
+		out = put_num(out, veh->num);
+		out = put_raw(out, veh->in_use ? ",\"in_use\":true,\"class\":" : ",\"in_use\":false,\"class\":");
+		out = put_string(out, veh->class, MAX_CLASS_LEN);
+		out = put_raw(out, ",\"desc\":");
+		out = put_string(out, veh->desc, MAX_DESC_LEN);
+		out = put_raw(out, ",\"type\":");
+		out = put_string(out, stock_type_name(veh->type), MAX_DESC_LEN);
+		out = put_raw(out, ",\"class_desc\":");
+		veh_class_desc(veh, class_desc, sizeof(class_desc));
+		out = put_string(out, class_desc, sizeof(class_desc));
+		out = put_raw(out, "}\n");
+		w->len = out - w->buf;
+	}
+	flush(w);
+	bool ok = w->ok;
+	free(w);
+	return ok;
+}
+
+// MARK: - Import
+
+typedef struct {
+	const char	*p;
+	const char	*end;
+	const char	*err;
+} parser_t;
+
+static bool
+fail(parser_t *ps, const char *msg) {
+	if(!ps->err)
+		ps->err = msg;
+	return false;
+}
+
+static void
+skip_ws(parser_t *ps) {
+	while(ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r' || *ps->p == '\n'))
+		ps->p += 1;
+}
+
+static bool
+expect(parser_t *ps, char c, const char *msg) {
+	skip_ws(ps);
+	if(ps->p >= ps->end || *ps->p != c)
+		return fail(ps, msg);
+	ps->p += 1;
+	return true;
+}
+
+// Finds the first byte of a string body that needs a closer look: a quote, a backslash, a control
+// character or the start of a multi-byte sequence. Strings are mostly plain ASCII, so this is where
+// the parser spends its time, and it looks at 16 bytes at a time where SSE2 is available.
+static const char *
+scan_plain(const char *p, const char *end) {
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i slash = _mm_set1_epi8('\\');
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	while(end - p >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)p);
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, slash));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x));
+		int mask = _mm_movemask_epi8(special) | _mm_movemask_epi8(x);
+		if(mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while(p < end) {
+		uint8_t c = (uint8_t)*p;
+		if(c == '"' || c == '\\' || c < 0x20 || c >= 0x80)
+			break;
+		p += 1;
+	}
+	return p;
+}
+
+static int
+hex_value(char c) {
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool
+parse_hex4(parser_t *ps, uint32_t *cp) {
+	if(ps->end - ps->p < 4)
+		return fail(ps, "short \\u escape");
+	*cp = 0;
+	for(int i = 0; i < 4; ++i) {
+		int v = hex_value(ps->p[i]);
+		if(v < 0)
+			return fail(ps, "bad \\u escape");
+		*cp = (*cp << 4) | (uint32_t)v;
+	}
+	ps->p += 4;
+	return true;
+}
+
+static bool
+parse_escape(parser_t *ps, uint32_t *cp) {
+	if(ps->p >= ps->end)
+		return fail(ps, "unterminated string");
+	char c = *ps->p++;
+	switch(c) {
+	case '"': *cp = '"'; return true;
+	case '\\': *cp = '\\'; return true;
+	case '/': *cp = '/'; return true;
+	case 'b': *cp = '\b'; return true;
+	case 'f': *cp = '\f'; return true;
+	case 'n': *cp = '\n'; return true;
+	case 'r': *cp = '\r'; return true;
+	case 't': *cp = '\t'; return true;
+	case 'u': break;
+	default: return fail(ps, "bad escape");
+	}
+
+	if(!parse_hex4(ps, cp))
+		return false;
+	if(*cp >= 0xdc00 && *cp <= 0xdfff)
+		return fail(ps, "lone surrogate");
+	if(*cp < 0xd800 || *cp > 0xdbff)
+		return true;
+
+	uint32_t low;
+	if(ps->end - ps->p < 2 || ps->p[0] != '\\' || ps->p[1] != 'u')
+		return fail(ps, "lone surrogate");
+	ps->p += 2;
+	if(!parse_hex4(ps, &low))
+		return false;
+	if(low < 0xdc00 || low > 0xdfff)
+		return fail(ps, "lone surrogate");
+	*cp = 0x10000 + ((*cp - 0xd800) << 10) + (low - 0xdc00);
+	return true;
+}
+
+// Where a string's text goes. Text that doesn't fit is cut at a character boundary.
+typedef struct {
+	char		*buf;
+	size_t		cap;
+	size_t		len;
+	bool		full;
+} text_t;
+
+static void
+text_add(text_t *text, const char *str, size_t n, bool can_split) {
+	if(!text->buf || text->full)
+		return;
+	size_t room = text->cap - 1 - text->len;
+	if(n > room) {
+		text->full = true;
+		if(!can_split)
+			return;
+		n = room;
+	}
+	memcpy(text->buf + text->len, str, n);
+	text->len += n;
+}
+
+// Parses a string starting at its opening quote. With a NULL `out`, it is only checked.
+static bool
+parse_string(parser_t *ps, char *out, size_t cap) {
+	if(ps->p >= ps->end || *ps->p != '"')
+		return fail(ps, "expected a string");
+	ps->p += 1;
+
+	text_t text = {.buf = cap ? out : NULL, .cap = cap};
+	for(;;) {
+		const char *run = ps->p;
+		ps->p = scan_plain(ps->p, ps->end);
+		text_add(&text, run, ps->p - run, true);
+		if(ps->p >= ps->end)
+			return fail(ps, "unterminated string");
+
+		uint8_t c = (uint8_t)*ps->p;
+		if(c == '"') {
+			ps->p += 1;
+			break;
+		}
+		if(c < 0x20)
+			return fail(ps, "control character in string");
+
+		char utf8[4];
+		size_t n;
+		if(c == '\\') {
+			uint32_t cp;
+			ps->p += 1;
+			if(!parse_escape(ps, &cp))
+				return false;
+			n = utf8_encode(cp, utf8);
+		} else {
+			n = utf8_len((const uint8_t *)ps->p, ps->end - ps->p);
+			if(!n)
+				return fail(ps, "invalid UTF-8");
+			memcpy(utf8, ps->p, n);
+			ps->p += n;
+		}
+		text_add(&text, utf8, n, false);
+	}
+	if(text.buf)
+		text.buf[text.len] = '\0';
+	return true;
+}
+
+// Checks a number against the JSON grammar. `num` is only set when it is an integer that fits.
+static bool
+parse_number(parser_t *ps, int64_t *num, bool *is_int) {
+	const char *p = ps->p, *end = ps->end;
+	bool neg = false, overflow = false;
+	uint64_t mag = 0;
+
+	if(p < end && *p == '-') {
+		neg = true;
+		p += 1;
+	}
+	if(p >= end || *p < '0' || *p > '9')
+		return fail(ps, "bad number");
+	if(*p == '0') {
+		p += 1;
+	} else {
+		for(; p < end && *p >= '0' && *p <= '9'; ++p) {
+			uint64_t digit = (uint64_t)(*p - '0');
+			if(mag > (UINT64_MAX - digit) / 10)
+				overflow = true;
+			else
+				mag = mag * 10 + digit;
+		}
+	}
+
+	*is_int = true;
+	if(p < end && *p == '.') {
+		*is_int = false;
+		p += 1;
+		if(p >= end || *p < '0' || *p > '9')
+			return fail(ps, "bad number");
+		while(p < end && *p >= '0' && *p <= '9') p += 1;
+	}
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		*is_int = false;
+		p += 1;
+		if(p < end && (*p == '+' || *p == '-')) p += 1;
+		if(p >= end || *p < '0' || *p > '9')
+			return fail(ps, "bad number");
+		while(p < end && *p >= '0' && *p <= '9') p += 1;
+	}
+	ps->p = p;
+
+	if(overflow || mag > (uint64_t)INT64_MAX + (neg ? 1 : 0))
+		*is_int = false;
+	else if(*is_int)
+		*num = neg ? (int64_t)(0 - mag) : (int64_t)mag;
+	return true;
+}
+
+static bool
+parse_literal(parser_t *ps, const char *lit) {
+	size_t len = strlen(lit);
+	if((size_t)(ps->end - ps->p) < len || memcmp(ps->p, lit, len))
+		return fail(ps, "bad literal");
+	ps->p += len;
+	return true;
+}
+
+static bool
+parse_bool(parser_t *ps, bool *value) {
+	if(ps->p < ps->end && *ps->p == 't') {
+		*value = true;
+		return parse_literal(ps, "true");
+	}
+	*value = false;
+	if(ps->p < ps->end && *ps->p == 'f')
+		return parse_literal(ps, "false");
+	return fail(ps, "expected true or false");
+}
+
+static bool
+skip_value(parser_t *ps, int depth);
+
+static bool
+skip_container(parser_t *ps, char close, bool keys, int depth) {
+	if(depth >= MAX_DEPTH)
+		return fail(ps, "too deeply nested");
+	ps->p += 1;
+	skip_ws(ps);
+	if(ps->p < ps->end && *ps->p == close) {
+		ps->p += 1;
+		return true;
+	}
+	for(;;) {
+		skip_ws(ps);
+		if(keys && !(parse_string(ps, NULL, 0) && expect(ps, ':', "expected :")))
+			return false;
+		skip_ws(ps);
+		if(!skip_value(ps, depth + 1))
+			return false;
+		skip_ws(ps);
+		if(ps->p < ps->end && *ps->p == ',') {
+			ps->p += 1;
+			continue;
+		}
+		return expect(ps, close, keys ? "expected , or }" : "expected , or ]");
+	}
+}
+
+static bool
+skip_value(parser_t *ps, int depth) {
+	if(ps->p >= ps->end)
+		return fail(ps, "expected a value");
+	int64_t num;
+	bool is_int;
+	switch(*ps->p) {
+	case '"': return parse_string(ps, NULL, 0);
+	case '{': return skip_container(ps, '}', true, depth);
+	case '[': return skip_container(ps, ']', false, depth);
+	case 't': return parse_literal(ps, "true");
+	case 'f': return parse_literal(ps, "false");
+	case 'n': return parse_literal(ps, "null");
+	case '-': return parse_number(ps, &num, &is_int);
+	default: break;
+	}
+	if(*ps->p >= '0' && *ps->p <= '9')
+		return parse_number(ps, &num, &is_int);
+	return fail(ps, "expected a value");
+}
+
+// A vehicle being parsed, with room for its text. `veh` points into it, so it must not be copied.
+typedef struct {
+	veh_t		veh;
+	char		class[MAX_CLASS_LEN];
+	char		desc[MAX_DESC_LEN];
+} parsed_veh_t;
+
+static bool
+parse_field(parser_t *ps, parsed_veh_t *rec, bool *has_num, bool *has_class) {
+	veh_t *veh = &rec->veh;
+	char key[32];
+	skip_ws(ps);
+	if(!parse_string(ps, key, sizeof(key)) || !expect(ps, ':', "expected :"))
+		return false;
+	skip_ws(ps);
+
+	if(!strcmp(key, "num")) {
+		bool is_int;
+		if(!parse_number(ps, &veh->num, &is_int))
+			return false;
+		if(!is_int)
+			return fail(ps, "num is not an integer");
+		*has_num = true;
+		return true;
+	}
+	if(!strcmp(key, "in_use"))
+		return parse_bool(ps, &veh->in_use);
+	if(!strcmp(key, "class")) {
+		*has_class = true;
+		return parse_string(ps, rec->class, sizeof(rec->class));
+	}
+	if(!strcmp(key, "desc"))
+		return parse_string(ps, rec->desc, sizeof(rec->desc));
+	return skip_value(ps, 1);
+}
+
+static bool
+parse_vehicle(parser_t *ps, parsed_veh_t *rec) {
+	if(!expect(ps, '{', "expected an object"))
+		return false;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->veh.class = rec->class;
+	rec->veh.desc = rec->desc;
+	bool has_num = false, has_class = false;
+	bool ok = true;
+	skip_ws(ps);
+	if(ps->p < ps->end && *ps->p == '}') {
+		ps->p += 1;
+	} else {
+		for(;;) {
+			if(!(ok = parse_field(ps, rec, &has_num, &has_class)))
+				break;
+			skip_ws(ps);
+			if(ps->p < ps->end && *ps->p == ',') {
+				ps->p += 1;
+				continue;
+			}
+			ok = expect(ps, '}', "expected , or }");
+			break;
+		}
+	}
+
+	skip_ws(ps);
+	if(ok && ps->p != ps->end)
+		ok = fail(ps, "trailing characters");
+	if(ok && !has_num)
+		ok = fail(ps, "no num");
+	if(ok && !has_class)
+		ok = fail(ps, "no class");
+	return ok;
+}
+
+static void
+import_line(db_t *db, const char *line, const char *end, size_t line_no, bool renumber,
+	    ndjson_import_t *res) {
+	parser_t ps = {.p = line, .end = end};
+	skip_ws(&ps);
+	if(ps.p == ps.end)
+		return;
+
+	parsed_veh_t rec;
+	if(!parse_vehicle(&ps, &rec)) {
+		if(!res->invalid++) {
+			res->error_line = line_no;
+			snprintf(res->error, sizeof(res->error), "%s", ps.err);
+		}
+		return;
+	}
+	stock_import_veh(db, &rec.veh, renumber, &res->stock);
+}
+
+bool
+ndjson_import_from_file(FILE *f, db_t *db, bool renumber, ndjson_import_t *res) {
+	ASSERT(f != NULL);
+	ASSERT(db != NULL);
+	ASSERT(res != NULL);
+
+	memset(res, 0, sizeof(*res));
+	mem_op_t op = mem_op_begin(MEM_OP_LOAD);
+
+	size_t cap = IN_BUF_SIZE, len = 0, line_no = 0;
+	char *buf = mem_calloc(cap, 1);
+	bool ok = true;
+	for(;;) {
+		size_t n = fread(buf + len, 1, cap - len, f);
+		len += n;
+		bool eof = n == 0;
+		if(eof && ferror(f)) {
+			ok = false;
+			break;
+		}
+
+		const char *start = buf, *end = buf + len;
+		const char *nl;
+		while((nl = memchr(start, '\n', end - start)) != NULL) {
+			import_line(db, start, nl, ++line_no, renumber, res);
+			start = nl + 1;
+		}
+		if(eof) {
+			if(start < end)
+				import_line(db, start, end, ++line_no, renumber, res);
+			break;
+		}
+
+		// Keep the partial line for the next read, making room if it fills the buffer
+		len = end - start;
+		memmove(buf, start, len);
+		if(len == cap) {
+			cap *= 2;
+			buf = mem_realloc(buf, cap);
+		}
+	}
+	free(buf);
+	mem_op_end(op);
+	return ok;
+}
+
+bool
+ndjson_import_from_path(const char *path, db_t *db, bool renumber, ndjson_import_t *res) {
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+	bool ok = ndjson_import_from_file(f, db, renumber, res);
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,43 @@
+/*===--------------------------------------------------------------------------------------------===
+ * ndjson.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _NDJSON_H_
+#define _NDJSON_H_
+
+#include "stock.h"
+
+// Vehicles as newline-delimited JSON, one object per line:
+//
+//     {"num":91850460001,"in_use":true,"class":"Re 460","desc":"Lok 2000",
+//      "type":"locomotive","class_desc":"..."}
+//
+// `type` and `class_desc` are derived from the class, so they are written for other systems to
+// read but ignored on import, where they are worked out again. Only `num` and `class` are required,
+// and keys the DB doesn't know about are checked and skipped.
+
+typedef struct {
+	stock_import_t	stock;
+	size_t		invalid;	// lines that aren't a valid vehicle object
+	size_t		error_line;	// the first of them, 0 if there was none
+	char		error[64];
+} ndjson_import_t;
+
+// Validates and imports a stream in one pass, without building a document tree. Invalid lines are
+// counted and skipped. Returns false only if the stream could not be read.
+bool
+ndjson_import_from_file(FILE *f, db_t *db, bool renumber, ndjson_import_t *res);
+
+bool
+ndjson_import_from_path(const char *path, db_t *db, bool renumber, ndjson_import_t *res);
+
+// Writes the DB in running-number order, through a fixed-size buffer.
+bool
+ndjson_write_to_file(FILE *f, const db_t *db);
+
+#endif /* ifndef _NDJSON_H_ */
@@ -0,0 +1,150 @@
+/*===--------------------------------------------------------------------------------------------===
+ * net.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _NET_H_
+#define _NET_H_
+
+#include "stock.h"
+
+// Every message on the socket is framed as a little-endian u32 payload length, followed by a one
+// byte opcode and the payload itself. Strings are sent as a u8 length and the raw bytes.
+//
+//	PUT	i64 num, u8 in_use, str class, str desc	add a vehicle
+//	DEL	i64 num					delete a vehicle
+//	IN_USE	i64 num, u8 in_use			toggle a vehicle's in-use flag
+//	SYNC	-					end of the snapshot sent on connect
+//	EDIT	i64 old num, then the fields of PUT	change or renumber a vehicle
+//	MOVE	u32 count, count * (i64 old, i64 new)	renumber vehicles all at once
+//	REJECT	u8 gone, then the fields of PUT		the daemon's own version of a vehicle
+//
+// A MOVE carries every renumbering of a batch, because vehicles in a batch can trade numbers and
+// moves applied one by one would collide. It is applied as a batch too, whole or not at all, and
+// is the one message allowed past MSG_MAX_SIZE.
+//
+// The daemon applies whatever its clients send, and forwards the change to every other client.
+// A message that doesn't fit the receiving copy of the DB, such as a PUT of a number that is
+// already taken or an EDIT of a vehicle that is gone, is refused rather than merged. The daemon
+// then answers the client that sent it with a REJECT for every number the message touched, and
+// the client takes the daemon's version of each, so that both copies agree again.
+typedef enum {
+	MSG_PUT		= 1,
+	MSG_DEL		= 2,
+	MSG_IN_USE	= 3,
+	MSG_SYNC	= 4,
+	MSG_EDIT	= 5,
+	MSG_MOVE	= 6,
+	MSG_REJECT	= 7,
+} msg_op_t;
+
+#define MSG_HEADER_SIZE	(5)
+#define MSG_MAX_SIZE	(1024)
+#define MSG_MAX_MOVES	(1 << 22)
+
+typedef struct {
+	uint8_t		*data;
+	size_t		len;
+	size_t		cap;
+} buf_t;
+
+typedef struct {
+	veh_num_t	old_num;
+	veh_num_t	num;
+} msg_move_t;
+
+// `veh.class` and `veh.desc` point into the message's own text, so a msg_t must not be copied.
+// The moves of a MOVE are allocated, and released by msg_fini().
+typedef struct {
+	msg_op_t	op;
+	veh_num_t	old_num;
+	veh_t		veh;
+	char		class[MAX_CLASS_LEN];
+	char		desc[MAX_DESC_LEN];
+	msg_move_t	*moves;
+	size_t		num_moves;
+	bool		gone;		// a REJECT of a number the daemon has no vehicle for
+} msg_t;
+
+void
+buf_reserve(buf_t *buf, size_t extra);
+
+void
+buf_consume(buf_t *buf, size_t count);
+
+void
+buf_fini(buf_t *buf);
+
+bool
+net_socket_path(const char *db_path, char *path, size_t cap);
+
+void
+msg_put_veh(buf_t *out, const veh_t *veh);
+
+void
+msg_put_edit(buf_t *out, veh_num_t old_num, const veh_t *veh);
+
+void
+msg_put_del(buf_t *out, veh_num_t num);
+
+void
+msg_put_in_use(buf_t *out, veh_num_t num, bool in_use);
+
+void
+msg_put_sync(buf_t *out);
+
+// Encodes the moves a batch just made, while DB_EV_RENUMBER is told. A batch of more than
+// MSG_MAX_MOVES moves is split over several messages, each of them applied whole.
+void
+msg_put_moves(buf_t *out, const db_t *db);
+
+// Encodes a DB observer event as the messages that replay it on another copy of the DB.
+void
+msg_put_event(buf_t *out, const db_t *db, db_event_t ev, const veh_t *veh, veh_num_t old_num);
+
+// Returns 1 and consumes a message from `in` if a full one is buffered, 0 if more data is needed
+// and -1 if the stream is malformed.
+int
+msg_next(buf_t *in, msg_t *msg);
+
+// Answers a message the DB refused with a REJECT for each running number it touched.
+void
+msg_put_rejects(buf_t *out, const db_t *db, const msg_t *msg);
+
+void
+msg_fini(msg_t *msg);
+
+// Returns false, and leaves the DB as it is, if the message conflicts with it. `*conflict` is then
+// the running number at fault.
+bool
+msg_apply(db_t *db, const msg_t *msg, veh_num_t *conflict);
+
+int
+server_run(const char *db_path);
+
+typedef struct client_s client_t;
+
+// Works on the copy of the DB a daemon serves for `db_path`, if one does. Local edits are sent
+// to the daemon as they are made, and changes from other clients merged in by client_pump().
+// `*served` tells whether a daemon answered at all; if it did and NULL is returned, it hung up
+// before the whole DB was sent, and `db` is left empty.
+client_t *
+client_connect(const char *db_path, db_t *db, bool *served);
+
+int
+client_fd(const client_t *client);
+
+// The client's UI pump. If the daemon goes away, the pump switches to watching the DB file.
+bool
+client_pump(void *client);
+
+// If the daemon went away during the session, writes the DB back to the file. Returns false if
+// that failed.
+bool
+client_close(client_t *client);
+
+#endif /* ifndef _NET_H_ */
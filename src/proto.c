@@ -0,0 +1,396 @@
+/*===--------------------------------------------------------------------------------------------===
+ * proto.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "net.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+buf_reserve(buf_t *buf, size_t extra) {
+	if(buf->len + extra <= buf->cap)
+		return;
+	buf->cap = MAX(buf->cap * 2, buf->len + extra);
+	buf->cap = MAX(buf->cap, 4096);
+	buf->data = safe_realloc(buf->data, buf->cap);
+}
+
+void
+buf_consume(buf_t *buf, size_t count) {
+	ASSERT(count <= buf->len);
+	memmove(buf->data, buf->data + count, buf->len - count);
+	buf->len -= count;
+}
+
+void
+buf_fini(buf_t *buf) {
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->cap = 0;
+}
+
+bool
+net_socket_path(const char *db_path, char *path, size_t cap) {
+	int len = snprintf(path, cap, "%s.sock", db_path);
+	return len > 0 && (size_t)len < cap;
+}
+
+static void
+put_u8(buf_t *out, uint8_t v) {
+	out->data[out->len++] = v;
+}
+
+static void
+put_u32(buf_t *out, uint32_t v) {
+	for(int i = 0; i < 4; ++i)
+		put_u8(out, (v >> (8 * i)) & 0xff);
+}
+
+static void
+put_u64(buf_t *out, uint64_t v) {
+	for(int i = 0; i < 8; ++i)
+		put_u8(out, (v >> (8 * i)) & 0xff);
+}
+
+static void
+put_str(buf_t *out, const char *str, size_t max) {
+	size_t len = strnlen(str, max);
+	put_u8(out, (uint8_t)len);
+	memcpy(out->data + out->len, str, len);
+	out->len += len;
+}
+
+static size_t
+msg_begin(buf_t *out, msg_op_t op) {
+	buf_reserve(out, MSG_MAX_SIZE);
+	size_t start = out->len;
+	put_u32(out, 0);
+	put_u8(out, op);
+	return start;
+}
+
+static void
+msg_end(buf_t *out, size_t start) {
+	uint32_t size = (uint32_t)(out->len - start - MSG_HEADER_SIZE);
+	for(int i = 0; i < 4; ++i)
+		out->data[start + i] = (size >> (8 * i)) & 0xff;
+}
+
+static void
+put_veh(buf_t *out, const veh_t *veh) {
+	put_u64(out, (uint64_t)veh->num);
+	put_u8(out, veh->in_use);
+	put_str(out, veh->class, MAX_CLASS_LEN - 1);
+	put_str(out, veh->desc, MAX_DESC_LEN - 1);
+}
+
+void
+msg_put_veh(buf_t *out, const veh_t *veh) {
+	size_t start = msg_begin(out, MSG_PUT);
+	put_veh(out, veh);
+	msg_end(out, start);
+}
+
+void
+msg_put_edit(buf_t *out, veh_num_t old_num, const veh_t *veh) {
+	size_t start = msg_begin(out, MSG_EDIT);
+	put_u64(out, (uint64_t)old_num);
+	put_veh(out, veh);
+	msg_end(out, start);
+}
+
+void
+msg_put_del(buf_t *out, veh_num_t num) {
+	size_t start = msg_begin(out, MSG_DEL);
+	put_u64(out, (uint64_t)num);
+	msg_end(out, start);
+}
+
+void
+msg_put_in_use(buf_t *out, veh_num_t num, bool in_use) {
+	size_t start = msg_begin(out, MSG_IN_USE);
+	put_u64(out, (uint64_t)num);
+	put_u8(out, in_use);
+	msg_end(out, start);
+}
+
+void
+msg_put_sync(buf_t *out) {
+	msg_end(out, msg_begin(out, MSG_SYNC));
+}
+
+void
+msg_put_moves(buf_t *out, const db_t *db) {
+	size_t count;
+	const stock_move_t *moves = stock_db_moves(db, &count);
+	for(size_t first = 0; first < count; first += MSG_MAX_MOVES) {
+		size_t n = MIN(count - first, MSG_MAX_MOVES);
+		size_t start = msg_begin(out, MSG_MOVE);
+		buf_reserve(out, 4 + n * 16);
+		put_u32(out, (uint32_t)n);
+		for(size_t i = first; i < first + n; ++i) {
+			put_u64(out, (uint64_t)moves[i].old_num);
+			put_u64(out, (uint64_t)moves[i].veh->num);
+		}
+		msg_end(out, start);
+	}
+}
+
+static void
+msg_put_reject(buf_t *out, const db_t *db, veh_num_t num) {
+	const veh_t *veh = stock_db_get(db, num);
+	size_t start = msg_begin(out, MSG_REJECT);
+	put_u8(out, veh == NULL);
+	if(veh) {
+		put_veh(out, veh);
+	} else {
+		veh_t gone = {.num = num, .class = "", .desc = ""};
+		put_veh(out, &gone);
+	}
+	msg_end(out, start);
+}
+
+void
+msg_put_rejects(buf_t *out, const db_t *db, const msg_t *msg) {
+	switch(msg->op) {
+	case MSG_MOVE:
+		for(size_t i = 0; i < msg->num_moves; ++i) {
+			msg_put_reject(out, db, msg->moves[i].old_num);
+			msg_put_reject(out, db, msg->moves[i].num);
+		}
+		break;
+	case MSG_EDIT:
+		msg_put_reject(out, db, msg->old_num);
+		if(msg->old_num != msg->veh.num)
+			msg_put_reject(out, db, msg->veh.num);
+		break;
+	case MSG_SYNC:
+		break;
+	default:
+		msg_put_reject(out, db, msg->veh.num);
+		break;
+	}
+}
+
+void
+msg_put_event(buf_t *out, const db_t *db, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	switch(ev) {
+	case DB_EV_UPDATE:
+		msg_put_edit(out, old_num, veh);
+		break;
+	case DB_EV_ADD:
+		msg_put_veh(out, veh);
+		break;
+	case DB_EV_DELETE:
+		msg_put_del(out, veh->num);
+		break;
+	case DB_EV_IN_USE:
+		msg_put_in_use(out, veh->num, veh->in_use);
+		break;
+	case DB_EV_RENUMBER:
+		msg_put_moves(out, db);
+		break;
+	}
+}
+
+typedef struct {
+	const uint8_t	*data;
+	size_t		len;
+	bool		error;
+} reader_t;
+
+static uint8_t
+get_u8(reader_t *r) {
+	if(r->len < 1) {
+		r->error = true;
+		return 0;
+	}
+	r->len -= 1;
+	return *r->data++;
+}
+
+static uint32_t
+get_u32(reader_t *r) {
+	uint32_t v = 0;
+	for(int i = 0; i < 4; ++i)
+		v |= (uint32_t)get_u8(r) << (8 * i);
+	return v;
+}
+
+static uint64_t
+get_u64(reader_t *r) {
+	uint64_t v = 0;
+	for(int i = 0; i < 8; ++i)
+		v |= (uint64_t)get_u8(r) << (8 * i);
+	return v;
+}
+
+static void
+get_str(reader_t *r, char *dest, size_t cap) {
+	size_t len = get_u8(r);
+	if(len >= cap || len > r->len) {
+		r->error = true;
+		return;
+	}
+	memcpy(dest, r->data, len);
+	dest[len] = '\0';
+	r->data += len;
+	r->len -= len;
+}
+
+int
+msg_next(buf_t *in, msg_t *msg) {
+	if(in->len < MSG_HEADER_SIZE)
+		return 0;
+
+	reader_t r = {.data = in->data, .len = MSG_HEADER_SIZE};
+	uint32_t size = get_u32(&r);
+	uint8_t op = get_u8(&r);
+	if(size > (op == MSG_MOVE ? 4 + (uint32_t)MSG_MAX_MOVES * 16 : MSG_MAX_SIZE))
+		return -1;
+	if(in->len < MSG_HEADER_SIZE + size)
+		return 0;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->veh.class = msg->class;
+	msg->veh.desc = msg->desc;
+	msg->op = op;
+	r.len = size;
+
+	switch(msg->op) {
+	case MSG_EDIT:
+	case MSG_REJECT:
+	case MSG_PUT:
+		if(msg->op == MSG_EDIT)
+			msg->old_num = (veh_num_t)get_u64(&r);
+		else if(msg->op == MSG_REJECT)
+			msg->gone = get_u8(&r) != 0;
+		msg->veh.num = (veh_num_t)get_u64(&r);
+		msg->veh.in_use = get_u8(&r) != 0;
+		get_str(&r, msg->class, sizeof(msg->class));
+		get_str(&r, msg->desc, sizeof(msg->desc));
+		break;
+	case MSG_DEL:
+		msg->veh.num = (veh_num_t)get_u64(&r);
+		break;
+	case MSG_IN_USE:
+		msg->veh.num = (veh_num_t)get_u64(&r);
+		msg->veh.in_use = get_u8(&r) != 0;
+		break;
+	case MSG_SYNC:
+		break;
+	case MSG_MOVE:
+		msg->num_moves = get_u32(&r);
+		if(msg->num_moves > r.len / 16) {
+			r.error = true;
+			break;
+		}
+		msg->moves = safe_calloc(MAX(msg->num_moves, 1), sizeof(*msg->moves));
+		for(size_t i = 0; i < msg->num_moves; ++i) {
+			msg->moves[i].old_num = (veh_num_t)get_u64(&r);
+			msg->moves[i].num = (veh_num_t)get_u64(&r);
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	if(r.error) {
+		msg_fini(msg);
+		return -1;
+	}
+	buf_consume(in, MSG_HEADER_SIZE + size);
+	return 1;
+}
+
+void
+msg_fini(msg_t *msg) {
+	free(msg->moves);
+	msg->moves = NULL;
+	msg->num_moves = 0;
+}
+
+static bool
+apply_moves(db_t *db, const msg_t *msg, veh_num_t *conflict) {
+	stock_batch_t batch;
+	stock_batch_init(&batch);
+	bool ok = true;
+	for(size_t i = 0; ok && i < msg->num_moves; ++i) {
+		veh_t *veh = stock_db_get(db, msg->moves[i].old_num);
+		if(veh)
+			stock_batch_renumber(&batch, veh, msg->moves[i].num);
+		else
+			*conflict = msg->moves[i].old_num;
+		ok = veh != NULL;
+	}
+	ok = ok && stock_db_apply(db, &batch, conflict);
+	stock_batch_fini(&batch);
+	return ok;
+}
+
+// The daemon's version of a vehicle replaces ours, whatever ours is.
+static void
+apply_reject(db_t *db, veh_t *veh, const msg_t *msg) {
+	if(msg->gone) {
+		if(veh)
+			stock_db_delete(db, veh);
+		return;
+	}
+	if(!veh) {
+		stock_db_add(db, &msg->veh);
+		return;
+	}
+	if(strcmp(veh->class, msg->veh.class) || strcmp(veh->desc, msg->veh.desc))
+		stock_db_update(db, veh, &msg->veh);
+	if(veh->in_use != msg->veh.in_use)
+		stock_db_set_in_use(db, veh, msg->veh.in_use);
+}
+
+bool
+msg_apply(db_t *db, const msg_t *msg, veh_num_t *conflict) {
+	veh_t *veh = stock_db_get(db, msg->op == MSG_EDIT ? msg->old_num : msg->veh.num);
+	*conflict = msg->veh.num;
+
+	switch(msg->op) {
+	case MSG_PUT:
+		return !veh && stock_db_add(db, &msg->veh);
+	case MSG_EDIT:
+		if(!veh) {
+			*conflict = msg->old_num;
+			return false;
+		}
+		if(msg->veh.num != veh->num && stock_db_get(db, msg->veh.num))
+			return false;
+		if(msg->veh.num != veh->num || strcmp(veh->class, msg->veh.class) || strcmp(veh->desc, msg->veh.desc))
+			stock_db_update(db, veh, &msg->veh);
+		if(veh->in_use != msg->veh.in_use)
+			stock_db_set_in_use(db, veh, msg->veh.in_use);
+		return true;
+	case MSG_DEL:
+		if(!veh)
+			return false;
+		stock_db_delete(db, veh);
+		return true;
+	case MSG_IN_USE:
+		if(!veh)
+			return false;
+		if(veh->in_use != msg->veh.in_use)
+			stock_db_set_in_use(db, veh, msg->veh.in_use);
+		return true;
+	case MSG_MOVE:
+		return apply_moves(db, msg, conflict);
+	case MSG_REJECT:
+		apply_reject(db, veh, msg);
+		return true;
+	case MSG_SYNC:
+		break;
+	}
+	return true;
+}
@@ -0,0 +1,934 @@
+/*===--------------------------------------------------------------------------------------------===
+ * query.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "query.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define BATCH_SIZE	(256)
+#define MAX_DEPTH	(32)
+#define MAX_STR_LEN	(64)
+
+typedef enum {
+	TOK_END,
+	TOK_IDENT,
+	TOK_NUMBER,
+	TOK_STRING,
+	TOK_LPAREN,
+	TOK_RPAREN,
+	TOK_AND,
+	TOK_OR,
+	TOK_NOT,
+	TOK_EQ,
+	TOK_NE,
+	TOK_LT,
+	TOK_LE,
+	TOK_GT,
+	TOK_GE,
+	TOK_HAS,
+	TOK_HAS_NOT,
+	TOK_ERROR,
+} tok_kind_t;
+
+typedef struct {
+	tok_kind_t	kind;
+	const char	*start;
+	int		len;
+} token_t;
+
+typedef enum {
+	OP_NUM,
+	OP_TYPE,
+	OP_IN_USE,
+	OP_CAPS,
+	OP_TRACTION,
+	OP_CLASS_EQ,
+	OP_CLASS_HAS,
+	OP_DESC_EQ,
+	OP_DESC_HAS,
+	OP_NOT,
+	OP_AND,
+	OP_OR,
+} op_t;
+
+typedef struct {
+	uint8_t		op;
+	uint8_t		cmp;	// token kind for OP_NUM
+	uint32_t	arg;	// type/capability mask, traction, or string index
+	int64_t		value;
+} insn_t;
+
+typedef enum {
+	NODE_LEAF,
+	NODE_NOT,
+	NODE_AND,
+	NODE_OR,
+} node_kind_t;
+
+typedef struct node_s node_t;
+struct node_s {
+	node_kind_t	kind;
+	node_t		*lhs;
+	node_t		*rhs;
+	insn_t		leaf;
+};
+
+struct query_s {
+	insn_t		*code;
+	int		len;
+	int		depth;
+
+	char		(*strings)[MAX_STR_LEN];
+	int		num_strings;
+
+	node_t		*ast;
+};
+
+typedef struct {
+	const char	*src;
+	const char	*cur;
+	token_t		tok;
+
+	query_t		*query;
+	int		cap;
+
+	char		*err;
+	size_t		err_cap;
+	bool		failed;
+} parser_t;
+
+// MARK: - Lexing
+
+static void
+error(parser_t *p, const char *fmt, ...) {
+	if(p->failed)
+		return;
+	p->failed = true;
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(p->err, p->err_cap, fmt, args);
+	va_end(args);
+}
+
+// Bytes of UTF-8 sequences are word characters, so that words like Küche need no quotes.
+static bool
+is_ident_char(char c) {
+	return isalnum((unsigned char)c) || (unsigned char)c >= 0x80
+	    || c == '_' || c == '-' || c == '/';
+}
+
+static void
+next_token(parser_t *p) {
+	while(isspace((unsigned char)*p->cur))
+		p->cur++;
+
+	token_t *tok = &p->tok;
+	tok->start = p->cur;
+	tok->len = 1;
+
+	char c = *p->cur;
+	switch(c) {
+	case '\0':
+		tok->kind = TOK_END;
+		tok->len = 0;
+		return;
+	case '(': tok->kind = TOK_LPAREN; p->cur++; return;
+	case ')': tok->kind = TOK_RPAREN; p->cur++; return;
+	case '~': tok->kind = TOK_HAS; p->cur++; return;
+	case '=': tok->kind = TOK_EQ; p->cur += (p->cur[1] == '=') ? 2 : 1; return;
+	case '<':
+	case '>':
+		tok->kind = c == '<' ? TOK_LT : TOK_GT;
+		if(p->cur[1] == '=') {
+			tok->kind += 1;
+			tok->len = 2;
+		}
+		p->cur += tok->len;
+		return;
+	case '!':
+		tok->kind = TOK_NOT;
+		if(p->cur[1] == '=') {
+			tok->kind = TOK_NE;
+			tok->len = 2;
+		} else if(p->cur[1] == '~') {
+			tok->kind = TOK_HAS_NOT;
+			tok->len = 2;
+		}
+		p->cur += tok->len;
+		return;
+	case '&':
+	case '|':
+		if(p->cur[1] != c)
+			break;
+		tok->kind = c == '&' ? TOK_AND : TOK_OR;
+		tok->len = 2;
+		p->cur += 2;
+		return;
+	case '"':
+		tok->kind = TOK_STRING;
+		tok->start = ++p->cur;
+		while(*p->cur && *p->cur != '"')
+			p->cur++;
+		if(!*p->cur) {
+			error(p, "unterminated string");
+			tok->kind = TOK_ERROR;
+			return;
+		}
+		tok->len = (int)(p->cur - tok->start);
+		p->cur++;
+		return;
+	default:
+		break;
+	}
+
+	if(isdigit((unsigned char)c)) {
+		tok->kind = TOK_NUMBER;
+		while(isdigit((unsigned char)*p->cur))
+			p->cur++;
+		// Something like 4/4 is a word, not a number
+		if(is_ident_char(*p->cur))
+			tok->kind = TOK_IDENT;
+		while(is_ident_char(*p->cur))
+			p->cur++;
+		tok->len = (int)(p->cur - tok->start);
+		return;
+	}
+	if(is_ident_char(c)) {
+		while(is_ident_char(*p->cur))
+			p->cur++;
+		tok->len = (int)(p->cur - tok->start);
+		tok->kind = TOK_IDENT;
+		if(tok->len == 3 && !strncasecmp(tok->start, "and", 3))
+			tok->kind = TOK_AND;
+		else if(tok->len == 2 && !strncasecmp(tok->start, "or", 2))
+			tok->kind = TOK_OR;
+		else if(tok->len == 3 && !strncasecmp(tok->start, "not", 3))
+			tok->kind = TOK_NOT;
+		return;
+	}
+
+	error(p, "unexpected '%c'", c);
+	tok->kind = TOK_ERROR;
+}
+
+static bool
+tok_is(const token_t *tok, const char *word) {
+	return (int)strlen(word) == tok->len && !strncasecmp(tok->start, word, tok->len);
+}
+
+// MARK: - Parsing
+
+typedef struct {
+	const char	*name;
+	uint32_t	value;
+} keyword_t;
+
+static const keyword_t type_words[] = {
+	{"unknown", VEH_TYPE_BIT(VEH_TYPE_UNKNOWN)},
+	{"lok", VEH_TYPE_BIT(VEH_TYPE_LOK)},
+	{"loco", VEH_TYPE_BIT(VEH_TYPE_LOK)},
+	{"locomotive", VEH_TYPE_BIT(VEH_TYPE_LOK)},
+	{"van", VEH_TYPE_BIT(VEH_TYPE_VAN)},
+	{"coach", VEH_TYPE_BIT(VEH_TYPE_COACH)},
+	{"wagon", VEH_TYPE_BIT(VEH_TYPE_WAGON)},
+	{"control", VEH_TYPE_BIT(VEH_TYPE_CONTROL)},
+	{"railcar", VEH_TYPE_BIT(VEH_TYPE_RAILCAR)},
+	{"traction", VEH_TYPE_BIT(VEH_TYPE_LOK) | VEH_TYPE_BIT(VEH_TYPE_RAILCAR)},
+	{NULL, 0},
+};
+
+static const keyword_t cap_words[] = {
+	{"elec", LOK_ELEC},
+	{"electric", LOK_ELEC},
+	{"diesel", LOK_DIESEL},
+	{"rack", LOK_RACK},
+	{"narrow", LOK_NARROW},
+	{"first", PAX_FIRST},
+	{"second", PAX_SECOND},
+	{"restaurant", PAX_RESTAURANT},
+	{"panoramic", PAX_PANORAMIC},
+	{"luggage", LUGGAGE_VAN},
+	{NULL, 0},
+};
+
+static const keyword_t traction_words[] = {
+	{"none", TRACTION_NONE},
+	{"steam", TRACTION_STEAM},
+	{"elec", TRACTION_ELEC},
+	{"electric", TRACTION_ELEC},
+	{"diesel", TRACTION_DIESEL},
+	{"electro-diesel", TRACTION_ELECTRO_DIESEL},
+	{NULL, 0},
+};
+
+static bool
+lookup_word(const keyword_t *words, const token_t *tok, uint32_t *value) {
+	for(const keyword_t *w = words; w->name; ++w) {
+		if(!tok_is(tok, w->name)) continue;
+		*value = w->value;
+		return true;
+	}
+	return false;
+}
+
+static node_t *
+new_node(node_kind_t kind, node_t *lhs, node_t *rhs) {
+	node_t *node = safe_calloc(1, sizeof(*node));
+	node->kind = kind;
+	node->lhs = lhs;
+	node->rhs = rhs;
+	return node;
+}
+
+static void
+free_node(node_t *node) {
+	if(!node)
+		return;
+	free_node(node->lhs);
+	free_node(node->rhs);
+	free(node);
+}
+
+static node_t *
+new_leaf(op_t op, uint32_t arg) {
+	node_t *node = new_node(NODE_LEAF, NULL, NULL);
+	node->leaf.op = op;
+	node->leaf.arg = arg;
+	return node;
+}
+
+static int
+add_string(parser_t *p, const token_t *tok) {
+	query_t *q = p->query;
+	q->strings = safe_realloc(q->strings, (q->num_strings + 1) * sizeof(*q->strings));
+	int len = MIN(tok->len, MAX_STR_LEN - 1);
+	memcpy(q->strings[q->num_strings], tok->start, len);
+	q->strings[q->num_strings][len] = '\0';
+	return q->num_strings++;
+}
+
+static node_t *parse_or(parser_t *p);
+
+static node_t *
+negate_if(node_t *node, bool negate) {
+	return negate ? new_node(NODE_NOT, node, NULL) : node;
+}
+
+static node_t *
+parse_term(parser_t *p) {
+	token_t field = p->tok;
+	if(field.kind != TOK_IDENT) {
+		error(p, "expected a field name");
+		return NULL;
+	}
+	next_token(p);
+
+	// in_use on its own is a predicate
+	if(tok_is(&field, "in_use") || tok_is(&field, "inuse")) {
+		if(p->tok.kind != TOK_EQ && p->tok.kind != TOK_NE)
+			return new_leaf(OP_IN_USE, 0);
+		bool negate = p->tok.kind == TOK_NE;
+		next_token(p);
+		bool value = tok_is(&p->tok, "1") || tok_is(&p->tok, "true") || tok_is(&p->tok, "yes");
+		if(!value && !tok_is(&p->tok, "0") && !tok_is(&p->tok, "false") && !tok_is(&p->tok, "no")) {
+			error(p, "in_use compares with true or false");
+			return NULL;
+		}
+		next_token(p);
+		return negate_if(new_leaf(OP_IN_USE, 0), negate == value);
+	}
+
+	tok_kind_t cmp = p->tok.kind;
+	if(cmp < TOK_EQ || cmp > TOK_HAS_NOT) {
+		error(p, "expected a comparison after '%.*s'", field.len, field.start);
+		return NULL;
+	}
+	next_token(p);
+	token_t value = p->tok;
+	if(value.kind != TOK_IDENT && value.kind != TOK_NUMBER && value.kind != TOK_STRING) {
+		error(p, "expected a value after '%.*s'", field.len, field.start);
+		return NULL;
+	}
+	next_token(p);
+
+	bool is_eq = cmp == TOK_EQ || cmp == TOK_NE;
+	bool is_has = cmp == TOK_HAS || cmp == TOK_HAS_NOT;
+	bool negate = cmp == TOK_NE || cmp == TOK_HAS_NOT;
+	uint32_t arg = 0;
+
+	if(tok_is(&field, "num")) {
+		if(value.kind != TOK_NUMBER || is_has) {
+			error(p, "num compares with a number");
+			return NULL;
+		}
+		node_t *node = new_leaf(OP_NUM, 0);
+		node->leaf.cmp = cmp;
+		node->leaf.value = strtoll(value.start, NULL, 10);
+		return node;
+	}
+	if(tok_is(&field, "class") || tok_is(&field, "desc")) {
+		if(!is_eq && !is_has) {
+			error(p, "'%.*s' compares with =, !=, ~ or !~", field.len, field.start);
+			return NULL;
+		}
+		bool is_class = tok_is(&field, "class");
+		op_t op = is_class ? (is_has ? OP_CLASS_HAS : OP_CLASS_EQ) : (is_has ? OP_DESC_HAS : OP_DESC_EQ);
+		return negate_if(new_leaf(op, add_string(p, &value)), negate);
+	}
+
+	const keyword_t *words = NULL;
+	op_t op;
+	if(tok_is(&field, "type")) {
+		words = type_words;
+		op = OP_TYPE;
+	} else if(tok_is(&field, "has")) {
+		words = cap_words;
+		op = OP_CAPS;
+	} else if(tok_is(&field, "traction")) {
+		words = traction_words;
+		op = OP_TRACTION;
+	} else {
+		error(p, "unknown field '%.*s'", field.len, field.start);
+		return NULL;
+	}
+
+	if(!is_eq) {
+		error(p, "'%.*s' compares with = or !=", field.len, field.start);
+		return NULL;
+	}
+	if(!lookup_word(words, &value, &arg)) {
+		error(p, "unknown %.*s '%.*s'", field.len, field.start, value.len, value.start);
+		return NULL;
+	}
+	return negate_if(new_leaf(op, arg), negate);
+}
+
+static node_t *
+parse_unary(parser_t *p) {
+	if(p->tok.kind == TOK_NOT) {
+		next_token(p);
+		node_t *node = parse_unary(p);
+		return node ? new_node(NODE_NOT, node, NULL) : NULL;
+	}
+	if(p->tok.kind == TOK_LPAREN) {
+		next_token(p);
+		node_t *node = parse_or(p);
+		if(node && p->tok.kind != TOK_RPAREN) {
+			error(p, "expected ')'");
+			free_node(node);
+			return NULL;
+		}
+		next_token(p);
+		return node;
+	}
+	return parse_term(p);
+}
+
+static node_t *
+parse_and(parser_t *p) {
+	node_t *lhs = parse_unary(p);
+	while(lhs && p->tok.kind == TOK_AND) {
+		next_token(p);
+		node_t *rhs = parse_unary(p);
+		if(!rhs) {
+			free_node(lhs);
+			return NULL;
+		}
+		lhs = new_node(NODE_AND, lhs, rhs);
+	}
+	return lhs;
+}
+
+static node_t *
+parse_or(parser_t *p) {
+	node_t *lhs = parse_and(p);
+	while(lhs && p->tok.kind == TOK_OR) {
+		next_token(p);
+		node_t *rhs = parse_and(p);
+		if(!rhs) {
+			free_node(lhs);
+			return NULL;
+		}
+		lhs = new_node(NODE_OR, lhs, rhs);
+	}
+	return lhs;
+}
+
+// MARK: - Code generation
+
+static void
+emit(parser_t *p, insn_t insn) {
+	query_t *q = p->query;
+	if(q->len == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 16;
+		q->code = safe_realloc(q->code, p->cap * sizeof(*q->code));
+	}
+	q->code[q->len++] = insn;
+}
+
+static int
+gen_code(parser_t *p, const node_t *node) {
+	switch(node->kind) {
+	case NODE_LEAF:
+		emit(p, node->leaf);
+		return 1;
+	case NODE_NOT: {
+		int depth = gen_code(p, node->lhs);
+		emit(p, (insn_t){.op = OP_NOT});
+		return depth;
+	}
+	case NODE_AND:
+	case NODE_OR: {
+		int lhs = gen_code(p, node->lhs);
+		int rhs = gen_code(p, node->rhs);
+		emit(p, (insn_t){.op = node->kind == NODE_AND ? OP_AND : OP_OR});
+		return MAX(lhs, rhs + 1);
+	}
+	}
+	return 0;
+}
+
+query_t *
+query_compile(const char *src, char *err, size_t err_cap) {
+	ASSERT(src != NULL);
+
+	parser_t p = {
+		.src = src,
+		.cur = src,
+		.err = err,
+		.err_cap = err_cap,
+		.query = safe_calloc(1, sizeof(query_t)),
+	};
+	next_token(&p);
+
+	node_t *ast = parse_or(&p);
+	if(ast && p.tok.kind != TOK_END)
+		error(&p, "unexpected '%.*s'", p.tok.len, p.tok.start);
+	if(!ast || p.failed) {
+		free_node(ast);
+		query_free(p.query);
+		return NULL;
+	}
+
+	p.query->ast = ast;
+	p.query->depth = gen_code(&p, ast);
+	if(p.query->depth > MAX_DEPTH) {
+		error(&p, "expression is too deeply nested");
+		query_free(p.query);
+		return NULL;
+	}
+	return p.query;
+}
+
+void
+query_free(query_t *query) {
+	if(!query)
+		return;
+	free_node(query->ast);
+	free(query->code);
+	free(query->strings);
+	free(query);
+}
+
+// MARK: - Evaluation
+
+static bool
+str_has(const char *haystack, const char *needle) {
+	size_t len = strlen(needle);
+	for(; *haystack; ++haystack) {
+		if(!strncasecmp(haystack, needle, len))
+			return true;
+	}
+	return len == 0;
+}
+
+static void
+eval_num(const insn_t *insn, const stock_cols_t *cols, const size_t *slots, int n, uint8_t *out) {
+	int64_t v = insn->value;
+	switch(insn->cmp) {
+	case TOK_EQ: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] == v; break;
+	case TOK_NE: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] != v; break;
+	case TOK_LT: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] < v; break;
+	case TOK_LE: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] <= v; break;
+	case TOK_GT: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] > v; break;
+	case TOK_GE: for(int i = 0; i < n; ++i) out[i] = cols->num[slots[i]] >= v; break;
+	}
+}
+
+// Runs the whole program over one batch of record slots. Each instruction loops over the batch, so
+// dispatch is paid once per batch rather than once per record.
+static void
+eval_batch(const query_t *q, const stock_cols_t *cols, const size_t *slots, int n, uint8_t *res) {
+	static _Thread_local uint8_t stack[MAX_DEPTH][BATCH_SIZE];
+	int sp = 0;
+
+	for(int pc = 0; pc < q->len; ++pc) {
+		const insn_t *insn = &q->code[pc];
+		uint8_t *out = stack[sp];
+
+		switch(insn->op) {
+		case OP_NUM:
+			eval_num(insn, cols, slots, n, out);
+			break;
+		case OP_TYPE:
+			for(int i = 0; i < n; ++i)
+				out[i] = (insn->arg >> cols->type[slots[i]]) & 1u;
+			break;
+		case OP_IN_USE:
+			for(int i = 0; i < n; ++i)
+				out[i] = cols->in_use[slots[i]];
+			break;
+		case OP_CAPS:
+			for(int i = 0; i < n; ++i)
+				out[i] = (cols->caps[slots[i]] & insn->arg) == insn->arg;
+			break;
+		case OP_TRACTION:
+			for(int i = 0; i < n; ++i) {
+				size_t s = slots[i];
+				out[i] = veh_traction(cols->type[s], cols->caps[s]) == insn->arg;
+			}
+			break;
+		case OP_CLASS_EQ:
+			for(int i = 0; i < n; ++i)
+				out[i] = !strcmp(cols->rec[slots[i]]->class, q->strings[insn->arg]);
+			break;
+		case OP_CLASS_HAS:
+			for(int i = 0; i < n; ++i)
+				out[i] = str_has(cols->rec[slots[i]]->class, q->strings[insn->arg]);
+			break;
+		case OP_DESC_EQ:
+			for(int i = 0; i < n; ++i)
+				out[i] = !strcmp(cols->rec[slots[i]]->desc, q->strings[insn->arg]);
+			break;
+		case OP_DESC_HAS:
+			for(int i = 0; i < n; ++i)
+				out[i] = str_has(cols->rec[slots[i]]->desc, q->strings[insn->arg]);
+			break;
+		case OP_NOT:
+			out = stack[sp-1];
+			for(int i = 0; i < n; ++i)
+				out[i] = !out[i];
+			continue;
+		case OP_AND:
+			out = stack[sp-2];
+			for(int i = 0; i < n; ++i)
+				out[i] &= stack[sp-1][i];
+			sp -= 1;
+			continue;
+		case OP_OR:
+			out = stack[sp-2];
+			for(int i = 0; i < n; ++i)
+				out[i] |= stack[sp-1][i];
+			sp -= 1;
+			continue;
+		}
+		sp += 1;
+	}
+	ASSERT(sp == 1);
+	memcpy(res, stack[0], n);
+}
+
+// MARK: - Index selection
+
+typedef enum {
+	SCAN_ALL,
+	SCAN_ONE,
+	SCAN_NUM_RANGE,
+	SCAN_PERM,
+} scan_kind_t;
+
+typedef struct {
+	scan_kind_t	kind;
+	size_t		estimate;
+
+	int64_t		lo;
+	int64_t		hi;
+
+	veh_t *const	*perm;
+	size_t		begin;
+	size_t		end;
+} scan_t;
+
+typedef struct {
+	db_t		*db;
+	int64_t		lo;
+	int64_t		hi;
+	scan_t		best;
+} planner_t;
+
+static void
+offer_scan(planner_t *plan, scan_t scan) {
+	if(scan.estimate < plan->best.estimate)
+		plan->best = scan;
+}
+
+static int
+cmp_type(const veh_t *veh, const void *key) {
+	return (int)veh->type - *(const int *)key;
+}
+
+static int
+cmp_class(const veh_t *veh, const void *key) {
+	return strcmp(veh->class, key);
+}
+
+static size_t
+perm_bound(veh_t *const *perm, size_t count, int (*cmp)(const veh_t *, const void *),
+	   const void *key, bool upper) {
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int res = cmp(perm[mid], key);
+		if(res < 0 || (upper && res == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+offer_perm(planner_t *plan, veh_sort_t sort, int (*cmp)(const veh_t *, const void *), const void *key) {
+	size_t count = stock_db_get_count(plan->db);
+	veh_t *const *perm = stock_db_sorted(plan->db, sort);
+	scan_t scan = {.kind = SCAN_PERM, .perm = perm};
+	scan.begin = perm_bound(perm, count, cmp, key, false);
+	scan.end = perm_bound(perm, count, cmp, key, true);
+	scan.estimate = scan.end - scan.begin;
+	offer_scan(plan, scan);
+}
+
+// Nothing is below INT64_MIN or above INT64_MAX. An empty range stays empty whatever bounds the
+// other leaves add to it.
+static void
+plan_empty(planner_t *plan) {
+	plan->lo = INT64_MAX;
+	plan->hi = INT64_MIN;
+}
+
+static void
+plan_leaf(planner_t *plan, const insn_t *leaf, bool negated) {
+	const db_t *db = plan->db;
+	const stock_stats_t *stats = stock_db_stats(db);
+
+	switch(leaf->op) {
+	case OP_NUM:
+		if(negated) break;
+		switch(leaf->cmp) {
+		case TOK_EQ: plan->lo = MAX(plan->lo, leaf->value); plan->hi = MIN(plan->hi, leaf->value); break;
+		case TOK_LT:
+			if(leaf->value == INT64_MIN)
+				plan_empty(plan);
+			else
+				plan->hi = MIN(plan->hi, leaf->value - 1);
+			break;
+		case TOK_LE: plan->hi = MIN(plan->hi, leaf->value); break;
+		case TOK_GT:
+			if(leaf->value == INT64_MAX)
+				plan_empty(plan);
+			else
+				plan->lo = MAX(plan->lo, leaf->value + 1);
+			break;
+		case TOK_GE: plan->lo = MAX(plan->lo, leaf->value); break;
+		}
+		break;
+	case OP_IN_USE: {
+		// The in-use order puts every vehicle in use first
+		size_t in_use = stats->total[1];
+		scan_t scan = {
+			.kind = SCAN_PERM,
+			.perm = stock_db_sorted(plan->db, VEH_SORT_IN_USE),
+			.begin = negated ? in_use : 0,
+			.end = negated ? stock_db_get_count(db) : in_use,
+		};
+		scan.estimate = scan.end - scan.begin;
+		offer_scan(plan, scan);
+		break;
+	}
+	case OP_TYPE:
+		// Only a single type maps to one contiguous range of the type order
+		if(negated || __builtin_popcount(leaf->arg) != 1) break;
+		{
+			int type = __builtin_ctz(leaf->arg);
+			size_t estimate = stats->by_type[type][0] + stats->by_type[type][1];
+			if(estimate < plan->best.estimate)
+				offer_perm(plan, VEH_SORT_TYPE, cmp_type, &type);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+plan_node(planner_t *plan, const query_t *q, const node_t *node) {
+	switch(node->kind) {
+	case NODE_AND:
+		plan_node(plan, q, node->lhs);
+		plan_node(plan, q, node->rhs);
+		break;
+	case NODE_NOT:
+		if(node->lhs->kind == NODE_LEAF)
+			plan_leaf(plan, &node->lhs->leaf, true);
+		break;
+	case NODE_LEAF:
+		if(node->leaf.op == OP_CLASS_EQ)
+			offer_perm(plan, VEH_SORT_CLASS, cmp_class, q->strings[node->leaf.arg]);
+		else
+			plan_leaf(plan, &node->leaf, false);
+		break;
+	case NODE_OR:
+		break;
+	}
+}
+
+static scan_t
+plan_query(const query_t *q, db_t *db) {
+	size_t count = stock_db_get_count(db);
+	planner_t plan = {
+		.db = db,
+		.lo = INT64_MIN,
+		.hi = INT64_MAX,
+		.best = {.kind = SCAN_ALL, .estimate = count},
+	};
+	plan_node(&plan, q, q->ast);
+
+	if(plan.lo > plan.hi) {
+		offer_scan(&plan, (scan_t){.kind = SCAN_ONE, .estimate = 0, .lo = 1, .hi = 0});
+	} else if(plan.lo == plan.hi) {
+		offer_scan(&plan, (scan_t){.kind = SCAN_ONE, .estimate = 1, .lo = plan.lo, .hi = plan.hi});
+	} else if(plan.lo != INT64_MIN || plan.hi != INT64_MAX) {
+		uint64_t width = (uint64_t)plan.hi - (uint64_t)plan.lo;
+		scan_t scan = {.kind = SCAN_NUM_RANGE, .lo = plan.lo, .hi = plan.hi};
+		scan.estimate = width < count ? (size_t)width + 1 : count;
+		offer_scan(&plan, scan);
+	}
+
+	// Gathering through an index only pays off when it cuts the work down substantially
+	if(plan.best.estimate > count / 2)
+		plan.best = (scan_t){.kind = SCAN_ALL, .estimate = count};
+	return plan.best;
+}
+
+typedef struct {
+	const query_t	*query;
+	const stock_cols_t *cols;
+	uint8_t		*match;
+	size_t		count;
+
+	size_t		slots[BATCH_SIZE];
+	int		n;
+} runner_t;
+
+static void
+run_flush(runner_t *run) {
+	uint8_t res[BATCH_SIZE];
+	eval_batch(run->query, run->cols, run->slots, run->n, res);
+	for(int i = 0; i < run->n; ++i) {
+		run->match[run->slots[i]] = res[i];
+		run->count += res[i];
+	}
+	run->n = 0;
+}
+
+static void
+run_push(runner_t *run, size_t slot) {
+	run->slots[run->n++] = slot;
+	if(run->n == BATCH_SIZE)
+		run_flush(run);
+}
+
+size_t
+query_mark(const query_t *query, db_t *db, uint8_t *match) {
+	ASSERT(query != NULL);
+	ASSERT(db != NULL);
+	ASSERT(match != NULL);
+
+	const stock_cols_t *cols = &db->cols;
+	scan_t scan = plan_query(query, db);
+	runner_t run = {.query = query, .cols = cols, .match = match};
+
+	if(scan.kind != SCAN_ALL)
+		memset(match, 0, cols->count);
+
+	switch(scan.kind) {
+	case SCAN_ALL:
+		for(size_t i = 0; i < cols->count; ++i)
+			run_push(&run, i);
+		break;
+	case SCAN_ONE: {
+		const veh_t *veh = scan.lo <= scan.hi ? stock_db_get(db, scan.lo) : NULL;
+		if(veh)
+			run_push(&run, veh->slot);
+		break;
+	}
+	case SCAN_NUM_RANGE: {
+		veh_t search = {.num = scan.lo};
+		avl_index_t where;
+		veh_t *veh = avl_find(&db->tree, &search, &where);
+		if(!veh)
+			veh = avl_nearest(&db->tree, where, AVL_AFTER);
+		for(; veh && veh->num <= scan.hi; veh = AVL_NEXT(&db->tree, veh))
+			run_push(&run, veh->slot);
+		break;
+	}
+	case SCAN_PERM:
+		for(size_t i = scan.begin; i < scan.end; ++i)
+			run_push(&run, scan.perm[i]->slot);
+		break;
+	}
+	if(run.n)
+		run_flush(&run);
+	return run.count;
+}
+
+bool
+query_match(const query_t *query, const db_t *db, const veh_t *veh) {
+	ASSERT(query != NULL);
+	ASSERT(db != NULL);
+	ASSERT(veh != NULL);
+	ASSERT(db->cols.rec[veh->slot] == veh);
+
+	size_t slot = veh->slot;
+	uint8_t res;
+	eval_batch(query, &db->cols, &slot, 1, &res);
+	return res;
+}
+
+static int
+veh_num_cmp(const void *a, const void *b) {
+	veh_num_t lhs = (*(veh_t *const *)a)->num;
+	veh_num_t rhs = (*(veh_t *const *)b)->num;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+size_t
+query_select(const query_t *query, db_t *db, veh_t ***list) {
+	ASSERT(list != NULL);
+
+	size_t total = stock_db_get_count(db);
+	uint8_t *match = safe_calloc(MAX(total, 1), 1);
+	size_t count = query_mark(query, db, match);
+
+	*list = safe_calloc(MAX(count, 1), sizeof(veh_t *));
+	size_t j = 0;
+	for(size_t i = 0; i < total; ++i) {
+		if(match[i])
+			(*list)[j++] = db->cols.rec[i];
+	}
+	free(match);
+	qsort(*list, count, sizeof(**list), veh_num_cmp);
+	return count;
+}
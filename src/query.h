@@ -0,0 +1,49 @@
+/*===--------------------------------------------------------------------------------------------===
+ * query.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+#include "stock.h"
+
+// Filter expressions over vehicles, for example:
+//
+//	type=lok and class~"HGe" and not in_use
+//	num >= 800 and num < 900 and (has=first or desc~panoramic)
+//
+// Fields are num, class, desc, type, traction, has (capability) and in_use. Numbers compare with
+// = != < <= > >=, strings with = != and ~ !~ (case-insensitive substring). Terms combine with
+// and/or/not and parentheses.
+//
+// Expressions are compiled once into a small stack bytecode. Evaluation runs each instruction over
+// a batch of records at a time, reading the DB's dense columns where it can. When the top-level
+// conjunction pins down the running number, type, class or in-use state, the matching index narrows
+// the candidates before anything is evaluated.
+typedef struct query_s query_t;
+
+query_t *
+query_compile(const char *src, char *err, size_t err_cap);
+
+void
+query_free(query_t *query);
+
+// Sets match[slot] for every record slot (see stock_cols_t), 1 if the record matches and 0 if it
+// doesn't. `match` must have room for stock_db_get_count() entries. Returns the number of matches.
+size_t
+query_mark(const query_t *query, db_t *db, uint8_t *match);
+
+// Whether a single record of the DB matches.
+bool
+query_match(const query_t *query, const db_t *db, const veh_t *veh);
+
+// Returns a newly allocated list of the matching records, in running-number order.
+size_t
+query_select(const query_t *query, db_t *db, veh_t ***list);
+
+#endif /* ifndef _QUERY_H_ */
@@ -0,0 +1,698 @@
+/*===--------------------------------------------------------------------------------------------===
+ * roster.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "roster.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MINUTES_PER_DAY	(24 * 60)
+
+// MARK: - Times
+
+bool
+roster_parse_time(const char *str, roster_time_t *time) {
+	ASSERT(str != NULL);
+	ASSERT(time != NULL);
+
+	long day = 0, hours, minutes;
+	const char *plus = strchr(str, '+');
+	if(plus) {
+		char *end;
+		day = strtol(str, &end, 10);
+		if(end != plus || day < 0)
+			return false;
+		str = plus + 1;
+	}
+
+	int len = 0;
+	if(sscanf(str, "%2ld:%2ld%n", &hours, &minutes, &len) != 2 || str[len] != '\0')
+		return false;
+	if(hours < 0 || hours > 23 || minutes < 0 || minutes > 59)
+		return false;
+	*time = (roster_time_t)day * MINUTES_PER_DAY + hours * 60 + minutes;
+	return true;
+}
+
+void
+roster_format_time(roster_time_t time, char *dest, size_t cap) {
+	ASSERT(dest != NULL);
+	int64_t day = time / MINUTES_PER_DAY;
+	int64_t mins = time % MINUTES_PER_DAY;
+	if(day)
+		snprintf(dest, cap, "%" PRId64 "+%02d:%02d", day, (int)(mins / 60), (int)(mins % 60));
+	else
+		snprintf(dest, cap, "%02d:%02d", (int)(mins / 60), (int)(mins % 60));
+}
+
+// MARK: - Interval tree
+
+static bool
+booking_before(const roster_booking_t *a, const roster_booking_t *b) {
+	if(a->start != b->start)
+		return a->start < b->start;
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+static void
+tree_pull(roster_booking_t *node) {
+	node->max_end = node->end;
+	if(node->left)
+		node->max_end = MAX(node->max_end, node->left->max_end);
+	if(node->right)
+		node->max_end = MAX(node->max_end, node->right->max_end);
+}
+
+static roster_booking_t *
+tree_rotate_right(roster_booking_t *node) {
+	roster_booking_t *left = node->left;
+	node->left = left->right;
+	left->right = node;
+	tree_pull(node);
+	tree_pull(left);
+	return left;
+}
+
+static roster_booking_t *
+tree_rotate_left(roster_booking_t *node) {
+	roster_booking_t *right = node->right;
+	node->right = right->left;
+	right->left = node;
+	tree_pull(node);
+	tree_pull(right);
+	return right;
+}
+
+static roster_booking_t *
+tree_insert(roster_booking_t *root, roster_booking_t *node) {
+	if(!root) {
+		node->left = node->right = NULL;
+		tree_pull(node);
+		return node;
+	}
+	if(booking_before(node, root)) {
+		root->left = tree_insert(root->left, node);
+		if(root->left->prio > root->prio)
+			return tree_rotate_right(root);
+	} else {
+		root->right = tree_insert(root->right, node);
+		if(root->right->prio > root->prio)
+			return tree_rotate_left(root);
+	}
+	tree_pull(root);
+	return root;
+}
+
+// Joins two treaps where everything in `a` comes before everything in `b`.
+static roster_booking_t *
+tree_merge(roster_booking_t *a, roster_booking_t *b) {
+	if(!a || !b)
+		return a ? a : b;
+	if(a->prio > b->prio) {
+		a->right = tree_merge(a->right, b);
+		tree_pull(a);
+		return a;
+	}
+	b->left = tree_merge(a, b->left);
+	tree_pull(b);
+	return b;
+}
+
+static roster_booking_t *
+tree_remove(roster_booking_t *root, roster_booking_t *node) {
+	ASSERT(root != NULL);
+	if(root == node)
+		return tree_merge(root->left, root->right);
+	if(booking_before(node, root))
+		root->left = tree_remove(root->left, node);
+	else
+		root->right = tree_remove(root->right, node);
+	tree_pull(root);
+	return root;
+}
+
+// Subtrees that end before the query starts, and right subtrees of nodes that start after it ends,
+// can't hold anything that overlaps, so only O(log n + k) nodes are visited.
+static void
+tree_query(const roster_booking_t *node, roster_time_t start, roster_time_t end,
+	   const roster_booking_t **list, size_t cap, size_t *count) {
+	if(!node || node->max_end <= start)
+		return;
+	tree_query(node->left, start, end, list, cap, count);
+	if(node->start >= end)
+		return;
+	if(node->end > start) {
+		if(*count < cap)
+			list[*count] = node;
+		*count += 1;
+	}
+	tree_query(node->right, start, end, list, cap, count);
+}
+
+// MARK: - Per-vehicle bookings
+
+static int
+booking_cmp(const void *a, const void *b) {
+	roster_time_t lhs = ((const roster_booking_t *)a)->start;
+	roster_time_t rhs = ((const roster_booking_t *)b)->start;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static uint32_t
+next_prio(roster_t *roster) {
+	// xorshift32: treap priorities only need to be spread out, not unpredictable
+	uint32_t x = roster->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return roster->seed = x;
+}
+
+static roster_veh_t *
+veh_bookings(roster_t *roster, veh_num_t num) {
+	roster_veh_t *rv = hash_get(&roster->by_veh, num);
+	if(!rv) {
+		rv = safe_calloc(1, sizeof(*rv));
+		rv->num = num;
+		avl_create(&rv->bookings, booking_cmp, sizeof(roster_booking_t),
+			   offsetof(roster_booking_t, veh_node));
+		hash_put(&roster->by_veh, num, rv);
+	}
+	return rv;
+}
+
+static void
+mark_changed(roster_t *roster, roster_veh_t *rv) {
+	if(stock_db_merging(roster->db))
+		return;
+	rv->changed = true;
+	roster->dirty = true;
+}
+
+// The file's lines for `num` are to go, whatever is booked under it here.
+static void
+mark_dropped(roster_t *roster, veh_num_t num) {
+	if(stock_db_merging(roster->db))
+		return;
+	hash_put(&roster->dropped, num, roster);
+	roster->dirty = true;
+}
+
+static void
+veh_bookings_free(roster_t *roster, roster_veh_t *rv) {
+	roster_booking_t *booking;
+	void *cookie = NULL;
+	while((booking = avl_destroy_nodes(&rv->bookings, &cookie)) != NULL) {
+		roster->root = tree_remove(roster->root, booking);
+		roster->count -= 1;
+		free(booking);
+	}
+	avl_destroy(&rv->bookings);
+	hash_remove(&roster->by_veh, rv->num);
+	free(rv);
+}
+
+const roster_booking_t *
+roster_conflict(const roster_t *roster, veh_num_t num, roster_time_t start, roster_time_t end) {
+	ASSERT(roster != NULL);
+
+	roster_veh_t *rv = hash_get(&roster->by_veh, num);
+	if(!rv)
+		return NULL;
+
+	roster_booking_t search = {.start = start};
+	avl_index_t where;
+	roster_booking_t *found = avl_find(&rv->bookings, &search, &where);
+	if(found)
+		return found;
+
+	roster_booking_t *prev = avl_nearest(&rv->bookings, where, AVL_BEFORE);
+	if(prev && prev->end > start)
+		return prev;
+	roster_booking_t *next = avl_nearest(&rv->bookings, where, AVL_AFTER);
+	if(next && next->start < end)
+		return next;
+	return NULL;
+}
+
+static void
+book(roster_t *roster, veh_num_t num, roster_time_t start, roster_time_t end, const char *service) {
+	roster_booking_t *booking = safe_calloc(1, sizeof(*booking));
+	booking->veh = veh_bookings(roster, num);
+	booking->start = start;
+	booking->end = end;
+	strncpy(booking->service, service, ROSTER_SERVICE_LEN - 1);
+	booking->prio = next_prio(roster);
+
+	avl_add(&booking->veh->bookings, booking);
+	roster->root = tree_insert(roster->root, booking);
+	roster->count += 1;
+	booking->veh->changed = true;
+	roster->dirty = true;
+}
+
+bool
+roster_book(roster_t *roster, veh_num_t num, roster_time_t start, roster_time_t end,
+	    const char *service, const roster_booking_t **conflict) {
+	ASSERT(roster != NULL);
+	ASSERT(service != NULL);
+
+	const roster_booking_t *clash = NULL;
+	bool ok = start < end && stock_db_get(roster->db, num);
+	if(ok)
+		clash = roster_conflict(roster, num, start, end);
+	if(conflict)
+		*conflict = clash;
+	if(!ok || clash)
+		return false;
+
+	book(roster, num, start, end, service);
+	return true;
+}
+
+bool
+roster_book_consist(roster_t *roster, const consist_t *consist, roster_time_t start,
+		    roster_time_t end, const char *service, const roster_booking_t **conflict) {
+	ASSERT(roster != NULL);
+	ASSERT(consist != NULL);
+
+	if(conflict)
+		*conflict = NULL;
+	if(start >= end || !consist->count)
+		return false;
+	for(const consist_member_t *m = consist->head; m; m = m->next) {
+		const roster_booking_t *clash = roster_conflict(roster, m->num, start, end);
+		if(!clash) continue;
+		if(conflict)
+			*conflict = clash;
+		return false;
+	}
+
+	for(const consist_member_t *m = consist->head; m; m = m->next)
+		book(roster, m->num, start, end, service);
+	return true;
+}
+
+void
+roster_cancel(roster_t *roster, roster_booking_t *booking) {
+	ASSERT(roster != NULL);
+	ASSERT(booking != NULL);
+
+	roster_veh_t *rv = booking->veh;
+	avl_remove(&rv->bookings, booking);
+	roster->root = tree_remove(roster->root, booking);
+	roster->count -= 1;
+	free(booking);
+	rv->changed = true;
+	roster->dirty = true;
+
+	if(!avl_numnodes(&rv->bookings)) {
+		hash_put(&roster->dropped, rv->num, roster);
+		avl_destroy(&rv->bookings);
+		hash_remove(&roster->by_veh, rv->num);
+		free(rv);
+	}
+}
+
+size_t
+roster_busy(const roster_t *roster, roster_time_t start, roster_time_t end,
+	    const roster_booking_t **list, size_t cap) {
+	ASSERT(roster != NULL);
+	size_t count = 0;
+	tree_query(roster->root, start, end, list, cap, &count);
+	return count;
+}
+
+size_t
+roster_free(const roster_t *roster, roster_time_t start, roster_time_t end,
+	    const veh_t **list, size_t cap) {
+	ASSERT(roster != NULL);
+
+	size_t num_busy = roster_busy(roster, start, end, NULL, 0);
+	const roster_booking_t **busy = safe_calloc(MAX(num_busy, 1), sizeof(*busy));
+	roster_busy(roster, start, end, busy, num_busy);
+
+	hash_map_t taken;
+	hash_init(&taken);
+	for(size_t i = 0; i < num_busy; ++i)
+		hash_put(&taken, busy[i]->veh->num, busy[i]->veh);
+	free(busy);
+
+	size_t count = 0;
+	const avl_tree_t *tree = &roster->db->tree;
+	for(const veh_t *veh = avl_first(tree); veh; veh = AVL_NEXT(tree, veh)) {
+		if(hash_get(&taken, veh->num)) continue;
+		if(count < cap)
+			list[count] = veh;
+		count += 1;
+	}
+	hash_fini(&taken);
+	return count;
+}
+
+// MARK: - Lifetime
+
+// As in a consist, vehicles in a batch can trade numbers: every one leaves the index before any
+// is put back under its new number.
+static void
+renumber_veh(roster_t *roster) {
+	size_t count;
+	const stock_move_t *moves = stock_db_moves(roster->db, &count);
+	roster_veh_t **list = safe_calloc(MAX(count, 1), sizeof(*list));
+	for(size_t i = 0; i < count; ++i) {
+		list[i] = hash_get(&roster->by_veh, moves[i].old_num);
+		if(list[i])
+			hash_remove(&roster->by_veh, moves[i].old_num);
+	}
+	for(size_t i = 0; i < count; ++i) {
+		if(!list[i]) continue;
+		mark_dropped(roster, list[i]->num);
+		list[i]->num = moves[i].veh->num;
+		hash_put(&roster->by_veh, list[i]->num, list[i]);
+		mark_changed(roster, list[i]);
+	}
+	free(list);
+}
+
+static void
+on_change(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	roster_t *roster = ctx;
+	if(ev == DB_EV_RENUMBER) {
+		renumber_veh(roster);
+		return;
+	}
+	roster_veh_t *rv = hash_get(&roster->by_veh, old_num);
+	if(!rv)
+		return;
+
+	switch(ev) {
+	case DB_EV_DELETE:
+		mark_dropped(roster, old_num);
+		veh_bookings_free(roster, rv);
+		break;
+	case DB_EV_UPDATE:
+		if(veh->num == old_num)
+			break;
+		mark_dropped(roster, old_num);
+		hash_remove(&roster->by_veh, old_num);
+		rv->num = veh->num;
+		hash_put(&roster->by_veh, veh->num, rv);
+		mark_changed(roster, rv);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+roster_init(roster_t *roster, db_t *db) {
+	ASSERT(roster != NULL);
+	ASSERT(db != NULL);
+
+	memset(roster, 0, sizeof(*roster));
+	roster->db = db;
+	roster->seed = 0x9e3779b9u;
+	hash_init(&roster->by_veh);
+	hash_init(&roster->dropped);
+	stock_db_observe(db, on_change, roster);
+}
+
+void
+roster_fini(roster_t *roster) {
+	ASSERT(roster != NULL);
+
+	stock_db_unobserve(roster->db, on_change, roster);
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&roster->by_veh, &iter)) != NULL) {
+		roster_veh_t *rv = entry->value;
+		roster_booking_t *booking;
+		void *cookie = NULL;
+		while((booking = avl_destroy_nodes(&rv->bookings, &cookie)) != NULL)
+			free(booking);
+		avl_destroy(&rv->bookings);
+		free(rv);
+	}
+	hash_fini(&roster->by_veh);
+	hash_fini(&roster->dropped);
+	roster->root = NULL;
+	roster->count = 0;
+}
+
+// MARK: - Diagrams
+
+static roster_conflict_t *
+report_push(roster_report_t *report, size_t line, const char *service, const char *target,
+	    roster_time_t start, roster_time_t end) {
+	if(report->num_conflicts == report->cap) {
+		report->cap = report->cap ? report->cap * 2 : 16;
+		report->conflicts = safe_realloc(report->conflicts, report->cap * sizeof(*report->conflicts));
+	}
+	roster_conflict_t *c = &report->conflicts[report->num_conflicts++];
+	memset(c, 0, sizeof(*c));
+	c->line = line;
+	strncpy(c->service, service, ROSTER_SERVICE_LEN - 1);
+	strncpy(c->target, target, CONSIST_NAME_LEN - 1);
+	c->start = start;
+	c->end = end;
+	return c;
+}
+
+static void
+report_clash(roster_report_t *report, size_t line, const char *service, const char *target,
+	     veh_num_t num, roster_time_t start, roster_time_t end, const roster_booking_t *with) {
+	roster_conflict_t *c = report_push(report, line, service, target, start, end);
+	c->num = num;
+	strncpy(c->with, with->service, ROSTER_SERVICE_LEN - 1);
+	c->with_start = with->start;
+	c->with_end = with->end;
+}
+
+static void
+report_unknown(roster_report_t *report, size_t line, const char *service, const char *target,
+	       roster_time_t start, roster_time_t end) {
+	report->invalid += 1;
+	report_push(report, line, service, target, start, end);
+}
+
+static bool
+parse_num(const char *str, veh_num_t *num) {
+	char *end;
+	*num = strtoll(str, &end, 10);
+	return end != str && *end == '\0';
+}
+
+// Books one diagram line, reporting every vehicle of the target that clashes.
+static void
+import_line(roster_t *roster, const consists_t *consists, char *line, size_t line_num,
+	    roster_report_t *report) {
+	char *comps[4];
+	if(str_split_inplace(line, ',', comps, 4) < 4) {
+		report->invalid += 1;
+		report_push(report, line_num, "", "", 0, 0);
+		return;
+	}
+	for(int i = 0; i < 4; ++i)
+		str_trim_space(comps[i]);
+
+	roster_time_t start, end;
+	const char *service = comps[2];
+	const char *target = comps[3];
+	if(!roster_parse_time(comps[0], &start) || !roster_parse_time(comps[1], &end) || start >= end) {
+		report->invalid += 1;
+		report_push(report, line_num, "", "", 0, 0);
+		return;
+	}
+
+	veh_num_t num;
+	if(parse_num(target, &num)) {
+		const roster_booking_t *clash;
+		if(roster_book(roster, num, start, end, service, &clash))
+			report->booked += 1;
+		else if(clash)
+			report_clash(report, line_num, service, target, num, start, end, clash);
+		else
+			report_unknown(report, line_num, service, target, start, end);
+		return;
+	}
+
+	const consist_t *consist = consists ? consists_get(consists, target) : NULL;
+	if(!consist || !consist->count) {
+		report_unknown(report, line_num, service, target, start, end);
+		return;
+	}
+	bool clashed = false;
+	for(const consist_member_t *m = consist->head; m; m = m->next) {
+		const roster_booking_t *clash = roster_conflict(roster, m->num, start, end);
+		if(!clash) continue;
+		report_clash(report, line_num, service, target, m->num, start, end, clash);
+		clashed = true;
+	}
+	if(!clashed && roster_book_consist(roster, consist, start, end, service, NULL))
+		report->booked += consist->count;
+}
+
+void
+roster_import_from_file(roster_t *roster, const consists_t *consists, FILE *f,
+			roster_report_t *report) {
+	ASSERT(roster != NULL);
+	ASSERT(f != NULL);
+	ASSERT(report != NULL);
+
+	memset(report, 0, sizeof(*report));
+	char *line = NULL;
+	size_t cap = 0;
+	size_t line_num = 0;
+	while(getline(&line, &cap, f) > 0) {
+		line_num += 1;
+		str_trim_space(line);
+		if(!line[0] || line[0] == '#')
+			continue;
+		import_line(roster, consists, line, line_num, report);
+	}
+	free(line);
+}
+
+void
+roster_report_fini(roster_report_t *report) {
+	ASSERT(report != NULL);
+	free(report->conflicts);
+	memset(report, 0, sizeof(*report));
+}
+
+void
+roster_report_write(FILE *f, const roster_report_t *report) {
+	ASSERT(f != NULL);
+	ASSERT(report != NULL);
+
+	for(size_t i = 0; i < report->num_conflicts; ++i) {
+		const roster_conflict_t *c = &report->conflicts[i];
+		char start[ROSTER_TIME_LEN], end[ROSTER_TIME_LEN];
+		roster_format_time(c->start, start, sizeof(start));
+		roster_format_time(c->end, end, sizeof(end));
+
+		if(!c->target[0]) {
+			fprintf(f, "line %zu: invalid booking\n", c->line);
+			continue;
+		}
+		if(!c->with[0]) {
+			fprintf(f, "line %zu: %s %s-%s: no vehicle or consist %s\n",
+				c->line, c->service, start, end, c->target);
+			continue;
+		}
+		char with_start[ROSTER_TIME_LEN], with_end[ROSTER_TIME_LEN];
+		roster_format_time(c->with_start, with_start, sizeof(with_start));
+		roster_format_time(c->with_end, with_end, sizeof(with_end));
+		fprintf(f, "line %zu: %s %s-%s: vehicle %" VEH_NUM_FMT " is on %s %s-%s\n",
+			c->line, c->service, start, end, c->num, c->with, with_start, with_end);
+	}
+	fprintf(f, "%zu booked, %zu conflicts, %zu invalid\n",
+		report->booked, report->num_conflicts - report->invalid, report->invalid);
+}
+
+static void
+mark_written(roster_t *roster) {
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	while((entry = hash_next(&roster->by_veh, &iter)) != NULL)
+		((roster_veh_t *)entry->value)->changed = false;
+	hash_fini(&roster->dropped);
+	hash_init(&roster->dropped);
+	roster->dirty = false;
+}
+
+// Copies the lines of the file for vehicles whose bookings weren't changed here.
+static void
+copy_kept_lines(const roster_t *roster, FILE *in, FILE *out) {
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while((len = getline(&line, &cap, in)) > 0) {
+		const char *target = strrchr(line, ',');
+		veh_num_t num;
+		char *end;
+		if(line[strspn(line, " \t")] != '#' && target
+		   && (num = strtoll(target + 1, &end, 10), end != target + 1)) {
+			const roster_veh_t *rv = hash_get(&roster->by_veh, num);
+			if((rv && rv->changed) || hash_get(&roster->dropped, num))
+				continue;
+		}
+		fputs(line, out);
+		if(line[len - 1] != '\n')
+			fputc('\n', out);
+	}
+	free(line);
+}
+
+bool
+roster_write_to_path(roster_t *roster, const char *path) {
+	ASSERT(roster != NULL);
+	ASSERT(path != NULL);
+
+	// The file itself is replaced, so writers hold a lock on one next to it that stays put
+	char lock_path[1024], tmp_path[1024];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	int lock = open(lock_path, O_RDWR | O_CREAT, 0666);
+	if(lock < 0)
+		return false;
+	if(flock(lock, LOCK_EX) < 0) {
+		close(lock);
+		return false;
+	}
+
+	bool ok = false;
+	FILE *f = fopen(tmp_path, "wb");
+	if(f) {
+		FILE *old = fopen(path, "rb");
+		if(old) {
+			copy_kept_lines(roster, old, f);
+			fclose(old);
+		}
+		size_t count = roster->count;
+		const roster_booking_t **list = safe_calloc(MAX(count, 1), sizeof(*list));
+		roster_busy(roster, INT64_MIN, INT64_MAX, list, count);
+		for(size_t i = 0; i < count; ++i) {
+			if(!list[i]->veh->changed) continue;
+			char start[ROSTER_TIME_LEN], end[ROSTER_TIME_LEN];
+			roster_format_time(list[i]->start, start, sizeof(start));
+			roster_format_time(list[i]->end, end, sizeof(end));
+			fprintf(f, "%s, %s, %s, %" VEH_NUM_FMT "\n", start, end, list[i]->service, list[i]->veh->num);
+		}
+		free(list);
+		ok = fclose(f) == 0 && rename(tmp_path, path) == 0;
+		if(!ok)
+			unlink(tmp_path);
+	}
+	close(lock);
+	if(ok)
+		mark_written(roster);
+	return ok;
+}
+
+bool
+roster_load_from_path(roster_t *roster, const char *path) {
+	ASSERT(roster != NULL);
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+	roster_report_t report;
+	roster_import_from_file(roster, NULL, f, &report);
+	roster_report_fini(&report);
+	fclose(f);
+	mark_written(roster);
+	return true;
+}
@@ -0,0 +1,153 @@
+/*===--------------------------------------------------------------------------------------------===
+ * roster.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _ROSTER_H_
+#define _ROSTER_H_
+
+#include "stock.h"
+#include "consist.h"
+
+#define ROSTER_SERVICE_LEN	(32)
+#define ROSTER_TIME_LEN		(16)
+
+// Minutes from midnight on the first day of the roster. Written as HH:MM, or D+HH:MM for later
+// days, so a service that runs past midnight ends at something like 1+00:40.
+typedef int64_t roster_time_t;
+
+typedef struct roster_veh_s roster_veh_t;
+typedef struct roster_booking_s roster_booking_t;
+
+// One vehicle booked to one service over [start, end).
+struct roster_booking_s {
+	roster_veh_t		*veh;
+	roster_time_t		start;
+	roster_time_t		end;
+	char			service[ROSTER_SERVICE_LEN];
+
+	avl_node_t		veh_node;
+
+	// Interval tree over every booking: a treap ordered on start, where each node knows the
+	// latest end in its subtree
+	roster_booking_t	*left;
+	roster_booking_t	*right;
+	roster_time_t		max_end;
+	uint32_t		prio;
+};
+
+// The bookings of one vehicle never overlap, so ordering them on start time orders them on end
+// time too, and a conflict can only come from the neighbours of the new interval.
+struct roster_veh_s {
+	veh_num_t		num;
+	avl_tree_t		bookings;
+	bool			changed;	// here, since the file was read or written
+};
+
+typedef struct {
+	db_t			*db;
+	hash_map_t		by_veh;
+	hash_map_t		dropped;	// numbers whose bookings were cancelled or moved here
+	roster_booking_t	*root;
+	size_t			count;
+	uint32_t		seed;
+	bool			dirty;
+} roster_t;
+
+typedef struct {
+	size_t			line;
+	char			service[ROSTER_SERVICE_LEN];
+	char			target[CONSIST_NAME_LEN];
+	veh_num_t		num;
+	roster_time_t		start;
+	roster_time_t		end;
+	// The booking it clashes with. Lines that can't be booked at all have no `with`, and
+	// malformed ones no `target` either.
+	char			with[ROSTER_SERVICE_LEN];
+	roster_time_t		with_start;
+	roster_time_t		with_end;
+} roster_conflict_t;
+
+// Invalid lines are reported alongside the conflicts, and counted in both `num_conflicts` and
+// `invalid`.
+typedef struct {
+	size_t			booked;
+	size_t			invalid;
+	roster_conflict_t	*conflicts;
+	size_t			num_conflicts;
+	size_t			cap;
+} roster_report_t;
+
+bool
+roster_parse_time(const char *str, roster_time_t *time);
+
+void
+roster_format_time(roster_time_t time, char *dest, size_t cap);
+
+// The roster observes the DB, dropping the bookings of deleted vehicles and following renumbered
+// ones. It must be finalised before the DB is. Changes the DB merges in from elsewhere are
+// followed, but left to the side that made them to write back.
+void
+roster_init(roster_t *roster, db_t *db);
+
+void
+roster_fini(roster_t *roster);
+
+// Returns a booking of the vehicle that overlaps [start, end), or NULL if it is free.
+const roster_booking_t *
+roster_conflict(const roster_t *roster, veh_num_t num, roster_time_t start, roster_time_t end);
+
+// Books a vehicle. Fails, leaving the roster unchanged, if the vehicle doesn't exist or is already
+// booked at some point of the interval; `conflict` is then set to the clashing booking, if any.
+bool
+roster_book(roster_t *roster, veh_num_t num, roster_time_t start, roster_time_t end,
+	    const char *service, const roster_booking_t **conflict);
+
+// Books every vehicle of a consist, or none of them.
+bool
+roster_book_consist(roster_t *roster, const consist_t *consist, roster_time_t start,
+		    roster_time_t end, const char *service, const roster_booking_t **conflict);
+
+void
+roster_cancel(roster_t *roster, roster_booking_t *booking);
+
+// Lists the bookings that overlap [start, end), in start order. Returns how many there are, which
+// may be more than `cap`.
+size_t
+roster_busy(const roster_t *roster, roster_time_t start, roster_time_t end,
+	    const roster_booking_t **list, size_t cap);
+
+// Lists the vehicles with no booking in [start, end), in running-number order. Returns how many
+// there are, which may be more than `cap`.
+size_t
+roster_free(const roster_t *roster, roster_time_t start, roster_time_t end,
+	    const veh_t **list, size_t cap);
+
+// Books a day's diagram, one "<start>, <end>, <service>, <vehicle number or consist name>" per
+// line. Lines are booked in order, and any that clash with the roster or an earlier line are
+// collected in the report instead.
+void
+roster_import_from_file(roster_t *roster, const consists_t *consists, FILE *f,
+			roster_report_t *report);
+
+void
+roster_report_fini(roster_report_t *report);
+
+void
+roster_report_write(FILE *f, const roster_report_t *report);
+
+// Saves the bookings in the diagram format, one vehicle per line. Only the vehicles whose bookings
+// changed here are written, and the file's lines for every other one kept. Other processes may be
+// writing the same file: the read, merge and write happen under a lock, and the file is replaced
+// whole.
+bool
+roster_write_to_path(roster_t *roster, const char *path);
+
+bool
+roster_load_from_path(roster_t *roster, const char *path);
+
+#endif /* ifndef _ROSTER_H_ */
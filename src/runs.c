@@ -0,0 +1,128 @@
+/*===--------------------------------------------------------------------------------------------===
+ * runs.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "runs.h"
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+
+static int
+run_cmp(const void *a, const void *b) {
+	if(((const num_run_t *)a)->lo < ((const num_run_t *)b)->lo)
+		return -1;
+	if(((const num_run_t *)a)->lo > ((const num_run_t *)b)->lo)
+		return 1;
+	return 0;
+}
+
+void
+runs_init(run_index_t *runs) {
+	ASSERT(runs != NULL);
+	avl_create(&runs->tree, run_cmp, sizeof(num_run_t), offsetof(num_run_t, node));
+}
+
+void
+runs_fini(run_index_t *runs) {
+	ASSERT(runs != NULL);
+	
+	num_run_t *run = NULL;
+	void *cookie = NULL;
+	while((run = avl_destroy_nodes(&runs->tree, &cookie)) != NULL) {
+		free(run);
+	}
+	avl_destroy(&runs->tree);
+}
+
+// Returns the run with the greatest start at or below `num`, which is the only one that can
+// contain it.
+static num_run_t *
+find_floor(const run_index_t *runs, int64_t num, avl_index_t *where) {
+	num_run_t search = {.lo = num};
+	avl_index_t idx;
+	num_run_t *run = avl_find(&runs->tree, &search, &idx);
+	if(where)
+		*where = idx;
+	return run ? run : avl_nearest(&runs->tree, idx, AVL_BEFORE);
+}
+
+void
+runs_add(run_index_t *runs, int64_t num) {
+	ASSERT(runs != NULL);
+	
+	avl_index_t where;
+	num_run_t *before = find_floor(runs, num, &where);
+	if(before && before->hi >= num)
+		return;
+	
+	num_run_t *after = before ? AVL_NEXT(&runs->tree, before) : avl_first(&runs->tree);
+	bool join_before = before && before->hi == num - 1;
+	bool join_after = after && num < INT64_MAX && after->lo == num + 1;
+	
+	if(join_before && join_after) {
+		before->hi = after->hi;
+		avl_remove(&runs->tree, after);
+		free(after);
+	} else if(join_before) {
+		before->hi = num;
+	} else if(join_after) {
+		// Lowering the start keeps the run between the same neighbours, so the tree stays ordered
+		after->lo = num;
+	} else {
+		num_run_t *run = mem_calloc(1, sizeof(*run));
+		run->lo = run->hi = num;
+		avl_insert(&runs->tree, run, where);
+	}
+}
+
+void
+runs_remove(run_index_t *runs, int64_t num) {
+	ASSERT(runs != NULL);
+	
+	num_run_t *run = find_floor(runs, num, NULL);
+	if(!run || run->hi < num)
+		return;
+	
+	if(run->lo == run->hi) {
+		avl_remove(&runs->tree, run);
+		free(run);
+	} else if(run->lo == num) {
+		run->lo = num + 1;
+	} else if(run->hi == num) {
+		run->hi = num - 1;
+	} else {
+		num_run_t *tail = mem_calloc(1, sizeof(*tail));
+		tail->lo = num + 1;
+		tail->hi = run->hi;
+		run->hi = num - 1;
+		avl_add(&runs->tree, tail);
+	}
+}
+
+bool
+runs_next_free(const run_index_t *runs, int64_t lo, int64_t hi, int64_t *num) {
+	ASSERT(runs != NULL);
+	ASSERT(num != NULL);
+	
+	if(lo > hi)
+		return false;
+	
+	// Runs are maximal, so the number right after the run covering `lo` is always free
+	const num_run_t *run = find_floor(runs, lo, NULL);
+	int64_t candidate = lo;
+	if(run && run->hi >= lo) {
+		if(run->hi == INT64_MAX)
+			return false;
+		candidate = run->hi + 1;
+	}
+	if(candidate > hi)
+		return false;
+	*num = candidate;
+	return true;
+}
@@ -0,0 +1,47 @@
+/*===--------------------------------------------------------------------------------------------===
+ * runs.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _RUNS_H_
+#define _RUNS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <utils/avl.h>
+
+// The set of running numbers in use, stored as maximal runs of consecutive numbers. The gaps
+// between runs are the free numbers, so the next free number after any point is found with a
+// single tree search instead of probing numbers one by one.
+typedef struct {
+	int64_t		lo;
+	int64_t		hi;
+	avl_node_t	node;
+} num_run_t;
+
+typedef struct {
+	avl_tree_t	tree;
+} run_index_t;
+
+void
+runs_init(run_index_t *runs);
+
+void
+runs_fini(run_index_t *runs);
+
+void
+runs_add(run_index_t *runs, int64_t num);
+
+void
+runs_remove(run_index_t *runs, int64_t num);
+
+// Finds the lowest free number in [lo, hi]. Returns false if the whole range is in use.
+bool
+runs_next_free(const run_index_t *runs, int64_t lo, int64_t hi, int64_t *num);
+
+#endif /* ifndef _RUNS_H_ */
@@ -0,0 +1,293 @@
+/*===--------------------------------------------------------------------------------------------===
+ * server.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "net.h"
+#include <utils/helpers.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PEERS	(64)
+#define FLUSH_DELAY_MS	(2000)
+#define READ_CHUNK	(16384)
+
+typedef struct {
+	int		fd;
+	buf_t		in;
+	buf_t		out;
+} peer_t;
+
+typedef struct {
+	db_t		db;
+	const char	*db_path;
+	char		sock_path[108];
+	int		listen_fd;
+
+	peer_t		peers[MAX_PEERS];
+	int		num_peers;
+	const peer_t	*origin;
+
+	bool		dirty;
+	int64_t		dirty_at;
+} server_t;
+
+static volatile sig_atomic_t should_quit = 0;
+
+static void
+on_signal(int sig) {
+	UNUSED(sig);
+	should_quit = 1;
+}
+
+static int64_t
+now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+on_change(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	server_t *server = ctx;
+
+	for(int i = 0; i < server->num_peers; ++i) {
+		peer_t *peer = &server->peers[i];
+		if(peer == server->origin || peer->fd < 0) continue;
+		msg_put_event(&peer->out, &server->db, ev, veh, old_num);
+	}
+
+	if(!server->dirty) {
+		server->dirty = true;
+		server->dirty_at = now_ms();
+	}
+}
+
+// Changes are coalesced and written back at most once every FLUSH_DELAY_MS. The file is written to
+// a temporary path and moved into place, so readers never see a half-written DB.
+static void
+flush_db(server_t *server) {
+	char tmp_path[1024];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", server->db_path);
+	if(stock_write_to_path(tmp_path, &server->db) && rename(tmp_path, server->db_path) == 0) {
+		server->dirty = false;
+	} else {
+		fprintf(stderr, "trainmgr: cannot write %s: %s\n", server->db_path, strerror(errno));
+		server->dirty_at = now_ms();
+	}
+}
+
+static bool
+set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void
+peer_close(peer_t *peer) {
+	close(peer->fd);
+	peer->fd = -1;
+	buf_fini(&peer->in);
+	buf_fini(&peer->out);
+}
+
+static void
+accept_peer(server_t *server) {
+	int fd = accept(server->listen_fd, NULL, NULL);
+	if(fd < 0)
+		return;
+	if(server->num_peers >= MAX_PEERS || !set_nonblocking(fd)) {
+		close(fd);
+		return;
+	}
+
+	peer_t *peer = &server->peers[server->num_peers++];
+	*peer = (peer_t){.fd = fd};
+
+	const avl_tree_t *tree = &server->db.tree;
+	for(const veh_t *veh = avl_first(tree); veh; veh = AVL_NEXT(tree, veh)) {
+		msg_put_veh(&peer->out, veh);
+	}
+	msg_put_sync(&peer->out);
+}
+
+// A peer that hangs up right after its last edits, as a batch command does, sends them together
+// with the end of the stream: what was read is applied before the peer is let go.
+static bool
+peer_read(server_t *server, peer_t *peer) {
+	bool open = true;
+	while(open) {
+		buf_reserve(&peer->in, READ_CHUNK);
+		ssize_t n = read(peer->fd, peer->in.data + peer->in.len, peer->in.cap - peer->in.len);
+		if(n == 0)
+			open = false;
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+			open = false;
+		}
+		if(n > 0)
+			peer->in.len += n;
+	}
+
+	msg_t msg;
+	int res;
+	server->origin = peer;
+	while((res = msg_next(&peer->in, &msg)) > 0) {
+		// A REJECT only ever goes from the daemon to a client.
+		veh_num_t conflict = msg.veh.num;
+		if(msg.op == MSG_REJECT || !msg_apply(&server->db, &msg, &conflict)) {
+			fprintf(stderr, "trainmgr: refused a change to %" VEH_NUM_FMT ", it conflicts with the DB\n", conflict);
+			msg_put_rejects(&peer->out, &server->db, &msg);
+		}
+		msg_fini(&msg);
+	}
+	server->origin = NULL;
+	return open && res == 0;
+}
+
+static bool
+peer_write(peer_t *peer) {
+	while(peer->out.len) {
+		ssize_t n = write(peer->fd, peer->out.data, peer->out.len);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		buf_consume(&peer->out, n);
+	}
+	return true;
+}
+
+static void
+reap_peers(server_t *server) {
+	int j = 0;
+	for(int i = 0; i < server->num_peers; ++i) {
+		if(server->peers[i].fd < 0) continue;
+		server->peers[j++] = server->peers[i];
+	}
+	server->num_peers = j;
+}
+
+static bool
+server_listen(server_t *server) {
+	if(!net_socket_path(server->db_path, server->sock_path, sizeof(server->sock_path))) {
+		fprintf(stderr, "trainmgr: socket path too long\n");
+		return false;
+	}
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	strncpy(addr.sun_path, server->sock_path, sizeof(addr.sun_path) - 1);
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server->listen_fd < 0)
+		return false;
+
+	// A socket file nobody answers on is left over from a daemon that did not shut down cleanly.
+	if(connect(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "trainmgr: %s is already being served\n", server->db_path);
+		close(server->listen_fd);
+		return false;
+	}
+	close(server->listen_fd);
+	unlink(server->sock_path);
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server->listen_fd < 0
+	   || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	   || listen(server->listen_fd, MAX_PEERS) < 0
+	   || !set_nonblocking(server->listen_fd)) {
+		fprintf(stderr, "trainmgr: cannot listen on %s: %s\n", server->sock_path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+int
+server_run(const char *db_path) {
+	static server_t server;
+	server.db_path = db_path;
+	server.listen_fd = -1;
+
+	stock_db_init(&server.db);
+	if(stock_load_from_path(db_path, &server.db) < 0) {
+		fprintf(stderr, "trainmgr: cannot read %s\n", db_path);
+		stock_db_fini(&server.db);
+		return -1;
+	}
+
+	if(!server_listen(&server)) {
+		if(server.listen_fd >= 0)
+			close(server.listen_fd);
+		stock_db_fini(&server.db);
+		return -1;
+	}
+	stock_db_observe(&server.db, on_change, &server);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while(!should_quit) {
+		struct pollfd fds[MAX_PEERS + 1];
+		fds[0] = (struct pollfd){.fd = server.listen_fd, .events = POLLIN};
+		for(int i = 0; i < server.num_peers; ++i) {
+			peer_t *peer = &server.peers[i];
+			fds[i+1] = (struct pollfd){
+				.fd = peer->fd,
+				.events = POLLIN | (peer->out.len ? POLLOUT : 0),
+			};
+		}
+
+		int timeout = -1;
+		if(server.dirty)
+			timeout = (int)MAX(0, server.dirty_at + FLUSH_DELAY_MS - now_ms());
+
+		int num_fds = server.num_peers + 1;
+		if(poll(fds, num_fds, timeout) < 0) {
+			if(errno == EINTR) continue;
+			break;
+		}
+
+		for(int i = 1; i < num_fds; ++i) {
+			peer_t *peer = &server.peers[i-1];
+			if(peer->fd < 0) continue;
+
+			bool ok = !(fds[i].revents & (POLLERR | POLLNVAL));
+			if(ok && (fds[i].revents & (POLLIN | POLLHUP)))
+				ok = peer_read(&server, peer);
+			if(ok)
+				ok = peer_write(peer);
+			if(!ok)
+				peer_close(peer);
+		}
+		reap_peers(&server);
+
+		if(fds[0].revents & POLLIN)
+			accept_peer(&server);
+
+		if(server.dirty && now_ms() >= server.dirty_at + FLUSH_DELAY_MS)
+			flush_db(&server);
+	}
+
+	if(server.dirty)
+		flush_db(&server);
+	for(int i = 0; i < server.num_peers; ++i)
+		peer_close(&server.peers[i]);
+	close(server.listen_fd);
+	unlink(server.sock_path);
+	stock_db_fini(&server.db);
+	return 0;
+}
@@ -9,13 +9,54 @@
 */
 #include "ui.h"
 #include "views.h"
+#include "utf8.h"
 #include <utils/helpers.h>
 
+#define BOX_H		(3)
+#define BOX_ROW_H	(BOX_H + 1)
+#define TRAIN_Y		(2)
+
+// Optimising draws this many random trains of the current length and keeps the best one
+#define OPT_TRIES	(4096)
+#define MIN_BRAKE_PCT	(100.f)
+
+typedef struct {
+	int		x;
+	int		y;		// -1 when the box is scrolled off screen
+	const veh_t	*veh;		// what the box shows on screen, NULL until it is drawn
+} box_t;
+
+// Where each box of the train goes. It is only worked out again when the terminal size, the
+// train length or the scroll position change; otherwise a frame only redraws the boxes whose
+// vehicle is not the one already on screen.
 typedef struct {
+	bool		valid;
+	int		w;
+	int		h;
+	int		train_len;
+	int		scroll;
+	int		per_row;
+	int		rows;		// rows of boxes on screen
+	int		total_rows;
+	int		loco_x;
+	int		loco_y;
+	box_t		*boxes;		// one per train position
+} layout_t;
+
+typedef struct {
+	db_t		*db;
+	consists_t	*consists;
+	const attr_table_t *attrs;
+	attr_cols_t	pool;		// the technical data of `stock`, row for row
 	int		tgt_num;
 	int		num_veh;
 	const veh_t	**stock;
 	const veh_t	**train;
+	uint32_t	*order;		// `train` as indices into `stock`
+	
+	int		box_w;		// fits the longest description in the selection
+	int		scroll;
+	layout_t	layout;
 } shunt_view_t;
 
 static void
@@ -36,47 +77,225 @@ draw_box(int w, int max_w, int x, int y, const char *txt) {
 	term_style_reset(stdout);
 }
 
-static void
-shuntview_draw(const shunt_view_t *view) {
-	hexes_clear_screen();
-	ui_title(" Rolling Stock Database - Shunting (%d > %d)",
-		view->num_veh, view->tgt_num);
-		
+// The locomotive takes the first place, and the train wraps onto as many rows of boxes as it
+// needs. Rows that don't fit above the selection list are reached by scrolling.
+static bool
+layout_update(shunt_view_t *view) {
+	layout_t *layout = &view->layout;
 	int w, h;
 	hexes_get_size(&w, &h);
+	if(layout->valid && layout->w == w && layout->h == h
+	   && layout->train_len == view->tgt_num && layout->scroll == view->scroll)
+		return false;
 	
-	size_t veh_w = 0;
+	int places = view->tgt_num + 1;
+	layout->per_row = MAX(1, (w - 1) / (view->box_w + 1));
+	layout->total_rows = (places + layout->per_row - 1) / layout->per_row;
+	int max_rows = MAX(1, (h - TRAIN_Y - 2) / BOX_ROW_H);
+	layout->rows = MIN(layout->total_rows, max_rows);
+	view->scroll = MAX(0, MIN(view->scroll, layout->total_rows - layout->rows));
 	
-	for(int i = 0; i < view->num_veh; ++i) {
-		hexes_cursor_go(1, 10+i);
-		ui_line("%s", view->stock[i]->combo_desc);
-		veh_w = MAX(veh_w, strlen(view->stock[i]->combo_desc));
+	for(int i = 0; i < places; ++i) {
+		int row = i / layout->per_row - view->scroll;
+		int x = 1 + (i % layout->per_row) * (view->box_w + 1);
+		int y = row >= 0 && row < layout->rows ? TRAIN_Y + row * BOX_ROW_H : -1;
+		if(!i) {
+			layout->loco_x = x;
+			layout->loco_y = y;
+		} else {
+			layout->boxes[i-1] = (box_t){.x = x, .y = y, .veh = NULL};
+		}
 	}
-	veh_w += 2;
 	
-	term_set_fg(stdout, TERM_BLUE);
-	draw_box(veh_w, w, 1, 2, " <Lok ");
+	layout->valid = true;
+	layout->w = w;
+	layout->h = h;
+	layout->train_len = view->tgt_num;
+	layout->scroll = view->scroll;
+	return true;
+}
+
+static void
+draw_metrics(const shunt_view_t *view) {
+	if(!view->attrs->count) {
+		ui_line(" no technical data for these classes");
+		return;
+	}
+	consist_metrics_t m;
+	consist_metrics(view->attrs, view->train, view->tgt_num, &m);
+	char vmax[16] = "-";
+	if(m.vmax < ATTR_NO_VMAX)
+		snprintf(vmax, sizeof(vmax), "%.0f km/h", m.vmax);
+	char unknown[48] = "";
+	if(m.known < m.count)
+		snprintf(unknown, sizeof(unknown), "    (%zu without data)", m.count - m.known);
+	ui_line(" %.1f m    %.0f t    %.0f 1st / %.0f 2nd class seats    max. %s    braked %.0f%%%s",
+		m.length, m.mass, m.seats[0], m.seats[1], vmax, consist_brake_pct(m.brake, m.mass),
+		unknown);
+}
+
+static void
+shuntview_draw(shunt_view_t *view) {
+	layout_t *layout = &view->layout;
+	bool full = layout_update(view);
+	char label[MAX_DESC_LEN];
+	
+	if(full) {
+		hexes_clear_screen();
+		if(layout->total_rows > layout->rows)
+			ui_title(" Rolling Stock Database - Shunting (%d > %d) - rows %d-%d of %d",
+				view->num_veh, view->tgt_num, view->scroll + 1,
+				view->scroll + layout->rows, layout->total_rows);
+		else
+			ui_title(" Rolling Stock Database - Shunting (%d > %d)",
+				view->num_veh, view->tgt_num);
+		
+		int list_y = TRAIN_Y + layout->rows * BOX_ROW_H + 2;
+		for(int i = 0; i < view->num_veh && list_y + i < layout->h - 1; ++i) {
+			veh_combo_desc(view->stock[i], label, sizeof(label));
+			hexes_cursor_go(1, list_y + i);
+			ui_line("%s", label);
+		}
+	}
+	
+	if(full && layout->loco_y >= 0) {
+		term_set_fg(stdout, TERM_BLUE);
+		draw_box(view->box_w, layout->w, layout->loco_x, layout->loco_y, " <Lok ");
+	}
 	for(int i = 0; i < view->tgt_num; ++i) {
-		draw_box(veh_w, w, 1 + (i+1) * (veh_w+1), 2, view->train[i]->combo_desc);
+		box_t *box = &layout->boxes[i];
+		if(box->y < 0 || box->veh == view->train[i])
+			continue;
+		veh_combo_desc(view->train[i], label, sizeof(label));
+		draw_box(view->box_w, layout->w, box->x, box->y, label);
+		box->veh = view->train[i];
 	}
 	
-	ui_prompt(" [R]eturn    [S]huffle    [I]ncrease or [D]ecrease train length");
+	hexes_cursor_go(1, TRAIN_Y + layout->rows * BOX_ROW_H);
+	draw_metrics(view);
+	ui_prompt(" [R]eturn    [S]huffle    [O]ptimise    [I]ncrease or [D]ecrease train length"
+		  "    [K]eep as consist    [Left/Right] scroll");
 }
 
+// Saves the train on screen as a named consist, replacing one with the same name.
 static void
-shuffle_train(shunt_view_t *view) {
-	// Copy rolling stock list
-	memcpy(view->train, view->stock, view->num_veh * sizeof(*view->stock));
+keep_train(shunt_view_t *view) {
+	ui_field_t field = {.kind = UI_FIELD_TEXT, .cap = CONSIST_NAME_LEN - 1};
 	
-	// Then shuffle
+	for(;;) {
+		shuntview_draw(view);
+		ui_prompt_field(" consist name: ", &field);
+		
+		int c = hexes_get_key();
+		if(ui_field_input(&field, c))
+			continue;
+		if(c == KEY_ESC || c == KEY_CTRL_C || (c == KEY_RETURN && !field.len))
+			break;
+		if(c != KEY_RETURN)
+			continue;
+		
+		veh_num_t *nums = safe_calloc(MAX(view->tgt_num, 1), sizeof(veh_num_t));
+		for(int i = 0; i < view->tgt_num; ++i)
+			nums[i] = view->train[i]->num;
+		consists_set(view->consists, field.txt, nums, view->tgt_num);
+		free(nums);
+		break;
+	}
+	hexes_show_cursor(false);
+}
+
+static void
+order_train(shunt_view_t *view) {
+	for(int i = 0; i < view->num_veh; ++i)
+		view->train[i] = view->stock[view->order[i]];
+}
+
+static void
+shuffle_train(shunt_view_t *view) {
+	for(int i = 0; i < view->num_veh; ++i)
+		view->order[i] = i;
 	for(int i = 0; i < view->num_veh; ++i) {
 		int n = view->num_veh - i;
 		int j = i + rand() % n;
 		
-		const veh_t *temp = view->train[j];
-		view->train[j] = view->train[i];
-		view->train[i] = temp;
+		uint32_t temp = view->order[j];
+		view->order[j] = view->order[i];
+		view->order[i] = temp;
+	}
+	order_train(view);
+}
+
+// Favours the fastest train that is braked well enough, then the one with the most seats.
+static void
+score_trains(const attr_cols_t *trains, float *restrict score) {
+	const float *restrict brake = trains->brake;
+	const float *restrict mass = trains->mass;
+	const float *restrict vmax = trains->vmax;
+	const float *restrict seats_1st = trains->seats[0];
+	const float *restrict seats_2nd = trains->seats[1];
+	for(size_t t = 0; t < trains->count; ++t) {
+		float speed = vmax[t] < ATTR_NO_VMAX ? vmax[t] : 0.f;
+		float seats = MIN(seats_1st[t] + seats_2nd[t], 4095.f);
+		float penalty = brake[t] < mass[t] * (MIN_BRAKE_PCT / 100.f) ? 1e7f : 0.f;
+		score[t] = speed * 4096.f + seats - penalty;
+	}
+}
+
+// The first candidate is the train on screen, so optimising never makes it worse.
+static void
+optimise_train(shunt_view_t *view) {
+	size_t len = view->tgt_num;
+	size_t n = view->num_veh;
+	if(!len)
+		return;
+	
+	uint32_t *idx = safe_calloc(len * OPT_TRIES, sizeof(*idx));
+	uint32_t *perm = safe_calloc(n, sizeof(*perm));
+	for(size_t i = 0; i < n; ++i)
+		perm[i] = i;
+	for(size_t p = 0; p < len; ++p)
+		idx[p * OPT_TRIES] = view->order[p];
+	for(size_t t = 1; t < OPT_TRIES; ++t) {
+		for(size_t p = 0; p < len; ++p) {
+			size_t j = p + rand() % (n - p);
+			uint32_t temp = perm[j];
+			perm[j] = perm[p];
+			perm[p] = temp;
+			idx[p * OPT_TRIES + t] = perm[p];
+		}
+	}
+	
+	attr_cols_t trains;
+	attr_cols_init(&trains, OPT_TRIES);
+	attr_cols_sum(&view->pool, idx, len, &trains);
+	float *score = safe_calloc(OPT_TRIES, sizeof(*score));
+	score_trains(&trains, score);
+	size_t best = 0;
+	for(size_t t = 1; t < OPT_TRIES; ++t) {
+		if(score[t] > score[best])
+			best = t;
 	}
+	
+	// The rest of the stock follows the train in its old order
+	memset(perm, 0, n * sizeof(*perm));
+	for(size_t p = 0; p < len; ++p)
+		perm[idx[p * OPT_TRIES + best]] = 1;
+	uint32_t *order = safe_calloc(n, sizeof(*order));
+	size_t rest = len;
+	for(size_t i = 0; i < n; ++i) {
+		if(!perm[view->order[i]])
+			order[rest++] = view->order[i];
+	}
+	for(size_t p = 0; p < len; ++p)
+		order[p] = idx[p * OPT_TRIES + best];
+	memcpy(view->order, order, n * sizeof(*order));
+	free(order);
+	order_train(view);
+	
+	free(score);
+	attr_cols_fini(&trains);
+	free(perm);
+	free(idx);
 }
 
 static bool
@@ -91,6 +310,14 @@ shuntview_update(shunt_view_t *view) {
 	case 'S':
 		shuffle_train(view);
 		break;
+	case 'o':
+	case 'O':
+		optimise_train(view);
+		break;
+	case 'k':
+	case 'K':
+		keep_train(view);
+		break;
 		
 	case 'i':
 	case 'I':
@@ -105,26 +332,50 @@ shuntview_update(shunt_view_t *view) {
 		view->tgt_num = MAX(1, view->tgt_num - 1);
 		shuffle_train(view);
 		break;
+		
+	case KEY_ARROW_LEFT:
+		view->scroll = MAX(0, view->scroll - 1);
+		break;
+	case KEY_ARROW_RIGHT:
+		view->scroll += 1;
+		break;
 	}
 	return true;
 }
 
 void
-show_shuntview(db_t *db, const veh_t **veh, int count) {
-	UNUSED(db);
-	
+show_shuntview(db_t *db, consists_t *consists, const attr_table_t *attrs, const veh_t **veh,
+	       int count) {
 	shunt_view_t view = {
+		.db = db,
+		.consists = consists,
+		.attrs = attrs,
 		.num_veh = count,
 		.tgt_num = 0.7 * count,
 		.stock = veh,
 		.train = NULL,
 	};
-	view.train = safe_calloc(count, sizeof(veh_t *));
+	view.train = safe_calloc(MAX(count, 1), sizeof(veh_t *));
+	view.order = safe_calloc(MAX(count, 1), sizeof(uint32_t));
+	view.layout.boxes = safe_calloc(MAX(count, 1), sizeof(box_t));
+	attr_cols_init(&view.pool, count);
+	attr_cols_gather(&view.pool, attrs, veh);
 	shuffle_train(&view);
 	
+	view.box_w = (int)strlen(" <Lok ");
+	char label[MAX_DESC_LEN];
+	for(int i = 0; i < count; ++i) {
+		veh_combo_desc(veh[i], label, sizeof(label));
+		view.box_w = MAX(view.box_w, utf8_width(label, sizeof(label)));
+	}
+	view.box_w += 2;
+	
 	do {
 		shuntview_draw(&view);
 	} while(shuntview_update(&view));
 	
+	attr_cols_fini(&view.pool);
+	free(view.layout.boxes);
+	free(view.order);
 	free(view.train);
 }
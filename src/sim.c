@@ -0,0 +1,605 @@
+/*===--------------------------------------------------------------------------------------------===
+ * sim.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "sim.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS	(16)
+
+void
+sim_params_default(sim_params_t *params) {
+	ASSERT(params != NULL);
+	*params = (sim_params_t){
+		.seed = 1,
+		.runs = 100,
+		.hours = 24,
+		.arrivals_per_hour = 3,
+		.tracks = 6,
+		.shunters = 2,
+		.min_cars = 4,
+		.max_cars = 10,
+		.move_min = 5,
+		.split_min = 2,
+		.form_min = 3,
+		.dwell_min = 10,
+	};
+}
+
+// MARK: - Random numbers
+
+// splitmix64: small, fast, and good enough to drive arrivals. Its state is the run's own, so runs
+// never share a generator across threads.
+static uint64_t
+rng_next(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static double
+rng_unit(uint64_t *state) {
+	return (rng_next(state) >> 11) * 0x1.0p-53;
+}
+
+static int
+rng_range(uint64_t *state, int lo, int hi) {
+	return lo + (int)(rng_next(state) % (uint64_t)(hi - lo + 1));
+}
+
+// MARK: - Event queue
+
+typedef enum {
+	EV_ARRIVE,
+	EV_SPLIT_DONE,
+	EV_FORM_DONE,
+	EV_DEPART,
+} event_kind_t;
+
+// Times are whole seconds, so that a run comes out the same on any machine.
+typedef struct {
+	int64_t		time;
+	uint64_t	seq;
+	event_kind_t	kind;
+	int		track;
+} event_t;
+
+typedef struct {
+	event_t		*heap;
+	size_t		len;
+	size_t		cap;
+	uint64_t	seq;
+} event_queue_t;
+
+static bool
+event_before(const event_t *a, const event_t *b) {
+	return a->time != b->time ? a->time < b->time : a->seq < b->seq;
+}
+
+static void
+queue_push(event_queue_t *q, int64_t time, event_kind_t kind, int track) {
+	if(q->len == q->cap) {
+		q->cap = q->cap ? q->cap * 2 : 64;
+		q->heap = safe_realloc(q->heap, q->cap * sizeof(*q->heap));
+	}
+	size_t i = q->len++;
+	q->heap[i] = (event_t){.time = time, .seq = q->seq++, .kind = kind, .track = track};
+	while(i > 0) {
+		size_t parent = (i - 1) / 2;
+		if(!event_before(&q->heap[i], &q->heap[parent]))
+			break;
+		event_t tmp = q->heap[i];
+		q->heap[i] = q->heap[parent];
+		q->heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static bool
+queue_pop(event_queue_t *q, event_t *ev) {
+	if(!q->len)
+		return false;
+	*ev = q->heap[0];
+	q->heap[0] = q->heap[--q->len];
+	size_t i = 0;
+	for(;;) {
+		size_t min = i;
+		size_t left = 2 * i + 1, right = 2 * i + 2;
+		if(left < q->len && event_before(&q->heap[left], &q->heap[min]))
+			min = left;
+		if(right < q->len && event_before(&q->heap[right], &q->heap[min]))
+			min = right;
+		if(min == i)
+			break;
+		event_t tmp = q->heap[i];
+		q->heap[i] = q->heap[min];
+		q->heap[min] = tmp;
+		i = min;
+	}
+	return true;
+}
+
+// MARK: - Yard
+
+typedef enum {
+	TRACK_FREE,
+	TRACK_SPLIT_WAIT,	// an arrival waiting for a shunter
+	TRACK_SPLITTING,
+	TRACK_STOCK_WAIT,	// empty, waiting for enough stock to form a train
+	TRACK_FORM_WAIT,	// stock reserved, waiting for a shunter
+	TRACK_FORMING,
+	TRACK_DEPARTING,
+} track_state_t;
+
+typedef struct {
+	track_state_t	state;
+	int		cars;
+	int64_t		occupied;	// since when
+	int64_t		since;		// in the current state
+} track_t;
+
+// A FIFO of track indices or of waiting arrivals, grown as needed.
+typedef struct {
+	int64_t		*items;
+	size_t		head;
+	size_t		len;
+	size_t		cap;
+} fifo_t;
+
+static void
+fifo_init(fifo_t *f, size_t cap) {
+	f->items = safe_calloc(MAX(cap, 1), sizeof(*f->items));
+	f->head = f->len = 0;
+	f->cap = MAX(cap, 1);
+}
+
+static void
+fifo_push(fifo_t *f, int64_t item) {
+	if(f->len == f->cap) {
+		int64_t *items = safe_calloc(f->cap * 2, sizeof(*items));
+		for(size_t i = 0; i < f->len; ++i)
+			items[i] = f->items[(f->head + i) % f->cap];
+		free(f->items);
+		f->items = items;
+		f->head = 0;
+		f->cap *= 2;
+	}
+	f->items[(f->head + f->len++) % f->cap] = item;
+}
+
+static int64_t
+fifo_peek(const fifo_t *f) {
+	return f->items[f->head];
+}
+
+static int64_t
+fifo_pop(fifo_t *f) {
+	int64_t item = f->items[f->head];
+	f->head = (f->head + 1) % f->cap;
+	f->len -= 1;
+	return item;
+}
+
+typedef struct {
+	size_t		arrived;
+	size_t		departed;
+	size_t		cancelled;
+	size_t		waiting;
+	size_t		vehicles;
+	size_t		max_queue;
+	double		track_use;
+	double		shunter_use;
+	double		track_wait;
+	double		track_wait_max;
+	double		stock_wait;
+} run_result_t;
+
+typedef struct {
+	const sim_params_t *params;
+	uint64_t	rng;
+	int64_t		end;
+	FILE		*trace;
+
+	event_queue_t	events;
+	track_t		*tracks;
+	fifo_t		arrivals;	// (cars << 32) | arrival time of trains waiting for a track
+	fifo_t		jobs;		// tracks waiting for a shunter
+	fifo_t		stock_wait;	// tracks waiting for stock
+	int		free_shunters;
+
+	size_t		line_locos, line_cars;	// out on the line, ready to come in as arrivals
+	size_t		yard_locos, yard_cars;	// split and waiting to leave
+
+	int64_t		track_busy;
+	int64_t		shunter_busy;
+	int64_t		track_wait;
+	int64_t		track_wait_max;
+	int64_t		stock_wait_total;
+	size_t		formed;
+	run_result_t	res;
+} yard_t;
+
+static int64_t
+minutes(double min) {
+	return llround(min * 60.0);
+}
+
+static void
+trace(yard_t *yard, int64_t time, const char *fmt, ...) {
+	if(!yard->trace)
+		return;
+	fprintf(yard->trace, "%02d:%02d:%02d  ", (int)(time / 3600), (int)(time / 60 % 60),
+		(int)(time % 60));
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(yard->trace, fmt, args);
+	va_end(args);
+	fputc('\n', yard->trace);
+}
+
+static void
+schedule_arrival(yard_t *yard, int64_t now) {
+	double gap = -log(1.0 - rng_unit(&yard->rng)) / yard->params->arrivals_per_hour;
+	int64_t time = now + MAX(llround(gap * 3600.0), 1);
+	if(time < yard->end)
+		queue_push(&yard->events, time, EV_ARRIVE, -1);
+}
+
+// Work that runs past the end of the day only counts up to it.
+static int64_t
+clip(const yard_t *yard, int64_t start, int64_t duration) {
+	return MIN(start + duration, yard->end) - start;
+}
+
+static void
+start_jobs(yard_t *yard, int64_t now) {
+	const sim_params_t *params = yard->params;
+	while(yard->free_shunters && yard->jobs.len) {
+		int i = (int)fifo_pop(&yard->jobs);
+		track_t *track = &yard->tracks[i];
+		int64_t duration;
+		if(track->state == TRACK_SPLIT_WAIT) {
+			duration = minutes(params->move_min + params->split_min * track->cars);
+			track->state = TRACK_SPLITTING;
+			queue_push(&yard->events, now + duration, EV_SPLIT_DONE, i);
+			trace(yard, now, "track %d: splitting %d cars", i + 1, track->cars);
+		} else {
+			ASSERT(track->state == TRACK_FORM_WAIT);
+			duration = minutes(params->move_min + params->form_min * track->cars);
+			track->state = TRACK_FORMING;
+			queue_push(&yard->events, now + duration, EV_FORM_DONE, i);
+			trace(yard, now, "track %d: forming %d cars", i + 1, track->cars);
+		}
+		track->since = now;
+		yard->free_shunters -= 1;
+		yard->shunter_busy += clip(yard, now, duration);
+	}
+}
+
+// Tracks are given stock in the order they emptied, so a big train can't be starved by small ones.
+static void
+form_trains(yard_t *yard, int64_t now) {
+	while(yard->stock_wait.len) {
+		track_t *track = &yard->tracks[fifo_peek(&yard->stock_wait)];
+		if(!yard->yard_locos || yard->yard_cars < (size_t)track->cars)
+			break;
+		int i = (int)fifo_pop(&yard->stock_wait);
+		yard->yard_locos -= 1;
+		yard->yard_cars -= track->cars;
+		yard->stock_wait_total += now - track->since;
+		yard->formed += 1;
+		track->state = TRACK_FORM_WAIT;
+		track->since = now;
+		fifo_push(&yard->jobs, i);
+	}
+}
+
+static void
+assign_tracks(yard_t *yard, int64_t now) {
+	for(int i = 0; i < yard->params->tracks && yard->arrivals.len; ++i) {
+		track_t *track = &yard->tracks[i];
+		if(track->state != TRACK_FREE)
+			continue;
+		int64_t train = fifo_pop(&yard->arrivals);
+		int64_t wait = now - (train & 0xffffffff);
+		yard->track_wait += wait;
+		yard->track_wait_max = MAX(yard->track_wait_max, wait);
+
+		track->state = TRACK_SPLIT_WAIT;
+		track->cars = (int)(train >> 32);
+		track->occupied = track->since = now;
+		fifo_push(&yard->jobs, i);
+		trace(yard, now, "track %d: in, %d cars", i + 1, track->cars);
+	}
+}
+
+static void
+on_arrive(yard_t *yard, int64_t now) {
+	const sim_params_t *params = yard->params;
+	schedule_arrival(yard, now);
+
+	int cars = rng_range(&yard->rng, params->min_cars, params->max_cars);
+	yard->res.arrived += 1;
+	if(!yard->line_locos || yard->line_cars < (size_t)cars) {
+		yard->res.cancelled += 1;
+		trace(yard, now, "cancelled, no stock for %d cars", cars);
+		return;
+	}
+	yard->line_locos -= 1;
+	yard->line_cars -= cars;
+	fifo_push(&yard->arrivals, ((int64_t)cars << 32) | now);
+	yard->res.max_queue = MAX(yard->res.max_queue, yard->arrivals.len);
+	trace(yard, now, "arrival, %d cars, %zu waiting", cars, yard->arrivals.len);
+}
+
+static void
+on_split_done(yard_t *yard, int64_t now, int i) {
+	const sim_params_t *params = yard->params;
+	track_t *track = &yard->tracks[i];
+	yard->free_shunters += 1;
+	yard->yard_locos += 1;
+	yard->yard_cars += track->cars;
+	yard->res.vehicles += track->cars + 1;
+
+	track->state = TRACK_STOCK_WAIT;
+	track->cars = rng_range(&yard->rng, params->min_cars, params->max_cars);
+	track->since = now;
+	fifo_push(&yard->stock_wait, i);
+	trace(yard, now, "track %d: split, %zu cars in the yard", i + 1, yard->yard_cars);
+}
+
+static void
+on_form_done(yard_t *yard, int64_t now, int i) {
+	track_t *track = &yard->tracks[i];
+	yard->free_shunters += 1;
+	yard->res.vehicles += track->cars + 1;
+	track->state = TRACK_DEPARTING;
+	track->since = now;
+	queue_push(&yard->events, now + minutes(yard->params->dwell_min), EV_DEPART, i);
+}
+
+static void
+on_depart(yard_t *yard, int64_t now, int i) {
+	track_t *track = &yard->tracks[i];
+	yard->line_locos += 1;
+	yard->line_cars += track->cars;
+	yard->res.departed += 1;
+	yard->track_busy += now - track->occupied;
+	track->state = TRACK_FREE;
+	trace(yard, now, "track %d: departed, %d cars", i + 1, track->cars);
+}
+
+// Half of the stock starts the day out on the line and half in the yard, where the first tracks
+// to empty will find it.
+static void
+run_one(const sim_params_t *params, size_t locos, size_t cars, uint64_t seed, FILE *trace_to,
+	run_result_t *res) {
+	yard_t yard = {
+		.params = params,
+		.rng = seed,
+		.end = minutes(params->hours * 60.0),
+		.trace = trace_to,
+		.tracks = safe_calloc(MAX(params->tracks, 1), sizeof(track_t)),
+		.free_shunters = params->shunters,
+		.line_locos = locos - locos / 2,
+		.line_cars = cars - cars / 2,
+		.yard_locos = locos / 2,
+		.yard_cars = cars / 2,
+	};
+	fifo_init(&yard.arrivals, 64);
+	fifo_init(&yard.jobs, params->tracks);
+	fifo_init(&yard.stock_wait, params->tracks);
+
+	schedule_arrival(&yard, 0);
+	event_t ev;
+	while(queue_pop(&yard.events, &ev) && ev.time < yard.end) {
+		switch(ev.kind) {
+		case EV_ARRIVE: on_arrive(&yard, ev.time); break;
+		case EV_SPLIT_DONE: on_split_done(&yard, ev.time, ev.track); break;
+		case EV_FORM_DONE: on_form_done(&yard, ev.time, ev.track); break;
+		case EV_DEPART: on_depart(&yard, ev.time, ev.track); break;
+		}
+		// Departures free tracks, splits bring stock and every job done frees a shunter: give
+		// each its next piece of work before moving the clock on.
+		assign_tracks(&yard, ev.time);
+		form_trains(&yard, ev.time);
+		start_jobs(&yard, ev.time);
+	}
+
+	for(int i = 0; i < params->tracks; ++i) {
+		if(yard.tracks[i].state != TRACK_FREE)
+			yard.track_busy += yard.end - yard.tracks[i].occupied;
+	}
+	int64_t handled = (int64_t)(yard.res.arrived - yard.res.cancelled - yard.arrivals.len);
+	res->arrived = yard.res.arrived;
+	res->departed = yard.res.departed;
+	res->cancelled = yard.res.cancelled;
+	res->waiting = yard.arrivals.len;
+	res->vehicles = yard.res.vehicles;
+	res->max_queue = yard.res.max_queue;
+	res->track_use = yard.end ? (double)yard.track_busy / (yard.end * MAX(params->tracks, 1)) : 0;
+	res->shunter_use = yard.end && params->shunters
+		? (double)yard.shunter_busy / (yard.end * params->shunters) : 0;
+	res->track_wait = handled ? yard.track_wait / 60.0 / handled : 0;
+	res->track_wait_max = yard.track_wait_max / 60.0;
+	res->stock_wait = yard.formed ? yard.stock_wait_total / 60.0 / yard.formed : 0;
+
+	free(yard.events.heap);
+	free(yard.tracks);
+	free(yard.arrivals.items);
+	free(yard.jobs.items);
+	free(yard.stock_wait.items);
+}
+
+// MARK: - Runs
+
+typedef struct {
+	const sim_params_t *params;
+	size_t		locos;
+	size_t		cars;
+	run_result_t	*results;
+	size_t		first;
+	size_t		stride;
+} sim_job_t;
+
+// Each run's seed comes from its index, not from the thread running it.
+static uint64_t
+run_seed(uint64_t seed, size_t run) {
+	uint64_t state = seed ^ (run * 0xd1342543de82ef95ull);
+	return rng_next(&state);
+}
+
+static void *
+run_sims(void *data) {
+	sim_job_t *job = data;
+	const sim_params_t *params = job->params;
+	for(size_t i = job->first; i < (size_t)params->runs; i += job->stride) {
+		run_one(params, job->locos, job->cars, run_seed(params->seed, i),
+			i == 0 ? params->trace : NULL, &job->results[i]);
+	}
+	return NULL;
+}
+
+typedef double (*result_get_f)(const run_result_t *res);
+
+static void
+summarise(sim_stat_t *stat, const run_result_t *results, size_t count, result_get_f get) {
+	double sum = 0, sq = 0;
+	stat->min = INFINITY;
+	stat->max = -INFINITY;
+	for(size_t i = 0; i < count; ++i) {
+		double v = get(&results[i]);
+		sum += v;
+		sq += v * v;
+		stat->min = MIN(stat->min, v);
+		stat->max = MAX(stat->max, v);
+	}
+	stat->mean = sum / count;
+	stat->sd = count > 1 ? sqrt(MAX(sq - sum * sum / count, 0) / (count - 1)) : 0;
+}
+
+#define GETTER(field) \
+	static double get_##field(const run_result_t *res) { return (double)res->field; }
+GETTER(arrived)
+GETTER(departed)
+GETTER(cancelled)
+GETTER(waiting)
+GETTER(vehicles)
+GETTER(track_use)
+GETTER(shunter_use)
+GETTER(track_wait)
+GETTER(track_wait_max)
+GETTER(stock_wait)
+GETTER(max_queue)
+#undef GETTER
+
+bool
+sim_run(const db_t *db, const sim_params_t *params, sim_report_t *report) {
+	ASSERT(db != NULL);
+	ASSERT(params != NULL);
+	ASSERT(report != NULL);
+	ASSERT(params->runs > 0);
+	ASSERT(params->tracks > 0 && params->shunters > 0);
+	ASSERT(params->min_cars >= 0 && params->min_cars <= params->max_cars);
+	ASSERT(params->arrivals_per_hour > 0);
+
+	memset(report, 0, sizeof(*report));
+	const stock_stats_t *stats = stock_db_stats(db);
+	size_t locos = stats->by_type[VEH_TYPE_LOK][1];
+	if(!locos)
+		return false;
+	size_t cars = stats->total[1] - locos;
+
+	size_t runs = params->runs;
+	run_result_t *results = safe_calloc(runs, sizeof(*results));
+	long cpus = params->threads > 0 ? params->threads : sysconf(_SC_NPROCESSORS_ONLN);
+	size_t workers = MIN((size_t)MAX(cpus, 1), MIN(runs, MAX_THREADS));
+	sim_job_t jobs[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	for(size_t i = 0; i < workers; ++i) {
+		jobs[i] = (sim_job_t){
+			.params = params,
+			.locos = locos,
+			.cars = cars,
+			.results = results,
+			.first = i,
+			.stride = workers,
+		};
+	}
+
+	size_t started = 1;
+	for(; started < workers; ++started) {
+		if(pthread_create(&threads[started], NULL, run_sims, &jobs[started]))
+			break;
+	}
+	run_sims(&jobs[0]);
+	for(size_t i = 1; i < started; ++i)
+		pthread_join(threads[i], NULL);
+	for(size_t i = started; i < workers; ++i)
+		run_sims(&jobs[i]);
+
+	report->runs = runs;
+	report->locos = locos;
+	report->cars = cars;
+	summarise(&report->arrived, results, runs, get_arrived);
+	summarise(&report->departed, results, runs, get_departed);
+	summarise(&report->cancelled, results, runs, get_cancelled);
+	summarise(&report->waiting, results, runs, get_waiting);
+	summarise(&report->vehicles, results, runs, get_vehicles);
+	summarise(&report->track_use, results, runs, get_track_use);
+	summarise(&report->shunter_use, results, runs, get_shunter_use);
+	summarise(&report->track_wait, results, runs, get_track_wait);
+	summarise(&report->track_wait_max, results, runs, get_track_wait_max);
+	summarise(&report->stock_wait, results, runs, get_stock_wait);
+	summarise(&report->max_queue, results, runs, get_max_queue);
+	free(results);
+	return true;
+}
+
+// MARK: - Report
+
+static void
+print_stat(FILE *f, const char *name, const sim_stat_t *stat, double scale) {
+	fprintf(f, "%-20s %9.1f %9.1f %9.1f %9.1f\n", name, stat->mean * scale, stat->sd * scale,
+		stat->min * scale, stat->max * scale);
+}
+
+void
+sim_report_print(FILE *f, const sim_params_t *params, const sim_report_t *report) {
+	ASSERT(f != NULL);
+	ASSERT(params != NULL);
+	ASSERT(report != NULL);
+
+	fprintf(f, "%zu runs from seed %llu: %g h, %d tracks, %d shunters, %g trains/h of %d-%d cars\n",
+		report->runs, (unsigned long long)params->seed, params->hours, params->tracks,
+		params->shunters, params->arrivals_per_hour, params->min_cars, params->max_cars);
+	fprintf(f, "stock: %zu locomotives, %zu other vehicles\n\n",
+		report->locos, report->cars);
+
+	fprintf(f, "%-20s %9s %9s %9s %9s\n", "", "mean", "sd", "min", "max");
+	print_stat(f, "arrivals", &report->arrived, 1);
+	print_stat(f, "departures", &report->departed, 1);
+	print_stat(f, "trains per hour", &report->departed, 1.0 / params->hours);
+	print_stat(f, "cancelled", &report->cancelled, 1);
+	print_stat(f, "left waiting", &report->waiting, 1);
+	print_stat(f, "vehicles shunted", &report->vehicles, 1);
+	print_stat(f, "track use %", &report->track_use, 100);
+	print_stat(f, "shunter use %", &report->shunter_use, 100);
+	print_stat(f, "track wait (min)", &report->track_wait, 1);
+	print_stat(f, "worst wait (min)", &report->track_wait_max, 1);
+	print_stat(f, "stock wait (min)", &report->stock_wait, 1);
+	print_stat(f, "longest queue", &report->max_queue, 1);
+}
@@ -0,0 +1,83 @@
+/*===--------------------------------------------------------------------------------------------===
+ * sim.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "stock.h"
+
+// A discrete-event model of a day in a yard worked with the fleet's in-use stock.
+//
+// Trains arrive at random, each a locomotive and some cars taken from the stock out on the line.
+// Railcars are shunted as cars, like everything else that isn't a locomotive.
+// An arriving train waits for a free track, then for a shunter to split it. Its vehicles join the
+// stock in the yard, and the track is used to form a departure from it: a shunter couples a
+// locomotive and some cars, and the train leaves after its brake test, handing its vehicles back
+// to the line. Tracks and shunters are the limited resources.
+//
+// Events are run in time order from a priority queue, ties broken by the order they were
+// scheduled in, so a run depends only on its parameters and its seed. Runs are spread across
+// threads, but every run has its own seed derived from the base seed and its index, so a report
+// is the same however many threads made it.
+typedef struct {
+	uint64_t	seed;
+	int		runs;
+	int		threads;		// 0 for one per core
+
+	double		hours;
+	double		arrivals_per_hour;
+	int		tracks;
+	int		shunters;
+	int		min_cars;
+	int		max_cars;
+
+	double		move_min;		// fixed time of any shunting job
+	double		split_min;		// per car uncoupled
+	double		form_min;		// per car coupled
+	double		dwell_min;		// from formed to departed
+
+	FILE		*trace;			// events of the first run, or NULL
+} sim_params_t;
+
+void
+sim_params_default(sim_params_t *params);
+
+typedef struct {
+	double		mean;
+	double		sd;
+	double		min;
+	double		max;
+} sim_stat_t;
+
+typedef struct {
+	size_t		runs;
+	size_t		locos;			// in-use stock the runs started with
+	size_t		cars;
+	sim_stat_t	arrived;
+	sim_stat_t	departed;
+	sim_stat_t	cancelled;		// arrivals with no stock out on the line to make them
+	sim_stat_t	waiting;		// trains still waiting for a track at the end
+	sim_stat_t	vehicles;		// vehicles uncoupled and coupled
+	sim_stat_t	track_use;		// fraction of track time occupied
+	sim_stat_t	shunter_use;		// fraction of shunter time busy
+	sim_stat_t	track_wait;		// mean minutes an arrival waited for a track
+	sim_stat_t	track_wait_max;
+	sim_stat_t	stock_wait;		// mean minutes a track waited for stock to form a train
+	sim_stat_t	max_queue;
+} sim_report_t;
+
+// Runs the simulation over the DB's in-use stock. Returns false if there is no locomotive in use
+// to run trains with.
+bool
+sim_run(const db_t *db, const sim_params_t *params, sim_report_t *report);
+
+void
+sim_report_print(FILE *f, const sim_params_t *params, const sim_report_t *report);
+
+#endif /* ifndef _SIM_H_ */
@@ -0,0 +1,145 @@
+/*===--------------------------------------------------------------------------------------------===
+ * statsview.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "ui.h"
+#include "views.h"
+#include "mem.h"
+#include <utils/helpers.h>
+
+#define LABEL_WIDTH	(24)
+#define COUNT_WIDTH	(10)
+
+static int
+stats_row(int y, const char *label, const size_t count[2]) {
+	hexes_cursor_go(0, y);
+	ui_line("  %-*s %*zu %*zu %*zu",
+		LABEL_WIDTH, label,
+		COUNT_WIDTH, count[0] + count[1],
+		COUNT_WIDTH, count[1],
+		COUNT_WIDTH, count[0]);
+	return y + 1;
+}
+
+static int
+stats_heading(int y, const char *title) {
+	hexes_cursor_go(0, y);
+	term_set_bold(stdout, true);
+	ui_line(" %s", title);
+	term_style_reset(stdout);
+	return y + 1;
+}
+
+static void
+statsview_draw(const db_t *db) {
+	const stock_stats_t *stats = stock_db_stats(db);
+	
+	hexes_clear_screen();
+	ui_title(" Rolling Stock Database - Fleet Statistics");
+	
+	int y = 2;
+	hexes_cursor_go(0, y++);
+	term_set_underline(stdout, true);
+	ui_line("  %-*s %*s %*s %*s",
+		LABEL_WIDTH, "",
+		COUNT_WIDTH, "total",
+		COUNT_WIDTH, "in use",
+		COUNT_WIDTH, "spare");
+	term_style_reset(stdout);
+	
+	y = stats_row(y, "all vehicles", stats->total);
+	
+	y = stats_heading(y + 1, "By type");
+	for(int i = 0; i < VEH_TYPE_COUNT; ++i) {
+		y = stats_row(y, stock_type_name(i), stats->by_type[i]);
+	}
+	
+	y = stats_heading(y + 1, "By traction");
+	for(int i = TRACTION_NONE + 1; i < TRACTION_COUNT; ++i) {
+		y = stats_row(y, stock_traction_name(i), stats->by_traction[i]);
+	}
+	
+	y = stats_heading(y + 1, "By capability");
+	for(int i = 0; i < VEH_CAP_COUNT; ++i) {
+		y = stats_row(y, stock_cap_name(i), stats->by_cap[i]);
+	}
+	
+	ui_prompt(" [R]eturn    [M]emory");
+}
+
+static int
+mem_row(int y, const char *label, size_t bytes) {
+	char size[32];
+	mem_format_size(bytes, size, sizeof(size));
+	hexes_cursor_go(0, y);
+	ui_line("  %-*s %*s", LABEL_WIDTH, label, COUNT_WIDTH + 4, size);
+	return y + 1;
+}
+
+static void
+memview_draw(const db_t *db, size_t view_bytes) {
+	stock_memstats_t mem;
+	stock_db_memstats(db, &mem);
+	mem.views = view_bytes;
+	mem_count_t counts[MEM_OP_COUNT];
+	mem_counts(counts);
+	
+	hexes_clear_screen();
+	ui_title(" Rolling Stock Database - Memory");
+	
+	int y = stats_heading(2, "Memory in use");
+	y = mem_row(y, "records", mem.records);
+	y = mem_row(y, "strings", mem.strings);
+	y = mem_row(y, "index", mem.index);
+	y = mem_row(y, "view buffers", mem.views);
+	y = mem_row(y, "slack", mem.slack);
+	y = mem_row(y, "total", stock_memstats_total(&mem));
+	
+	y = stats_heading(y + 1, "Allocations since start");
+	for(int i = 0; i < MEM_OP_COUNT; ++i) {
+		char size[32];
+		mem_format_size(counts[i].bytes, size, sizeof(size));
+		hexes_cursor_go(0, y++);
+		ui_line("  %-*s %*zu %*s", LABEL_WIDTH, mem_op_name(i), COUNT_WIDTH, counts[i].allocs,
+			COUNT_WIDTH + 4, size);
+	}
+	
+	ui_prompt(" [R]eturn    [M]emory");
+}
+
+static bool
+statsview_update(bool *memory) {
+	switch(ui_get_key()) {
+	case 'm':
+	case 'M':
+		*memory = !*memory;
+		break;
+	case KEY_CTRL_C:
+	case KEY_CTRL_D:
+	case KEY_CTRL_Q:
+	case 'q':
+	case 'Q':
+	case 'r':
+	case 'R':
+		return false;
+	default:
+		break;
+	}
+	return true;
+}
+
+void
+show_statsview(db_t *db, size_t view_bytes) {
+	bool memory = false;
+	do {
+		if(memory)
+			memview_draw(db, view_bytes);
+		else
+			statsview_draw(db);
+	} while(statsview_update(&memory));
+}
@@ -8,10 +8,19 @@
  *===--------------------------------------------------------------------------------------------===
 */
 #include "stock.h"
+#include "mem.h"
+#include "uic.h"
+#include "utf8.h"
 #include <stdio.h>
 #include <utils/assert.h>
 #include <utils/helpers.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 static int
 veh_cmp(const void *a, const void *b) {
@@ -22,31 +31,69 @@ veh_cmp(const void *a, const void *b) {
 	return 0;
 }
 
-typedef enum {
-	LOK_ELEC 	= 1 << 0,
-	LOK_DIESEL 	= 1 << 1,
-	LOK_RACK 	= 1 << 2,
-	LOK_NARROW 	= 1 << 3,
-	
-	PAX_FIRST	= 1 << 4,
-	PAX_SECOND	= 1 << 5,
-	PAX_RESTAURANT	= 1 << 6,
-	
-	PAX_PANORAMIC	= 1 << 7,
-	
-	LUGGAGE_VAN	= 1 << 8,
-} veh_cap_mask_t;
+static const char *type_names[] = {
+	[VEH_TYPE_UNKNOWN] = "unknown",
+	[VEH_TYPE_LOK] = "locomotive",
+	[VEH_TYPE_VAN] = "luggage van",
+	[VEH_TYPE_COACH] = "coach",
+	[VEH_TYPE_WAGON] = "wagon",
+	[VEH_TYPE_CONTROL] = "control",
+	[VEH_TYPE_RAILCAR] = "railcar",
+};
 
-static const char *
-lok_traction_str(veh_type_t type, uint32_t mask) {
-	if(type != VEH_TYPE_LOK && type != VEH_TYPE_RAILCAR) return NULL;
+static const char *traction_names[TRACTION_COUNT] = {
+	[TRACTION_NONE] = NULL,
+	[TRACTION_STEAM] = "steam",
+	[TRACTION_ELEC] = "electric",
+	[TRACTION_DIESEL] = "diesel",
+	[TRACTION_ELECTRO_DIESEL] = "electro-diesel",
+};
+
+static const char *cap_names[VEH_CAP_COUNT] = {
+	"electric",
+	"diesel",
+	"rack",
+	"narrow-gauge",
+	"1st class",
+	"2nd class",
+	"restaurant",
+	"panoramic",
+	"luggage",
+};
+
+veh_traction_t
+veh_traction(veh_type_t type, uint32_t mask) {
+	if(type != VEH_TYPE_LOK && type != VEH_TYPE_RAILCAR) return TRACTION_NONE;
 	if((mask & (LOK_ELEC|LOK_DIESEL)) == (LOK_ELEC|LOK_DIESEL))
-		return "electro-diesel";
+		return TRACTION_ELECTRO_DIESEL;
 	if(mask & LOK_DIESEL)
-		return "diesel";
+		return TRACTION_DIESEL;
 	if(mask & LOK_ELEC)
-		return "electric";
-	return "steam";
+		return TRACTION_ELEC;
+	return TRACTION_STEAM;
+}
+
+const char *
+stock_type_name(veh_type_t type) {
+	ASSERT(type < VEH_TYPE_COUNT);
+	return type_names[type];
+}
+
+const char *
+stock_traction_name(veh_traction_t traction) {
+	ASSERT(traction < TRACTION_COUNT);
+	return traction_names[traction] ? traction_names[traction] : "none";
+}
+
+const char *
+stock_cap_name(int bit) {
+	ASSERT(bit >= 0 && bit < VEH_CAP_COUNT);
+	return cap_names[bit];
+}
+
+static const char *
+lok_traction_str(veh_type_t type, uint32_t mask) {
+	return traction_names[veh_traction(type, mask)];
 }
 
 static const char *
@@ -81,61 +128,6 @@ van_str(veh_type_t type, uint32_t mask) {
 	return (mask & (LUGGAGE_VAN)) ? "with luggage compartment" : NULL;	
 }
 
-static uint32_t
-veh_uic_to_mask(char c) {
-	switch(c) {
-	case 'D': return LUGGAGE_VAN;
-	case 'W': return PAX_RESTAURANT;
-		
-	case 'A': return PAX_FIRST;
-	case 'B': return PAX_SECOND;
-	
-	case 'p': return PAX_PANORAMIC;
-	
-	case 'H': return LOK_RACK;
-	case 'G': return LOK_NARROW;
-	case 'e': return LOK_ELEC;
-	
-	case 'm': return LOK_DIESEL;
-	case 'h': return LOK_RACK;
-	}
-	return 0;
-}
-
-static veh_type_t
-veh_uic_to_type(char c) {
-	switch(c) {
-	case 'D':
-		return VEH_TYPE_VAN;
-	case 'W':
-	case 'A':
-	case 'B':
-		return VEH_TYPE_COACH;
-	case 'R':
-	case 'G':
-	case 'H':
-	case 'e':
-	case 'a':
-	case 'f':
-	case 'm':
-	case 'h':
-		return VEH_TYPE_LOK;
-	case 'L':
-		return VEH_TYPE_WAGON;
-	}
-	return VEH_TYPE_UNKNOWN;
-}
-
-static const char *type_names[] = {
-	[VEH_TYPE_UNKNOWN] = "unknown",
-	[VEH_TYPE_LOK] = "locomotive",
-	[VEH_TYPE_VAN] = "luggage van",
-	[VEH_TYPE_COACH] = "coach",
-	[VEH_TYPE_WAGON] = "wagon",
-	[VEH_TYPE_CONTROL] = "control",
-	[VEH_TYPE_RAILCAR] = "railcar",
-};
-
 static void describe_mask(veh_type_t type, uint32_t mask, char *dest, int cap) {
 	
 	const char *comps[] = {
@@ -151,102 +143,482 @@ static void describe_mask(veh_type_t type, uint32_t mask, char *dest, int cap) {
 		van_str(type, mask),
 	};
 	
+	if(cap > 0)
+		dest[0] = '\0';
 	bool before = false;
 	for(int i = 0; i < 7; ++i) {
 		if(!comps[i]) continue;
-		size_t written = snprintf(dest, cap, "%s%s", before ? " " : "", comps[i]);
+		int written = snprintf(dest, cap, "%s%s", before ? " " : "", comps[i]);
+		if(written < 0 || written >= cap) break;
 		cap -= written;
 		dest += written;
 		before = true;
-		if(!cap) break;
 	}
 }
 
 static void
 veh_find_type(veh_t *veh) {
-	uint32_t type_mask = 0;
-	veh_type_t type = VEH_TYPE_UNKNOWN;
-	UNUSED(type_names);
-	
-	const char *c = veh->class;
-	while(*c && !isspace(*c)) {
-		veh_type_t new_type = veh_uic_to_type(*c);
-		type_mask |= veh_uic_to_mask(*c);
-		c++;
-		switch(type) {
-		case VEH_TYPE_UNKNOWN:
-			type = new_type;
-			break;
-		case VEH_TYPE_LOK:
-			type = new_type > VEH_TYPE_LOK ? VEH_TYPE_RAILCAR : VEH_TYPE_LOK;
-			break;
-		default:
-			if(new_type == VEH_TYPE_LOK) {
-				type = VEH_TYPE_RAILCAR;
-			} else {
-				type = MAX(new_type, type);
-			}
-			break;
+	veh_type_t type;
+	uint32_t caps;
+	uic_classify(veh->class, &type, &caps);
+	veh->type = type;
+	veh->caps = caps;
+}
+
+void
+veh_combo_desc(const veh_t *veh, char *buf, size_t cap) {
+	ASSERT(veh != NULL);
+	snprintf(buf, cap, "%s %" VEH_NUM_FMT, veh->class, veh->num);
+}
+
+void
+veh_class_desc(const veh_t *veh, char *buf, size_t cap) {
+	ASSERT(veh != NULL);
+	describe_mask(veh->type, veh->caps, buf, (int)MIN(cap, INT_MAX));
+}
+
+veh_t *
+veh_new(veh_num_t num, bool in_use, const char *class, const char *desc) {
+	ASSERT(class != NULL);
+	ASSERT(desc != NULL);
+	
+	size_t class_len = utf8_clip(class, MAX_CLASS_LEN - 1);
+	size_t desc_len = utf8_clip(desc, MAX_DESC_LEN - 1);
+	size_t class_size = dict_str_size(class_len);
+	veh_t *veh = mem_calloc(1, sizeof(*veh) + class_size + dict_str_size(desc_len));
+	char *text = (char *)(veh + 1);
+	veh->num = num;
+	veh->in_use = in_use;
+	veh->class = dict_str_init(text, class, class_len);
+	veh->desc = dict_str_init(text + class_size, desc, desc_len);
+	veh_find_type(veh);
+	return veh;
+}
+
+static void
+cols_sync(stock_cols_t *cols, const veh_t *veh) {
+	cols->num[veh->slot] = veh->num;
+	cols->type[veh->slot] = (uint8_t)veh->type;
+	cols->in_use[veh->slot] = veh->in_use;
+	cols->caps[veh->slot] = veh->caps;
+}
+
+static void
+cols_push(stock_cols_t *cols, veh_t *veh) {
+	if(cols->count == cols->cap) {
+		cols->cap = cols->cap ? cols->cap * 2 : 256;
+		cols->num = mem_realloc(cols->num, cols->cap * sizeof(*cols->num));
+		cols->type = mem_realloc(cols->type, cols->cap * sizeof(*cols->type));
+		cols->in_use = mem_realloc(cols->in_use, cols->cap * sizeof(*cols->in_use));
+		cols->caps = mem_realloc(cols->caps, cols->cap * sizeof(*cols->caps));
+		cols->rec = mem_realloc(cols->rec, cols->cap * sizeof(*cols->rec));
+	}
+	veh->slot = cols->count++;
+	cols->rec[veh->slot] = veh;
+	cols_sync(cols, veh);
+}
+
+static void
+cols_remove(stock_cols_t *cols, veh_t *veh) {
+	ASSERT(veh->slot < cols->count);
+	ASSERT(cols->rec[veh->slot] == veh);
+	
+	veh_t *last = cols->rec[--cols->count];
+	if(last != veh) {
+		last->slot = veh->slot;
+		cols->rec[last->slot] = last;
+		cols_sync(cols, last);
+	}
+}
+
+static void
+cols_fini(stock_cols_t *cols) {
+	free(cols->num);
+	free(cols->type);
+	free(cols->in_use);
+	free(cols->caps);
+	free(cols->rec);
+	memset(cols, 0, sizeof(*cols));
+}
+
+// Records in the same DB share their text, so equal strings are usually the same pointer.
+static int
+sort_cmp_class(const veh_t *a, const veh_t *b) {
+	return a->class == b->class ? 0 : strcmp(a->class, b->class);
+}
+
+static int
+sort_cmp_desc(const veh_t *a, const veh_t *b) {
+	return a->desc == b->desc ? 0 : strcmp(a->desc, b->desc);
+}
+
+static int
+sort_cmp_type(const veh_t *a, const veh_t *b) {
+	return (int)a->type - (int)b->type;
+}
+
+static int
+sort_cmp_in_use(const veh_t *a, const veh_t *b) {
+	return (int)b->in_use - (int)a->in_use;
+}
+
+static int (*const sort_cmp[VEH_SORT_COUNT])(const veh_t *, const veh_t *) = {
+	[VEH_SORT_NUM] = NULL,
+	[VEH_SORT_CLASS] = sort_cmp_class,
+	[VEH_SORT_TYPE] = sort_cmp_type,
+	[VEH_SORT_DESC] = sort_cmp_desc,
+	[VEH_SORT_IN_USE] = sort_cmp_in_use,
+};
+
+static const char *sort_names[VEH_SORT_COUNT] = {
+	[VEH_SORT_NUM] = "running number",
+	[VEH_SORT_CLASS] = "class",
+	[VEH_SORT_TYPE] = "type",
+	[VEH_SORT_DESC] = "description",
+	[VEH_SORT_IN_USE] = "in use",
+};
+
+// Every order falls back on the running number, which makes it total: a record's position in a
+// permutation can always be found again by binary search.
+static int
+perm_cmp(veh_sort_t key, const veh_t *a, const veh_t *b) {
+	int res = sort_cmp[key] ? sort_cmp[key](a, b) : 0;
+	return res ? res : veh_cmp(a, b);
+}
+
+// A merge sort rather than qsort(), so the key is passed along instead of through a global:
+// orders can be sorted on several DBs at once, from the depot loading threads.
+static void
+perm_sort(veh_t **list, size_t count, veh_sort_t key) {
+	veh_t **tmp = mem_calloc(MAX(count, 1), sizeof(*tmp));
+	veh_t **src = list, **dst = tmp;
+	for(size_t width = 1; width < count; width *= 2) {
+		for(size_t lo = 0; lo < count; lo += 2 * width) {
+			size_t mid = MIN(lo + width, count), hi = MIN(lo + 2 * width, count);
+			size_t i = lo, j = mid, k = lo;
+			while(i < mid && j < hi)
+				dst[k++] = perm_cmp(key, src[j], src[i]) < 0 ? src[j++] : src[i++];
+			while(i < mid)
+				dst[k++] = src[i++];
+			while(j < hi)
+				dst[k++] = src[j++];
 		}
+		veh_t **swap = src;
+		src = dst;
+		dst = swap;
 	}
-	veh->type = type;
-	describe_mask(type, type_mask, veh->class_desc, sizeof(veh->class_desc));
+	if(src != list)
+		memcpy(list, src, count * sizeof(*list));
+	free(tmp);
+}
+
+static size_t
+perm_lower_bound(const stock_perm_t *perm, veh_sort_t key, const veh_t *veh) {
+	size_t lo = 0, hi = perm->count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(perm_cmp(key, perm->list[mid], veh) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
 }
 
 static void
-post_proc_veh(veh_t *veh) {
-	snprintf(veh->combo_desc, sizeof(veh->combo_desc), "%s %d", veh->class, veh->num);
-	veh_find_type(veh);
+perm_insert(stock_perm_t *perm, veh_sort_t key, veh_t *veh) {
+	if(!perm->valid) return;
+	if(perm->count == perm->cap) {
+		perm->cap = perm->cap ? perm->cap * 2 : 256;
+		perm->list = mem_realloc(perm->list, perm->cap * sizeof(*perm->list));
+	}
+	size_t at = perm_lower_bound(perm, key, veh);
+	memmove(perm->list + at + 1, perm->list + at, (perm->count - at) * sizeof(*perm->list));
+	perm->list[at] = veh;
+	perm->count += 1;
+}
+
+static void
+perm_remove(stock_perm_t *perm, veh_sort_t key, const veh_t *veh) {
+	if(!perm->valid) return;
+	size_t at = perm_lower_bound(perm, key, veh);
+	ASSERT(at < perm->count && perm->list[at] == veh);
+	perm->count -= 1;
+	memmove(perm->list + at, perm->list + at + 1, (perm->count - at) * sizeof(*perm->list));
+}
+
+static void
+perms_insert(db_t *db, veh_t *veh) {
+	for(int i = 0; i < VEH_SORT_COUNT; ++i)
+		perm_insert(&db->perms[i], i, veh);
+}
+
+static void
+perms_remove(db_t *db, const veh_t *veh) {
+	for(int i = 0; i < VEH_SORT_COUNT; ++i)
+		perm_remove(&db->perms[i], i, veh);
+}
+
+static void
+perms_fini(db_t *db) {
+	for(int i = 0; i < VEH_SORT_COUNT; ++i) {
+		free(db->perms[i].list);
+	}
+	memset(db->perms, 0, sizeof(db->perms));
+}
+
+const char *
+stock_sort_name(veh_sort_t key) {
+	ASSERT(key < VEH_SORT_COUNT);
+	return sort_names[key];
+}
+
+int
+stock_sort_cmp(veh_sort_t key, const veh_t *a, const veh_t *b) {
+	ASSERT(key < VEH_SORT_COUNT);
+	return perm_cmp(key, a, b);
+}
+
+veh_t *const *
+stock_db_sorted(db_t *db, veh_sort_t key) {
+	ASSERT(db != NULL);
+	ASSERT(key < VEH_SORT_COUNT);
+	
+	stock_perm_t *perm = &db->perms[key];
+	if(perm->valid)
+		return perm->list;
+	
+	perm->count = db->cols.count;
+	perm->cap = MAX(perm->count, 256);
+	perm->list = mem_realloc(perm->list, perm->cap * sizeof(*perm->list));
+	
+	// The column slots already hold every record, so they can be sorted directly without walking
+	// the tree. Running-number order comes out of the tree for free.
+	if(key == VEH_SORT_NUM) {
+		size_t i = 0;
+		for(veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh))
+			perm->list[i++] = veh;
+	} else if(perm->count) {
+		memcpy(perm->list, db->cols.rec, perm->count * sizeof(*perm->list));
+		perm_sort(perm->list, perm->count, key);
+	}
+	perm->valid = true;
+	return perm->list;
+}
+
+static void
+stats_count(stock_stats_t *stats, const veh_t *veh, int delta) {
+	int in_use = veh->in_use ? 1 : 0;
+	stats->total[in_use] += delta;
+	stats->by_type[veh->type][in_use] += delta;
+	stats->by_traction[veh_traction(veh->type, veh->caps)][in_use] += delta;
+	for(int i = 0; i < VEH_CAP_COUNT; ++i) {
+		if(veh->caps & (1u << i))
+			stats->by_cap[i][in_use] += delta;
+	}
+}
+
+// FNV-1a over the fields that are stored in the DB file, finished with a stronger mix so the
+// XOR of many record hashes stays well spread.
+static uint64_t
+veh_hash(const veh_t *veh) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t num = (uint64_t)veh->num;
+	for(int i = 0; i < 8; ++i) {
+		h = (h ^ ((num >> (8 * i)) & 0xff)) * 0x100000001b3ull;
+	}
+	h = (h ^ (uint64_t)veh->in_use) * 0x100000001b3ull;
+	for(const char *c = veh->class; *c; ++c)
+		h = (h ^ (uint8_t)*c) * 0x100000001b3ull;
+	h = (h ^ 0xff) * 0x100000001b3ull;
+	for(const char *c = veh->desc; *c; ++c)
+		h = (h ^ (uint8_t)*c) * 0x100000001b3ull;
+	
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebull;
+	return h ^ (h >> 31);
+}
+
+static void
+digest_count(hash_map_t *digests, const veh_t *veh, int delta) {
+	uint64_t hash = veh_hash(veh);
+	for(int level = 0; level < STOCK_DIGEST_LEVELS; ++level) {
+		int64_t block = veh->num >> (STOCK_DIGEST_SHIFT * (level + 1));
+		stock_digest_t *digest = hash_get(&digests[level], block);
+		if(!digest) {
+			digest = mem_calloc(1, sizeof(*digest));
+			hash_put(&digests[level], block, digest);
+		}
+		digest->hash ^= hash;
+		digest->count += delta;
+		if(!digest->count) {
+			hash_remove(&digests[level], block);
+			free(digest);
+		}
+	}
+}
+
+static void
+digests_fini(hash_map_t *digests) {
+	for(int level = 0; level < STOCK_DIGEST_LEVELS; ++level) {
+		size_t iter = 0;
+		const hash_entry_t *entry;
+		while((entry = hash_next(&digests[level], &iter)) != NULL)
+			free(entry->value);
+		hash_fini(&digests[level]);
+	}
+}
+
+void
+stock_db_init(db_t *db) {
+	ASSERT(db != NULL);
+	
+	avl_create(&db->tree, veh_cmp, sizeof(veh_t), offsetof(veh_t, db_node));
+	hash_init(&db->by_num);
+	for(int i = 0; i < STOCK_DIGEST_LEVELS; ++i)
+		hash_init(&db->digests[i]);
+	memset(&db->cols, 0, sizeof(db->cols));
+	memset(db->perms, 0, sizeof(db->perms));
+	memset(&db->stats, 0, sizeof(db->stats));
+	trie_init(&db->classes);
+	runs_init(&db->used);
+	dict_init(&db->strings);
+	db->gen = 0;
+	db->num_observers = 0;
+	db->moves = NULL;
+	db->num_moves = 0;
+	db->merging = false;
+}
+
+void
+stock_db_observe(db_t *db, db_observer_f fn, void *ctx) {
+	ASSERT(db != NULL);
+	ASSERT(fn != NULL);
+	ASSERT(db->num_observers < DB_MAX_OBSERVERS);
+	
+	db->observers[db->num_observers++] = (db_observer_t){fn, ctx};
 }
 
 void
-stock_db_init(avl_tree_t *db) {
+stock_db_unobserve(db_t *db, db_observer_f fn, void *ctx) {
 	ASSERT(db != NULL);
 	
-	avl_create(db, veh_cmp, sizeof(veh_t), offsetof(veh_t, db_node));
+	for(int i = 0; i < db->num_observers; ++i) {
+		if(db->observers[i].fn != fn || db->observers[i].ctx != ctx) continue;
+		db->num_observers -= 1;
+		memmove(&db->observers[i], &db->observers[i+1],
+			(db->num_observers - i) * sizeof(db->observers[0]));
+		return;
+	}
+}
+
+static void
+tell_observers(db_t *db, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	for(int i = 0; i < db->num_observers; ++i)
+		db->observers[i].fn(db->observers[i].ctx, ev, veh, old_num);
+}
+
+static void
+notify(db_t *db, db_event_t ev, const veh_t *veh, veh_num_t old_num) {
+	db->gen += 1;
+	tell_observers(db, ev, veh, old_num);
 }
 
 void
-stock_db_fini(avl_tree_t *db) {
+stock_db_fini(db_t *db) {
 	ASSERT(db != NULL);
 	
 	veh_t *veh = NULL;
 	void *cookie = NULL;
 	
-	while((veh = avl_destroy_nodes(db, &cookie)) != NULL) {
+	while((veh = avl_destroy_nodes(&db->tree, &cookie)) != NULL) {
 		free(veh);
 	}
-	avl_destroy(db);
+	avl_destroy(&db->tree);
+	hash_fini(&db->by_num);
+	digests_fini(db->digests);
+	cols_fini(&db->cols);
+	perms_fini(db);
+	trie_fini(&db->classes);
+	runs_fini(&db->used);
+	dict_fini(&db->strings);
 }
 
-bool
-stock_db_add(avl_tree_t *db, veh_t *veh) {
+veh_t *
+stock_db_add(db_t *db, const veh_t *data) {
 	ASSERT(db != NULL);
-	ASSERT(veh != NULL);
-
-	post_proc_veh(veh);
+	ASSERT(data != NULL);
 	
 	avl_index_t where;
-	if(avl_find(db, veh, &where) != NULL)
-		return false;
-	avl_insert(db, veh, where);
-	return true;
+	if(avl_find(&db->tree, data, &where) != NULL)
+		return NULL;
+	mem_op_t op = mem_op_begin(MEM_OP_ADD);
+	veh_t *veh = mem_calloc(1, sizeof(*veh));
+	veh->num = data->num;
+	veh->in_use = data->in_use;
+	veh->class = dict_intern(&db->strings, data->class, MAX_CLASS_LEN - 1);
+	veh->desc = dict_intern(&db->strings, data->desc, MAX_DESC_LEN - 1);
+	veh_find_type(veh);
+	avl_insert(&db->tree, veh, where);
+	hash_put(&db->by_num, veh->num, veh);
+	cols_push(&db->cols, veh);
+	perms_insert(db, veh);
+	stats_count(&db->stats, veh, 1);
+	digest_count(db->digests, veh, 1);
+	trie_add(&db->classes, veh->class);
+	runs_add(&db->used, veh->num);
+	mem_op_end(op);
+	notify(db, DB_EV_ADD, veh, veh->num);
+	return veh;
 }
 
 bool
-stock_db_update(db_t *db, veh_t *veh) {
+stock_db_update(db_t *db, veh_t *veh, const veh_t *data) {
 	ASSERT(db != NULL);
 	ASSERT(veh != NULL);
-	post_proc_veh(veh);
-	return avl_update(db, veh);
+	ASSERT(data != NULL);
+	
+	veh_num_t old_num = veh->num;
+	mem_op_t op = mem_op_begin(MEM_OP_UPDATE);
+	perms_remove(db, veh);
+	stats_count(&db->stats, veh, -1);
+	digest_count(db->digests, veh, -1);
+	trie_remove(&db->classes, veh->class);
+	if(data != veh) {
+		// Interned before the old text is released, in case they are the same string
+		const char *class = dict_intern(&db->strings, data->class, MAX_CLASS_LEN - 1);
+		const char *desc = dict_intern(&db->strings, data->desc, MAX_DESC_LEN - 1);
+		dict_release(&db->strings, veh->class);
+		dict_release(&db->strings, veh->desc);
+		veh->num = data->num;
+		veh->class = class;
+		veh->desc = desc;
+	}
+	veh_find_type(veh);
+	
+	cols_sync(&db->cols, veh);
+	bool moved = avl_update(&db->tree, veh);
+	perms_insert(db, veh);
+	stats_count(&db->stats, veh, 1);
+	digest_count(db->digests, veh, 1);
+	trie_add(&db->classes, veh->class);
+	if(veh->num != old_num) {
+		hash_remove(&db->by_num, old_num);
+		hash_put(&db->by_num, veh->num, veh);
+		runs_remove(&db->used, old_num);
+		runs_add(&db->used, veh->num);
+	}
+	mem_op_end(op);
+	notify(db, DB_EV_UPDATE, veh, old_num);
+	return moved;
 }
 
 veh_t *
-stock_db_get(const avl_tree_t *db, int num) {
+stock_db_get(const db_t *db, veh_num_t num) {
 	ASSERT(db != NULL);
-	
-	veh_t search = {.num = num};
-	return avl_find(db, &search, NULL);
+	return hash_get(&db->by_num, num);
 }
 
 void
@@ -254,99 +626,635 @@ stock_db_delete(db_t *db, veh_t *veh) {
 	ASSERT(db != NULL);
 	ASSERT(veh != NULL);
 	
-	avl_remove(db, veh);
+	notify(db, DB_EV_DELETE, veh, veh->num);
+	mem_op_t op = mem_op_begin(MEM_OP_DELETE);
+	perms_remove(db, veh);
+	stats_count(&db->stats, veh, -1);
+	digest_count(db->digests, veh, -1);
+	trie_remove(&db->classes, veh->class);
+	runs_remove(&db->used, veh->num);
+	cols_remove(&db->cols, veh);
+	hash_remove(&db->by_num, veh->num);
+	avl_remove(&db->tree, veh);
+	dict_release(&db->strings, veh->class);
+	dict_release(&db->strings, veh->desc);
 	free(veh);
+	mem_op_end(op);
+}
+
+bool
+stock_db_next_free(const db_t *db, veh_num_t lo, veh_num_t hi, veh_num_t *num) {
+	ASSERT(db != NULL);
+	return runs_next_free(&db->used, lo, hi, num);
 }
 
+// Types only change as a whole, so the derived indexes are rebuilt in one pass rather than
+// patched record by record. The text of the records doesn't change, so observers aren't told.
 size_t
-stock_db_get_list(const avl_tree_t *db, int *list, size_t cap) {
+stock_db_reclassify(db_t *db) {
+	ASSERT(db != NULL);
+	
+	size_t changed = 0;
+	for(veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh)) {
+		veh_type_t type = veh->type;
+		uint32_t caps = veh->caps;
+		veh_find_type(veh);
+		if(veh->type == type && veh->caps == caps)
+			continue;
+		cols_sync(&db->cols, veh);
+		changed += 1;
+	}
+	if(!changed)
+		return 0;
+	
+	memset(&db->stats, 0, sizeof(db->stats));
+	for(const veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh))
+		stats_count(&db->stats, veh, 1);
+	db->perms[VEH_SORT_TYPE].valid = false;
+	db->gen += 1;
+	return changed;
+}
+
+void
+stock_db_set_in_use(db_t *db, veh_t *veh, bool in_use) {
+	ASSERT(db != NULL);
+	ASSERT(veh != NULL);
+	
+	perm_remove(&db->perms[VEH_SORT_IN_USE], VEH_SORT_IN_USE, veh);
+	stats_count(&db->stats, veh, -1);
+	digest_count(db->digests, veh, -1);
+	veh->in_use = in_use;
+	db->cols.in_use[veh->slot] = in_use;
+	perm_insert(&db->perms[VEH_SORT_IN_USE], VEH_SORT_IN_USE, veh);
+	stats_count(&db->stats, veh, 1);
+	digest_count(db->digests, veh, 1);
+	notify(db, DB_EV_IN_USE, veh, veh->num);
+}
+
+size_t
+stock_db_get_list(const db_t *db, veh_num_t *list, size_t cap) {
 	ASSERT(db != NULL);
 	
 	size_t written = 0;
-	for(const veh_t *veh = avl_first(db); veh; veh = AVL_NEXT(db, veh)) {
+	for(const veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh)) {
 		if(written >= cap) break;
 		list[written++] = veh->num;
 	}
 	return written;
 }
 
+// Both scans below are written without branches on the record fields so that the compiler can
+// vectorise them over the dense columns.
+static inline uint8_t
+filter_match(const stock_cols_t *cols, size_t i, uint32_t types, uint8_t in_use, uint8_t any_use) {
+	uint8_t type_ok = (types >> cols->type[i]) & 1u;
+	uint8_t use_ok = (cols->in_use[i] == in_use) | any_use;
+	return type_ok & use_ok;
+}
+
+size_t
+stock_db_count(const db_t *db, const veh_filter_t *filter) {
+	ASSERT(db != NULL);
+	ASSERT(filter != NULL);
+	
+	const stock_cols_t *cols = &db->cols;
+	uint32_t types = filter->types ? filter->types : ~0u;
+	uint8_t in_use = filter->in_use > 0;
+	uint8_t any_use = filter->in_use < 0;
+	
+	size_t count = 0;
+	for(size_t i = 0; i < cols->count; ++i) {
+		count += filter_match(cols, i, types, in_use, any_use);
+	}
+	return count;
+}
+
+static int
+veh_ptr_cmp(const void *a, const void *b) {
+	return veh_cmp(*(const veh_t **)a, *(const veh_t **)b);
+}
+
+size_t
+stock_db_select(const db_t *db, const veh_filter_t *filter, const veh_t **list, size_t cap) {
+	ASSERT(db != NULL);
+	ASSERT(filter != NULL);
+	
+	const stock_cols_t *cols = &db->cols;
+	uint32_t types = filter->types ? filter->types : ~0u;
+	uint8_t in_use = filter->in_use > 0;
+	uint8_t any_use = filter->in_use < 0;
+	
+	size_t written = 0;
+	for(size_t i = 0; i < cols->count && written < cap; ++i) {
+		if(filter_match(cols, i, types, in_use, any_use))
+			list[written++] = cols->rec[i];
+	}
+	
+	// Slots are in insertion order, callers expect running-number order
+	qsort(list, written, sizeof(*list), veh_ptr_cmp);
+	return written;
+}
+
+// MARK: - Batches
+
+void
+stock_batch_init(stock_batch_t *batch) {
+	ASSERT(batch != NULL);
+	memset(batch, 0, sizeof(*batch));
+}
+
+void
+stock_batch_fini(stock_batch_t *batch) {
+	ASSERT(batch != NULL);
+	free(batch->edits);
+	memset(batch, 0, sizeof(*batch));
+}
+
+static void
+batch_push(stock_batch_t *batch, stock_edit_t edit) {
+	ASSERT(batch != NULL);
+	ASSERT(edit.veh != NULL);
+	if(batch->count == batch->cap) {
+		batch->cap = batch->cap ? batch->cap * 2 : 64;
+		batch->edits = mem_realloc(batch->edits, batch->cap * sizeof(*batch->edits));
+	}
+	batch->edits[batch->count++] = edit;
+}
+
+void
+stock_batch_set_in_use(stock_batch_t *batch, veh_t *veh, bool in_use) {
+	batch_push(batch, (stock_edit_t){.veh = veh, .kind = STOCK_EDIT_IN_USE, .in_use = in_use});
+}
+
+void
+stock_batch_renumber(stock_batch_t *batch, veh_t *veh, veh_num_t num) {
+	batch_push(batch, (stock_edit_t){.veh = veh, .kind = STOCK_EDIT_RENUMBER, .num = num});
+}
+
+void
+stock_batch_delete(stock_batch_t *batch, veh_t *veh) {
+	batch_push(batch, (stock_edit_t){.veh = veh, .kind = STOCK_EDIT_DELETE});
+}
+
+size_t
+stock_batch_renumber_range(stock_batch_t *batch, const db_t *db, veh_num_t lo, veh_num_t hi,
+			   veh_num_t to) {
+	ASSERT(batch != NULL);
+	ASSERT(db != NULL);
+	
+	veh_t search = {.num = lo};
+	avl_index_t where;
+	veh_t *veh = avl_find(&db->tree, &search, &where);
+	if(!veh)
+		veh = avl_nearest(&db->tree, where, AVL_AFTER);
+	size_t count = 0;
+	for(; veh && veh->num <= hi; veh = AVL_NEXT(&db->tree, veh)) {
+		stock_batch_renumber(batch, veh, veh->num - lo + to);
+		count += 1;
+	}
+	return count;
+}
+
+static bool
+is_renumber(const stock_edit_t *edit) {
+	return edit->kind == STOCK_EDIT_RENUMBER && edit->num != edit->veh->num;
+}
+
+// Everything that could make the batch fail is checked before anything is touched.
+static bool
+batch_check(const db_t *db, const stock_batch_t *batch, veh_num_t *conflict) {
+	hash_map_t edits, targets;
+	hash_init(&edits);
+	hash_init(&targets);
+	bool ok = true;
+	for(size_t i = 0; ok && i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(hash_get(&edits, edit->veh->num)) {
+			*conflict = edit->veh->num;
+			ok = false;
+		}
+		hash_put(&edits, edit->veh->num, (void *)edit);
+		if(ok && edit->kind == STOCK_EDIT_RENUMBER) {
+			if(hash_get(&targets, edit->num)) {
+				*conflict = edit->num;
+				ok = false;
+			}
+			hash_put(&targets, edit->num, (void *)edit);
+		}
+	}
+	// A number can only be taken if its vehicle is leaving it
+	for(size_t i = 0; ok && i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(!is_renumber(edit))
+			continue;
+		const veh_t *other = stock_db_get(db, edit->num);
+		if(!other)
+			continue;
+		const stock_edit_t *leaving = hash_get(&edits, other->num);
+		if(!leaving || (leaving->kind != STOCK_EDIT_DELETE && !is_renumber(leaving))) {
+			*conflict = edit->num;
+			ok = false;
+		}
+	}
+	hash_fini(&edits);
+	hash_fini(&targets);
+	return ok;
+}
+
+// Deleted records are dropped from every valid order in one pass, which keeps the rest sorted.
+static void
+perms_drop(db_t *db, const uint8_t *drop) {
+	for(int key = 0; key < VEH_SORT_COUNT; ++key) {
+		stock_perm_t *perm = &db->perms[key];
+		if(!perm->valid)
+			continue;
+		size_t kept = 0;
+		for(size_t i = 0; i < perm->count; ++i) {
+			if(!drop[perm->list[i]->slot])
+				perm->list[kept++] = perm->list[i];
+		}
+		perm->count = kept;
+	}
+}
+
+// In-use order is the vehicles in use, then the others, each by running number: the tree gives
+// it back in two walks without sorting anything.
+static void
+perm_rebuild_in_use(db_t *db) {
+	stock_perm_t *perm = &db->perms[VEH_SORT_IN_USE];
+	if(!perm->valid)
+		return;
+	size_t i = 0;
+	for(int pass = 1; pass >= 0; --pass) {
+		for(veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh)) {
+			if(veh->in_use == pass)
+				perm->list[i++] = veh;
+		}
+	}
+	ASSERT(i == perm->count);
+}
+
+static void
+delete_records(db_t *db, const stock_batch_t *batch, size_t count) {
+	uint8_t *drop = mem_calloc(MAX(db->cols.count, 1), 1);
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(edit->kind == STOCK_EDIT_DELETE)
+			drop[edit->veh->slot] = 1;
+	}
+	perms_drop(db, drop);
+	free(drop);
+	
+	for(size_t i = 0; i < batch->count && count; ++i) {
+		veh_t *veh = batch->edits[i].veh;
+		if(batch->edits[i].kind != STOCK_EDIT_DELETE)
+			continue;
+		stats_count(&db->stats, veh, -1);
+		digest_count(db->digests, veh, -1);
+		trie_remove(&db->classes, veh->class);
+		runs_remove(&db->used, veh->num);
+		cols_remove(&db->cols, veh);
+		hash_remove(&db->by_num, veh->num);
+		avl_remove(&db->tree, veh);
+		dict_release(&db->strings, veh->class);
+		dict_release(&db->strings, veh->desc);
+		free(veh);
+		count -= 1;
+	}
+}
+
+// Every moving record leaves the number indexes before any takes its new number, so that
+// vehicles can shift along a range or swap numbers without ever colliding.
+static void
+renumber_records(db_t *db, const stock_batch_t *batch, veh_num_t *old, uint8_t *told) {
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(!is_renumber(edit))
+			continue;
+		veh_t *veh = edit->veh;
+		old[i] = veh->num;
+		told[i] = 1;
+		digest_count(db->digests, veh, -1);
+		hash_remove(&db->by_num, veh->num);
+		runs_remove(&db->used, veh->num);
+		avl_remove(&db->tree, veh);
+	}
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(!is_renumber(edit))
+			continue;
+		veh_t *veh = edit->veh;
+		veh->num = edit->num;
+		db->cols.num[veh->slot] = veh->num;
+		digest_count(db->digests, veh, 1);
+		hash_put(&db->by_num, veh->num, veh);
+		runs_add(&db->used, veh->num);
+		avl_add(&db->tree, veh);
+	}
+	for(int key = 0; key < VEH_SORT_COUNT; ++key)
+		db->perms[key].valid = false;
+}
+
+bool
+stock_db_apply(db_t *db, const stock_batch_t *batch, veh_num_t *conflict) {
+	ASSERT(db != NULL);
+	ASSERT(batch != NULL);
+	ASSERT(conflict != NULL);
+	
+	if(!batch_check(db, batch, conflict))
+		return false;
+	
+	size_t deleted = 0, renumbered = 0, switched = 0;
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		deleted += edit->kind == STOCK_EDIT_DELETE;
+		renumbered += is_renumber(edit);
+		switched += edit->kind == STOCK_EDIT_IN_USE && edit->in_use != edit->veh->in_use;
+	}
+	if(!deleted && !renumbered && !switched)
+		return true;
+	
+	// As with stock_db_delete(), observers hear about a deletion while the record still exists
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(edit->kind == STOCK_EDIT_DELETE)
+			tell_observers(db, DB_EV_DELETE, edit->veh, edit->veh->num);
+	}
+	
+	if(deleted) {
+		mem_op_t op = mem_op_begin(MEM_OP_DELETE);
+		delete_records(db, batch, deleted);
+		mem_op_end(op);
+	}
+	
+	mem_op_t op = mem_op_begin(MEM_OP_UPDATE);
+	veh_num_t *old = mem_calloc(MAX(batch->count, 1), sizeof(*old));
+	uint8_t *told = mem_calloc(MAX(batch->count, 1), 1);
+	for(size_t i = 0; switched && i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(edit->kind != STOCK_EDIT_IN_USE || edit->in_use == edit->veh->in_use)
+			continue;
+		veh_t *veh = edit->veh;
+		stats_count(&db->stats, veh, -1);
+		digest_count(db->digests, veh, -1);
+		veh->in_use = edit->in_use;
+		db->cols.in_use[veh->slot] = veh->in_use;
+		stats_count(&db->stats, veh, 1);
+		digest_count(db->digests, veh, 1);
+		old[i] = veh->num;
+		told[i] = 1;
+	}
+	if(renumbered)
+		renumber_records(db, batch, old, told);
+	else if(switched)
+		perm_rebuild_in_use(db);
+	mem_op_end(op);
+	
+	db->gen += 1;
+	stock_move_t *moves = renumbered ? mem_calloc(renumbered, sizeof(*moves)) : NULL;
+	size_t num_moves = 0;
+	for(size_t i = 0; i < batch->count; ++i) {
+		const stock_edit_t *edit = &batch->edits[i];
+		if(!told[i])
+			continue;
+		if(edit->kind == STOCK_EDIT_IN_USE)
+			tell_observers(db, DB_EV_IN_USE, edit->veh, old[i]);
+		else
+			moves[num_moves++] = (stock_move_t){.veh = edit->veh, .old_num = old[i]};
+	}
+	if(num_moves) {
+		db->moves = moves;
+		db->num_moves = num_moves;
+		tell_observers(db, DB_EV_RENUMBER, NULL, 0);
+		db->moves = NULL;
+		db->num_moves = 0;
+	}
+	free(moves);
+	free(old);
+	free(told);
+	return true;
+}
+
+// MARK: - Memory
+
+static void
+count_array(stock_memstats_t *stats, const void *ptr, size_t used, size_t cap) {
+	stats->index += used;
+	stats->slack += mem_block_size(ptr, cap) - used;
+}
+
+static void
+count_hash(stock_memstats_t *stats, const hash_map_t *map) {
+	count_array(stats, map->entries, map->count * sizeof(*map->entries), map->cap * sizeof(*map->entries));
+	count_array(stats, map->dist, map->count * sizeof(*map->dist), map->cap * sizeof(*map->dist));
+}
+
+void
+stock_db_memstats(const db_t *db, stock_memstats_t *stats) {
+	ASSERT(db != NULL);
+	ASSERT(stats != NULL);
+	
+	memset(stats, 0, sizeof(*stats));
+	size_t count = stock_db_get_count(db);
+	stats->records = count * (sizeof(veh_t) - sizeof(avl_node_t));
+	stats->index = count * sizeof(avl_node_t);
+	for(const veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh))
+		stats->slack += mem_block_size(veh, sizeof(*veh)) - sizeof(*veh);
+	
+	// Each distinct string is stored once, with a small header
+	stats->strings = db->strings.bytes;
+	stats->slack += dict_slack(&db->strings);
+	count_hash(stats, &db->strings.map);
+	
+	const stock_cols_t *cols = &db->cols;
+	count_array(stats, cols->num, cols->count * sizeof(*cols->num), cols->cap * sizeof(*cols->num));
+	count_array(stats, cols->type, cols->count * sizeof(*cols->type), cols->cap * sizeof(*cols->type));
+	count_array(stats, cols->in_use, cols->count * sizeof(*cols->in_use), cols->cap * sizeof(*cols->in_use));
+	count_array(stats, cols->caps, cols->count * sizeof(*cols->caps), cols->cap * sizeof(*cols->caps));
+	count_array(stats, cols->rec, cols->count * sizeof(*cols->rec), cols->cap * sizeof(*cols->rec));
+	for(int i = 0; i < VEH_SORT_COUNT; ++i) {
+		const stock_perm_t *perm = &db->perms[i];
+		if(perm->list)
+			count_array(stats, perm->list, perm->count * sizeof(*perm->list), perm->cap * sizeof(*perm->list));
+	}
+	
+	count_hash(stats, &db->by_num);
+	for(int i = 0; i < STOCK_DIGEST_LEVELS; ++i) {
+		count_hash(stats, &db->digests[i]);
+		stats->index += db->digests[i].count * sizeof(stock_digest_t);
+	}
+	stats->index += db->classes.num_nodes * sizeof(trie_node_t);
+	stats->index += avl_numnodes(&db->used.tree) * sizeof(num_run_t);
+}
+
 ssize_t
-stock_load_from_path(const char *path, avl_tree_t *db) {
+stock_load_from_path(const char *path, db_t *db) {
 	ASSERT(db != NULL);
 	ASSERT(path != NULL);
 	
 	FILE *f = fopen(path, "rb");
 	if(!f)
 		return -1;
-	return stock_load_from_file(f, db);
+	// A writer holds an exclusive lock until the file is complete
+	flock(fileno(f), LOCK_SH);
+	ssize_t count = stock_load_from_file(f, db);
+	fclose(f);
+	return count;
 }
 
-static veh_t *
-parse_one_veh(char **comps, int offset) {
-	veh_t *veh = safe_calloc(1, sizeof(*veh));
-	if(offset)
-		veh->in_use = comps[0][0] == 'x';
-	else
-		veh->in_use = false;
+// Fills in `veh` with text that points into `line`, which is split in place.
+static bool
+parse_fields(char *line, veh_t *veh) {
+	str_trim_space(line);
+	if(line[0] == '#')
+		return false;
 	
-	veh->num = atoi(comps[offset+0]);
+	char *comps[4];
+	unsigned n_comps = str_split_inplace(line, ',', comps, 4);
+	if(n_comps < 3)
+		return false;
 	
+	int offset = n_comps > 3;
+	memset(veh, 0, sizeof(*veh));
+	veh->in_use = offset && comps[0][0] == 'x';
+	veh->num = strtoll(comps[offset+0], NULL, 10);
 	str_trim_space(comps[offset+1]);
-	strncpy(veh->class, comps[offset+1], sizeof(veh->class));
+	veh->class = comps[offset+1];
 	str_trim_space(comps[offset+2]);
-	strncpy(veh->desc, comps[offset+2], sizeof(veh->desc));
-	return veh;
+	veh->desc = comps[offset+2];
+	return true;
+}
+
+veh_t *
+stock_parse_line(char *line) {
+	ASSERT(line != NULL);
+	
+	veh_t data;
+	if(!parse_fields(line, &data))
+		return NULL;
+	return veh_new(data.num, data.in_use, data.class, data.desc);
+}
+
+bool
+stock_parse_num(const char *line, veh_num_t *num) {
+	ASSERT(line != NULL);
+	ASSERT(num != NULL);
+	
+	while(isspace((unsigned char)*line))
+		line += 1;
+	if(line[0] == '#')
+		return false;
+	
+	// The fields parse_fields() would split the line into: the number comes second after an
+	// in-use mark, which only lines with a fourth field have.
+	const char *sep[3];
+	int count = 0;
+	for(const char *c = line; *c && count < 3; ++c) {
+		if(*c == ',')
+			sep[count++] = c;
+	}
+	if(count < 2)
+		return false;
+	*num = strtoll(count > 2 ? sep[0] + 1 : line, NULL, 10);
+	return true;
 }
 
 ssize_t
-stock_load_from_file(FILE *f, avl_tree_t *db) {
+stock_load_from_file(FILE *f, db_t *db) {
+	stock_import_t res;
+	stock_import_from_file(f, db, false, &res);
+	return (ssize_t)res.added;
+}
+
+// Colliding vehicles are moved to the first free number in their own block of a hundred, so that
+// a wagon imported as 812 stays an 8xx wagon. Only if that block is full does it go past it.
+static bool
+renumber_veh(const db_t *db, veh_t *veh) {
+	veh_num_t block_end = stock_block_end(veh->num);
+	veh_num_t num;
+	if(!stock_db_next_free(db, veh->num, block_end, &num)
+	   && !stock_db_next_free(db, veh->num, VEH_NUM_MAX, &num))
+		return false;
+	veh->num = num;
+	return true;
+}
+
+bool
+stock_import_from_path(const char *path, db_t *db, bool renumber, stock_import_t *res) {
+	ASSERT(db != NULL);
+	ASSERT(path != NULL);
+	
+	FILE *f = fopen(path, "rb");
+	if(!f)
+		return false;
+	stock_import_from_file(f, db, renumber, res);
+	fclose(f);
+	return true;
+}
+
+void
+stock_import_veh(db_t *db, const veh_t *veh, bool renumber, stock_import_t *res) {
+	ASSERT(db != NULL);
+	ASSERT(veh != NULL);
+	ASSERT(res != NULL);
+	
+	veh_t data = *veh;
+	if(renumber && stock_db_get(db, data.num)) {
+		if(renumber_veh(db, &data))
+			res->renumbered += 1;
+	}
+	if(!stock_db_add(db, &data)) {
+		res->skipped += 1;
+		return;
+	}
+	res->added += 1;
+}
+
+void
+stock_import_from_file(FILE *f, db_t *db, bool renumber, stock_import_t *res) {
 	ASSERT(db != NULL);
 	ASSERT(f != NULL);
+	ASSERT(res != NULL);
 	
+	memset(res, 0, sizeof(*res));
+	mem_op_t op = mem_op_begin(MEM_OP_LOAD);
         char *line = NULL;
         size_t cap = 0;
-	size_t count = 0;
         while(getline(&line, &cap, f) > 0) {
-		str_trim_space(line);
-		if(line[0] == '#')
-			continue;
-		
-		char *comps[4];
-        	unsigned n_comps = str_split_inplace(line, ',', comps, 4);
-		if(n_comps < 3)
-			continue;
-		
-		veh_t *veh = parse_one_veh(comps, n_comps > 3);
-		if(!veh)
-			continue;
-		if(!stock_db_add(db, veh))
-			continue;
-		count += 1;
+		veh_t veh;
+		if(parse_fields(line, &veh))
+			stock_import_veh(db, &veh, renumber, res);
         }
 	if(line && cap)
 		free(line);
-	
-	return (ssize_t)count;
+	mem_op_end(op);
 }
 
 bool
-stock_write_to_path(const char *path, const avl_tree_t *db) {
+stock_write_to_path(const char *path, const db_t *db) {
 	ASSERT(db != NULL);
 	ASSERT(path != NULL);
 	
-	FILE *f = fopen(path, "wb");
-	if(!f)
+	// Truncating only once the lock is held keeps readers from seeing a half-written file
+	int fd = open(path, O_WRONLY | O_CREAT, 0666);
+	if(fd < 0)
 		return false;
-	return stock_write_to_file(f, db);
+	FILE *f = NULL;
+	if(flock(fd, LOCK_EX) < 0 || ftruncate(fd, 0) < 0 || !(f = fdopen(fd, "wb"))) {
+		close(fd);
+		return false;
+	}
+	bool ok = stock_write_to_file(f, db);
+	return (fclose(f) == 0) && ok;
 }
 
 bool
-stock_write_to_file(FILE *f, const avl_tree_t *db) {
+stock_write_to_file(FILE *f, const db_t *db) {
 	ASSERT(db != NULL);
 	ASSERT(f != NULL);
 	
-	for(const veh_t *veh = avl_first(db); veh; veh = AVL_NEXT(db, veh)) {
-		fprintf(f, "%c,%d, %s, %s\n",
+	for(const veh_t *veh = avl_first(&db->tree); veh; veh = AVL_NEXT(&db->tree, veh)) {
+		fprintf(f, "%c,%" VEH_NUM_FMT ", %s, %s\n",
 			veh->in_use ? 'x' : '-',
 			veh->num,
 			veh->class,
@@ -11,16 +11,26 @@
 #define _STOCK_H_
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <utils/avl.h>
+#include "dict.h"
+#include "hash.h"
+#include "runs.h"
+#include "trie.h"
 
+// Longest class and description kept, terminator included. Longer text is cut when it is stored.
 #define MAX_CLASS_LEN	(16)
 #define MAX_DESC_LEN	(32)
 #define MAX_LONG_DESC_LEN	(64)
 
-typedef avl_tree_t	db_t;
+// Wide enough for a full 12-digit UIC vehicle number
+typedef int64_t	veh_num_t;
+
+#define VEH_NUM_FMT	PRId64
+#define VEH_NUM_MAX	INT64_MAX
 
 // These are defined in a "priority" order - if one
 typedef enum {
@@ -31,58 +41,390 @@ typedef enum {
 	VEH_TYPE_WAGON,
 	VEH_TYPE_CONTROL,
 	VEH_TYPE_RAILCAR,
+	VEH_TYPE_COUNT,
 } veh_type_t;
 
+typedef enum {
+	LOK_ELEC 	= 1 << 0,
+	LOK_DIESEL 	= 1 << 1,
+	LOK_RACK 	= 1 << 2,
+	LOK_NARROW 	= 1 << 3,
+	
+	PAX_FIRST	= 1 << 4,
+	PAX_SECOND	= 1 << 5,
+	PAX_RESTAURANT	= 1 << 6,
+	
+	PAX_PANORAMIC	= 1 << 7,
+	
+	LUGGAGE_VAN	= 1 << 8,
+} veh_cap_mask_t;
+
+#define VEH_CAP_COUNT	(9)
+
+typedef enum {
+	TRACTION_NONE,
+	TRACTION_STEAM,
+	TRACTION_ELEC,
+	TRACTION_DIESEL,
+	TRACTION_ELECTRO_DIESEL,
+	TRACTION_COUNT,
+} veh_traction_t;
 
+
+// In a DB, `class` and `desc` point into the DB's string dictionary, so records that share a class
+// or a description share its text. Anywhere else they point to text owned by whoever made the
+// record. Text in a DB or in a record made by veh_new() is laid out the way the dictionary keeps
+// it, so dict_width() gives its display width without measuring it. The longer descriptions are
+// worked out from the class when they are displayed.
 typedef struct {
-	int		num;
-	char		class[MAX_CLASS_LEN];
-	char		desc[MAX_DESC_LEN];
-	
-	char		combo_desc[MAX_DESC_LEN];
-	char		class_desc[MAX_LONG_DESC_LEN];
+	veh_num_t	num;
+	const char	*class;
+	const char	*desc;
 	
+	uint32_t	slot;
+	uint16_t	caps;
+	uint8_t		type;	// veh_type_t
 	bool		in_use;
-	
-	veh_type_t	type;
 	avl_node_t	db_node;
 } veh_t;
 
+// Dense, slot-indexed copies of the fields that every scan touches. Filters and counts run over
+// these arrays instead of chasing records through the tree, which drags the text fields into cache
+// along with them. Records are swap-removed, so slot order is not running-number order.
+typedef struct {
+	size_t		count;
+	size_t		cap;
+	veh_num_t	*num;
+	uint8_t		*type;
+	uint8_t		*in_use;
+	uint32_t	*caps;
+	veh_t		**rec;
+} stock_cols_t;
+
+typedef enum {
+	VEH_SORT_NUM,
+	VEH_SORT_CLASS,
+	VEH_SORT_TYPE,
+	VEH_SORT_DESC,
+	VEH_SORT_IN_USE,
+	VEH_SORT_COUNT,
+} veh_sort_t;
+
+// A cached sort order over the whole DB. Permutations are built the first time a column is asked
+// for, and from then on patched in place by every mutation rather than re-sorted.
+typedef struct {
+	bool		valid;
+	veh_t		**list;
+	size_t		count;
+	size_t		cap;
+} stock_perm_t;
+
+// Fleet-wide counters, each split by in-use state. They are kept up to date by every mutation, so
+// reading them never walks the DB.
+typedef struct {
+	size_t		total[2];
+	size_t		by_type[VEH_TYPE_COUNT][2];
+	size_t		by_traction[TRACTION_COUNT][2];
+	size_t		by_cap[VEH_CAP_COUNT][2];
+} stock_stats_t;
+
+typedef enum {
+	DB_EV_ADD,
+	DB_EV_UPDATE,
+	DB_EV_DELETE,
+	DB_EV_IN_USE,
+	DB_EV_RENUMBER,
+} db_event_t;
+
+// Observers are called after a record is added, updated or has its in-use flag changed, and
+// before it is deleted. `old_num` is the record's running number before an update.
+//
+// A batch that renumbers vehicles is told once, as DB_EV_RENUMBER with no record, after every
+// vehicle has moved: numbers can be traded within a batch, so a single move seen on its own may
+// land on a number another vehicle is only about to leave. stock_db_moves() has the whole map.
+typedef void (*db_observer_f)(void *ctx, db_event_t ev, const veh_t *veh, veh_num_t old_num);
+
+typedef struct {
+	veh_t		*veh;
+	veh_num_t	old_num;
+} stock_move_t;
+
+#define DB_MAX_OBSERVERS	(8)
+
+typedef struct {
+	db_observer_f	fn;
+	void		*ctx;
+} db_observer_t;
+
+// Running numbers are grouped in blocks of 1 << STOCK_DIGEST_SHIFT, and those blocks in turn into
+// larger ones, STOCK_DIGEST_LEVELS deep. Each block keeps an order-independent digest of its
+// records, so two DBs can be compared from the top down, only descending into blocks whose
+// digests differ.
+#define STOCK_DIGEST_SHIFT	(6)
+#define STOCK_DIGEST_LEVELS	(3)
+
+typedef struct {
+	uint64_t	hash;	// XOR of the record hashes in the block
+	size_t		count;
+} stock_digest_t;
+
+typedef struct {
+	avl_tree_t	tree;
+	hash_map_t	by_num;
+	hash_map_t	digests[STOCK_DIGEST_LEVELS];	// block -> stock_digest_t, finest first
+	stock_cols_t	cols;
+	stock_perm_t	perms[VEH_SORT_COUNT];
+	stock_stats_t	stats;
+	trie_t		classes;
+	run_index_t	used;
+	dict_t		strings;	// class and description text
+	
+	uint64_t	gen;
+	db_observer_t	observers[DB_MAX_OBSERVERS];
+	int		num_observers;
+	const stock_move_t *moves;	// while DB_EV_RENUMBER is being told
+	size_t		num_moves;
+	bool		merging;	// while changes made elsewhere are applied
+} db_t;
+
+#define VEH_TYPE_BIT(t)	(1u << (t))
+
+typedef struct {
+	uint32_t	types;	// VEH_TYPE_BIT() mask, 0 matches any type
+	int		in_use;	// 0 or 1, -1 matches either
+} veh_filter_t;
+
 void
 stock_db_init(db_t *db);
 
 void
 stock_db_fini(db_t *db);
 
-bool
-stock_db_add(db_t *db, veh_t *veh);
+void
+stock_db_observe(db_t *db, db_observer_f fn, void *ctx);
+
+void
+stock_db_unobserve(db_t *db, db_observer_f fn, void *ctx);
+
+// The vehicles a batch renumbered, with the numbers they had, while observers are told about it.
+static inline const stock_move_t *
+stock_db_moves(const db_t *db, size_t *count) {
+	*count = db->num_moves;
+	return db->moves;
+}
+
+// Set by whoever merges in changes made by another client or process, so that observers that keep
+// files of their own can leave those changes to the side that made them.
+static inline bool
+stock_db_merging(const db_t *db) {
+	return db->merging;
+}
 
+// Bumped on every mutation, so views can tell when their cached rows went stale.
+static inline uint64_t
+stock_db_gen(const db_t *db) {
+	return db->gen;
+}
+
+// Adds a copy of `data` to the DB. Returns the DB's record, or NULL if the running number is taken.
+veh_t *
+stock_db_add(db_t *db, const veh_t *data);
+
+// Copies the running number, class and description of `data` into `veh` and re-indexes it.
 bool
-stock_db_update(db_t *db, veh_t *veh);
+stock_db_update(db_t *db, veh_t *veh, const veh_t *data);
 
 veh_t *
-stock_db_get(const db_t *db, int num);
+stock_db_get(const db_t *db, veh_num_t num);
 
 void
 stock_db_delete(db_t *db, veh_t *veh);
 
 void
-veh_describe(const veh_t *veh, char *buf, size_t cap);
+stock_db_set_in_use(db_t *db, veh_t *veh, bool in_use);
+
+// Classifies every record again with the active UIC rules. Returns how many changed type or
+// capabilities.
+size_t
+stock_db_reclassify(db_t *db);
+
+// The last running number in the block of a hundred `num` is in, which stops at VEH_NUM_MAX.
+static inline veh_num_t
+stock_block_end(veh_num_t num) {
+	veh_num_t base = num - num % 100;
+	return base > VEH_NUM_MAX - 99 ? VEH_NUM_MAX : base + 99;
+}
+
+// Finds the lowest running number in [lo, hi] that no vehicle uses, in O(log n).
+bool
+stock_db_next_free(const db_t *db, veh_num_t lo, veh_num_t hi, veh_num_t *num);
+
+// Makes a vehicle outside of any DB, with its own copy of the text. Free it with free().
+veh_t *
+veh_new(veh_num_t num, bool in_use, const char *class, const char *desc);
+
+// "<class> <number>", as used to label vehicles in a train.
+void
+veh_combo_desc(const veh_t *veh, char *buf, size_t cap);
+
+// A description of what the class designation says, such as "1st class panoramic coach".
+void
+veh_class_desc(const veh_t *veh, char *buf, size_t cap);
+
+veh_traction_t
+veh_traction(veh_type_t type, uint32_t caps);
+
+const char *
+stock_type_name(veh_type_t type);
+
+const char *
+stock_traction_name(veh_traction_t traction);
+
+const char *
+stock_cap_name(int bit);
+
+static inline const stock_stats_t *
+stock_db_stats(const db_t *db) {
+	return &db->stats;
+}
+
+// Suggests existing classes starting with `prefix`, most common first.
+static inline size_t
+stock_db_complete_class(const db_t *db, const char *prefix, trie_match_t *matches, size_t cap) {
+	return trie_complete(&db->classes, prefix, matches, cap);
+}
 
 static inline size_t
 stock_db_get_count(const db_t *db) {
-	return avl_numnodes(db);
+	return avl_numnodes(&db->tree);
 }
 
 size_t
-stock_db_get_list(const db_t *db, int *list, size_t cap);
+stock_db_get_list(const db_t *db, veh_num_t *list, size_t cap);
+
+veh_t *const *
+stock_db_sorted(db_t *db, veh_sort_t key);
 
+const char *
+stock_sort_name(veh_sort_t key);
+
+// The order stock_db_sorted() uses, which always falls back on the running number.
+int
+stock_sort_cmp(veh_sort_t key, const veh_t *a, const veh_t *b);
+
+size_t
+stock_db_count(const db_t *db, const veh_filter_t *filter);
+
+size_t
+stock_db_select(const db_t *db, const veh_filter_t *filter, const veh_t **list, size_t cap);
+
+typedef enum {
+	STOCK_EDIT_IN_USE,
+	STOCK_EDIT_RENUMBER,
+	STOCK_EDIT_DELETE,
+} stock_edit_kind_t;
+
+typedef struct {
+	veh_t			*veh;
+	stock_edit_kind_t	kind;
+	bool			in_use;
+	veh_num_t		num;
+} stock_edit_t;
+
+// Edits to many records, collected first and then applied together by stock_db_apply().
+typedef struct {
+	stock_edit_t	*edits;
+	size_t		count;
+	size_t		cap;
+} stock_batch_t;
+
+void
+stock_batch_init(stock_batch_t *batch);
+
+void
+stock_batch_fini(stock_batch_t *batch);
+
+void
+stock_batch_set_in_use(stock_batch_t *batch, veh_t *veh, bool in_use);
+
+void
+stock_batch_renumber(stock_batch_t *batch, veh_t *veh, veh_num_t num);
+
+void
+stock_batch_delete(stock_batch_t *batch, veh_t *veh);
+
+// Adds edits moving every vehicle numbered in [lo, hi] to the same place in a range starting at
+// `to`. Returns how many vehicles it moves.
+size_t
+stock_batch_renumber_range(stock_batch_t *batch, const db_t *db, veh_num_t lo, veh_num_t hi,
+			   veh_num_t to);
+
+// Applies every edit of the batch, or none of them. Nothing changes, and `*conflict` is set to the
+// running number at fault, if a vehicle has more than one edit, two would take the same number, or
+// one would be renumbered onto a vehicle that keeps its number. Vehicles may trade numbers among
+// themselves.
+//
+// The sort orders are repaired once for the whole batch rather than per record, and the generation
+// only moves once. Observers hear about every deleted record and in-use change, and about all of
+// the renumbering at once.
+bool
+stock_db_apply(db_t *db, const stock_batch_t *batch, veh_num_t *conflict);
+
+// Where a DB's memory goes, in bytes. Each record's running-tree node counts as index. Slack is
+// memory held without being used: array and hash table capacity that isn't filled yet and, where
+// the allocator reports it, the rounding up of each heap block, records and dictionary strings
+// included.
+typedef struct {
+	size_t		records;	// record fields other than text
+	size_t		strings;	// interned text, with its headers and terminators
+	size_t		index;		// trees, hash tables, columns, sort orders, class trie, number runs
+	size_t		views;		// row buffers of open views, filled in by the caller
+	size_t		slack;
+} stock_memstats_t;
+
+void
+stock_db_memstats(const db_t *db, stock_memstats_t *stats);
+
+static inline size_t
+stock_memstats_total(const stock_memstats_t *stats) {
+	return stats->records + stats->strings + stats->index + stats->views + stats->slack;
+}
+
+// Parses one line of a DB file into a vehicle made with veh_new(), and classifies it. Returns NULL
+// for comments and lines that don't describe a vehicle. `line` is modified in place.
+veh_t *
+stock_parse_line(char *line);
+
+// Reads only the running number of a DB file line, without copying or classifying anything.
+// Returns false for the same lines stock_parse_line() rejects.
+bool
+stock_parse_num(const char *line, veh_num_t *num);
+
+// Loading from and writing to a path take a shared and an exclusive advisory lock on the file.
 ssize_t
 stock_load_from_path(const char *path, db_t *db);
 
 ssize_t
 stock_load_from_file(FILE *f, db_t *db);
 
+typedef struct {
+	size_t		added;
+	size_t		renumbered;
+	size_t		skipped;
+} stock_import_t;
+
+// Adds the vehicles in a file to the DB. With `renumber` set, vehicles whose running number is
+// already taken are moved to a free one instead of being skipped.
+bool
+stock_import_from_path(const char *path, db_t *db, bool renumber, stock_import_t *res);
+
+void
+stock_import_from_file(FILE *f, db_t *db, bool renumber, stock_import_t *res);
+
+// Adds a copy of one parsed vehicle the way an import does.
+void
+stock_import_veh(db_t *db, const veh_t *veh, bool renumber, stock_import_t *res);
+
 bool
 stock_write_to_path(const char *path, const db_t *db);
 
@@ -0,0 +1,165 @@
+/*===--------------------------------------------------------------------------------------------===
+ * trie.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "trie.h"
+#include "mem.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+trie_init(trie_t *trie) {
+	ASSERT(trie != NULL);
+	memset(trie, 0, sizeof(*trie));
+}
+
+static void
+free_children(trie_node_t *node) {
+	trie_node_t *child = node->child;
+	while(child) {
+		trie_node_t *next = child->next;
+		free_children(child);
+		free(child);
+		child = next;
+	}
+}
+
+void
+trie_fini(trie_t *trie) {
+	ASSERT(trie != NULL);
+	free_children(&trie->root);
+	memset(trie, 0, sizeof(*trie));
+}
+
+static trie_node_t *
+find_child(const trie_node_t *node, char ch) {
+	for(trie_node_t *child = node->child; child; child = child->next) {
+		if(child->ch == ch) return child;
+		if(child->ch > ch) break;
+	}
+	return NULL;
+}
+
+static trie_node_t *
+get_child(trie_t *trie, trie_node_t *node, char ch) {
+	trie_node_t **link = &node->child;
+	while(*link && (*link)->ch < ch)
+		link = &(*link)->next;
+	if(*link && (*link)->ch == ch)
+		return *link;
+	
+	trie_node_t *child = mem_calloc(1, sizeof(*child));
+	child->ch = ch;
+	child->parent = node;
+	child->next = *link;
+	*link = child;
+	trie->num_nodes += 1;
+	return child;
+}
+
+static void
+top_offer(trie_node_t *node, trie_node_t *cand) {
+	int at = node->num_top;
+	while(at > 0 && node->top[at-1]->count < cand->count)
+		at -= 1;
+	if(at >= TRIE_TOP_K)
+		return;
+	
+	int last = MIN(node->num_top, TRIE_TOP_K - 1);
+	memmove(&node->top[at+1], &node->top[at], (last - at) * sizeof(node->top[0]));
+	node->top[at] = cand;
+	node->num_top = MIN(node->num_top + 1, TRIE_TOP_K);
+}
+
+// A node's top list is its own string (if any) merged with its children's lists. Rebuilding it from
+// the path up after every change keeps the cost bounded by depth times fan-out.
+static void
+refresh_top(trie_node_t *node) {
+	for(; node; node = node->parent) {
+		node->num_top = 0;
+		if(node->count)
+			top_offer(node, node);
+		for(trie_node_t *child = node->child; child; child = child->next) {
+			for(int i = 0; i < child->num_top; ++i)
+				top_offer(node, child->top[i]);
+		}
+	}
+}
+
+void
+trie_add(trie_t *trie, const char *str) {
+	ASSERT(trie != NULL);
+	ASSERT(str != NULL);
+	
+	trie_node_t *node = &trie->root;
+	for(size_t i = 0; str[i] && i < TRIE_MAX_LEN - 1; ++i)
+		node = get_child(trie, node, str[i]);
+	node->count += 1;
+	refresh_top(node);
+}
+
+static void
+unlink_child(trie_node_t *parent, trie_node_t *child) {
+	trie_node_t **link = &parent->child;
+	while(*link != child)
+		link = &(*link)->next;
+	*link = child->next;
+}
+
+void
+trie_remove(trie_t *trie, const char *str) {
+	ASSERT(trie != NULL);
+	ASSERT(str != NULL);
+	
+	trie_node_t *node = &trie->root;
+	for(size_t i = 0; node && str[i] && i < TRIE_MAX_LEN - 1; ++i)
+		node = find_child(node, str[i]);
+	if(!node || !node->count)
+		return;
+	
+	node->count -= 1;
+	while(node != &trie->root && !node->count && !node->child) {
+		trie_node_t *parent = node->parent;
+		unlink_child(parent, node);
+		free(node);
+		trie->num_nodes -= 1;
+		node = parent;
+	}
+	refresh_top(node);
+}
+
+static void
+node_string(const trie_node_t *node, char *str) {
+	size_t len = 0;
+	for(const trie_node_t *n = node; n->parent; n = n->parent)
+		len += 1;
+	str[len] = '\0';
+	for(const trie_node_t *n = node; n->parent; n = n->parent)
+		str[--len] = n->ch;
+}
+
+size_t
+trie_complete(const trie_t *trie, const char *prefix, trie_match_t *matches, size_t cap) {
+	ASSERT(trie != NULL);
+	ASSERT(prefix != NULL);
+	
+	const trie_node_t *node = &trie->root;
+	for(size_t i = 0; node && prefix[i]; ++i)
+		node = find_child(node, prefix[i]);
+	if(!node)
+		return 0;
+	
+	size_t count = MIN(cap, node->num_top);
+	for(size_t i = 0; i < count; ++i) {
+		node_string(node->top[i], matches[i].str);
+		matches[i].count = node->top[i]->count;
+	}
+	return count;
+}
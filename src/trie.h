@@ -0,0 +1,61 @@
+/*===--------------------------------------------------------------------------------------------===
+ * trie.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _TRIE_H_
+#define _TRIE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TRIE_TOP_K	(4)
+#define TRIE_MAX_LEN	(64)
+
+typedef struct trie_node_s trie_node_t;
+
+// Each node caches the TRIE_TOP_K most frequent strings in its subtree, so completing a prefix
+// only costs the walk down to it, however many strings the trie holds.
+struct trie_node_s {
+	trie_node_t	*parent;
+	trie_node_t	*child;
+	trie_node_t	*next;
+	
+	uint32_t	count;
+	char		ch;
+	uint8_t		num_top;
+	trie_node_t	*top[TRIE_TOP_K];
+};
+
+typedef struct {
+	trie_node_t	root;
+	size_t		num_nodes;
+} trie_t;
+
+typedef struct {
+	char		str[TRIE_MAX_LEN];
+	uint32_t	count;
+} trie_match_t;
+
+void
+trie_init(trie_t *trie);
+
+void
+trie_fini(trie_t *trie);
+
+void
+trie_add(trie_t *trie, const char *str);
+
+void
+trie_remove(trie_t *trie, const char *str);
+
+// Writes up to `cap` of the most frequent strings starting with `prefix`, most frequent first.
+size_t
+trie_complete(const trie_t *trie, const char *prefix, trie_match_t *matches, size_t cap);
+
+#endif /* ifndef _TRIE_H_ */
@@ -8,7 +8,21 @@
  *===--------------------------------------------------------------------------------------------===
 */
 #include "ui.h"
+#include "utf8.h"
+#include <utils/helpers.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+static struct {
+	int		fd;
+	ui_pump_f	fn;
+	void		*ctx;
+} pump = {.fd = -1};
+
+static char status[128];
 
 void
 ui_start() {
@@ -24,11 +38,45 @@ ui_end() {
 	hexes_show_cursor(true);
 }
 
+void
+ui_set_pump(int fd, ui_pump_f fn, void *ctx) {
+	pump.fd = fn ? fd : -1;
+	pump.fn = fn;
+	pump.ctx = ctx;
+}
+
+int
+ui_get_key() {
+	while(pump.fn) {
+		struct pollfd fds[2] = {
+			{.fd = STDIN_FILENO, .events = POLLIN},
+			{.fd = pump.fd, .events = POLLIN},
+		};
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) continue;
+			break;
+		}
+		if(fds[0].revents & POLLIN)
+			break;
+		if(fds[1].revents) {
+			if(!pump.fn(pump.ctx))
+				ui_set_pump(-1, NULL, NULL);
+			return UI_KEY_REFRESH;
+		}
+	}
+	return hexes_get_key_raw();
+}
+
 static void
 draw_line(int w, const char *fmt, va_list args) {
 	char buffer[512];
 	vsnprintf(buffer, sizeof(buffer), fmt, args);
-	printf("%-*.*s", w, w, buffer);
+	utf8_put(stdout, buffer, -1, w);
+}
+
+const char *
+ui_cell(char buf[UI_CELL_CAP], const char *text, int width, int cols) {
+	return utf8_cell(buf, UI_CELL_CAP, text, width, cols);
 }
 
 void
@@ -59,15 +107,27 @@ ui_title(const char *fmt, ...) {
 	term_set_bold(stdout, true);
 	term_reverse(stdout);
 	
+	char title[512];
 	va_list args;
 	va_start(args, fmt);
-	
-	draw_line(w, fmt, args);
-	
+	vsnprintf(title, sizeof(title), fmt, args);
 	va_end(args);
+	
+	if(status[0])
+		ui_text(w, "%s - %s", title, status);
+	else
+		ui_text(w, "%s", title);
 	term_style_reset(stdout);
 }
 
+void
+ui_status(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(status, sizeof(status), fmt, args);
+	va_end(args);
+}
+
 void
 ui_prompt(const char *fmt, ...) {
 	int w, h;
@@ -85,3 +145,110 @@ ui_prompt(const char *fmt, ...) {
 	term_style_reset(stdout);
 }
 
+void
+ui_field_draw(const char *label, const ui_field_t *field, bool highlight, int label_w, int max_w) {
+	int label_size = MIN(label_w, max_w);
+	ui_text(label_size, "%s", label);
+	
+	int size = MIN(field->cap, (max_w - label_w));
+	if(highlight)
+		term_reverse(stdout);
+	term_set_underline(stdout, true);
+	ui_text(size, "%s", field->txt);
+	term_style_reset(stdout);
+}
+
+void
+ui_prompt_field(const char *label, const ui_field_t *field) {
+	int w, h;
+	hexes_get_size(&w, &h);
+	int label_w = MIN(utf8_width(label, SIZE_MAX), w);
+	
+	ui_prompt("");
+	hexes_cursor_go(0, h-1);
+	ui_field_draw(label, field, false, label_w, w);
+	hexes_show_cursor(true);
+	hexes_cursor_go(MIN(label_w + ui_field_cursor_x(field), w-1), h-1);
+	fflush(stdout);
+}
+
+int
+ui_field_cursor_x(const ui_field_t *field) {
+	return utf8_width(field->txt, field->cur);
+}
+
+// Keys arrive a byte at a time, so text fields take every byte of a UTF-8 sequence.
+static inline bool char_match(ui_field_kind_t kind, int c) {
+	if(c >= '0' && c <= '9') return true;
+	if(kind == UI_FIELD_NUMERIC) return false;
+	if(c >= 0x80 && c <= 0xff) return true;
+	if(kind == UI_FIELD_EXPR) return c >= ' ' && c <= '~';
+	return (c >= 'a' && c <= 'z')
+	    || (c >= 'A' && c <= 'Z')
+	    || c == ' ' || c == '/' || c == '-' || c == '(' || c == ')';
+}
+
+// Whether the text before the cursor ends in a sequence still missing bytes.
+static bool
+continues(const ui_field_t *field) {
+	int lead = field->cur - 1;
+	while(lead > 0 && field->cur - lead < 4 && ((uint8_t)field->txt[lead] & 0xc0) == 0x80)
+		lead -= 1;
+	size_t len = utf8_seq_len((uint8_t)field->txt[lead]);
+	return len > 1 && (int)len > field->cur - lead;
+}
+
+bool
+ui_field_input(ui_field_t *field, int c) {
+
+	switch(c) {
+	// The cursor moves over whole clusters, and backspace takes the last code point off one, so
+	// that an accent typed as its own key can be taken back on its own.
+	case KEY_BACKSPACE:
+		if(field->len && field->cur) {
+			int start = field->cur - 1;
+			while(start > 0 && ((uint8_t)field->txt[start] & 0xc0) == 0x80)
+				start -= 1;
+			memmove(field->txt + start,
+				field->txt + field->cur,
+				field->len - field->cur);
+			field->len -= field->cur - start;
+			field->cur = start;
+			field->txt[field->len] = '\0';
+		}
+		return true;
+	case KEY_ARROW_LEFT:
+		field->cur = (int)utf8_prev(field->txt, field->cur);
+		return true;
+	case KEY_ARROW_RIGHT: {
+		int width = 0;
+		field->cur = (int)utf8_next(field->txt, field->len, field->cur, &width);
+		return true;
+	}
+		
+	}
+	
+	if(!char_match(field->kind, c))
+		return false;
+	
+	// A lead byte only goes in if its whole sequence fits, and a continuation byte only goes in
+	// to finish a sequence, so stray bytes never end up in the text.
+	size_t need = c < 0x80 ? 1 : utf8_seq_len((uint8_t)c);
+	if(c >= 0x80 && !need) {
+		if((c & 0xc0) != 0x80 || !field->cur || !continues(field))
+			return true;
+		need = 1;
+	}
+	if(field->len + (int)need > field->cap || field->len + (int)need + 1 > FIELD_CAP)
+		return true;
+	
+	memmove(field->txt + field->cur + 1,
+		field->txt + field->cur,
+		field->len - field->cur);
+	field->txt[field->cur] = (char)c;
+	field->cur++;
+	field->len++;
+	field->txt[field->len] = '\0';
+	
+	return true;
+}
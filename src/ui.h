@@ -12,21 +12,79 @@
 
 #include <term/hexes.h>
 #include <term/colors.h>
+#include <stdbool.h>
+
+// Returned by ui_get_key() when the pump handled outside input and the screen should be redrawn.
+#define UI_KEY_REFRESH	(-2)
+
+typedef bool (*ui_pump_f)(void *ctx);
 
 void
 ui_start();
 void
 ui_end();
 
+// Registers a file descriptor to be serviced by `pump` while ui_get_key() waits for a key. The pump
+// is dropped once it returns false.
+void
+ui_set_pump(int fd, ui_pump_f pump, void *ctx);
+
+int
+ui_get_key();
+
 void
 ui_text(int w, const char *fmt, ...);
 void
 ui_line(const char *fmt, ...);
 void
 ui_title(const char *fmt, ...);
+
+// A note about the session as a whole, such as a lost connection, carried at the end of every
+// view's title until it is replaced. An empty format clears it.
+void
+ui_status(const char *fmt, ...);
 void
 ui_prompt(const char *fmt, ...);
 
+// Buffer size for ui_cell(), enough for a cell as wide as any line.
+#define UI_CELL_CAP	(512)
+
+// Fits `text` into a cell `cols` columns wide, cut between characters and padded with spaces, for
+// use as a `%s` in a line. `width` is the text's display width if it is known, or -1.
+const char *
+ui_cell(char buf[UI_CELL_CAP], const char *text, int width, int cols);
+
+#define FIELD_CAP	(128)
+
+typedef enum {
+	UI_FIELD_TEXT,
+	UI_FIELD_NUMERIC,
+	UI_FIELD_EXPR,
+} ui_field_kind_t;
+
+typedef struct {
+	ui_field_kind_t	kind;
+	char		txt[FIELD_CAP];
+	int		cap;
+	int		len;
+	int 		cur;
+} ui_field_t;
+
+void
+ui_field_draw(const char *label, const ui_field_t *field, bool highlight, int label_w, int max_w);
+
+// Draws the field on the prompt line, after `label`, and leaves the cursor in it.
+void
+ui_prompt_field(const char *label, const ui_field_t *field);
+
+// The column of the field's cursor, counted from the start of its text.
+int
+ui_field_cursor_x(const ui_field_t *field);
+
+// Applies an editing key to the field. Returns false if the key isn't one the field handles.
+bool
+ui_field_input(ui_field_t *field, int c);
+
 #endif /* ifndef _UI_H_ */
 
 
@@ -0,0 +1,298 @@
+/*===--------------------------------------------------------------------------------------------===
+ * uic.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "uic.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The state after the end of the first word. Every other state is the type so far.
+#define STATE_STOP	(VEH_TYPE_COUNT)
+#define MAX_LINE	(256)
+
+struct uic_rules_s {
+	uint8_t		next[VEH_TYPE_COUNT][256];
+	uint32_t	caps[256];
+	char		*src;
+};
+
+const char uic_default_rules[] =
+	"# UIC classification rules\n"
+	"#\n"
+	"# <letter> <type | -> [<capability>...]\n"
+	"#     types: lok van coach wagon control railcar\n"
+	"#     capabilities: electric diesel rack narrow first second restaurant panoramic luggage\n"
+	"# combine <type so far> <letter's type> <result>\n"
+	"#     By default, the type further down the list above wins, and a locomotive letter\n"
+	"#     combined with any other type makes a railcar.\n"
+	"\n"
+	"A coach first\n"
+	"B coach second\n"
+	"W coach restaurant\n"
+	"D van luggage\n"
+	"L wagon\n"
+	"t control\n"
+	"p - panoramic\n"
+	"\n"
+	"R lok\n"
+	"a lok\n"
+	"f lok\n"
+	"e lok electric\n"
+	"m lok diesel\n"
+	"h lok rack\n"
+	"H lok rack\n"
+	"G lok narrow\n";
+
+typedef struct {
+	const char	*name;
+	uint32_t	value;
+} word_t;
+
+static const word_t type_words[] = {
+	{"-", VEH_TYPE_UNKNOWN},
+	{"unknown", VEH_TYPE_UNKNOWN},
+	{"lok", VEH_TYPE_LOK},
+	{"loco", VEH_TYPE_LOK},
+	{"locomotive", VEH_TYPE_LOK},
+	{"van", VEH_TYPE_VAN},
+	{"coach", VEH_TYPE_COACH},
+	{"wagon", VEH_TYPE_WAGON},
+	{"control", VEH_TYPE_CONTROL},
+	{"railcar", VEH_TYPE_RAILCAR},
+	{NULL, 0},
+};
+
+static const word_t cap_words[] = {
+	{"elec", LOK_ELEC},
+	{"electric", LOK_ELEC},
+	{"diesel", LOK_DIESEL},
+	{"rack", LOK_RACK},
+	{"narrow", LOK_NARROW},
+	{"first", PAX_FIRST},
+	{"second", PAX_SECOND},
+	{"restaurant", PAX_RESTAURANT},
+	{"panoramic", PAX_PANORAMIC},
+	{"luggage", LUGGAGE_VAN},
+	{NULL, 0},
+};
+
+static bool
+lookup(const word_t *words, const char *name, uint32_t *value) {
+	for(const word_t *w = words; w->name; ++w) {
+		if(strcmp(w->name, name)) continue;
+		*value = w->value;
+		return true;
+	}
+	return false;
+}
+
+static veh_type_t
+default_combine(veh_type_t type, veh_type_t letter) {
+	if(type == VEH_TYPE_UNKNOWN)
+		return letter;
+	if(type == VEH_TYPE_LOK)
+		return letter > VEH_TYPE_LOK ? VEH_TYPE_RAILCAR : VEH_TYPE_LOK;
+	if(letter == VEH_TYPE_LOK)
+		return VEH_TYPE_RAILCAR;
+	return MAX(letter, type);
+}
+
+static bool
+is_stop(int c) {
+	return c == '\0' || c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static void
+error(char *err, size_t cap, int line, const char *fmt, ...) {
+	int n = snprintf(err, cap, "line %d: ", line);
+	if(n < 0 || (size_t)n >= cap)
+		return;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(err + n, cap - n, fmt, args);
+	va_end(args);
+}
+
+uic_rules_t *
+uic_rules_compile(const char *src, char *err, size_t err_cap) {
+	ASSERT(src != NULL);
+
+	uint8_t letter_type[256] = {0};
+	uint8_t combine[VEH_TYPE_COUNT][VEH_TYPE_COUNT];
+	for(int i = 0; i < VEH_TYPE_COUNT; ++i) {
+		for(int j = 0; j < VEH_TYPE_COUNT; ++j)
+			combine[i][j] = (uint8_t)default_combine(i, j);
+	}
+
+	uic_rules_t *rules = safe_calloc(1, sizeof(*rules));
+	int line_no = 0;
+	for(const char *line = src; *line;) {
+		const char *eol = strchr(line, '\n');
+		size_t len = eol ? (size_t)(eol - line) : strlen(line);
+		line_no += 1;
+
+		char buf[MAX_LINE];
+		if(len >= sizeof(buf)) {
+			error(err, err_cap, line_no, "line too long");
+			uic_rules_free(rules);
+			return NULL;
+		}
+		memcpy(buf, line, len);
+		buf[len] = '\0';
+		line = eol ? eol + 1 : line + len;
+
+		char *hash = strchr(buf, '#');
+		if(hash)
+			*hash = '\0';
+		char *words[8];
+		int count = 0;
+		char *save = NULL;
+		for(char *tok = strtok_r(buf, " \t\r", &save); tok; tok = strtok_r(NULL, " \t\r", &save)) {
+			if(count == 8) {
+				error(err, err_cap, line_no, "too many words");
+				uic_rules_free(rules);
+				return NULL;
+			}
+			words[count++] = tok;
+		}
+		if(!count)
+			continue;
+
+		uint32_t a, b, c;
+		if(!strcmp(words[0], "combine")) {
+			if(count != 4 || !lookup(type_words, words[1], &a) || !lookup(type_words, words[2], &b)
+			   || !lookup(type_words, words[3], &c)) {
+				error(err, err_cap, line_no, "expected combine <type> <type> <type>");
+				uic_rules_free(rules);
+				return NULL;
+			}
+			combine[a][b] = (uint8_t)c;
+			continue;
+		}
+
+		if(strlen(words[0]) != 1 || count < 2) {
+			error(err, err_cap, line_no, "expected <letter> <type> [<capability>...]");
+			uic_rules_free(rules);
+			return NULL;
+		}
+		uint8_t letter = (uint8_t)words[0][0];
+		if(!lookup(type_words, words[1], &a)) {
+			error(err, err_cap, line_no, "unknown type '%s'", words[1]);
+			uic_rules_free(rules);
+			return NULL;
+		}
+		letter_type[letter] = (uint8_t)a;
+		rules->caps[letter] = 0;
+		for(int i = 2; i < count; ++i) {
+			if(!lookup(cap_words, words[i], &b)) {
+				error(err, err_cap, line_no, "unknown capability '%s'", words[i]);
+				uic_rules_free(rules);
+				return NULL;
+			}
+			rules->caps[letter] |= b;
+		}
+	}
+
+	for(int state = 0; state < VEH_TYPE_COUNT; ++state) {
+		for(int ch = 0; ch < 256; ++ch)
+			rules->next[state][ch] = is_stop(ch) ? STATE_STOP : combine[state][letter_type[ch]];
+	}
+	size_t len = strlen(src);
+	rules->src = safe_calloc(len + 1, 1);
+	memcpy(rules->src, src, len);
+	return rules;
+}
+
+uic_rules_t *
+uic_rules_load_from_path(const char *path, char *err, size_t err_cap) {
+	ASSERT(path != NULL);
+
+	FILE *f = fopen(path, "rb");
+	if(!f) {
+		snprintf(err, err_cap, "cannot read %s", path);
+		return NULL;
+	}
+	size_t len = 0, cap = 4096;
+	char *src = safe_calloc(cap, 1);
+	size_t n;
+	while((n = fread(src + len, 1, cap - len - 1, f)) > 0) {
+		len += n;
+		if(len + 1 == cap) {
+			cap *= 2;
+			src = safe_realloc(src, cap);
+		}
+	}
+	fclose(f);
+	src[len] = '\0';
+
+	uic_rules_t *rules = uic_rules_compile(src, err, err_cap);
+	free(src);
+	return rules;
+}
+
+void
+uic_rules_free(uic_rules_t *rules) {
+	if(!rules)
+		return;
+	free(rules->src);
+	free(rules);
+}
+
+const char *
+uic_rules_source(const uic_rules_t *rules) {
+	ASSERT(rules != NULL);
+	return rules->src;
+}
+
+// MARK: - Classification
+
+static uic_rules_t *active = NULL;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+static void
+use_defaults(void) {
+	char err[128];
+	active = uic_rules_compile(uic_default_rules, err, sizeof(err));
+	ASSERT(active != NULL);
+}
+
+void
+uic_rules_use(uic_rules_t *rules) {
+	ASSERT(rules != NULL);
+	pthread_once(&active_once, use_defaults);
+	uic_rules_free(active);
+	active = rules;
+}
+
+const uic_rules_t *
+uic_rules_active(void) {
+	pthread_once(&active_once, use_defaults);
+	return active;
+}
+
+void
+uic_classify(const char *class, veh_type_t *type, uint32_t *caps) {
+	ASSERT(class != NULL);
+	const uic_rules_t *rules = uic_rules_active();
+
+	uint8_t state = VEH_TYPE_UNKNOWN;
+	uint32_t mask = 0;
+	for(const uint8_t *c = (const uint8_t *)class;; ++c) {
+		uint8_t next = rules->next[state][*c];
+		if(next == STATE_STOP)
+			break;
+		mask |= rules->caps[*c];
+		state = next;
+	}
+	*type = (veh_type_t)state;
+	*caps = mask;
+}
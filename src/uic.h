@@ -0,0 +1,55 @@
+/*===--------------------------------------------------------------------------------------------===
+ * uic.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _UIC_H_
+#define _UIC_H_
+
+#include "stock.h"
+
+// Rules that classify UIC class designations ("Re 460", "ABt", "RBDe"). Each letter of the first
+// word can give the vehicle a type and capabilities; when letters give different types, a
+// combination table picks the result, so that a locomotive letter next to a coach letter makes a
+// railcar. A rules file has one rule per line:
+//
+//     <letter> <type | -> [<capability>...]
+//     combine <type so far> <letter's type> <result>
+//
+// Types and capabilities use the same words as queries. Rules are compiled into a transition table
+// over (type so far, character), which classifies a class string in a single pass with one lookup
+// per character.
+typedef struct uic_rules_s uic_rules_t;
+
+// The rules used until others are loaded, in rules file syntax.
+extern const char uic_default_rules[];
+
+uic_rules_t *
+uic_rules_compile(const char *src, char *err, size_t err_cap);
+
+uic_rules_t *
+uic_rules_load_from_path(const char *path, char *err, size_t err_cap);
+
+void
+uic_rules_free(uic_rules_t *rules);
+
+const char *
+uic_rules_source(const uic_rules_t *rules);
+
+// Makes `rules` the ones every classification uses, and frees the previous ones. DBs that are
+// already loaded keep their old classification until stock_db_reclassify(). Must not be called
+// while other threads are loading DBs.
+void
+uic_rules_use(uic_rules_t *rules);
+
+const uic_rules_t *
+uic_rules_active(void);
+
+void
+uic_classify(const char *class, veh_type_t *type, uint32_t *caps);
+
+#endif /* ifndef _UIC_H_ */
@@ -0,0 +1,253 @@
+/*===--------------------------------------------------------------------------------------------===
+ * utf8.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "utf8.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <string.h>
+
+#define ZWJ	(0x200d)
+
+typedef struct {
+	uint32_t	lo;
+	uint32_t	hi;
+} cp_range_t;
+
+// Combining marks, joiners, variation selectors and other code points drawn over the one before.
+static const cp_range_t zero_width[] = {
+	{0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf}, {0x05c1, 0x05c2},
+	{0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a}, {0x064b, 0x065f}, {0x0670, 0x0670},
+	{0x06d6, 0x06dc}, {0x06df, 0x06e4}, {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0900, 0x0902},
+	{0x093a, 0x093a}, {0x093c, 0x093c}, {0x0941, 0x0948}, {0x094d, 0x094d}, {0x0951, 0x0957},
+	{0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff},
+	{0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f},
+	{0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0x1f3fb, 0x1f3ff}, {0xe0000, 0xe007f},
+	{0xe0100, 0xe01ef},
+};
+
+// East Asian wide and fullwidth characters, and the emoji terminals draw on two columns.
+static const cp_range_t double_width[] = {
+	{0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec}, {0x23f0, 0x23f0},
+	{0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267f, 0x267f},
+	{0x2693, 0x2693}, {0x26a1, 0x26a1}, {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5},
+	{0x26ce, 0x26ce}, {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+	{0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b}, {0x2728, 0x2728},
+	{0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+	{0x27b0, 0x27b0}, {0x27bf, 0x27bf}, {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55},
+	{0x2e80, 0x303e}, {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+	{0xa960, 0xa97f}, {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6f},
+	{0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf},
+	{0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f2ff}, {0x1f300, 0x1f3fa}, {0x1f400, 0x1f64f},
+	{0x1f680, 0x1f6ff}, {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f9ff}, {0x1fa70, 0x1faff},
+	{0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+static bool
+in_table(const cp_range_t *table, size_t count, uint32_t cp) {
+	if(cp < table[0].lo || cp > table[count - 1].hi)
+		return false;
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if(cp > table[mid].hi)
+			lo = mid + 1;
+		else if(cp < table[mid].lo)
+			hi = mid;
+		else
+			return true;
+	}
+	return false;
+}
+
+static bool
+is_extend(uint32_t cp) {
+	return in_table(zero_width, sizeof(zero_width) / sizeof(zero_width[0]), cp);
+}
+
+static bool
+is_regional(uint32_t cp) {
+	return cp >= 0x1f1e6 && cp <= 0x1f1ff;
+}
+
+size_t
+utf8_seq_len(uint8_t lead) {
+	if(lead < 0x80) return 1;
+	if(lead < 0xc2) return 0;
+	if(lead < 0xe0) return 2;
+	if(lead < 0xf0) return 3;
+	if(lead < 0xf5) return 4;
+	return 0;
+}
+
+size_t
+utf8_decode(const char *s, size_t len, uint32_t *cp) {
+	ASSERT(s != NULL);
+	ASSERT(cp != NULL);
+	if(!len || !s[0])
+		return 0;
+
+	const uint8_t *b = (const uint8_t *)s;
+	size_t n = utf8_seq_len(b[0]);
+	*cp = UTF8_REPLACEMENT;
+	if(!n || n > len)
+		return 1;
+	if(n == 1) {
+		*cp = b[0];
+		return 1;
+	}
+
+	uint32_t c = b[0] & (0x7f >> n);
+	for(size_t i = 1; i < n; ++i) {
+		if((b[i] & 0xc0) != 0x80)
+			return 1;
+		c = (c << 6) | (b[i] & 0x3f);
+	}
+	// Overlong forms, surrogates and anything past the last plane
+	static const uint32_t min_cp[] = {0, 0, 0x80, 0x800, 0x10000};
+	if(c < min_cp[n] || (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+		return 1;
+	*cp = c;
+	return n;
+}
+
+int
+utf8_cp_width(uint32_t cp) {
+	if(cp < 0x20 || (cp >= 0x7f && cp < 0xa0))
+		return 0;
+	if(cp < 0x300)
+		return 1;
+	if(is_extend(cp))
+		return 0;
+	return in_table(double_width, sizeof(double_width) / sizeof(double_width[0]), cp) ? 2 : 1;
+}
+
+size_t
+utf8_next(const char *s, size_t len, size_t pos, int *width) {
+	ASSERT(s != NULL);
+	ASSERT(width != NULL);
+
+	uint32_t cp;
+	size_t n = utf8_decode(s + pos, len - pos, &cp);
+	if(!n)
+		return pos;
+	pos += n;
+	*width += utf8_cp_width(cp);
+
+	bool joined = cp == ZWJ;
+	bool regional = is_regional(cp);
+	for(;;) {
+		uint32_t next;
+		n = utf8_decode(s + pos, len - pos, &next);
+		if(!n)
+			break;
+		if(regional && is_regional(next)) {
+			*width += 1;
+			regional = false;
+		} else if(!joined && !is_extend(next)) {
+			break;
+		}
+		// What follows a joiner draws as part of the same picture.
+		joined = next == ZWJ;
+		pos += n;
+	}
+	return pos;
+}
+
+size_t
+utf8_prev(const char *s, size_t pos) {
+	ASSERT(s != NULL);
+	size_t start = 0;
+	int width = 0;
+	while(start < pos) {
+		size_t end = utf8_next(s, pos, start, &width);
+		if(end >= pos || end == start)
+			break;
+		start = end;
+	}
+	return start;
+}
+
+int
+utf8_width(const char *s, size_t len) {
+	ASSERT(s != NULL);
+	int width = 0;
+	size_t pos = 0;
+	for(;;) {
+		size_t next = utf8_next(s, len, pos, &width);
+		if(next == pos)
+			return width;
+		pos = next;
+	}
+}
+
+size_t
+utf8_fit(const char *s, size_t len, int cols, int *width) {
+	ASSERT(s != NULL);
+	ASSERT(width != NULL);
+	size_t pos = 0;
+	int used = 0;
+	for(;;) {
+		int w = 0;
+		size_t next = utf8_next(s, len, pos, &w);
+		if(next == pos || used + w > cols)
+			break;
+		used += w;
+		pos = next;
+	}
+	*width = used;
+	return pos;
+}
+
+size_t
+utf8_clip(const char *s, size_t max_len) {
+	ASSERT(s != NULL);
+	size_t len = strnlen(s, max_len);
+	size_t lead = len;
+	while(lead > 0 && len - lead < 3 && ((uint8_t)s[lead - 1] & 0xc0) == 0x80)
+		lead -= 1;
+	if(lead > 0 && utf8_seq_len((uint8_t)s[lead - 1]) > len - (lead - 1))
+		return lead - 1;
+	return len;
+}
+
+const char *
+utf8_cell(char *buf, size_t cap, const char *s, int width, int cols) {
+	ASSERT(buf != NULL);
+	ASSERT(cap > 0);
+	ASSERT(s != NULL);
+
+	cols = MAX(cols, 0);
+	size_t len;
+	if(width < 0 || width > cols)
+		len = utf8_fit(s, SIZE_MAX, cols, &width);
+	else
+		len = strlen(s);
+	if(len >= cap)
+		len = utf8_fit(s, utf8_clip(s, cap - 1), cols, &width);
+
+	memcpy(buf, s, len);
+	size_t pad = MIN((size_t)(cols - width), cap - 1 - len);
+	memset(buf + len, ' ', pad);
+	buf[len + pad] = '\0';
+	return buf;
+}
+
+void
+utf8_put(FILE *f, const char *s, int width, int cols) {
+	ASSERT(f != NULL);
+	ASSERT(s != NULL);
+
+	cols = MAX(cols, 0);
+	if(width < 0 || width > cols)
+		fwrite(s, 1, utf8_fit(s, SIZE_MAX, cols, &width), f);
+	else
+		fputs(s, f);
+	for(int i = width; i < cols; ++i)
+		fputc(' ', f);
+}
@@ -0,0 +1,69 @@
+/*===--------------------------------------------------------------------------------------------===
+ * utf8.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Text is laid out in terminal columns, not bytes. A code point takes 0 (combining marks and other
+// modifiers), 1 or 2 (East Asian wide and emoji) columns, and text is only ever cut between
+// grapheme clusters: a code point, the zero-width ones after it, and anything joined to it by a
+// zero-width joiner. Malformed bytes are taken one at a time as a single column each.
+
+#define UTF8_REPLACEMENT	(0xfffd)
+
+// Decodes the code point at `s`, reading no more than `len` bytes, and returns how many it used.
+// Returns 0 at the end of the text, and 1 with UTF8_REPLACEMENT for a malformed or cut sequence.
+size_t
+utf8_decode(const char *s, size_t len, uint32_t *cp);
+
+// How many bytes the sequence started by `lead` has, or 0 if it can't start one.
+size_t
+utf8_seq_len(uint8_t lead);
+
+int
+utf8_cp_width(uint32_t cp);
+
+// Returns the end of the grapheme cluster that starts at `pos`, and adds its width to `*width`.
+size_t
+utf8_next(const char *s, size_t len, size_t pos, int *width);
+
+// Returns the start of the grapheme cluster that ends at `pos`.
+size_t
+utf8_prev(const char *s, size_t pos);
+
+// The display width of the first `len` bytes of `s`, stopping early at a NUL.
+int
+utf8_width(const char *s, size_t len);
+
+// Returns how many bytes of `s` fit in `cols` columns without cutting a cluster, and their width
+// in `*width`. It only looks as far as the columns it fills.
+size_t
+utf8_fit(const char *s, size_t len, int cols, int *width);
+
+// Returns how many of the first `max_len` bytes of `s` can be kept without ending the text in the
+// middle of a sequence.
+size_t
+utf8_clip(const char *s, size_t max_len);
+
+// Copies `s` into `buf`, cut or padded to exactly `cols` columns, or as many as `cap` bytes hold.
+// `width` is as for utf8_put().
+const char *
+utf8_cell(char *buf, size_t cap, const char *s, int width, int cols);
+
+// Writes `s` cut or padded to exactly `cols` columns. `width` is its display width if known,
+// which spares measuring text that fits, or -1.
+void
+utf8_put(FILE *f, const char *s, int width, int cols);
+
+#endif /* ifndef _UTF8_H_ */
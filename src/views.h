@@ -11,10 +11,18 @@
 #define _VIEWS_H_
 
 #include "stock.h"
+#include "lazy.h"
+#include "consist.h"
+#include "depot.h"
+#include "attrs.h"
 
-void show_dbview(db_t *db);
+void show_dbview(db_t *db, consists_t *consists, const attr_table_t *attrs);
 void show_addview(db_t *db, veh_t *veh);
-void show_shuntview(db_t *db, const veh_t **veh, int count);
+void show_shuntview(db_t *db, consists_t *consists, const attr_table_t *attrs, const veh_t **veh,
+		    int count);
+void show_statsview(db_t *db, size_t view_bytes);
+void show_lazyview(lazy_db_t *db, const char *path);
+void show_depotview(depot_set_t *set);
 
 #endif /* ifndef _VIEWS_H_ */
 
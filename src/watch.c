@@ -0,0 +1,534 @@
+/*===--------------------------------------------------------------------------------------------===
+ * watch.c
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent. All rights reserved
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#include "watch.h"
+#include "uic.h"
+#include <utils/assert.h>
+#include <utils/helpers.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// A block ends after a line whose hash has these bits clear, so an insertion or a deletion only
+// changes the block it lands in instead of shifting every block after it.
+#define BLOCK_MASK	(63)
+#define BLOCK_MAX_ROWS	(1024)
+
+#define FNV_OFFSET	(0xcbf29ce484222325ull)
+#define FNV_PRIME	(0x100000001b3ull)
+
+typedef struct {
+	veh_num_t	num;
+	uint64_t	hash;
+	bool		valid;	// false for comments and lines that aren't a vehicle
+} row_t;
+
+typedef struct {
+	uint64_t	hash;
+	size_t		first;
+	size_t		count;
+	bool		matched;
+} block_t;
+
+typedef struct {
+	row_t		*rows;
+	size_t		num_rows;
+	block_t		*blocks;
+	size_t		num_blocks;
+} table_t;
+
+struct db_watch_s {
+	char		path[1024];
+	const char	*base;
+	db_t		*db;
+	int		fd;
+
+	table_t		table;
+	off_t		size;
+	struct timespec	mtime;
+	ino_t		ino;
+
+	uint64_t	synced_gen;
+	bool		dirty;
+};
+
+static uint64_t
+fnv(uint64_t hash, const char *str, size_t len) {
+	for(size_t i = 0; i < len; ++i) {
+		hash ^= (uint8_t)str[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static bool
+is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Finds the running number of a line without copying or classifying it, following the same
+// rules as stock_parse_line(): a fourth field means the first one is the in-use flag.
+static bool
+row_num(const char *line, size_t len, veh_num_t *num) {
+	if(!len || line[0] == '#')
+		return false;
+	const char *fields[2] = {NULL, NULL};
+	int commas = 0;
+	for(size_t i = 0; i < len; ++i) {
+		if(line[i] != ',') continue;
+		if(commas < 2)
+			fields[commas] = line + i + 1;
+		commas += 1;
+	}
+	if(commas < 2)
+		return false;
+	*num = strtoll(commas > 2 ? fields[0] : line, NULL, 10);
+	return true;
+}
+
+static void
+table_fini(table_t *table) {
+	free(table->rows);
+	free(table->blocks);
+	memset(table, 0, sizeof(*table));
+}
+
+static void
+table_build(table_t *table, const char *data, size_t size) {
+	size_t rows_cap = 0, blocks_cap = 0;
+	memset(table, 0, sizeof(*table));
+
+	block_t block = {.hash = FNV_OFFSET};
+	const char *end = data + size;
+	for(const char *line = data; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *next = eol ? eol + 1 : end;
+		const char *last = eol ? eol : end;
+
+		const char *start = line;
+		while(start < last && is_space(*start)) start += 1;
+		while(last > start && is_space(last[-1])) last -= 1;
+		size_t len = last - start;
+		line = next;
+		if(!len) continue;
+
+		if(table->num_rows == rows_cap) {
+			rows_cap = rows_cap ? rows_cap * 2 : 1024;
+			table->rows = safe_realloc(table->rows, rows_cap * sizeof(*table->rows));
+		}
+		row_t *row = &table->rows[table->num_rows++];
+		row->hash = fnv(FNV_OFFSET, start, len);
+		row->valid = row_num(start, len, &row->num);
+
+		block.hash = fnv(block.hash, start, len + 1);
+		block.count += 1;
+		if((row->hash & BLOCK_MASK) && block.count < BLOCK_MAX_ROWS && line < end)
+			continue;
+
+		if(table->num_blocks == blocks_cap) {
+			blocks_cap = blocks_cap ? blocks_cap * 2 : 64;
+			table->blocks = safe_realloc(table->blocks, blocks_cap * sizeof(*table->blocks));
+		}
+		table->blocks[table->num_blocks++] = block;
+		block = (block_t){.hash = FNV_OFFSET, .first = table->num_rows};
+	}
+	if(block.count) {
+		if(table->num_blocks == blocks_cap)
+			table->blocks = safe_realloc(table->blocks, (blocks_cap + 1) * sizeof(*table->blocks));
+		table->blocks[table->num_blocks++] = block;
+	}
+}
+
+static void
+record_stat(db_watch_t *watch, const struct stat *st) {
+	watch->size = st->st_size;
+	watch->mtime = st->st_mtim;
+	watch->ino = st->st_ino;
+}
+
+static bool
+same_stat(const db_watch_t *watch, const struct stat *st) {
+	return watch->size == st->st_size
+	    && watch->mtime.tv_sec == st->st_mtim.tv_sec
+	    && watch->mtime.tv_nsec == st->st_mtim.tv_nsec
+	    && watch->ino == st->st_ino;
+}
+
+static char *
+read_locked(const char *path, size_t *size, struct stat *st) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	if(flock(fd, LOCK_SH) < 0 || fstat(fd, st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t cap = MAX((size_t)st->st_size, 4096), len = 0;
+	char *data = safe_calloc(cap + 1, 1);
+	for(;;) {
+		if(len == cap) {
+			cap *= 2;
+			data = safe_realloc(data, cap + 1);
+		}
+		ssize_t n = read(fd, data + len, cap - len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0) {
+			free(data);
+			close(fd);
+			return NULL;
+		}
+		if(n == 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	data[len] = '\0';
+	*size = len;
+	return data;
+}
+
+// MARK: - Merging
+
+// Makes the DB hold the vehicle a file line describes. Returns whether anything changed.
+static bool
+apply_line(db_t *db, const char *line, size_t len) {
+	char *copy = safe_calloc(len + 1, 1);
+	memcpy(copy, line, len);
+	veh_t *veh = stock_parse_line(copy);
+	free(copy);
+	if(!veh)
+		return false;
+
+	veh_t *existing = stock_db_get(db, veh->num);
+	if(!existing) {
+		bool added = stock_db_add(db, veh) != NULL;
+		free(veh);
+		return added;
+	}
+
+	bool changed = false;
+	if(strcmp(existing->class, veh->class) || strcmp(existing->desc, veh->desc)) {
+		stock_db_update(db, existing, veh);
+		changed = true;
+	}
+	if(existing->in_use != veh->in_use) {
+		stock_db_set_in_use(db, existing, veh->in_use);
+		changed = true;
+	}
+	free(veh);
+	return changed;
+}
+
+// Walks the lines of a block again to hand the changed ones to apply_line(). The table only
+// keeps hashes, so the text comes from the buffer it was built from.
+static size_t
+apply_block(db_watch_t *watch, const block_t *block, const char **cursor, const char *end,
+	    hash_map_t *gone) {
+	size_t changed = 0;
+	const table_t *table = &watch->table;
+	for(size_t i = 0; i < block->count;) {
+		const char *line = *cursor;
+		const char *eol = memchr(line, '\n', end - line);
+		const char *last = eol ? eol : end;
+		*cursor = eol ? eol + 1 : end;
+
+		while(line < last && is_space(*line)) line += 1;
+		while(last > line && is_space(last[-1])) last -= 1;
+		if(last == line) continue;
+
+		const row_t *row = &table->rows[block->first + i++];
+		if(!row->valid) continue;
+
+		const row_t *old = hash_remove(gone, row->num);
+		if(old && old->hash == row->hash)
+			continue;
+		if(apply_line(watch->db, line, last - line))
+			changed += 1;
+	}
+	return changed;
+}
+
+// Skips over the lines of a block that is left as it was.
+static void
+skip_block(const block_t *block, const char **cursor, const char *end) {
+	for(size_t i = 0; i < block->count && *cursor < end;) {
+		const char *line = *cursor;
+		const char *eol = memchr(line, '\n', end - line);
+		*cursor = eol ? eol + 1 : end;
+		for(; line < *cursor; ++line) {
+			if(is_space(*line)) continue;
+			i += 1;
+			break;
+		}
+	}
+}
+
+static size_t
+merge(db_watch_t *watch, table_t *old, const char *data, size_t size) {
+	table_t *table = &watch->table;
+
+	hash_map_t by_hash;
+	hash_init(&by_hash);
+	for(size_t i = 0; i < old->num_blocks; ++i) {
+		old->blocks[i].matched = false;
+		hash_put(&by_hash, (int64_t)old->blocks[i].hash, &old->blocks[i]);
+	}
+	for(size_t i = 0; i < table->num_blocks; ++i) {
+		block_t *match = hash_get(&by_hash, (int64_t)table->blocks[i].hash);
+		if(!match) continue;
+		match->matched = true;
+		table->blocks[i].matched = true;
+	}
+	hash_fini(&by_hash);
+
+	// The rows of blocks that went away. Whatever isn't found again in a new block was deleted.
+	hash_map_t gone;
+	hash_init(&gone);
+	for(size_t i = 0; i < old->num_blocks; ++i) {
+		const block_t *block = &old->blocks[i];
+		if(block->matched) continue;
+		for(size_t j = 0; j < block->count; ++j) {
+			const row_t *row = &old->rows[block->first + j];
+			if(row->valid)
+				hash_put(&gone, row->num, (void *)row);
+		}
+	}
+	for(size_t i = 0; i < table->num_blocks; ++i) {
+		const block_t *block = &table->blocks[i];
+		if(!block->matched) continue;
+		for(size_t j = 0; j < block->count; ++j) {
+			const row_t *row = &table->rows[block->first + j];
+			if(row->valid)
+				hash_remove(&gone, row->num);
+		}
+	}
+
+	size_t changed = 0;
+	const char *cursor = data, *end = data + size;
+	for(size_t i = 0; i < table->num_blocks; ++i) {
+		const block_t *block = &table->blocks[i];
+		if(block->matched)
+			skip_block(block, &cursor, end);
+		else
+			changed += apply_block(watch, block, &cursor, end, &gone);
+	}
+
+	size_t iter = 0;
+	const hash_entry_t *entry;
+	veh_t **doomed = safe_calloc(MAX(gone.count, 1), sizeof(*doomed));
+	size_t num_doomed = 0;
+	while((entry = hash_next(&gone, &iter)) != NULL) {
+		veh_t *veh = stock_db_get(watch->db, entry->key);
+		if(veh)
+			doomed[num_doomed++] = veh;
+	}
+	for(size_t i = 0; i < num_doomed; ++i)
+		stock_db_delete(watch->db, doomed[i]);
+	changed += num_doomed;
+	free(doomed);
+	hash_fini(&gone);
+	return changed;
+}
+
+// MARK: - Rules
+
+// The classification rules live in <db>.rules, and apply to the DB as soon as they're saved.
+static bool
+is_rules(const db_watch_t *watch, const char *name) {
+	size_t len = strlen(watch->base);
+	return !strncmp(name, watch->base, len) && !strcmp(name + len, ".rules");
+}
+
+static void
+reload_rules(db_watch_t *watch) {
+	char path[1040];
+	snprintf(path, sizeof(path), "%s.rules", watch->path);
+	uic_rules_t *rules = uic_rules_load_from_path(path, NULL, 0);
+	if(!rules)
+		return;
+	uic_rules_use(rules);
+	stock_db_reclassify(watch->db);
+}
+
+// MARK: - API
+
+db_watch_t *
+watch_open(const char *path, db_t *db) {
+	ASSERT(path != NULL);
+	ASSERT(db != NULL);
+
+	db_watch_t *watch = safe_calloc(1, sizeof(*watch));
+	snprintf(watch->path, sizeof(watch->path), "%s", path);
+	const char *slash = strrchr(watch->path, '/');
+	watch->base = slash ? slash + 1 : watch->path;
+	watch->db = db;
+	watch->fd = -1;
+
+	size_t size = 0;
+	struct stat st;
+	char *data = read_locked(path, &size, &st);
+	if(data) {
+		table_build(&watch->table, data, size);
+		record_stat(watch, &st);
+		free(data);
+	}
+	watch->synced_gen = stock_db_gen(db);
+
+#ifdef __linux__
+	// Writers replace the file as often as they rewrite it, so the directory is what's watched.
+	char dir[1024];
+	if(slash)
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - watch->path), watch->path);
+	else
+		snprintf(dir, sizeof(dir), ".");
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watch->fd >= 0 && inotify_add_watch(watch->fd, dir[0] ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(watch->fd);
+		watch->fd = -1;
+	}
+#endif
+	return watch;
+}
+
+void
+watch_close(db_watch_t *watch) {
+	if(!watch)
+		return;
+	if(watch->fd >= 0)
+		close(watch->fd);
+	table_fini(&watch->table);
+	free(watch);
+}
+
+int
+watch_fd(const db_watch_t *watch) {
+	ASSERT(watch != NULL);
+	return watch->fd;
+}
+
+bool
+watch_pump(void *ctx) {
+	db_watch_t *watch = ctx;
+	ASSERT(watch != NULL);
+
+	bool ours = false, rules = false;
+#ifdef __linux__
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for(;;) {
+		ssize_t n = read(watch->fd, buf, sizeof(buf));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		for(char *p = buf; p < buf + n;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			if(ev->len && !strcmp(ev->name, watch->base))
+				ours = true;
+			else if(ev->len && is_rules(watch, ev->name))
+				rules = true;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+#endif
+	if(ours)
+		watch_sync(watch, false);
+	if(rules)
+		reload_rules(watch);
+	return true;
+}
+
+ssize_t
+watch_sync(db_watch_t *watch, bool force) {
+	ASSERT(watch != NULL);
+
+	struct stat st;
+	if(!force && stat(watch->path, &st) == 0 && same_stat(watch, &st))
+		return 0;
+
+	size_t size = 0;
+	char *data = read_locked(watch->path, &size, &st);
+	if(!data)
+		return -1;
+
+	watch->dirty = watch->dirty || stock_db_gen(watch->db) != watch->synced_gen;
+	table_t old = watch->table;
+	table_build(&watch->table, data, size);
+	watch->db->merging = true;
+	size_t changed = merge(watch, &old, data, size);
+	watch->db->merging = false;
+	table_fini(&old);
+	free(data);
+
+	record_stat(watch, &st);
+	watch->synced_gen = stock_db_gen(watch->db);
+	return (ssize_t)changed;
+}
+
+void
+watch_mark_dirty(db_watch_t *watch) {
+	ASSERT(watch != NULL);
+	watch->dirty = true;
+}
+
+bool
+watch_db_dirty(const db_watch_t *watch) {
+	ASSERT(watch != NULL);
+	return watch->dirty || stock_db_gen(watch->db) != watch->synced_gen;
+}
+
+bool
+watch_write(db_watch_t *watch) {
+	ASSERT(watch != NULL);
+
+	char *data = NULL;
+	size_t size = 0;
+	FILE *mem = open_memstream(&data, &size);
+	if(!mem)
+		return false;
+	stock_write_to_file(mem, watch->db);
+	fclose(mem);
+
+	bool ok = false;
+	int fd = open(watch->path, O_WRONLY | O_CREAT, 0666);
+	if(fd >= 0 && flock(fd, LOCK_EX) == 0 && ftruncate(fd, 0) == 0) {
+		ok = true;
+		for(size_t off = 0; off < size;) {
+			ssize_t n = write(fd, data + off, size - off);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0) {
+				ok = false;
+				break;
+			}
+			off += n;
+		}
+	}
+
+	struct stat st;
+	if(ok && fstat(fd, &st) == 0) {
+		table_fini(&watch->table);
+		table_build(&watch->table, data, size);
+		record_stat(watch, &st);
+		watch->synced_gen = stock_db_gen(watch->db);
+		watch->dirty = false;
+	}
+	if(fd >= 0)
+		close(fd);
+	free(data);
+	return ok;
+}
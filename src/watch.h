@@ -0,0 +1,60 @@
+/*===--------------------------------------------------------------------------------------------===
+ * watch.h
+ *
+ * Created by Amy Parent <amy@amyparent.com>
+ * Copyright (c) 2024 Amy Parent
+ *
+ * Licensed under the MIT License
+ *===--------------------------------------------------------------------------------------------===
+*/
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "stock.h"
+
+// Keeps a loaded DB in step with its file while something else may rewrite it.
+//
+// The watcher remembers the file as content-defined blocks of lines, with a checksum for each
+// block and each row. When the file changes, only the blocks whose checksum is new are parsed,
+// and their rows are merged into the DB as adds, updates and deletes. A row is only applied if
+// it changed in the file since the last sync, so edits made in the DB meanwhile are kept unless
+// the file changed the same vehicle.
+//
+// On Linux, changes are picked up through inotify as they happen. Elsewhere, or when inotify
+// isn't available, watch_fd() is -1 and changes are only merged when watch_sync() is called.
+typedef struct db_watch_s db_watch_t;
+
+// Starts watching the file a DB was just loaded from.
+db_watch_t *
+watch_open(const char *path, db_t *db);
+
+void
+watch_close(db_watch_t *watch);
+
+int
+watch_fd(const db_watch_t *watch);
+
+// A UI pump: drains pending file events, and merges the file if it changed.
+bool
+watch_pump(void *ctx);
+
+// Merges changes to the file into the DB. Without `force`, a file whose size, modification time
+// and inode are unchanged is assumed to be unchanged. Returns how many vehicles changed, or -1
+// if the file could not be read.
+ssize_t
+watch_sync(db_watch_t *watch, bool force);
+
+// Marks the DB as having changes of its own from before the watch was opened, so that it is
+// written back even if nothing changes after.
+void
+watch_mark_dirty(db_watch_t *watch);
+
+// Whether the DB has changes of its own that the file doesn't have.
+bool
+watch_db_dirty(const db_watch_t *watch);
+
+// Writes the DB back to the file under an exclusive lock, and takes the result as the new baseline.
+bool
+watch_write(db_watch_t *watch);
+
+#endif /* ifndef _WATCH_H_ */